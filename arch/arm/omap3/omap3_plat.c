@@ -35,6 +35,8 @@ static int __init omap3_init(void)
 	val |= 1 << 3;
 	writel(VA(0x48004c30), val);
 
+	omap3_timer_init();
+
 #ifdef CONFIG_IRQ_SUPPORT
 	omap3_irq_init();
 	irq_enable();
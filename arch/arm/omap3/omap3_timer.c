@@ -0,0 +1,40 @@
+#include <io.h>
+#include <init.h>
+#include <timer.h>
+
+/*
+ * The tick interrupt is not wired up on OMAP3, so get_tick() reads the
+ * 32KHz sync counter instead. It runs from power on and needs no setup
+ * beyond its interface clock.
+ */
+static __u32 omap3_read_ms(void)
+{
+	static __u32 last, ms;
+	static __u64 frac;
+	__u32 now;
+
+	now = readl(VA(SYNCTIMER_BASE + SYNCTIMER_CR));
+
+	// 32768 counts per second, so no division is needed
+	frac += (__u64)(now - last) * 1000;
+	last = now;
+
+	ms += (__u32)(frac >> 15);
+	frac &= 0x7fff;
+
+	return ms;
+}
+
+int __init omap3_timer_init(void)
+{
+	__u32 val;
+
+	val = readl(VA(CM_ICLKEN_WKUP));
+	val |= 1 << 2; // EN_32KSYNC
+	writel(VA(CM_ICLKEN_WKUP), val);
+
+	omap3_read_ms();
+	set_tick_source(omap3_read_ms);
+
+	return 0;
+}
@@ -7,6 +7,12 @@ OBJ_S ?= $(SRC_S:%.S=%.o)
 obj-y = $(OBJ_C) $(OBJ_S)
 obj-y := $(subst $(path)/,,$(obj-y))
 
+# commands for optional drivers, built only when the driver is
+opt-obj := netem.o
+opt-obj-$(CONFIG_NET_SIM) += netem.o
+
+obj-y := $(filter-out $(filter-out $(opt-obj-y), $(opt-obj)), $(obj-y))
+
 #tmp_dir := $(shell mktemp -d)
 tmp_dir := /tmp
 dst_src = $(tmp_dir)/$^
@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <bcache.h>
+
+static void bcache_show(void)
+{
+	struct bcache_stat stat;
+
+	bcache_get_stat(&stat);
+
+	printf("bcache: %d buffer(s), %d / %d KB\n"
+		"hit:    %d\n"
+		"miss:   %d\n"
+		"evict:  %d\n",
+		stat.buffers, stat.bytes >> 10, stat.limit >> 10,
+		stat.hits, stat.misses, stat.evictions);
+}
+
+int main(int argc, char *argv[])
+{
+	int ch, ret;
+	unsigned long val;
+
+	while ((ch = getopt(argc, argv, "s:c")) != -1) {
+		switch (ch) {
+		case 's':
+			if (hr_str_to_val(optarg, &val) < 0) {
+				printf("Invalid size: \"%s\"\n", optarg);
+				return -EINVAL;
+			}
+
+			ret = bcache_setup(val);
+			if (ret < 0)
+				return ret;
+			break;
+
+		case 'c':
+			bcache_clear_stat();
+			break;
+
+		default:
+			usage();
+			return -EINVAL;
+		}
+	}
+
+	if (optind != argc) {
+		usage();
+		return -EINVAL;
+	}
+
+	bcache_show();
+
+	return 0;
+}
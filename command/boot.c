@@ -8,6 +8,9 @@
 #include <linux.h>
 #include <board.h>
 #include <fs.h>
+#ifdef CONFIG_NET
+#include <net/netconsole.h>
+#endif
 
 #if 0
 #include <net/net.h>
@@ -274,6 +277,11 @@ static int show_atags(const struct tag *tag)
 
 static inline int prepare()
 {
+#ifdef CONFIG_NET
+	// the kernel owns the NIC from here on, send what is still queued
+	netcon_stop();
+#endif
+
 	irq_disable();
 
 	// TODO: add code here
@@ -1,6 +1,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <delay.h>
+#include <timer.h>
 #include <string.h>
 #include <assert.h>
 #include <unistd.h>
@@ -14,11 +15,24 @@
 
 #define ETHER_TYPE 1
 
+#define DHCP_SERVER_PORT 67
+#define DHCP_CLIENT_PORT 68
+
 // DHCP option type code
-#define DHCP_MESSAGE		53
-#define DHCP_MESSAGE_LEN	1
+#define DHCP_PAD            0
+#define DHCP_SUBNET_MASK    1
+#define DHCP_ROUTER         3
 #define DHCP_REQUEST_IP		50
 #define DHCP_REQUEST_IP_LEN 4
+#define DHCP_OVERLOAD       52
+#define DHCP_MESSAGE		53
+#define DHCP_MESSAGE_LEN	1
+#define DHCP_SERVER_ID      54
+#define DHCP_PARAM_REQ      55
+#define DHCP_TFTP_SERVER    66
+#define DHCP_BOOT_FILE      67
+#define DHCP_RAPID_COMMIT   80 // RFC 4039
+#define DHCP_END            0xff
 
 // DHCP message type value
 #define DHCPDISCOVER	0x1
@@ -30,6 +44,17 @@
 #define DHCPRELEASE		0x7
 #define DHCPINFOM		0x8
 
+#define DHCP_MSG_MASK(type) (1 << (type))
+
+// retransmission: start small for the LAN case and back off exponentially
+#define DHCP_INIT_TIMEOUT   250 // ms
+#define DHCP_MAX_TIMEOUT    4000
+#define DHCP_MAX_RETRY      5
+#define DHCP_REBOOT_RETRY   2
+#define DHCP_PROBE_WAIT     150 // ms
+
+#define DHCP_OPT_LEN        308
+
 struct dhcp_packet {
 	char	op;
 	char	htype;
@@ -45,11 +70,29 @@ struct dhcp_packet {
 	char	chaddr[16];
 	char	sname[64];
 	char	file[128];
-	// actually, the options field's size is 64 bytes(include the magic cookie)
 	char	magic_cookie[4];
-	char	option[60];
+	__u8	option[DHCP_OPT_LEN];
 }__PACKED__;
 
+// the subset of an ACK that is worth caching across boots
+struct dhcp_lease {
+	__u32 addr;
+	__u32 mask;
+	__u32 server;
+	__u32 router;
+	__u32 next_server;
+	char  boot_file[128];
+};
+
+struct dhcp_client {
+	int sockfd;
+	__u32 xid;
+	__u8 mac_addr[MAC_ADR_LEN];
+	struct net_device *ndev;
+	struct sockaddr_in bcast_addr;
+	struct dhcp_packet packet;
+};
+
 static void init_dhcp_packet(struct dhcp_packet *packet, __u32 xid, __u8 mac_addr[])
 {
 	memset(packet, 0x0, sizeof(*packet));
@@ -70,131 +113,313 @@ static void init_dhcp_packet(struct dhcp_packet *packet, __u32 xid, __u8 mac_add
 	packet->magic_cookie[3] = 0x63;
 }
 
-static int send_dhcp_discover(int sockfd, struct dhcp_packet *packet, struct sockaddr_in *remote_addr)
+static int dhcp_add_option(__u8 *opt, int pos, __u8 code, __u8 len, const void *data)
+{
+	opt[pos++] = code;
+	opt[pos++] = len;
+	memcpy(opt + pos, data, len);
+
+	return pos + len;
+}
+
+static int dhcp_add_common_options(__u8 *opt, int pos, __u8 type)
 {
-	packet->option[0] = DHCP_MESSAGE;
-	packet->option[1] = DHCP_MESSAGE_LEN;
-	packet->option[2] = DHCPDISCOVER;
-	packet->option[3] = 0xff;
+	static const __u8 params[] = {
+		DHCP_SUBNET_MASK, DHCP_ROUTER, DHCP_TFTP_SERVER, DHCP_BOOT_FILE,
+	};
+
+	pos = dhcp_add_option(opt, pos, DHCP_MESSAGE, DHCP_MESSAGE_LEN, &type);
+	pos = dhcp_add_option(opt, pos, DHCP_PARAM_REQ, sizeof(params), params);
 
-	return sendto(sockfd, packet, sizeof(*packet), 0,
-				(const struct sockaddr *)remote_addr, sizeof(struct sockaddr));
+	return pos;
 }
 
-static int send_dhcp_request(int sockfd, struct dhcp_packet *packet, struct sockaddr_in *remote_addr)
+/*
+ * return the option payload and its length, or NULL if not present.
+ */
+static const __u8 *dhcp_get_option(const struct dhcp_packet *packet, __u8 code, int *len)
 {
-	__u32 request_ip;
+	int pos = 0;
+	const __u8 *opt = packet->option;
+
+	while (pos < DHCP_OPT_LEN && opt[pos] != DHCP_END) {
+		if (opt[pos] == DHCP_PAD) {
+			pos++;
+			continue;
+		}
 
-	request_ip = packet->yiaddr;
+		if (pos + 2 > DHCP_OPT_LEN || pos + 2 + opt[pos + 1] > DHCP_OPT_LEN)
+			break;
 
-	packet->option[0] = DHCP_MESSAGE;
-	packet->option[1] = DHCP_MESSAGE_LEN;
-	packet->option[2] = DHCPREQUEST;
-	packet->option[3] = DHCP_REQUEST_IP;
-	packet->option[4] = DHCP_REQUEST_IP_LEN;
-	// request ip
-	packet->option[5] = request_ip & 0xff;
-	packet->option[6] = request_ip >> 8 & 0xff;
-	packet->option[7] = request_ip >> 16 & 0xff;
-	packet->option[8] = request_ip >> 24;
+		if (opt[pos] == code) {
+			*len = opt[pos + 1];
+			return opt + pos + 2;
+		}
 
-	packet->option[9] = 0xff;
+		pos += 2 + opt[pos + 1];
+	}
 
-	return sendto(sockfd, packet, sizeof(*packet), 0,
-				(const struct sockaddr *)remote_addr, sizeof(*remote_addr));
+	return NULL;
 }
 
-static int send_dhcp_declient(int sockfd, struct dhcp_packet *packet, struct sockaddr_in *remote_addr)
+static int dhcp_get_msg_type(const struct dhcp_packet *packet)
 {
-	__u32 declient_ip;
+	int len;
+	const __u8 *type;
 
-	declient_ip = packet->yiaddr;
+	type = dhcp_get_option(packet, DHCP_MESSAGE, &len);
+	if (!type || len != DHCP_MESSAGE_LEN)
+		return -EINVAL;
 
-	packet->option[0] = DHCP_MESSAGE;
-	packet->option[1] = DHCP_MESSAGE_LEN;
-	packet->option[2] = DHCPDECLINE;
-	packet->option[3] = DHCP_REQUEST_IP;
-	packet->option[4] = DHCP_REQUEST_IP_LEN;
-	// request ip
-	packet->option[5] = declient_ip & 0xff;
-	packet->option[6] = declient_ip >> 8 & 0xff;
-	packet->option[7] = declient_ip >> 16 & 0xff;
-	packet->option[8] = declient_ip >> 24;
+	return *type;
+}
+
+static __u32 dhcp_get_ip_option(const struct dhcp_packet *packet, __u8 code)
+{
+	int len;
+	__u32 ip = 0;
+	const __u8 *val;
 
-	packet->option[9] = 0xff;
+	val = dhcp_get_option(packet, code, &len);
+	if (val && len >= IPV4_ADR_LEN)
+		memcpy(&ip, val, IPV4_ADR_LEN);
 
-	return sendto(sockfd, packet, sizeof(*packet), 0,
-				(const struct sockaddr *)remote_addr, sizeof(*remote_addr));
+	return ip;
 }
 
-int qu_is_empty(int fd);
-
-static int check_ip_is_user(__u32 ip)
+/*
+ * send the current packet and wait for a reply of one of the expected
+ * types, retransmitting with exponential backoff.
+ */
+static int dhcp_transact(struct dhcp_client *dhcp, int pkt_len, __u32 expect, int max_retry)
 {
-	int ret, i;
-	int sockfd;
-	struct sockaddr_in remote_addr, local_addr;
-	socklen_t addrlen = sizeof(struct sockaddr_in);
+	int ret, retry, opt_len, timeout = DHCP_INIT_TIMEOUT;
+	__u32 start;
+	socklen_t addrlen;
+	struct sockaddr_in remote_addr;
+	struct dhcp_packet request = dhcp->packet;
+
+	for (retry = 0; retry < max_retry; retry++) {
+		ret = sendto(dhcp->sockfd, &request, pkt_len, 0,
+				(const struct sockaddr *)&dhcp->bcast_addr, sizeof(dhcp->bcast_addr));
+		if (ret < 0)
+			return ret;
+
+		socket_ioctl(dhcp->sockfd, SKIOCS_TIMEOUT, timeout);
+		start = get_tick();
+
+		while (get_tick() - start < timeout) {
+			ret = recvfrom(dhcp->sockfd, &dhcp->packet, sizeof(dhcp->packet), 0,
+					(struct sockaddr *)&remote_addr, &addrlen);
+			if (ret <= 0)
+				break;
 
-	sockfd = socket(AF_INET, SOCK_RAW, PROT_ETH);
-	if (sockfd < 0) {
-		printf("socket() failed!\n");
-		return sockfd;
+			if (dhcp->packet.op != SERVER_ACK || dhcp->packet.xid != dhcp->xid)
+				continue;
+
+			ret = dhcp_get_msg_type(&dhcp->packet);
+
+			// RFC 4039: an ACK to a DISCOVER is only taken with Rapid Commit
+			if (ret == DHCPACK && dhcp_get_msg_type(&request) == DHCPDISCOVER &&
+				!dhcp_get_option(&dhcp->packet, DHCP_RAPID_COMMIT, &opt_len))
+				continue;
+
+			if (ret > 0 && (expect & DHCP_MSG_MASK(ret)))
+				return ret;
+		}
+
+		timeout = min(timeout << 1, DHCP_MAX_TIMEOUT);
 	}
 
-	local_addr.sin_addr.s_addr = 0;
-	remote_addr.sin_addr.s_addr = ip;
+	dhcp->packet = request;
 
-	ret = bind(sockfd, (struct sockaddr *) &local_addr, sizeof(local_addr));
-	if (ret < 0) {
-		printf("connect() failed!\n");
-		goto L1;
+	return -ETIMEDOUT;
+}
+
+static int dhcp_msg_len(int opt_len)
+{
+	return sizeof(struct dhcp_packet) - DHCP_OPT_LEN + opt_len;
+}
+
+static int send_dhcp_discover(struct dhcp_client *dhcp, bool rapid_commit)
+{
+	int pos;
+	__u8 *opt = dhcp->packet.option;
+
+	init_dhcp_packet(&dhcp->packet, dhcp->xid, dhcp->mac_addr);
+
+	pos = dhcp_add_common_options(opt, 0, DHCPDISCOVER);
+	if (rapid_commit)
+		pos = dhcp_add_option(opt, pos, DHCP_RAPID_COMMIT, 0, NULL);
+	opt[pos++] = DHCP_END;
+
+	return dhcp_transact(dhcp, sizeof(dhcp->packet),
+			DHCP_MSG_MASK(DHCPOFFER) | DHCP_MSG_MASK(DHCPACK), DHCP_MAX_RETRY);
+}
+
+/*
+ * server_id == 0 means INIT-REBOOT (RFC 2131 4.3.2): ask the server to
+ * confirm a previously assigned address without a DISCOVER round trip.
+ */
+static int send_dhcp_request(struct dhcp_client *dhcp, __u32 request_ip, __u32 server_id, int max_retry)
+{
+	int pos;
+	__u8 *opt = dhcp->packet.option;
+
+	init_dhcp_packet(&dhcp->packet, dhcp->xid, dhcp->mac_addr);
+
+	pos = dhcp_add_common_options(opt, 0, DHCPREQUEST);
+	pos = dhcp_add_option(opt, pos, DHCP_REQUEST_IP, DHCP_REQUEST_IP_LEN, &request_ip);
+	if (server_id)
+		pos = dhcp_add_option(opt, pos, DHCP_SERVER_ID, IPV4_ADR_LEN, &server_id);
+	opt[pos++] = DHCP_END;
+
+	return dhcp_transact(dhcp, sizeof(dhcp->packet),
+			DHCP_MSG_MASK(DHCPACK) | DHCP_MSG_MASK(DHCPNAK), max_retry);
+}
+
+static int send_dhcp_decline(struct dhcp_client *dhcp, __u32 decline_ip, __u32 server_id)
+{
+	int pos;
+	__u8 *opt = dhcp->packet.option;
+
+	init_dhcp_packet(&dhcp->packet, dhcp->xid, dhcp->mac_addr);
+
+	pos = dhcp_add_option(opt, 0, DHCP_MESSAGE, DHCP_MESSAGE_LEN, &(__u8){DHCPDECLINE});
+	pos = dhcp_add_option(opt, pos, DHCP_REQUEST_IP, DHCP_REQUEST_IP_LEN, &decline_ip);
+	pos = dhcp_add_option(opt, pos, DHCP_SERVER_ID, IPV4_ADR_LEN, &server_id);
+	opt[pos++] = DHCP_END;
+
+	return sendto(dhcp->sockfd, &dhcp->packet, dhcp_msg_len(pos), 0,
+			(const struct sockaddr *)&dhcp->bcast_addr, sizeof(dhcp->bcast_addr));
+}
+
+static void dhcp_parse_ack(const struct dhcp_packet *packet, struct dhcp_lease *lease)
+{
+	int len;
+	const __u8 *val;
+	char ip_str[IPV4_STR_LEN];
+
+	memset(lease, 0, sizeof(*lease));
+
+	lease->addr   = packet->yiaddr;
+	lease->mask   = dhcp_get_ip_option(packet, DHCP_SUBNET_MASK);
+	lease->router = dhcp_get_ip_option(packet, DHCP_ROUTER);
+	lease->server = dhcp_get_ip_option(packet, DHCP_SERVER_ID);
+	lease->next_server = packet->siaddr;
+
+	val = dhcp_get_option(packet, DHCP_TFTP_SERVER, &len);
+	if (val && len < IPV4_STR_LEN) {
+		memcpy(ip_str, val, len);
+		ip_str[len] = '\0';
+		str_to_ip((__u8 *)&lease->next_server, ip_str);
 	}
 
-	ret = sendto(sockfd, NULL, 0, 0, (struct sockaddr *)&remote_addr, addrlen);
-	if (ret < 0) {
-		printf("sendto arp error\n");
-		goto L1;
+	val = dhcp_get_option(packet, DHCP_BOOT_FILE, &len);
+	if (val && len < sizeof(lease->boot_file)) {
+		memcpy(lease->boot_file, val, len);
+		lease->boot_file[len] = '\0';
+	} else {
+		strncpy(lease->boot_file, packet->file, sizeof(lease->boot_file) - 1);
 	}
 
-	for (i = 0; i < 3; i++) {
-		if (qu_is_empty(sockfd)) {
-			if (i >= 3)
-				break;
+	if (!lease->next_server)
+		lease->next_server = lease->server;
+}
 
-			udelay(10000000);
-			continue;
-		}
+static const char *g_lease_attr[] = {
+	"net.dhcp.address",
+	"net.dhcp.netmask",
+	"net.dhcp.server",
+	"net.dhcp.router",
+	"net.dhcp.next_server",
+};
 
-		ret = 1;
-		goto L1;
+static int dhcp_load_lease(struct dhcp_lease *lease)
+{
+	int i;
+	char buff[CONF_VAL_LEN];
+	__u32 *ip = &lease->addr;
+
+	memset(lease, 0, sizeof(*lease));
+
+	for (i = 0; i < ARRAY_ELEM_NUM(g_lease_attr); i++) {
+		if (!conf_get_attr(g_lease_attr[i], buff))
+			str_to_ip((__u8 *)&ip[i], buff);
 	}
 
-	ret = 0;
+	if (!conf_get_attr("net.dhcp.boot_file", buff))
+		strncpy(lease->boot_file, buff, sizeof(lease->boot_file) - 1);
+
+	return lease->addr ? 0 : -ENOENT;
+}
 
-L1:
-	close(sockfd);
+static inline void dhcp_store_attr(const char *attr, const char *val)
+{
+	if (conf_set_attr(attr, val) < 0)
+		conf_add_attr(attr, val);
+}
 
-	return ret;
+static void dhcp_save_lease(const struct dhcp_lease *lease)
+{
+	int i;
+	char ip_str[IPV4_STR_LEN];
+	const __u32 *ip = &lease->addr;
+
+	for (i = 0; i < ARRAY_ELEM_NUM(g_lease_attr); i++) {
+		ip_to_str(ip_str, ip[i]);
+		dhcp_store_attr(g_lease_attr[i], ip_str);
+	}
+
+	dhcp_store_attr("net.dhcp.boot_file", lease->boot_file);
+}
+
+/*
+ * Address conflict probe (RFC 5227 style). The request goes out as soon
+ * as an address is known, so the REQUEST/ACK exchange overlaps the wait
+ * for replies. A bounded window is still polled before the address is
+ * taken, for a holder that answers slower than the server.
+ */
+static inline void dhcp_arp_probe(__u32 ip)
+{
+	if (ip)
+		arp_send_packet((__u8 *)&ip, NULL, ARP_OP_REQ);
+}
+
+static inline bool dhcp_ip_conflict(struct dhcp_client *dhcp, __u32 ip)
+{
+	__u32 start;
+	struct eth_addr *addr;
+
+	start = get_tick();
+
+	do {
+		ndev_poll();
+
+		addr = getaddr(ip);
+		if (addr && memcmp(addr->mac, dhcp->mac_addr, MAC_ADR_LEN))
+			return true;
+	} while (get_tick() - start < DHCP_PROBE_WAIT);
+
+	return false;
 }
 
 int main(int argc, char *argv[])
 {
 	int opt;
-	int ret, i, j;
-	int sockfd;
-	__u32 xid;
+	int ret;
+	__u32 start;
 	char nic_name[NET_NAME_LEN];
 	char ip_str[IPV4_STR_LEN];
-	__u8 mac_addr[MAC_ADR_LEN];
-	bool sync_svr = false, nic = false;
-	socklen_t addrlen;
-	struct net_device *ndev = NULL;
+	bool sync_svr = false, nic = false, use_cache = true;
 	struct list_head *ndev_list, *iter;
-	struct sockaddr_in remote_addr, local_addr;
-	struct dhcp_packet packet;
+	struct sockaddr_in local_addr;
+	struct dhcp_lease lease, cached;
+	struct dhcp_client dhcp;
 
-	while ((opt = getopt(argc, argv, "x:sh")) != -1) {
+	memset(&dhcp, 0, sizeof(dhcp));
+
+	while ((opt = getopt(argc, argv, "x:sfh")) != -1) {
 		switch (opt) {
 		case 's':
 			sync_svr = true;
@@ -205,156 +430,153 @@ int main(int argc, char *argv[])
 			strncpy(nic_name, optarg, NET_NAME_LEN);
 			break;
 
+		case 'f':
+			use_cache = false;
+			break;
+
 		default:
 			usage();
 			return -EINVAL;
 		}
 	}
 
-	if (nic) {
-		ndev_list= ndev_get_list();
+	ndev_list = ndev_get_list();
+	if (list_empty(ndev_list)) {
+		printf("No NIC available!\n");
+		return -ENODEV;
+	}
 
+	if (nic) {
 		list_for_each(iter, ndev_list) {
-			ndev = container_of(iter, struct net_device, ndev_node);
+			struct net_device *ndev;
 
-			if (strncpy(ndev->ifx_name, nic_name, NET_NAME_LEN) == 0)
+			ndev = container_of(iter, struct net_device, ndev_node);
+			if (!strncmp(ndev->ifx_name, nic_name, NET_NAME_LEN)) {
+				dhcp.ndev = ndev;
 				break;
+			}
 		}
 
-		if (NULL == ndev) {
+		if (NULL == dhcp.ndev) {
 			printf("device \'%s\' not found\n", nic_name);
 			return -ENODEV;
 		}
 	} else {
-		ndev = ndev_get_first();
-
-		if (NULL == ndev) {
-			printf("No NIC available!\n");
-			return -ENODEV;
-		}
+		dhcp.ndev = ndev_get_first();
 	}
 
-	sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-	if (sockfd < 0) {
+	dhcp.sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (dhcp.sockfd < 0) {
 		printf("socket() failed!\n");
-		return sockfd;
+		return dhcp.sockfd;
 	}
 
-	local_addr.sin_addr.s_addr = 0;
-	local_addr.sin_port = htons(68);
+	memset(&local_addr, 0, sizeof(local_addr));
+	local_addr.sin_family = AF_INET;
+	local_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	local_addr.sin_port = htons(DHCP_CLIENT_PORT);
 
-	memset(&remote_addr.sin_addr, 0xff, IPV4_ADR_LEN);
-	remote_addr.sin_port = htons(67);
+	memset(&dhcp.bcast_addr, 0, sizeof(dhcp.bcast_addr));
+	dhcp.bcast_addr.sin_family = AF_INET;
+	memset(&dhcp.bcast_addr.sin_addr, 0xff, IPV4_ADR_LEN);
+	dhcp.bcast_addr.sin_port = htons(DHCP_SERVER_PORT);
 
-	ret = bind(sockfd, (const struct sockaddr *) &local_addr, sizeof(local_addr));
+	ret = bind(dhcp.sockfd, (const struct sockaddr *)&local_addr, sizeof(local_addr));
 	if (ret < 0) {
-		printf("connect() failed!\n");
+		printf("bind() failed!\n");
 		goto error;
 	}
 
-	ret = ndev_ioctl(ndev, NIOC_GET_MAC, mac_addr);
+	socket_ioctl(dhcp.sockfd, SKIOCS_FLAGS, 1);
 
-	srandom(__LINE__);
-	xid = random();
+	ndev_ioctl(dhcp.ndev, NIOC_GET_MAC, dhcp.mac_addr);
 
-	init_dhcp_packet(&packet, xid, mac_addr);
+	start = get_tick();
+	srandom(start ^ *(__u32 *)(dhcp.mac_addr + 2));
+	dhcp.xid = random();
 
-	ret = send_dhcp_discover(sockfd, &packet, &remote_addr);
-	if (ret < 0) {
-		printf("send dhcp discover packet failed!\n");
-		goto error;
-	}
-
-	addrlen = sizeof(remote_addr);
+	ret = -ENOENT;
 
-	for (i = 0, j = 0; i < 3; i++) {
-#if 0
-		if (qu_is_empty(sockfd)) {
-			if (i >= 3)
-				break;
-
-			udelay(10000000);
+	// warm boot: confirm the cached lease with a single REQUEST/ACK
+	if (!dhcp_load_lease(&cached) && use_cache) {
+		dhcp_arp_probe(cached.addr);
 
-			continue;
+		ret = send_dhcp_request(&dhcp, cached.addr, 0, DHCP_REBOOT_RETRY);
+		if (ret == DHCPNAK) {
+			printf("cached lease rejected by server\n");
+			ret = -EACCES;
 		}
-#endif
+	}
 
-		ret = recvfrom(sockfd, &packet, sizeof(packet), 0,
-				(struct sockaddr *)&remote_addr, &addrlen);
-		if (ret <= 0) {
-			printf("recv dhcp offer packet failed!");
+	if (ret != DHCPACK) {
+		dhcp.xid = random();
+
+		ret = send_dhcp_discover(&dhcp, true);
+		if (ret < 0) {
+			printf("no DHCP offer received!\n");
 			goto error;
 		}
 
-		if (packet.xid == xid) {
-			if (0 == j) {
-				if (packet.option[2] != DHCPOFFER) {
-					if (i < 3)
-						continue;
-
-					printf("Can't recv offer packet!\n");
-					ret = -ENONET;
-					goto error;
-				}
-
-				remote_addr.sin_addr.s_addr = 0xFFFFFFFF;
-
-				i = -1;
-				j++;
-
-				ret = send_dhcp_request(sockfd, &packet, &remote_addr);
-				if (ret < 0) {
-					printf("send dhcp request packet failed!");
-					goto error;
-				}
-			} else {
-				if (packet.option[2] != DHCPACK) {
-					if (i < 3)
-						continue;
-
-					printf("Can't recv ACK packet!\n");
-					ret = -ENONET;
-					goto error;
-				}
+		// without Rapid Commit, the server answers with an OFFER
+		if (ret == DHCPOFFER) {
+			__u32 server_id = dhcp_get_ip_option(&dhcp.packet, DHCP_SERVER_ID);
+			__u32 offer_ip = dhcp.packet.yiaddr;
 
-				break;
+			dhcp_arp_probe(offer_ip);
+
+			ret = send_dhcp_request(&dhcp, offer_ip, server_id, DHCP_MAX_RETRY);
+			if (ret != DHCPACK) {
+				printf("Can't recv ACK packet!\n");
+				ret = ret < 0 ? ret : -ENONET;
+				goto error;
 			}
+		} else {
+			dhcp_arp_probe(dhcp.packet.yiaddr);
 		}
 	}
 
-	if (i >= 3) {
-		printf("Time out\n");
-		goto error;
-	}
+	dhcp_parse_ack(&dhcp.packet, &lease);
 
-	ret = check_ip_is_user(packet.yiaddr);
-	if (ret != 0) {
-		ip_to_str(ip_str, packet.yiaddr);
+	if (dhcp_ip_conflict(&dhcp, lease.addr)) {
+		ip_to_str(ip_str, lease.addr);
 		printf("ip: %s is used\n", ip_str);
 
-		send_dhcp_declient(sockfd, &packet, &remote_addr);
+		send_dhcp_decline(&dhcp, lease.addr, lease.server);
+		ret = -EADDRINUSE;
 
 		goto error;
 	}
 
-	ndev_ioctl(ndev, NIOC_SET_IP, (void *)packet.yiaddr);
+	ndev_ioctl(dhcp.ndev, NIOC_SET_IP, (void *)lease.addr);
+	if (lease.mask)
+		ndev_ioctl(dhcp.ndev, NIOC_SET_MASK, (void *)lease.mask);
+
+	// a warm boot with the same lease leaves the flash alone
+	if (memcmp(&lease, &cached, sizeof(lease)) || sync_svr) {
+		dhcp_save_lease(&lease);
+
+		if (sync_svr)
+			net_set_server_ip(lease.next_server);
 
-	if (sync_svr) {
-		net_set_server_ip(packet.siaddr);
-		// conf_store();
+		ret = conf_store();
+		if (ret < 0 && ret != -ENODEV)
+			printf("Warning: fail to store the lease (ret = %d)!\n", ret);
 	}
 
-	ip_to_str(ip_str, remote_addr.sin_addr.s_addr);
+	ip_to_str(ip_str, lease.server);
 	printf("server ip: %s\n", ip_str);
-	ip_to_str(ip_str, packet.yiaddr);
+	ip_to_str(ip_str, lease.addr);
 	printf("local  ip: %s\n", ip_str);
+	if (lease.boot_file[0])
+		printf("boot file: %s\n", lease.boot_file);
+	printf("(%d ms)\n", get_tick() - start);
 
-	sk_close(sockfd);
+	sk_close(dhcp.sockfd);
 
 	return 0;
 
 error:
-	sk_close(sockfd);
+	sk_close(dhcp.sockfd);
 
 	return ret;
 }
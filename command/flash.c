@@ -4,7 +4,11 @@
 #include <unistd.h>
 #include <string.h>
 #include <fcntl.h>
+#include <timer.h>
+#include <random.h>
+#include <bitops.h>
 #include <mtd/mtd.h>
+#include <mtd/nand.h>
 
 static int flash_str_to_val(char * str, __u32 * val, char *unit)
 {
@@ -54,8 +58,8 @@ static int info(int argc, char *argv[])
 		part.label,
 		"??",
 		"??", // part.name,
-		part.base,
-		part.size,
+		(__u32)part.base,
+		(__u32)part.size,
 		0, // write_size,
 		0 // erase_size
 		);
@@ -70,6 +74,7 @@ static int read_write(int argc, char *argv[])
 	char start_unit = 0, size_unit = 0;
 	void *buff = NULL;
 	int fd;
+	__u32 skipped;
 	struct flash_info flash_val;
 	char bdev_name[BLOCK_DEV_NAME_LEN];
 
@@ -135,6 +140,8 @@ static int read_write(int argc, char *argv[])
 		goto L2;
 	}
 
+	skipped = flash_val.skipped_pages;
+
 	// -a xxxblock or -a xxxpage
 	if (start_unit == 'b') {
 		start *= flash_val.block_size;
@@ -180,6 +187,16 @@ static int read_write(int argc, char *argv[])
 
 L2:
 	close(fd);
+
+	// the tail is only flushed on close
+	if (ret >= 0 && 0 != strcmp(argv[0], "read")) {
+		fd = open(bdev_name, O_RDONLY);
+		if (fd >= 0) {
+			if (ioctl(fd, FLASH_IOCG_INFO, &flash_val) == 0)
+				printf("%d blank page(s) skipped\n", flash_val.skipped_pages - skipped);
+			close(fd);
+		}
+	}
 L1:
 	return ret;
 }
@@ -371,7 +388,7 @@ static int dump(int argc, char *argv[])
 
 	DPRINT("%s 0x%08x (flash 0x%08x) ==> RAM 0x%08x, "
 		"Expected length 0x%08x, Real length 0x%08x\n",
-		flash_val.name, start, flash_val.bdev_base + start, buff, size, ret);
+		flash_val.name, start, (__u32)(flash_val.bdev_base + start), buff, size, ret);
 
 	p = buff;
 
@@ -425,8 +442,9 @@ static int erase(int argc, char *argv[])
 	int ch;
 	int arg_flag = 0;
 	int ret = 0;
-	__u32 start = 0;
-	__u32 size = 0;
+	__u32 val;
+	__u64 start = 0;
+	__u64 size = 0;
 	__u32 dev_num = 0;
 	char start_unit = 0;
 	char size_unit = 0;
@@ -439,23 +457,26 @@ static int erase(int argc, char *argv[])
 	while ((ch = getopt(argc, argv, "a:l:p::c:f")) != -1) {
 		switch(ch) {
 		case 'a':
-			if (arg_flag == 2 || flash_str_to_val(optarg, &start, &start_unit) < 0) {
+			if (arg_flag == 2 || flash_str_to_val(optarg, &val, &start_unit) < 0) {
 				printf("Invalid argument: \"%s\"\n", optarg);
 				usage();
 				return -EINVAL;
 			}
 
+			start = val;
 			arg_flag = 1;
 
 			break;
 
 		case 'l':
-			if (arg_flag == 2 || flash_str_to_val(optarg, &size, &size_unit) < 0) {
+			if (arg_flag == 2 || flash_str_to_val(optarg, &val, &size_unit) < 0) {
 				printf("Invalid argument: \"%s\"\n", optarg);
 				usage();
 				return -EINVAL;
 			}
 
+			size = val;
+
 			break;
 
 		case 'p':
@@ -522,11 +543,13 @@ static int erase(int argc, char *argv[])
 		return -EINVAL;
 	}
 
-	//aligned:
-	ALIGN_UP(start, flash_val.page_size);
-	ALIGN_UP(size, flash_val.block_size);
+	// aligned, with 64-bit masks (ALIGN_UP() builds a 32-bit one)
+	start = (start + flash_val.page_size - 1) & ~((__u64)flash_val.page_size - 1);
+	size  = (size + flash_val.block_size - 1) & ~((__u64)flash_val.block_size - 1);
 
-	printf("[0x%08x : 0x%08x]\n", start, size);
+	printf("[0x%08x : 0x%08x] blocks\n",
+		(__u32)(start >> (ffs(flash_val.block_size) - 1)),
+		(__u32)(size >> (ffs(flash_val.block_size) - 1)));
 
 	memset(&eopt, 0, sizeof(eopt));
 	eopt.len = size;
@@ -545,6 +568,121 @@ L1:
 	return ret;
 }
 
+#define BCH_BENCH_STEPS 64
+
+static int bch_bench_round(struct nand_bch *bch, __u8 *data, __u8 *ecc, int loops, int errors)
+{
+	int i, j, k, ret, code_len = nand_bch_code_len(bch);
+	__u8 calc[(NAND_BCH_MAX_T * 13 + 7) / 8];
+	__u32 bit, enc_ms, dec_ms, bytes, tick;
+
+	for (i = 0; i < BCH_BENCH_STEPS; i++)
+		nand_bch_encode(bch, data + i * NAND_BCH_DATA_LEN, NAND_BCH_DATA_LEN, ecc + i * code_len);
+
+	enc_ms = dec_ms = 0;
+
+	for (k = 0; k < loops; k++) {
+		tick = get_tick();
+		for (i = 0; i < BCH_BENCH_STEPS; i++)
+			nand_bch_encode(bch, data + i * NAND_BCH_DATA_LEN, NAND_BCH_DATA_LEN, calc);
+		enc_ms += get_tick() - tick;
+
+		// distinct flips in each step, the data must come back intact
+		for (i = 0; i < BCH_BENCH_STEPS; i++) {
+			for (j = 0; j < errors; j++) {
+				bit = random() % (8 * NAND_BCH_DATA_LEN / errors) * errors + j;
+				data[i * NAND_BCH_DATA_LEN + bit / 8] ^= 1 << (bit & 7);
+			}
+		}
+
+		tick = get_tick();
+		for (i = 0; i < BCH_BENCH_STEPS; i++) {
+			nand_bch_encode(bch, data + i * NAND_BCH_DATA_LEN, NAND_BCH_DATA_LEN, calc);
+
+			ret = nand_bch_decode(bch, data + i * NAND_BCH_DATA_LEN, NAND_BCH_DATA_LEN,
+					ecc + i * code_len, calc);
+			if (ret != errors) {
+				printf("step %d: %d error(s) injected, decode returns %d!\n", i, errors, ret);
+				return -EIO;
+			}
+		}
+		dec_ms += get_tick() - tick;
+	}
+
+	bytes = loops * BCH_BENCH_STEPS * NAND_BCH_DATA_LEN;
+
+	printf("%6d  %8d  %8d\n", errors,
+		enc_ms ? bytes / enc_ms : 0, dec_ms ? bytes / dec_ms : 0);
+
+	return 0;
+}
+
+// encode/decode throughput of the software BCH, in KB/s
+static int bchtest(int argc, char *argv[])
+{
+	int ch, i, ret = 0, errors;
+	unsigned long strength = 8, loops = 16;
+	struct nand_bch *bch;
+	__u8 *data, *ecc;
+
+	while ((ch = getopt(argc, argv, "t:n:h")) != -1) {
+		switch (ch) {
+		case 't':
+			if (str_to_val(optarg, &strength) < 0 ||
+				strength < 1 || strength > NAND_BCH_MAX_T) {
+				printf("Invalid strength: \"%s\"\n", optarg);
+				return -EINVAL;
+			}
+			break;
+
+		case 'n':
+			if (str_to_val(optarg, &loops) < 0 || !loops) {
+				printf("Invalid argument: \"%s\"\n", optarg);
+				return -EINVAL;
+			}
+			break;
+
+		default:
+			usage();
+			return -EINVAL;
+		}
+	}
+
+	bch = nand_bch_new(strength);
+	if (!bch) {
+		printf("fail to create BCH-%lu!\n", strength);
+		return -ENOMEM;
+	}
+
+	data = malloc(BCH_BENCH_STEPS * NAND_BCH_DATA_LEN);
+	ecc  = malloc(BCH_BENCH_STEPS * nand_bch_code_len(bch));
+	if (!data || !ecc) {
+		ret = -ENOMEM;
+		goto L1;
+	}
+
+	for (i = 0; i < BCH_BENCH_STEPS * NAND_BCH_DATA_LEN; i++)
+		data[i] = random();
+
+	printf("BCH-%lu, %d-byte step, %d-byte code, %lu x %d KB\n",
+		strength, NAND_BCH_DATA_LEN, nand_bch_code_len(bch),
+		loops, BCH_BENCH_STEPS * NAND_BCH_DATA_LEN / 1024);
+	printf("errors  enc KB/s  dec KB/s\n");
+
+	for (errors = 0; errors <= strength; errors++) {
+		ret = bch_bench_round(bch, data, ecc, loops, errors);
+		if (ret < 0)
+			break;
+	}
+
+L1:
+	free(ecc);
+	free(data);
+	nand_bch_free(bch);
+
+	return ret;
+}
+
 int main(int argc, char *argv[])
 {
 	int ret = 0, i;
@@ -568,6 +706,9 @@ int main(int argc, char *argv[])
 		}, {
 			.name = "scanbb",
 			.main = scanbb
+		}, {
+			.name = "bchtest",
+			.main = bchtest
 		},
 	};
 
@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <mtd/nand_sim.h>
+
+#ifdef CONFIG_NAND_SIM
+static void nand_sim_show(void)
+{
+	struct nand_sim_opt opt;
+	struct nand_sim_stat stat;
+
+	nand_sim_get_info(&opt, &stat);
+
+	printf("nandsim: bitflip %d ppm, fail %d ppm, seed %d\n",
+		opt.bitflip, opt.fail, opt.seed);
+	printf("read:    %d page(s), %d byte(s) out, %d bitflip(s)\n"
+		"program: %d page(s), %d byte(s) in, %d failure(s)\n"
+		"erase:   %d block(s), %d failure(s)\n"
+		"clock:   %d us\n",
+		stat.reads, stat.bytes_out, stat.bitflips,
+		stat.programs, stat.bytes_in, stat.prog_fails,
+		stat.erases, stat.erase_fails,
+		stat.clock_us);
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+#ifdef CONFIG_NAND_SIM
+	int ch, ret;
+	unsigned long val;
+	struct nand_sim_opt opt;
+	__u32 *field;
+
+	if (argc == 1) {
+		nand_sim_show();
+		return 0;
+	}
+
+	nand_sim_get_info(&opt, NULL);
+
+	while ((ch = getopt(argc, argv, "b:f:s:c")) != -1) {
+		switch (ch) {
+		case 'b':
+			field = &opt.bitflip;
+			break;
+
+		case 'f':
+			field = &opt.fail;
+			break;
+
+		case 's':
+			field = &opt.seed;
+			break;
+
+		case 'c':
+			nand_sim_clear_stat();
+			continue;
+
+		default:
+			usage();
+			return -EINVAL;
+		}
+
+		if (str_to_val(optarg, &val) < 0) {
+			printf("Invalid argument: \"%s\"\n", optarg);
+			return -EINVAL;
+		}
+
+		*field = val;
+	}
+
+	if (optind != argc) {
+		usage();
+		return -EINVAL;
+	}
+
+	ret = nand_sim_setup(&opt);
+	if (ret < 0) {
+		printf("Invalid nandsim setup (ret = %d)!\n", ret);
+		return ret;
+	}
+
+	nand_sim_show();
+#else
+	printf("NAND simulator is not enabled (CONFIG_NAND_SIM)!\n");
+#endif
+
+	return 0;
+}
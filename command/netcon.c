@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <net/net.h>
+#include <net/netconsole.h>
+
+int main(int argc, char *argv[])
+{
+	int ch, ret;
+	int policy = NETCON_UART_ON;
+	unsigned long rate;
+	char target[CONF_VAL_LEN];
+
+	while ((ch = getopt(argc, argv, "u:s")) != -1) {
+		switch (ch) {
+		case 'u':
+			if (!strcmp(optarg, "on")) {
+				policy = NETCON_UART_ON;
+			} else if (!strcmp(optarg, "off")) {
+				policy = NETCON_UART_OFF;
+			} else if (str_to_val(optarg, &rate) >= 0 && rate > 0) {
+				policy = rate;
+			} else {
+				printf("Invalid UART policy: \"%s\"\n", optarg);
+				return -EINVAL;
+			}
+			break;
+
+		case 's':
+			netcon_stop();
+			printf("netconsole stopped\n");
+			return 0;
+
+		default:
+			usage();
+			return -EINVAL;
+		}
+	}
+
+	if (optind + 1 == argc) {
+		strncpy(target, argv[optind], sizeof(target) - 1);
+		target[sizeof(target) - 1] = '\0';
+	} else if (optind == argc) {
+		if (conf_get_attr("net.console", target) < 0) {
+			printf("Please specify the host or set \"net.console\"!\n");
+			return -EINVAL;
+		}
+	} else {
+		usage();
+		return -EINVAL;
+	}
+
+	ret = netcon_setup(target, policy);
+	if (ret < 0) {
+		printf("fail to start netconsole on \"%s\"! (ret = %d)\n", target, ret);
+		return ret;
+	}
+
+	printf("netconsole: logging to %s\n", target);
+
+	return 0;
+}
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <net/net.h>
+#include <net/netem.h>
+#include <net/netsim.h>
+
+static void netem_show(void)
+{
+	struct netem_opt opt;
+	struct netem_stat stat;
+	struct netsim_stat sim;
+
+	netsim_get_stat(&sim);
+
+	printf("netsim: %d frame(s) to the peer, %d from it, %d overflow\n"
+		"peer:   %d arp, %d icmp, %d dhcp\n"
+		"tftp:   %d session(s), %d byte(s) out, %d byte(s) in, %d resend(s)\n"
+		"nfs:    %d call(s), %d byte(s) out\n",
+		sim.tx_frames, sim.rx_frames, sim.rx_overflow,
+		sim.arp, sim.icmp, sim.dhcp,
+		sim.tftp_sessions, sim.tftp_bytes_out, sim.tftp_bytes_in, sim.tftp_rexmits,
+		sim.nfs_calls, sim.nfs_bytes_out);
+
+	netem_get_info(&opt, &stat);
+
+	if (!netem_active()) {
+		printf("netem:  off\n");
+		return;
+	}
+
+	printf("netem: latency %dms, jitter %dms, loss %d%%, reorder %d%%, seed %d\n",
+		opt.latency, opt.jitter, opt.loss, opt.reorder, opt.seed);
+	printf("rx: passed %d, delayed %d, reordered %d, dropped %d, overflow %d\n"
+		"tx: dropped %d\n"
+		"max queue: %d/%d\n",
+		stat.rx_passed, stat.rx_delayed, stat.rx_reordered, stat.rx_dropped,
+		stat.overflow, stat.tx_dropped, stat.max_queue, NETEM_QUEUE_LEN);
+}
+
+int main(int argc, char *argv[])
+{
+	int ch, ret;
+	unsigned long val;
+	struct netem_opt opt;
+	__u32 *field;
+
+	if (argc == 1) {
+		netem_show();
+		return 0;
+	}
+
+	memset(&opt, 0, sizeof(opt));
+
+	while ((ch = getopt(argc, argv, "d:j:l:r:s:c")) != -1) {
+		switch (ch) {
+		case 'd':
+			field = &opt.latency;
+			break;
+
+		case 'j':
+			field = &opt.jitter;
+			break;
+
+		case 'l':
+			field = &opt.loss;
+			break;
+
+		case 'r':
+			field = &opt.reorder;
+			break;
+
+		case 's':
+			field = &opt.seed;
+			break;
+
+		case 'c':
+			netem_setup(&opt);
+			netsim_clear_stat();
+			netem_show();
+			return 0;
+
+		default:
+			usage();
+			return -EINVAL;
+		}
+
+		if (str_to_val(optarg, &val) < 0) {
+			printf("Invalid argument: \"%s\"\n", optarg);
+			return -EINVAL;
+		}
+
+		*field = val;
+	}
+
+	if (optind != argc) {
+		usage();
+		return -EINVAL;
+	}
+
+	ret = netem_setup(&opt);
+	if (ret == -ENOSYS) {
+		printf("get_tick() does not advance, latency/jitter cannot be emulated!\n");
+		return ret;
+	} else if (ret < 0) {
+		printf("Invalid netem setup (ret = %d)!\n", ret);
+		return ret;
+	}
+
+	netem_show();
+
+	return 0;
+}
@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <net/net.h>
+#include <net/tftp.h>
+
+int main(int argc, char *argv[])
+{
+	int ch;
+	unsigned long val;
+	struct tftpd_opt opt;
+
+	memset(&opt, 0x0, sizeof(opt));
+
+	while ((ch = getopt(argc, argv, "d:b:w:t:r:ov")) != -1) {
+		switch (ch) {
+		case 'd':
+			opt.root = optarg;
+			break;
+
+		case 'b':
+		case 'w':
+		case 't':
+		case 'r':
+			if (str_to_val(optarg, &val) < 0) {
+				printf("Invalid argument: \"%s\"\n", optarg);
+				return -EINVAL;
+			}
+
+			if (ch == 'b')
+				opt.max_blksize = val;
+			else if (ch == 'w')
+				opt.max_winsize = val;
+			else if (ch == 't')
+				opt.timeout = val;
+			else
+				opt.retries = val;
+			break;
+
+		case 'o':
+			opt.once = true;
+			break;
+
+		case 'v':
+			opt.verbose = true;
+			break;
+
+		default:
+			usage();
+			return -EINVAL;
+		}
+	}
+
+	if (optind < argc) {
+		usage();
+		return -EINVAL;
+	}
+
+	return tftpd_serve(&opt);
+}
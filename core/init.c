@@ -9,6 +9,9 @@
 // fixme: to be removed!
 #include <syscalls.h>
 #include <shell.h>
+#ifdef CONFIG_NET
+#include <net/netconsole.h>
+#endif
 #include <uart/uart.h>
 #include <font/font.h>
 #include <fs.h> // fixme: to be removed
@@ -155,6 +158,13 @@ int main(void)
 	if (ret < 0)
 		return ret;
 
+	// a sysconf stored on flash by conf_store() replaces the loader's copy
+	conf_load();
+
+#ifdef CONFIG_NET
+	netcon_init();
+#endif
+
 	ret = populate_rootfs();
 	if (ret < 0)
 		return ret;
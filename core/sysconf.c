@@ -5,10 +5,13 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <net/net.h>
+#include <malloc.h>
 #include <mtd/mtd.h>
 
 #define LINE_LEN 512
 
+#define SYSCONF_PART_LABEL "sysconf"
+
 #ifdef CONFIG_SYSCONFIG_DEBUG
 #define SC_DEBUG GEN_DBG
 #else
@@ -102,7 +105,13 @@ static int search_attr(struct sysconfig *cfg, const char *str)
 	return -ENODATA;
 }
 
-#if 0
+static inline void _syscfg_set_size(struct sysconfig *cfg)
+{
+	extern unsigned long g_board_config[];
+
+	g_board_config[1] = cfg->size;
+}
+
 int conf_del_attr(const char *attr)
 {
 	struct sysconfig *cfg;
@@ -119,20 +128,22 @@ int conf_del_attr(const char *attr)
 
 	len = ret + 1;
 
-	memcpy(cfg->data + cfg->offset - len, cfg->data + cfg->offset, cfg->size - cfg->offset);
+	memmove(cfg->data + cfg->offset - len, cfg->data + cfg->offset, cfg->size - cfg->offset);
 
 	cfg->size -= len;
+	_syscfg_set_size(cfg);
 
 L1:
 	_syscfg_close(cfg);
 
-	return ret;
+	return ret < 0 ? ret : 0;
 }
 
 int conf_add_attr(const char *attr, const char *val)
 {
 	struct sysconfig *cfg;
-	int ret = 0;
+	char line[LINE_LEN];
+	int ret = 0, len;
 
 	cfg = _syscfg_open();
 
@@ -142,7 +153,15 @@ int conf_add_attr(const char *attr, const char *val)
 		goto L1;
 	}
 
-	cfg->size += sprintf(cfg->data + cfg->offset, "%s = %s\n", attr, val);
+	len = snprintf(line, sizeof(line), "%s = %s\n", attr, val);
+	if (cfg->size + len > CONFIG_HEAD_SIZE) {
+		ret = -ENOSPC;
+		goto L1;
+	}
+
+	memcpy(cfg->data + cfg->size, line, len);
+	cfg->size += len;
+	_syscfg_set_size(cfg);
 
 L1:
 	_syscfg_close(cfg);
@@ -168,12 +187,18 @@ int conf_set_attr(const char *attr, const char *val)
 	old_len = ret + 1; // add  '\n'
 
 	new_len = snprintf(line, sizeof(line), "%s = %s\n", attr, val);
-	printf("new attr = %s\n", line);
+	SC_DEBUG("new attr = %s\n", line);
+
+	if (cfg->size + new_len - old_len > CONFIG_HEAD_SIZE) {
+		ret = -ENOSPC;
+		goto L1;
+	}
 
 	if (new_len != old_len) {
 		memmove(cfg->data + cfg->offset - old_len + new_len,
 			cfg->data + cfg->offset, cfg->size - cfg->offset);
 		cfg->size += new_len - old_len;
+		_syscfg_set_size(cfg);
 	}
 
 	memcpy(cfg->data + cfg->offset - old_len, line, new_len);
@@ -181,24 +206,124 @@ int conf_set_attr(const char *attr, const char *val)
 L1:
 	_syscfg_close(cfg);
 
-	return ret;
+	return ret < 0 ? ret : 0;
 }
-#else
-int conf_add_attr(const char *attr, const char *val)
+
+/*
+ * The attributes are edited in the RAM copy passed up by the loader.
+ * conf_store() writes that copy to the first good block of the flash
+ * partition labelled "sysconf", and conf_load() reads it back once
+ * the flash drivers are up. Without such a partition nothing persists.
+ */
+static struct mtd_info *conf_get_part(__u64 *phys)
 {
-	return 0;
+	int i, ret;
+	struct mtd_info *mtd;
+
+	for (i = 1; (mtd = get_mtd_device(NULL, i)); i++) {
+		if (strcmp(mtd->bdev.label, SYSCONF_PART_LABEL))
+			continue;
+
+		ret = flash_map_addr(mtd, 0, mtd->erase_size, phys);
+		if (ret < 0 || CONFIG_HEAD_SIZE > mtd->erase_size)
+			return NULL;
+
+		return mtd;
+	}
+
+	return NULL;
 }
 
-int conf_set_attr(const char *attr, const char *val)
+int conf_store(void)
 {
-	return 0;
+	int ret;
+	__u32 size, len;
+	__u64 phys;
+	__u8 *buff;
+	struct mtd_info *mtd;
+	struct sysconfig *cfg;
+	struct erase_info opt;
+
+	mtd = conf_get_part(&phys);
+	if (!mtd)
+		return -ENODEV;
+
+	cfg = _syscfg_open();
+
+	// EOF terminates the data
+	size = flash_write_is_align(mtd, cfg->size + 1);
+	buff = malloc(size);
+	if (!buff) {
+		ret = -ENOMEM;
+		goto L1;
+	}
+
+	memset(buff, EOF, size);
+	memcpy(buff, cfg->data, cfg->size);
+
+	memset(&opt, 0, sizeof(opt));
+	opt.addr = phys;
+	opt.len  = mtd->erase_size;
+
+	ret = mtd->erase(mtd, &opt);
+	if (ret < 0)
+		goto L2;
+
+	ret = mtd->write(mtd, phys, size, &len, buff);
+
+L2:
+	free(buff);
+L1:
+	_syscfg_close(cfg);
+
+	return ret < 0 ? ret : 0;
 }
 
-int conf_del_attr(const char *attr)
+int conf_load(void)
 {
-	return 0;
+	int ret;
+	size_t len;
+	__u32 size;
+	__u64 phys;
+	char *buff;
+	struct mtd_info *mtd;
+	struct sysconfig *cfg;
+
+	mtd = conf_get_part(&phys);
+	if (!mtd)
+		return -ENODEV;
+
+	size = flash_write_is_align(mtd, CONFIG_HEAD_SIZE);
+	buff = malloc(size);
+	if (!buff)
+		return -ENOMEM;
+
+	ret = mtd->read(mtd, phys, size, &len, (__u8 *)buff);
+	if (ret < 0)
+		goto L1;
+
+	// an erased or foreign block leaves the loader's copy in use
+	if (strncmp(buff, GB_SYSCFG_MAGIC, sizeof(GB_SYSCFG_MAGIC) - 1)) {
+		ret = -ENOENT;
+		goto L1;
+	}
+
+	cfg = _syscfg_open();
+
+	for (len = 0; len < CONFIG_HEAD_SIZE && buff[len] != (char)EOF; len++);
+
+	memcpy(cfg->data, buff, len);
+	cfg->size = len;
+	_syscfg_set_size(cfg);
+
+	_syscfg_close(cfg);
+
+	ret = 0;
+L1:
+	free(buff);
+
+	return ret;
 }
-#endif
 
 // TODO: add ex version:
 // int conf_get_attr_ex(char val[], const char *fmt, ...)
@@ -3,6 +3,7 @@
 static volatile __u32 g_tick_count = 1;
 static volatile __u32 loops_perjiffies = DEFAULT_LOOPS_PERJIFFIES;
 static volatile __u32 loops_perusec = DEFAULT_LOOPS_PERJIFFIES; //fixme
+static __u32 (*g_tick_source)(void);
 
 void inc_tick(void)
 {
@@ -11,9 +12,17 @@ void inc_tick(void)
 
 __u32 get_tick(void)
 {
+	if (g_tick_source)
+		return g_tick_source();
+
 	return g_tick_count;
 }
 
+void set_tick_source(__u32 (*read_ms)(void))
+{
+	g_tick_source = read_ms;
+}
+
 void mdelay(__u32 n)
 {
 	volatile __u32 curr_tick = get_tick();
@@ -0,0 +1,242 @@
+#include <list.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <assert.h>
+#include <malloc.h>
+#include <sysconf.h>
+#include <block.h>
+#include <drive.h>
+#include <bcache.h>
+
+/*
+ * Buffer cache shared by the block based filesystems: buffers are keyed
+ * by (bdev, block number, block size), hashed for lookup and kept on an
+ * LRU list. Unreferenced buffers are evicted oldest first whenever the
+ * cache grows beyond its size limit. A disk and its partitions may cache
+ * the same sectors, so invalidation compares master drive sectors.
+ */
+
+static struct {
+	bool   init;
+	size_t limit;
+	size_t bytes;
+	__u32  buffers;
+	struct list_head hash[BCACHE_HASH_SIZE];
+	struct list_head lru; // oldest first
+	struct bcache_stat stat;
+} g_bcache;
+
+static inline struct list_head *bcache_bucket(struct block_device *bdev, sector_t block)
+{
+	return &g_bcache.hash[(block ^ ((unsigned long)bdev >> 4)) & (BCACHE_HASH_SIZE - 1)];
+}
+
+static void bcache_init(void)
+{
+	int i;
+	char buff[CONF_VAL_LEN];
+	unsigned long val;
+
+	for (i = 0; i < BCACHE_HASH_SIZE; i++)
+		INIT_LIST_HEAD(&g_bcache.hash[i]);
+	INIT_LIST_HEAD(&g_bcache.lru);
+
+	if (conf_get_attr("block.bcache.size", buff) < 0 || hr_str_to_val(buff, &val) < 0)
+		val = BCACHE_DEF_SIZE;
+
+	g_bcache.limit = val;
+	g_bcache.init  = true;
+}
+
+static void bcache_free(struct buffer_head *bh)
+{
+	g_bcache.bytes -= bh->b_size;
+	g_bcache.buffers--;
+
+	free(bh->b_data);
+	free(bh);
+}
+
+static void bcache_unhash(struct buffer_head *bh)
+{
+	list_del_init(&bh->b_hash);
+	list_del_init(&bh->b_lru);
+}
+
+static void bcache_shrink(void)
+{
+	struct list_head *iter, *next;
+	struct buffer_head *bh;
+
+	for (iter = g_bcache.lru.next; iter != &g_bcache.lru && g_bcache.bytes > g_bcache.limit; iter = next) {
+		next = iter->next;
+		bh = container_of(iter, struct buffer_head, b_lru);
+
+		if (bh->b_count)
+			continue;
+
+		bcache_unhash(bh);
+		bcache_free(bh);
+		g_bcache.stat.evictions++;
+	}
+}
+
+static int bcache_fill(struct buffer_head *bh)
+{
+	struct bio bio;
+
+	memset(&bio, 0, sizeof(bio));
+	bio.bdev = bh->b_bdev;
+	bio.sect = bh->b_blocknr * (bh->b_size >> 9);
+	bio.data = bh->b_data;
+	bio.size = bh->b_size;
+
+	submit_bio(READ, &bio);
+
+	return bio.error;
+}
+
+struct buffer_head *bread(struct block_device *bdev, sector_t block, size_t size)
+{
+	struct list_head *bucket, *iter;
+	struct buffer_head *bh;
+
+	if (!g_bcache.init)
+		bcache_init();
+
+	bucket = bcache_bucket(bdev, block);
+
+	list_for_each(iter, bucket) {
+		bh = container_of(iter, struct buffer_head, b_hash);
+
+		if (bh->b_bdev == bdev && bh->b_blocknr == block && bh->b_size == size) {
+			bh->b_count++;
+			list_del(&bh->b_lru);
+			list_add_tail(&bh->b_lru, &g_bcache.lru);
+			g_bcache.stat.hits++;
+			return bh;
+		}
+	}
+
+	g_bcache.stat.misses++;
+
+	bh = zalloc(sizeof(*bh));
+	if (!bh)
+		return NULL;
+
+	bh->b_data = malloc(size);
+	if (!bh->b_data) {
+		free(bh);
+		return NULL;
+	}
+
+	bh->b_bdev    = bdev;
+	bh->b_blocknr = block;
+	bh->b_size    = size;
+	bh->b_count   = 1;
+
+	g_bcache.bytes += size;
+	g_bcache.buffers++;
+
+	if (bcache_fill(bh) < 0) {
+		bcache_free(bh);
+		return NULL;
+	}
+
+	list_add(&bh->b_hash, bucket);
+	list_add_tail(&bh->b_lru, &g_bcache.lru);
+
+	bcache_shrink();
+
+	return bh;
+}
+
+void brelse(struct buffer_head *bh)
+{
+	if (!bh)
+		return;
+
+	assert(bh->b_count > 0);
+
+	if (--bh->b_count)
+		return;
+
+	if (bh->b_stale)
+		bcache_free(bh);
+	else
+		bcache_shrink();
+}
+
+// the master drive of bdev, with *sect moved to its sector space
+static struct block_device *bcache_master(struct block_device *bdev, sector_t *sect)
+{
+	struct disk_drive *drive;
+
+	if (!(bdev->flags & BDF_PART))
+		return bdev;
+
+	drive = container_of(bdev, struct disk_drive, bdev);
+	*sect += (sector_t)(bdev->base >> 9);
+
+	return &drive->master->bdev;
+}
+
+void bcache_invalidate(struct block_device *bdev, sector_t sect, size_t count)
+{
+	struct list_head *iter, *next;
+	struct buffer_head *bh;
+	struct block_device *master;
+	sector_t start, end;
+
+	if (!g_bcache.init)
+		return;
+
+	bdev = bcache_master(bdev, &sect);
+
+	for (iter = g_bcache.lru.next; iter != &g_bcache.lru; iter = next) {
+		next = iter->next;
+		bh = container_of(iter, struct buffer_head, b_lru);
+
+		start  = bh->b_blocknr * (bh->b_size >> 9);
+		master = bcache_master(bh->b_bdev, &start);
+		end    = start + (bh->b_size >> 9);
+
+		if (master != bdev || end <= sect || start >= sect + count)
+			continue;
+
+		bcache_unhash(bh);
+
+		if (bh->b_count)
+			bh->b_stale = true;
+		else
+			bcache_free(bh);
+	}
+}
+
+int bcache_setup(size_t limit)
+{
+	if (!g_bcache.init)
+		bcache_init();
+
+	g_bcache.limit = limit;
+	bcache_shrink();
+
+	return 0;
+}
+
+void bcache_get_stat(struct bcache_stat *stat)
+{
+	if (!g_bcache.init)
+		bcache_init();
+
+	*stat = g_bcache.stat;
+	stat->buffers = g_bcache.buffers;
+	stat->bytes   = g_bcache.bytes;
+	stat->limit   = g_bcache.limit;
+}
+
+void bcache_clear_stat(void)
+{
+	memset(&g_bcache.stat, 0, sizeof(g_bcache.stat));
+}
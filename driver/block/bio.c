@@ -0,0 +1,347 @@
+#include <list.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <block.h>
+#include <assert.h>
+#include <malloc.h>
+#include <drive.h>
+#include <bcache.h>
+
+/*
+ * Request layer: bios are queued per drive, merged with an adjacent
+ * request of the same direction while the queue is plugged, and
+ * dispatched to the drive as one request each. Callers either wait
+ * with submit_bio() or get an end_io() callback.
+ */
+
+static int g_plug_depth;
+static LIST_HEAD(g_plug_list); // drives with queued requests
+
+struct bio *bio_alloc(/* reserved */)
+{
+	struct bio *bio;
+
+	bio = zalloc(sizeof(*bio));
+	if (bio)
+		INIT_LIST_HEAD(&bio->node);
+
+	return bio;
+}
+
+void bio_free(struct bio *bio)
+{
+	free(bio);
+}
+
+int bio_add_seg(struct bio *bio, void *base, size_t len)
+{
+	if (bio->vcnt == BIO_MAX_VECS)
+		return -ENOSPC;
+
+	if (len == 0 || len & 511)
+		return -EINVAL;
+
+	bio->vec[bio->vcnt].base = base;
+	bio->vec[bio->vcnt].len  = len;
+	bio->vcnt++;
+	bio->count += len >> 9;
+
+	return 0;
+}
+
+void req_iter_init(struct req_iter *it, struct request *req)
+{
+	it->head     = &req->bios;
+	it->bio_node = req->bios.next;
+	it->vec      = 0;
+	it->off      = 0;
+}
+
+void *req_iter_next(struct req_iter *it)
+{
+	struct bio *bio;
+	void *sect;
+
+	if (it->bio_node == it->head)
+		return NULL;
+
+	bio  = container_of(it->bio_node, struct bio, node);
+	sect = (__u8 *)bio->vec[it->vec].base + it->off;
+
+	it->off += 512;
+	if (it->off == bio->vec[it->vec].len) {
+		it->off = 0;
+		it->vec++;
+		if (it->vec == bio->vcnt) {
+			it->vec = 0;
+			it->bio_node = it->bio_node->next;
+		}
+	}
+
+	return sect;
+}
+
+// for drives without a request handler, one call per segment
+static int blk_default_request(struct disk_drive *drive, struct request *req)
+{
+	int i, ret;
+	sector_t sect = req->sect;
+	struct list_head *iter;
+	struct bio *bio;
+
+	list_for_each(iter, &req->bios) {
+		bio = container_of(iter, struct bio, node);
+
+		for (i = 0; i < bio->vcnt; i++) {
+			if (READ == req->rw)
+				ret = drive->get_blocks(drive, sect, bio->vec[i].len >> 9, bio->vec[i].base);
+			else
+				ret = drive->put_blocks(drive, sect, bio->vec[i].len >> 9, bio->vec[i].base);
+
+			if (ret < 0)
+				return ret;
+
+			sect += bio->vec[i].len >> 9;
+		}
+	}
+
+	return 0;
+}
+
+static void blk_end_request(struct request *req, int error)
+{
+	struct bio *bio;
+
+	while (!list_empty(&req->bios)) {
+		bio = container_of(req->bios.next, struct bio, node);
+		list_del_init(&bio->node);
+
+		bio->error = error;
+		if (error < 0)
+			bio->flags = 1; // fixme
+
+		if (bio->end_io)
+			bio->end_io(bio, error);
+	}
+
+	free(req);
+}
+
+static void blk_run_queue(struct disk_drive *drive)
+{
+	int ret;
+	struct request *req;
+
+	while (!list_empty(&drive->queue)) {
+		req = container_of(drive->queue.next, struct request, node);
+		list_del(&req->node);
+
+		if (drive->request)
+			ret = drive->request(drive, req);
+		else
+			ret = blk_default_request(drive, req);
+
+		blk_end_request(req, ret);
+	}
+}
+
+static void blk_unplug_all(void)
+{
+	struct disk_drive *drive;
+
+	while (!list_empty(&g_plug_list)) {
+		drive = container_of(g_plug_list.next, struct disk_drive, plug_node);
+		list_del(&drive->plug_node);
+		blk_run_queue(drive);
+	}
+}
+
+static inline bool blk_overlap(struct request *req, sector_t sect, size_t count)
+{
+	return sect < req->sect + req->count && req->sect < sect + count;
+}
+
+/*
+ * Merge into the newest adjacent request of the same direction. Going
+ * back from the tail, stop at any request touching the same sectors so
+ * that a merge never moves an access across a conflicting one.
+ */
+static bool blk_try_merge(struct disk_drive *drive, int rw, struct bio *bio)
+{
+	struct list_head *iter;
+	struct request *req;
+
+	for (iter = drive->queue.prev; iter != &drive->queue; iter = iter->prev) {
+		req = container_of(iter, struct request, node);
+
+		if (req->rw == rw) {
+			if (req->sect + req->count == bio->sect) {
+				list_add_tail(&bio->node, &req->bios);
+				req->count += bio->count;
+				return true;
+			}
+
+			if (bio->sect + bio->count == req->sect) {
+				list_add(&bio->node, &req->bios);
+				req->sect   = bio->sect;
+				req->count += bio->count;
+				return true;
+			}
+		}
+
+		if (blk_overlap(req, bio->sect, bio->count))
+			break;
+	}
+
+	return false;
+}
+
+void blk_queue_bio(int rw, struct bio *bio)
+{
+	struct block_device *bdev = bio->bdev;
+	struct disk_drive *drive;
+	struct request *req;
+
+	assert(bdev);
+
+	drive = container_of(bdev, struct disk_drive, bdev);
+
+	if (!bio->vcnt && bio->size)
+		bio_add_seg(bio, bio->data, bio->size);
+
+	if (WRITE == rw)
+		bcache_invalidate(bdev, bio->sect, bio->count);
+
+	if (!bio->count) {
+		bio->error = -EINVAL;
+		if (bio->end_io)
+			bio->end_io(bio, bio->error);
+		return;
+	}
+
+	if (!blk_try_merge(drive, rw, bio)) {
+		req = malloc(sizeof(*req));
+		if (!req) {
+			bio->error = -ENOMEM;
+			bio->flags = 1; // fixme
+			if (bio->end_io)
+				bio->end_io(bio, bio->error);
+			return;
+		}
+
+		req->rw    = rw;
+		req->sect  = bio->sect;
+		req->count = bio->count;
+		INIT_LIST_HEAD(&req->bios);
+		list_add_tail(&bio->node, &req->bios);
+
+		if (list_empty(&drive->queue))
+			list_add_tail(&drive->plug_node, &g_plug_list);
+		list_add_tail(&req->node, &drive->queue);
+	}
+
+	if (!g_plug_depth)
+		blk_unplug_all();
+}
+
+void blk_plug(void)
+{
+	g_plug_depth++;
+}
+
+void blk_unplug(void)
+{
+	assert(g_plug_depth > 0);
+
+	if (--g_plug_depth == 0)
+		blk_unplug_all();
+}
+
+void submit_bio(int rw, struct bio *bio)
+{
+	// whatever the plug state, the caller expects the data now
+	blk_queue_bio(rw, bio);
+	if (g_plug_depth)
+		blk_unplug_all();
+}
+
+static void blk_runs_end_io(struct bio *bio, int error)
+{
+	int *ret = bio->private;
+
+	if (error < 0)
+		*ret = error;
+
+	bio_free(bio);
+}
+
+/*
+ * Read size bytes, starting off bytes into blk[0], where blk[] lists
+ * the blocks (in blk_size units) of the range and 0 is a hole. Whole
+ * blocks are read straight into buff, one bio per physically contiguous
+ * run; partial blocks are copied out of the buffer cache.
+ */
+ssize_t blk_read_runs(struct block_device *bdev, void *buff, const __u32 blk[],
+			size_t blk_size, size_t off, size_t size)
+{
+	int ret = 0;
+	size_t i = 0, j, nr, len, count = 0;
+	struct buffer_head *bh;
+	struct bio *bio;
+
+	blk_plug();
+
+	while (count < size) {
+		len = min(size - count, blk_size - off);
+
+		if (!blk[i]) {
+			memset(buff + count, 0, len);
+			goto next;
+		}
+
+		// hosts move data by words, so unaligned destinations take the bounce path
+		if (len < blk_size || (unsigned long)(buff + count) & 3) {
+			bh = bread(bdev, blk[i], blk_size);
+			if (!bh) {
+				ret = -EIO;
+				break;
+			}
+
+			memcpy(buff + count, bh->b_data + off, len);
+			brelse(bh);
+			goto next;
+		}
+
+		nr = (size - count) / blk_size;
+		for (j = 1; j < nr && blk[i + j] == blk[i + j - 1] + 1; j++)
+			;
+
+		bio = bio_alloc();
+		if (!bio) {
+			ret = -ENOMEM;
+			break;
+		}
+
+		bio->bdev    = bdev;
+		bio->sect    = (sector_t)blk[i] * (blk_size >> 9);
+		bio->data    = buff + count;
+		bio->size    = j * blk_size;
+		bio->end_io  = blk_runs_end_io;
+		bio->private = &ret;
+
+		blk_queue_bio(READ, bio);
+
+		i += j;
+		count += j * blk_size;
+		continue;
+next:
+		i++;
+		count += len;
+		off = 0;
+	}
+
+	blk_unplug();
+
+	return ret < 0 ? ret : count;
+}
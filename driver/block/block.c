@@ -1,4 +1,5 @@
 #include <list.h>
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
 #include <block.h>
@@ -25,59 +26,44 @@ struct block_device *bdev_get(const char *name)
 	return NULL;
 }
 
+// printf() has no 64-bit conversion, so the high word goes first by hand
+static void bdev_print_addr(__u64 addr)
+{
+	if (addr >> 32)
+		printf("0x%x%08x", (__u32)(addr >> 32), (__u32)addr);
+	else
+		printf("0x%08x", (__u32)addr);
+}
+
 int block_device_register(struct block_device *bdev)
 {
 	list_add_tail(&bdev->bdev_node, &g_bdev_list);
 
-	printf("    0x%08x - 0x%08x %s (%s)\n",
-		bdev->base, bdev->base + bdev->size, bdev->name,
-		bdev->label[0] ? bdev->label : "N/A");
+	printf("    ");
+	bdev_print_addr(bdev->base);
+	printf(" - ");
+	bdev_print_addr(bdev->base + bdev->size);
+	printf(" %s (%s)\n", bdev->name, bdev->label[0] ? bdev->label : "N/A");
 
 	// device_enqueue(bdev);
 
 	return 0;
 }
 
-struct bio *bio_alloc(/* reserved */)
-{
-	struct bio *bio;
-
-	bio = zalloc(sizeof(*bio));
-
-	return bio;
-}
-
-void bio_free(struct bio *bio)
-{
-	free(bio);
-}
-
-void submit_bio(int rw, struct bio *bio)
+// hand the open over to the driver of the device behind the node
+int devfs_bdev_open(struct file *fp, struct inode *inode)
 {
-	int ret;
-	size_t len;
-	sector_t sect = bio->sect;
-	struct block_device *bdev = bio->bdev;
-	struct disk_drive *drive;
+	struct block_device *bdev = inode->i_private;
 
-	assert(bdev);
+	if (!bdev)
+		return -ENODEV;
 
-	drive = container_of(bdev, struct disk_drive, bdev);
+	fp->f_op = bdev->fops;
+	if (!fp->f_op)
+		return -ENOTSUPP;
 
-	for (len = 0; len < bio->size; len += 512) {
-		if (READ == rw)
-			ret = drive->get_block(drive, sect << 9, bio->data + len);
-		else
-			ret = drive->put_block(drive, sect << 9, bio->data + len);
+	if (fp->f_op->open)
+		return fp->f_op->open(fp, inode);
 
-		if (ret < 0)
-			bio->flags = 1; // fixme
-
-		sect++;
-	}
-}
-
-int devfs_bdev_open(struct file *fp, struct inode *inode)
-{
 	return 0;
 }
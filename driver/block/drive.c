@@ -6,6 +6,8 @@
 #include <drive.h>
 #include <malloc.h>
 #include <string.h>
+#include <fcntl.h>
+#include <fs.h>
 
 #define MBR_PART_TAB_OFF 0x1BE
 #define MSDOS_MAX_PARTS 16
@@ -67,6 +69,117 @@ static int drive_put_block(struct disk_drive *drive, int start, const void *buff
 	return master->put_block(master, drive->bdev.base + start, buff);
 }
 
+static int drive_request(struct disk_drive *drive, struct request *req)
+{
+	int ret;
+	sector_t base = (sector_t)(drive->bdev.base >> 9);
+	struct disk_drive *master = drive->master;
+
+	req->sect += base;
+	ret = master->request(master, req);
+	req->sect -= base;
+
+	return ret;
+}
+
+static int drive_get_blocks(struct disk_drive *drive, sector_t start, int count, void *buff)
+{
+	struct disk_drive *master = drive->master;
+
+	return master->get_blocks(master, (sector_t)(drive->bdev.base >> 9) + start, count, buff);
+}
+
+static int drive_put_blocks(struct disk_drive *drive, sector_t start, int count, const void *buff)
+{
+	struct disk_drive *master = drive->master;
+
+	return master->put_blocks(master, (sector_t)(drive->bdev.base >> 9) + start, count, buff);
+}
+
+// for drivers providing single-sector transfers only
+static int drive_get_blocks_loop(struct disk_drive *drive, sector_t start, int count, void *buff)
+{
+	int ret;
+
+	for (; count > 0; count--) {
+		ret = drive->get_block(drive, start << 9, buff);
+		if (ret < 0)
+			return ret;
+
+		buff = (__u8 *)buff + 512;
+		start++;
+	}
+
+	return 0;
+}
+
+static int drive_put_blocks_loop(struct disk_drive *drive, sector_t start, int count, const void *buff)
+{
+	int ret;
+
+	for (; count > 0; count--) {
+		ret = drive->put_block(drive, start << 9, buff);
+		if (ret < 0)
+			return ret;
+
+		buff = (const __u8 *)buff + 512;
+		start++;
+	}
+
+	return 0;
+}
+
+static int drive_open(struct file *fp, struct inode *inode)
+{
+	struct block_device *bdev = inode->i_private;
+
+	// read only for now
+	if (fp->flags == O_WRONLY || fp->flags == O_RDWR)
+		return -EACCES;
+
+	fp->private_data = container_of(bdev, struct disk_drive, bdev);
+
+	return 0;
+}
+
+static ssize_t drive_read(struct file *fp, void *buff, size_t size, loff_t *off)
+{
+	int ret;
+	size_t skip;
+	__u8 sect[512];
+	struct disk_drive *drive = fp->private_data;
+
+	if (*off >= drive->bdev.size)
+		return 0;
+
+	size = min(size, (size_t)(drive->bdev.size - *off));
+
+	// whole sectors straight into the caller's buffer, a partial one via bounce
+	skip = *off & 511;
+	if (skip || size < 512) {
+		ret = drive->get_blocks(drive, *off >> 9, 1, sect);
+		if (ret < 0)
+			return ret;
+
+		size = min(size, 512 - skip);
+		memcpy(buff, sect + skip, size);
+	} else {
+		size &= ~511;
+		ret = drive->get_blocks(drive, *off >> 9, size >> 9, buff);
+		if (ret < 0)
+			return ret;
+	}
+
+	*off += size;
+
+	return size;
+}
+
+static const struct file_operations drive_fops = {
+	.open = drive_open,
+	.read = drive_read,
+};
+
 int disk_drive_register(struct disk_drive *drive)
 {
 	int ret, i, n;
@@ -75,6 +188,13 @@ int disk_drive_register(struct disk_drive *drive)
 
 	printf("registering disk drive \"%s\":\n", drive->bdev.name);
 
+	if (!drive->get_blocks)
+		drive->get_blocks = drive_get_blocks_loop;
+	if (!drive->put_blocks)
+		drive->put_blocks = drive_put_blocks_loop;
+	INIT_LIST_HEAD(&drive->queue);
+	drive->bdev.fops = &drive_fops;
+
 	ret = block_device_register(&drive->bdev);
 	// if ret < 0 ...
 	INIT_LIST_HEAD(&drive->slave_list);
@@ -92,8 +212,10 @@ int disk_drive_register(struct disk_drive *drive)
 		snprintf(slave->bdev.name, LABEL_NAME_SIZE, "%sp%d", // fixme
 			drive->bdev.name, i + 1);
 
-		slave->bdev.base = part_tab[i].base;
-		slave->bdev.size = part_tab[i].size;
+		slave->bdev.base  = part_tab[i].base;
+		slave->bdev.size  = part_tab[i].size;
+		slave->bdev.flags = BDF_PART;
+		slave->bdev.fops  = &drive_fops;
 
 		slave->sect_size = drive->sect_size;
 		slave->master    = drive;
@@ -101,6 +223,11 @@ int disk_drive_register(struct disk_drive *drive)
 
 		slave->get_block = drive_get_block;
 		slave->put_block = drive_put_block;
+		slave->get_blocks = drive_get_blocks;
+		slave->put_blocks = drive_put_blocks;
+		INIT_LIST_HEAD(&slave->queue);
+		if (drive->request)
+			slave->request = drive_request;
 
 		ret = block_device_register(&slave->bdev);
 		// if ret < 0 ...
@@ -29,9 +29,9 @@ static int DataFlashWaitReady(struct mtd_info *);
 
 static int DataFlashErase(struct mtd_info *, struct erase_info *);
 
-static int DataFlashWrite(struct mtd_info *, __u32, __u32, __u32 *, const __u8 *);
+static int DataFlashWrite(struct mtd_info *, __u64, __u32, __u32 *, const __u8 *);
 
-static int DataFlashRead(struct mtd_info *, __u32, __u32, __u32 *, __u8 *);
+static int DataFlashRead(struct mtd_info *, __u64, __u32, __u32 *, __u8 *);
 
 static int DataFlashAdd(const char *, __u32, __u32, __u32);
 
@@ -223,7 +223,7 @@ static int DataFlashErase(struct mtd_info *mtd, struct erase_info *pErsOp)
 	return 0;
 }
 
-static int DataFlashWrite(struct mtd_info *mtd, __u32 to, __u32 len,
+static int DataFlashWrite(struct mtd_info *mtd, __u64 to, __u32 len,
 							   __u32 *retlen, const __u8 *buf)
 {
 	struct DataFlash *pDataFlash = container_of(flash, struct DataFlash, parent);
@@ -355,7 +355,7 @@ static int DataFlashWrite(struct mtd_info *mtd, __u32 to, __u32 len,
 	return status;
 }
 
-static int DataFlashRead(struct mtd_info *mtd, __u32 from, __u32 len,
+static int DataFlashRead(struct mtd_info *mtd, __u64 from, __u32 len,
 			__u32 *retlen, __u8 *buf)
 {
 	struct DataFlash *pDataFlash = container_of(flash, struct DataFlash, parent);
@@ -438,7 +438,7 @@ static int DataFlashRead(struct mtd_info *mtd, __u32 from, __u32 len,
 	return status;
 }
 
-static int DataFlashReadOOB(struct mtd_info *mtd, __u32 ulLen, struct mtd_oob_ops *pOps)
+static int DataFlashReadOOB(struct mtd_info *mtd, __u64 ulLen, struct mtd_oob_ops *pOps)
 {
 	flash = flash;
 	ulLen  = ulLen;
@@ -447,7 +447,7 @@ static int DataFlashReadOOB(struct mtd_info *mtd, __u32 ulLen, struct mtd_oob_op
 	return 0;
 }
 
-static int DataFlashWriteOOB(struct mtd_info *mtd, __u32 ulLen, struct mtd_oob_ops *pOps)
+static int DataFlashWriteOOB(struct mtd_info *mtd, __u64 ulLen, struct mtd_oob_ops *pOps)
 {
 	flash = flash;
 	ulLen  = ulLen;
@@ -456,7 +456,7 @@ static int DataFlashWriteOOB(struct mtd_info *mtd, __u32 ulLen, struct mtd_oob_o
 	return 0;
 }
 
-static int DataFlashIsBad(struct mtd_info *mtd, __u32 nAddr)
+static int DataFlashIsBad(struct mtd_info *mtd, __u64 nAddr)
 {
 	flash = flash;
 	nAddr  = nAddr;
@@ -464,7 +464,7 @@ static int DataFlashIsBad(struct mtd_info *mtd, __u32 nAddr)
 	return 0;
 }
 
-static int DataFlashMarkBad(struct mtd_info *mtd, __u32 nAddr)
+static int DataFlashMarkBad(struct mtd_info *mtd, __u64 nAddr)
 {
 	flash = flash;
 	nAddr  = nAddr;
@@ -521,7 +521,7 @@ static int DataFlashAdd(const char *pszName, __u32 nPages, __u32 page_size, __u3
 
 	DPRINT("pagesize=%d\nblocksize=%d\npageshift=%d\nblockshift=%d\nchipsize=%x\n",
 			  pDataFlash->page_size, pDataFlash->block_size,
-			  pDataFlash->nPageShift, pDataFlash->nBlockShift, flash->chip_size);
+			  pDataFlash->nPageShift, pDataFlash->nBlockShift, (__u32)flash->chip_size);
 
 	ulRet = flash_register(flash);
 	if (ulRet < 0) {
@@ -33,14 +33,51 @@ static int g_flash_count = 0;
  *
  */
 
+/*
+ * hr_str_to_val() is 32-bit, so a leading gigabyte count is taken apart
+ * here: "8g", "4g512m" and the like describe parts beyond 4 GiB.
+ */
+static int __init flash_str_to_size(const char *str, __u64 *size)
+{
+	int ret;
+	const char *p;
+	unsigned long val;
+	__u64 giga = 0;
+
+	for (p = str; *p >= '0' && *p <= '9'; p++)
+		giga = giga * 10 + *p - '0';
+
+	if (p > str && (*p == 'g' || *p == 'G')) {
+		giga <<= 30;
+		str = p + 1;
+	} else {
+		giga = 0;
+	}
+
+	if (*str == '\0') {
+		*size = giga;
+		return 0;
+	}
+
+	ret = hr_str_to_val(str, &val);
+	if (ret < 0)
+		return ret;
+
+	*size = giga + val;
+
+	return 0;
+}
+
 static int __init flash_parse_part(struct mtd_info *host,
 						struct part_attr *part,	const char *part_def)
 {
 	int i, ret = -EINVAL, index = 0;
-	__u32 curr_base = 0;
+	__u64 curr_base = 0, end;
 	char buff[128];
 	const char *p;
 
+	end = host->chip_size - (__u64)host->tail_blocks * host->erase_size;
+
 	p = strchr(part_def, ':');
 	if (!p)
 		goto error;
@@ -48,14 +85,16 @@ static int __init flash_parse_part(struct mtd_info *host,
 	p++;
 
 	while (*p && *p != ';') {
-		if (curr_base >= host->chip_size)
+		if (curr_base >= end) {
+			ret = -EINVAL;
 			goto error;
+		}
 
 		while (' ' == *p) p++;
 
 		// part size
 		if (*p == '-') {
-			part->size = host->chip_size - curr_base;
+			part->size = end - curr_base;
 			p++;
 		} else {
 			for (i = 0; *p; i++, p++) {
@@ -65,11 +104,12 @@ static int __init flash_parse_part(struct mtd_info *host,
 			}
 			buff[i] = '\0';
 
-			ret = hr_str_to_val(buff, (unsigned long *)&part->size);
+			ret = flash_str_to_size(buff, &part->size);
 			if (ret < 0)
 				goto error;
 
-			ALIGN_UP(part->size, host->erase_size);
+			// ALIGN_UP() would mask with a 32-bit ~(align - 1)
+			part->size = (part->size + host->erase_size - 1) & ~((__u64)host->erase_size - 1);
 		}
 
 		// part base
@@ -81,11 +121,11 @@ static int __init flash_parse_part(struct mtd_info *host,
 			}
 			buff[i] = '\0';
 
-			ret = hr_str_to_val(buff, (unsigned long *)&part->base);
+			ret = flash_str_to_size(buff, &part->base);
 			if (ret < 0)
 				goto error;
 
-			ALIGN_UP(part->base, host->erase_size);
+			part->base = (part->base + host->erase_size - 1) & ~((__u64)host->erase_size - 1);
 
 			curr_base = part->base;
 		} else {
@@ -116,6 +156,11 @@ static int __init flash_parse_part(struct mtd_info *host,
 
 		part->label[i] = '\0';
 
+		if (part->base + part->size > end) {
+			ret = -EINVAL;
+			goto error;
+		}
+
 		curr_base += part->size;
 
 		index++;
@@ -172,7 +217,7 @@ static int __init flash_scan_part(struct mtd_info *host,
 }
 
 static int part_read(struct mtd_info *slave,
-				__u32 from, __u32 len, size_t *retlen, __u8 *buff)
+				__u64 from, __u32 len, size_t *retlen, __u8 *buff)
 {
 	struct mtd_info *master = slave->master;
 
@@ -180,7 +225,7 @@ static int part_read(struct mtd_info *slave,
 }
 
 static int part_write(struct mtd_info *slave,
-				__u32 to, __u32 len, __u32 *retlen, const __u8 *buff)
+				__u64 to, __u32 len, __u32 *retlen, const __u8 *buff)
 {
 	struct mtd_info *master = slave->master;
 
@@ -196,7 +241,7 @@ static int part_erase(struct mtd_info *slave, struct erase_info *opt)
 }
 
 static int part_read_oob(struct mtd_info *slave,
-				__u32 from, struct mtd_oob_ops *ops)
+				__u64 from, struct mtd_oob_ops *ops)
 {
 	struct mtd_info *master = slave->master;
 
@@ -204,21 +249,21 @@ static int part_read_oob(struct mtd_info *slave,
 }
 
 static int part_write_oob(struct mtd_info *slave,
-				__u32 to,	struct mtd_oob_ops *opt)
+				__u64 to,	struct mtd_oob_ops *opt)
 {
 	struct mtd_info *master = slave->master;
 
 	return master->write_oob(master, slave->bdev.base + to, opt);
 }
 
-static int part_block_is_bad(struct mtd_info *slave, __u32 off)
+static int part_block_is_bad(struct mtd_info *slave, __u64 off)
 {
 	struct mtd_info *master = slave->master;
 
 	return master->block_isbad(master, slave->bdev.base + off);
 }
 
-static int part_block_mark_bad(struct mtd_info *slave, __u32 off)
+static int part_block_mark_bad(struct mtd_info *slave, __u64 off)
 {
 	struct mtd_info *master = slave->master;
 
@@ -270,6 +315,7 @@ int flash_register(struct mtd_info *mtd)
 			slave->chip_shift  = mtd->chip_shift;
 			slave->type        = mtd->type;
 			slave->oob_size    = mtd->oob_size;
+			slave->plane_num   = mtd->plane_num;
 			slave->oob_mode    = mtd->oob_mode;
 			slave->master      = mtd;
 
@@ -320,6 +366,120 @@ struct mtd_info *get_mtd_device(void *nil, unsigned int num)
 	return NULL;
 }
 
+static inline bool flash_is_part(struct mtd_info *mtd)
+{
+	return mtd->read == part_read;
+}
+
+// partitions share the device of their master, and so do its stats
+struct mtd_info *flash_get_master(struct mtd_info *mtd)
+{
+	return flash_is_part(mtd) ? mtd->master : mtd;
+}
+
+/*
+ * The map is built from the in-RAM BBT, which is only scanned after the
+ * partitions are registered, hence on first use rather than in
+ * flash_register().
+ */
+static int part_build_map(struct mtd_info *slave)
+{
+	__u32 i, n, blocks;
+	struct mtd_info *master = slave->master;
+
+	blocks = slave->bdev.size >> slave->erase_shift;
+
+	slave->blk_map = malloc(blocks * sizeof(*slave->blk_map));
+	if (!slave->blk_map)
+		return -ENOMEM;
+
+	for (i = n = 0; i < blocks; i++) {
+		if (master->block_isbad &&
+			master->block_isbad(master, slave->bdev.base + ((__u64)i << slave->erase_shift)))
+			continue;
+
+		slave->blk_map[n++] = i;
+	}
+
+	slave->blk_good = n;
+
+	if (n < blocks)
+		printf("%s: %d bad block(s) skipped\n", slave->bdev.name, blocks - n);
+
+	return 0;
+}
+
+/*
+ * Translate the logical partition offset @off, with bad blocks skipped,
+ * to a physical one. Returns how many of the @len bytes are physically
+ * contiguous from there.
+ */
+int flash_map_addr(struct mtd_info *mtd, __u64 off, __u32 len, __u64 *phys)
+{
+	int ret;
+	__u32 blk, end, next;
+	__u64 run;
+
+	if (!flash_is_part(mtd)) {
+		*phys = off;
+		return len;
+	}
+
+	if (!mtd->blk_map) {
+		ret = part_build_map(mtd);
+		if (ret < 0)
+			return ret;
+	}
+
+	blk = off >> mtd->erase_shift;
+	if (blk >= mtd->blk_good)
+		return -ENOSPC;
+
+	*phys = ((__u64)mtd->blk_map[blk] << mtd->erase_shift) | (off & (mtd->erase_size - 1));
+
+	end = (off + len - 1) >> mtd->erase_shift;
+	for (next = blk + 1; next <= end && next < mtd->blk_good; next++) {
+		if (mtd->blk_map[next] != mtd->blk_map[next - 1] + 1)
+			break;
+	}
+
+	run = ((__u64)next << mtd->erase_shift) - off;
+
+	return run < len ? run : len;
+}
+
+// drop a block that has just gone bad from the map of its partition
+void flash_bad_block_notify(struct mtd_info *master, __u64 off)
+{
+	__u32 i, blk;
+	struct mtd_info *slave;
+
+	// not registered yet, or registered without partitions
+	if (!master->slave_list.next)
+		return;
+
+	list_for_each_entry(slave, &master->slave_list, slave_node) {
+		if (off < slave->bdev.base || off >= slave->bdev.base + slave->bdev.size)
+			continue;
+
+		if (!slave->blk_map)
+			return;
+
+		blk = (off - slave->bdev.base) >> slave->erase_shift;
+
+		for (i = 0; i < slave->blk_good; i++) {
+			if (slave->blk_map[i] == blk) {
+				memmove(slave->blk_map + i, slave->blk_map + i + 1,
+					(slave->blk_good - i - 1) * sizeof(*slave->blk_map));
+				slave->blk_good--;
+				break;
+			}
+		}
+
+		return;
+	}
+}
+
 static int __init flash_init(void)
 {
 	return 0;
@@ -2,9 +2,81 @@
 #include <errno.h>
 #include <string.h>
 #include <malloc.h>
+#include <timer.h>
 #include <mtd/mtd.h>
 #include <mtd/nand.h>
 
+/*
+ * Each on-flash table copy carries this tail right after the bitmap, so
+ * a stale table, a table of another chip or a torn write is detected
+ * and the table is rebuilt from a scan instead.
+ */
+struct nand_bbt_tail {
+	__u8  magic[4];
+	__u8  vendor_id;
+	__u8  device_id;
+	__u8  bits;
+	__u8  version;
+	__u32 blocks;
+	__u32 crc; // over the bitmap and the tail up to here
+};
+
+static const __u8 g_bbt_tail_magic[4] = {'B', 'b', 't', 'C'};
+
+static __u32 bbt_crc32(__u32 crc, const __u8 *buf, __u32 len)
+{
+	int i;
+
+	crc = ~crc;
+
+	while (len--) {
+		crc ^= *buf++;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (crc & 1 ? 0xEDB88320 : 0);
+	}
+
+	return ~crc;
+}
+
+static void bbt_put_tail(struct nand_chip *nand, __u8 *bitmap, __u32 size,
+				int bits, int blocks, __u8 version)
+{
+	struct nand_bbt_tail tail;
+
+	memcpy(tail.magic, g_bbt_tail_magic, sizeof(tail.magic));
+	tail.vendor_id = nand->vendor_id;
+	tail.device_id = nand->device_id;
+	tail.bits      = bits;
+	tail.version   = version;
+	tail.blocks    = blocks;
+	tail.crc = bbt_crc32(bbt_crc32(0, bitmap, size), (__u8 *)&tail,
+			sizeof(tail) - sizeof(tail.crc));
+
+	memcpy(bitmap + size, &tail, sizeof(tail));
+}
+
+static int bbt_check_tail(struct nand_chip *nand, const __u8 *bitmap, __u32 size,
+				int bits, int blocks, __u8 version)
+{
+	struct nand_bbt_tail tail;
+
+	memcpy(&tail, bitmap + size, sizeof(tail));
+
+	if (memcmp(tail.magic, g_bbt_tail_magic, sizeof(tail.magic)))
+		return -ENOENT;
+
+	if (tail.crc != bbt_crc32(bbt_crc32(0, bitmap, size), (__u8 *)&tail,
+			sizeof(tail) - sizeof(tail.crc)))
+		return -EIO;
+
+	if (tail.vendor_id != (__u8)nand->vendor_id ||
+		tail.device_id != (__u8)nand->device_id ||
+		tail.bits != bits || tail.blocks != blocks || tail.version != version)
+		return -EINVAL;
+
+	return 0;
+}
+
 static int check_pattern(__u8 *buf, int len, int paglen, struct nand_bad_blk *td)
 {
 	int i, end = 0;
@@ -55,61 +127,63 @@ static int read_bbt(struct nand_chip *nand,
 				int num,
 				int bits,
 				int offs,
-				int reserved_block_code)
+				int reserved_block_code,
+				__u8 version)
 {
 	int ret, i, j, act = 0;
 	struct mtd_info *mtd = NAND_TO_FLASH(nand);
 	size_t retlen, len, totlen;
-	__u32 from;
+	__u64 from;
 	__u8 msk = (__u8) ((1 << bits) - 1);
 
 	totlen = (num * bits) >> 3;
-	from = ((__u32) page) << mtd->write_shift;
+	from = ((__u64) page) << mtd->write_shift;
 
-	while (totlen) {
-		len = min(totlen, (__u32) (1 << nand->bbt_erase_shift));
-		ret = mtd->read(mtd, from, len, &retlen, buf);
+	// the whole copy (bitmap + tail) in a single multi-page read
+	len = totlen + sizeof(struct nand_bbt_tail);
+	len = (len + mtd->write_size - 1) & ~(mtd->write_size - 1);
 
-		if (ret < 0) {
-			if (retlen != len) {
-				printf("%s(): Error reading bad block table\n", __func__);
-				return ret;
-			}
-			printf("%s(): ECC error while reading bad block table\n", __func__);
+	ret = mtd->read(mtd, from, len, &retlen, buf);
+	if (ret < 0) {
+		if (retlen != len) {
+			printf("%s(): Error reading bad block table\n", __func__);
+			return ret;
 		}
+		printf("%s(): ECC error while reading bad block table\n", __func__);
+	}
 
-		for (i = 0; i < len; i++) {
-			__u8 dat = buf[i];
-
-			for (j = 0; j < 8; j += bits, act += 2) {
-				__u8 tmp = (dat >> j) & msk;
-
-				if (tmp == msk)
-					continue;
-				if (reserved_block_code && (tmp == reserved_block_code)) {
-					printf("%s(): Reserved block at 0x%08x\n",
-						__func__,
-						((offs << 2) + (act >> 1)) << nand->bbt_erase_shift
-						);
-					nand->bbt[offs + (act >> 3)] |= 0x2 << (act & 0x06);
-					mtd->eccstat.bbtblocks++;
-					continue;
-				}
+	ret = bbt_check_tail(nand, buf, totlen, bits, num, version);
+	if (ret < 0) {
+		printf("%s(): invalid bad block table at page %d (%d)\n", __func__, page, ret);
+		return ret;
+	}
+
+	for (i = 0; i < totlen; i++) {
+		__u8 dat = buf[i];
 
-				printf("%s(): Bad block at 0x%08x\n", __func__,
-					((offs << 2) + (act >> 1)) << nand->bbt_erase_shift);
+		for (j = 0; j < 8; j += bits, act += 2) {
+			__u8 tmp = (dat >> j) & msk;
 
-				if (tmp == 0)
-					nand->bbt[offs + (act >> 3)] |= 0x3 << (act & 0x06);
-				else
-					nand->bbt[offs + (act >> 3)] |= 0x1 << (act & 0x06);
-				mtd->eccstat.badblocks++;
+			if (tmp == msk)
+				continue;
+			if (reserved_block_code && (tmp == reserved_block_code)) {
+				printf("%s(): Reserved block %d\n",
+					__func__, (offs << 2) + (act >> 1));
+				nand->bbt[offs + (act >> 3)] |= 0x2 << (act & 0x06);
+				mtd->eccstat.bbtblocks++;
+				continue;
 			}
-		}
 
-		totlen -= len;
-		from += len;
+			printf("%s(): Bad block %d\n", __func__, (offs << 2) + (act >> 1));
+
+			if (tmp == 0)
+				nand->bbt[offs + (act >> 3)] |= 0x3 << (act & 0x06);
+			else
+				nand->bbt[offs + (act >> 3)] |= 0x1 << (act & 0x06);
+			mtd->eccstat.badblocks++;
+		}
 	}
+
 	return 0;
 }
 
@@ -127,7 +201,7 @@ static int read_abs_bbt(struct nand_chip *nand, __u8 *buf, struct nand_bad_blk *
 
 		for (i = 0; i < nfc->slaves; i++) {
 			if (chip == -1 || chip == i)
-				ret = read_bbt(nand, buf, td->pages[i], mtd->chip_size >> nand->bbt_erase_shift, bits, offs, td->reserved_block_code);
+				ret = read_bbt(nand, buf, td->pages[i], mtd->chip_size >> nand->bbt_erase_shift, bits, offs, td->reserved_block_code, td->version[i]);
 
 			if (ret)
 				return ret;
@@ -135,7 +209,7 @@ static int read_abs_bbt(struct nand_chip *nand, __u8 *buf, struct nand_bad_blk *
 			offs += mtd->chip_size >> (nand->bbt_erase_shift + 2);
 		}
 	} else {
-		ret = read_bbt(nand, buf, td->pages[0], mtd->chip_size >> nand->bbt_erase_shift, bits, 0, td->reserved_block_code);
+		ret = read_bbt(nand, buf, td->pages[0], mtd->chip_size >> nand->bbt_erase_shift, bits, 0, td->reserved_block_code, td->version[0]);
 
 		if (ret)
 			return ret;
@@ -144,7 +218,7 @@ static int read_abs_bbt(struct nand_chip *nand, __u8 *buf, struct nand_bad_blk *
 }
 
 static int scan_read_raw(struct nand_chip *nand,
-					__u8 *buf, __u32 offs, __u32 len)
+					__u8 *buf, __u64 offs, __u32 len)
 {
 	struct mtd_oob_ops ops;
 	struct mtd_info *mtd = NAND_TO_FLASH(nand);
@@ -160,7 +234,7 @@ static int scan_read_raw(struct nand_chip *nand,
 }
 
 static int scan_write_bbt(struct nand_chip *nand,
-						__u32 offs,
+						__u64 offs,
 						__u32 len,
 						__u8 *buf,
 						__u8 *oob
@@ -190,7 +264,7 @@ static int read_abs_bbts(struct nand_chip *nand,
 	if (td->flags & NAND_BBT_VERSION) {
 		scan_read_raw(nand,
 				buf,
-				td->pages[0] << mtd->write_shift,
+				(__u64)td->pages[0] << mtd->write_shift,
 				mtd->write_size
 				);
 		td->version[0] = buf[mtd->write_size + td->veroffs];
@@ -199,7 +273,7 @@ static int read_abs_bbts(struct nand_chip *nand,
 
 	if (md && (md->flags & NAND_BBT_VERSION)) {
 		scan_read_raw(nand, buf,
-				md->pages[0] << mtd->write_shift,
+				(__u64)md->pages[0] << mtd->write_shift,
 				mtd->write_size);
 
 		md->version[0] = buf[mtd->write_size + md->veroffs];
@@ -211,7 +285,7 @@ static int read_abs_bbts(struct nand_chip *nand,
 
 static int scan_block_full(struct nand_chip *nand,
 						struct nand_bad_blk *bd,
-						__u32 offs,
+						__u64 offs,
 						__u8 *buf,
 						__u32 readlen,
 						int scanlen,
@@ -235,7 +309,7 @@ static int scan_block_full(struct nand_chip *nand,
 
 static int scan_block_fast(struct nand_chip *nand,
 						struct nand_bad_blk *bd,
-						__u32 offs,
+						__u64 offs,
 						__u8 *buf,
 						int len
 						)
@@ -276,7 +350,7 @@ static int create_bbt(struct nand_chip *nand,
 	struct nand_ctrl *nfc = nand->master;
 	int i, numblocks, len, scanlen;
 	int startblock;
-	__u32 from;
+	__u64 from;
 	__u32 readlen;
 
 	if (bd->flags & NAND_BBT_SCANALLPAGES)
@@ -313,7 +387,7 @@ static int create_bbt(struct nand_chip *nand,
 		numblocks = mtd->chip_size >> (nand->bbt_erase_shift - 1);
 		startblock = chip * numblocks;
 		numblocks += startblock;
-		from = startblock << (nand->bbt_erase_shift - 1);
+		from = (__u64)startblock << (nand->bbt_erase_shift - 1);
 	}
 
 	for (i = startblock; i < numblocks; ) {
@@ -330,7 +404,7 @@ static int create_bbt(struct nand_chip *nand,
 
 		if (ret) {
 			nand->bbt[i >> 3] |= 0x03 << (i & 0x6);
-			printf("Bad eraseblock %d at 0x%08x\n", i >> 1, from);
+			printf("Bad eraseblock %d\n", i >> 1);
 			mtd->eccstat.badblocks++;
 		}
 
@@ -377,7 +451,7 @@ static int search_bbt(struct nand_chip *nand, __u8 *buf, struct nand_bad_blk *td
 		for (block = 0; block < td->maxblocks; block++) {
 
 			int actblock = startblock + dir * block;
-			__u32 offs = actblock << nand->bbt_erase_shift;
+			__u64 offs = (__u64)actblock << nand->bbt_erase_shift;
 
 			scan_read_raw(nand, buf, offs, mtd->write_size);
 
@@ -432,7 +506,7 @@ static int write_bbt(struct nand_chip *nand,
 	__u8 msk[4];
 	__u8 rcode = td->reserved_block_code;
 	size_t retlen, len = 0;
-	__u32 to;
+	__u64 to;
 	struct mtd_oob_ops ops;
 
 	ops.ooblen = mtd->oob_size;
@@ -515,10 +589,10 @@ write:
 
 		bbtoffs = chip * (numblocks >> 2);
 
-		to = ((__u32) page) << mtd->write_shift;
+		to = ((__u64) page) << mtd->write_shift;
 
 		if (td->flags & NAND_BBT_SAVECONTENT) {
-			to &= ~((__u32) ((1 << nand->bbt_erase_shift) - 1));
+			to &= ~((__u64) ((1 << nand->bbt_erase_shift) - 1));
 			len = 1 << nand->bbt_erase_shift;
 			ret = mtd->read(mtd, to, len, &retlen, buf);
 			if (ret < 0) {
@@ -545,7 +619,7 @@ write:
 			memset(&buf[offs], 0xff, (__u32) (numblocks >> sft));
 			oob_off = len + (pageoffs * mtd->oob_size);
 		} else {
-			len = (__u32) (numblocks >> sft);
+			len = (__u32) (numblocks >> sft) + sizeof(struct nand_bbt_tail);
 
 			len = (len + (mtd->write_size - 1)) & ~(mtd->write_size - 1);
 
@@ -571,9 +645,11 @@ write:
 			}
 		}
 
+		bbt_put_tail(nand, &buf[offs], numblocks >> sft, bits, numblocks, td->version[chip]);
+
 		mtd->bad_allow = 1;
 		memset(&einfo, 0, sizeof(einfo));
-		einfo.addr = (__u32)to;
+		einfo.addr = to;
 		einfo.len  = 1 << nand->bbt_erase_shift;
 		ret = nand_erase(nand, &einfo);
 		if (ret < 0)
@@ -583,8 +659,8 @@ write:
 		if (ret < 0)
 			goto outerr;
 
-		printf("Bad block table written to 0x%08x, version "
-			"0x%02X\n", (unsigned int)to, td->version[chip]);
+		printf("Bad block table written to page %d, version "
+			"0x%02X\n", page, td->version[chip]);
 
 		td->pages[chip] = page;
 	}
@@ -682,8 +758,28 @@ static int check_create(struct nand_chip *nand, __u8 *buf, struct nand_bad_blk *
 			md->version[i] = 1;
 	writecheck:
 
-		if (rd)
-			read_abs_bbt(nand, buf, rd, chipsel);
+		if (rd && read_abs_bbt(nand, buf, rd, chipsel) < 0) {
+			struct nand_bad_blk *alt = rd == td ? md : td;
+
+			// fall back to the other copy, then to a full scan
+			if (alt && alt->pages[i] != -1 && read_abs_bbt(nand, buf, alt, chipsel) == 0) {
+				writeops |= rd == td ? 0x01 : 0x02;
+			} else {
+				printf("No valid bad block table for chip %d, scanning ...\n", i);
+
+				ret = create_bbt(nand, buf, bd, chipsel);
+				if (ret < 0)
+					return ret;
+
+				td->version[i]++;
+				if (md)
+					md->version[i] = td->version[i];
+
+				writeops = md ? 0x03 : 0x01;
+			}
+
+			rd2 = NULL;
+		}
 
 		if (rd2)
 			read_abs_bbt(nand, buf, rd2, chipsel);
@@ -730,7 +826,7 @@ static void mark_bbt_region(struct nand_chip *nand, struct nand_bad_blk *td)
 			newval = oldval | (0x2 << (block & 0x06));
 			nand->bbt[(block >> 3)] = newval;
 			if ((oldval != newval) && td->reserved_block_code)
-				nand_update_bbt(nand, block << (nand->bbt_erase_shift - 1));
+				nand_update_bbt(nand, (__u64)block << (nand->bbt_erase_shift - 1));
 			continue;
 		}
 		update = 0;
@@ -751,7 +847,7 @@ static void mark_bbt_region(struct nand_chip *nand, struct nand_bad_blk *td)
 		   new ones have been marked, then we need to update the stored
 		   bbts.  This should only happen once. */
 		if (update && td->reserved_block_code)
-			nand_update_bbt(nand, (block - 2) << (nand->bbt_erase_shift - 1));
+			nand_update_bbt(nand, (__u64)(block - 2) << (nand->bbt_erase_shift - 1));
 	}
 }
 
@@ -811,7 +907,7 @@ int nand_scan_bad_block(struct nand_chip *nand, struct nand_bad_blk *bd)
 	return ret;
 }
 
-int nand_update_bbt(struct nand_chip *nand, __u32 offs)
+int nand_update_bbt(struct nand_chip *nand, __u64 offs)
 {
 	struct mtd_info *mtd = NAND_TO_FLASH(nand);
 	int len, ret = 0, writeops = 0;
@@ -910,7 +1006,7 @@ static struct nand_bad_blk g_bbt_main_desc = {
 	.offs =	8,
 	.len = 4,
 	.veroffs = 12,
-	.maxblocks = 4,
+	.maxblocks = NAND_BBT_SCAN_MAXBLOCKS,
 	.pattern = g_bbt_main_patt
 };
 
@@ -920,11 +1016,35 @@ static struct nand_bad_blk g_bbt_mirror_desc = {
 	.offs =	8,
 	.len = 4,
 	.veroffs = 12,
-	.maxblocks = 4,
+	.maxblocks = NAND_BBT_SCAN_MAXBLOCKS,
 	.pattern = g_bbt_mirror_patt
 };
 
-int nand_scan_bbt(struct nand_chip *nand)
+// the table markers (pattern and version) must stay clear of the ECC bytes
+bool nand_bbt_oob_clash(struct nand_chip *nand)
+{
+	int i;
+	__u32 pos;
+	struct nand_bad_blk *td = nand->bbt_td ? nand->bbt_td : &g_bbt_main_desc;
+	struct nand_oob_layout *layout = nand->master->curr_oob_layout;
+
+	if (!layout)
+		return false;
+
+	for (i = 0; i < layout->ecc_code_len; i++) {
+		pos = layout->ecc_pos[i];
+
+		if (pos >= td->offs && pos < td->offs + td->len)
+			return true;
+
+		if ((td->flags & NAND_BBT_VERSION) && pos == td->veroffs)
+			return true;
+	}
+
+	return false;
+}
+
+static int __nand_scan_bbt(struct nand_chip *nand)
 {
 	struct mtd_info *mtd = NAND_TO_FLASH(nand);
 
@@ -962,7 +1082,19 @@ int nand_scan_bbt(struct nand_chip *nand)
 	return nand_scan_bad_block(nand, nand->bad_blk_patt);
 }
 
-int nand_is_bad_bbt(struct nand_chip *nand, __u32 offs)
+int nand_scan_bbt(struct nand_chip *nand)
+{
+	int ret;
+	__u32 start = get_tick();
+
+	ret = __nand_scan_bbt(nand);
+
+	printf("bad block table attached in %d ms\n", get_tick() - start);
+
+	return ret;
+}
+
+int nand_is_bad_bbt(struct nand_chip *nand, __u64 offs)
 {
 	struct mtd_info *mtd = NAND_TO_FLASH(nand);
 	int block;
@@ -971,8 +1103,8 @@ int nand_is_bad_bbt(struct nand_chip *nand, __u32 offs)
 	block = (int)(offs >> (nand->bbt_erase_shift - 1));
 	ret = (nand->bbt[block >> 3] >> (block & 0x06)) & 0x03;
 
-	DPRINT("%s(): bbt info for offs 0x%08x: (block %d) 0x%02x\n",
-		__func__, offs,	block >> 1, ret);
+	DPRINT("%s(): bbt info for block %d: 0x%02x\n",
+		__func__, block >> 1, ret);
 
 	switch (ret) {
 	case 0x00:
@@ -0,0 +1,471 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <malloc.h>
+#include <bitops.h>
+#include <mtd/nand.h>
+
+/*
+ * Binary BCH code over GF(2^13), shortened to NAND_BCH_DATA_LEN data
+ * bytes per step, correcting up to t bit errors with 13 * t parity bits.
+ *
+ * encode: byte-wise LFSR, one 256-entry remainder table lookup per byte
+ * decode: odd syndromes from the parity difference (S(2i) = S(i)^2),
+ *         Berlekamp-Massey for the error locator, closed form roots for
+ *         one and two errors (precomputed y^2 + y = c table) and a Chien
+ *         search otherwise
+ *
+ * The parity is stored inverted against the parity of an all-0xFF step,
+ * so an erased page reads back as a valid codeword.
+ */
+
+#define BCH_GF_M       13
+#define BCH_GF_N       ((1 << BCH_GF_M) - 1)
+#define BCH_GF_POLY    0x201B // x^13 + x^4 + x^3 + x + 1
+
+struct nand_bch {
+	int t;
+	int ecc_bits;
+	int ecc_bytes;
+	int ecc_words;
+
+	__u16 *a_pow;   // alpha^i, i in [0, n]
+	__u16 *a_log;   // log(x), x in [1, n]
+	__u16 *xi_tab;  // y such that y^2 + y = c
+	__u32 *mod_tab; // (b(x) * x^ecc_bits) mod g(x), b in [0, 255]
+	__u8  *ff_ecc;  // parity of an erased step
+
+	__u32 *reg;
+	__u32 syn[2 * NAND_BCH_MAX_T];
+	__u32 elp[2 * NAND_BCH_MAX_T + 1];
+	__u32 prv[2 * NAND_BCH_MAX_T + 1];
+	__u32 tmp[2 * NAND_BCH_MAX_T + 1];
+	__u32 chien[NAND_BCH_MAX_T + 1];
+	__u32 errloc[NAND_BCH_MAX_T];
+};
+
+static inline __u32 gf_mod(__u32 v)
+{
+	while (v >= BCH_GF_N)
+		v -= BCH_GF_N;
+
+	return v;
+}
+
+static inline __u32 gf_mul(const struct nand_bch *bch, __u32 a, __u32 b)
+{
+	if (!a || !b)
+		return 0;
+
+	return bch->a_pow[gf_mod(bch->a_log[a] + bch->a_log[b])];
+}
+
+static inline __u32 gf_div(const struct nand_bch *bch, __u32 a, __u32 b)
+{
+	if (!a)
+		return 0;
+
+	return bch->a_pow[gf_mod(bch->a_log[a] + BCH_GF_N - bch->a_log[b])];
+}
+
+static inline __u32 gf_sqr(const struct nand_bch *bch, __u32 a)
+{
+	return a ? bch->a_pow[gf_mod(2 * bch->a_log[a])] : 0;
+}
+
+// the remainder is kept left aligned: bit 31 of reg[0] is x^(ecc_bits - 1)
+static inline void bch_reg_shl(__u32 *reg, int words, int shift)
+{
+	int i;
+
+	for (i = 0; i < words - 1; i++)
+		reg[i] = (reg[i] << shift) | (reg[i + 1] >> (32 - shift));
+
+	reg[i] <<= shift;
+}
+
+static void bch_reg_to_bytes(const struct nand_bch *bch, const __u32 *reg, __u8 *ecc)
+{
+	int i;
+
+	for (i = 0; i < bch->ecc_bytes; i++)
+		ecc[i] = reg[i >> 2] >> (24 - 8 * (i & 3));
+}
+
+static int bch_build_gf(struct nand_bch *bch)
+{
+	__u32 i, x = 1;
+
+	for (i = 0; i < BCH_GF_N; i++) {
+		bch->a_pow[i] = x;
+		bch->a_log[x] = i;
+
+		x <<= 1;
+		if (x & (1 << BCH_GF_M))
+			x ^= BCH_GF_POLY;
+	}
+
+	if (x != 1)
+		return -EINVAL;
+
+	bch->a_pow[BCH_GF_N] = 1;
+	bch->a_log[0] = 0;
+
+	for (x = 0; x <= BCH_GF_N; x++)
+		bch->xi_tab[gf_sqr(bch, x) ^ x] = x;
+
+	return 0;
+}
+
+// g(x) = product of the minimal polynomials of alpha^1 .. alpha^(2t)
+static int bch_build_genpoly(struct nand_bch *bch, __u32 *gen)
+{
+	int i, j, deg = 0;
+	__u32 r, *g;
+	__u8 *roots;
+
+	g = malloc((BCH_GF_M * bch->t + 1) * sizeof(*g));
+	roots = zalloc(BCH_GF_N + 1);
+	if (!g || !roots) {
+		free(g);
+		free(roots);
+		return -ENOMEM;
+	}
+
+	for (i = 1; i < 2 * bch->t; i += 2) {
+		r = i;
+		do {
+			roots[r] = 1;
+			r = gf_mod(2 * r);
+		} while (r != i);
+	}
+
+	g[0] = 1;
+
+	for (r = 1; r < BCH_GF_N; r++) {
+		if (!roots[r])
+			continue;
+
+		g[deg + 1] = 1;
+		for (j = deg; j > 0; j--)
+			g[j] = g[j - 1] ^ gf_mul(bch, bch->a_pow[r], g[j]);
+		g[0] = gf_mul(bch, bch->a_pow[r], g[0]);
+		deg++;
+	}
+
+	bch->ecc_bits  = deg;
+	bch->ecc_bytes = (deg + 7) / 8;
+	bch->ecc_words = (deg + 31) / 32;
+
+	memset(gen, 0, bch->ecc_words * sizeof(*gen));
+
+	for (i = 0; i < deg; i++) {
+		if (g[deg - 1 - i])
+			gen[i >> 5] |= 1 << (31 - (i & 31));
+	}
+
+	free(roots);
+	free(g);
+
+	return 0;
+}
+
+static void bch_build_mod_tab(struct nand_bch *bch, const __u32 *gen)
+{
+	int b, i, k, fb;
+	__u32 *reg;
+
+	for (b = 0; b < 256; b++) {
+		reg = bch->mod_tab + b * bch->ecc_words;
+		memset(reg, 0, bch->ecc_words * sizeof(*reg));
+
+		for (i = 7; i >= 0; i--) {
+			fb = (reg[0] >> 31) ^ ((b >> i) & 1);
+			bch_reg_shl(reg, bch->ecc_words, 1);
+
+			if (fb) {
+				for (k = 0; k < bch->ecc_words; k++)
+					reg[k] ^= gen[k];
+			}
+		}
+	}
+}
+
+static void bch_encode_raw(struct nand_bch *bch, const __u8 *data, __u32 len, __u8 *ecc)
+{
+	int k, words = bch->ecc_words;
+	__u32 *reg = bch->reg;
+	const __u32 *p;
+
+	memset(reg, 0, words * sizeof(*reg));
+
+	while (len--) {
+		p = bch->mod_tab + ((reg[0] >> 24) ^ *data++) * words;
+		bch_reg_shl(reg, words, 8);
+
+		for (k = 0; k < words; k++)
+			reg[k] ^= p[k];
+	}
+
+	bch_reg_to_bytes(bch, reg, ecc);
+}
+
+void nand_bch_encode(struct nand_bch *bch, const __u8 *data, __u32 len, __u8 *ecc)
+{
+	int i;
+
+	bch_encode_raw(bch, data, len, ecc);
+
+	for (i = 0; i < bch->ecc_bytes; i++)
+		ecc[i] ^= bch->ff_ecc[i];
+}
+
+// syndromes of the received word = parity difference evaluated at alpha^i
+static int bch_syndromes(struct nand_bch *bch, const __u8 *read_ecc, const __u8 *calc_ecc)
+{
+	int i, j, k, pos, bit;
+	__u32 w, *syn = bch->syn;
+	bool zero = true;
+
+	memset(syn, 0, 2 * bch->t * sizeof(*syn));
+
+	for (k = 0; k < bch->ecc_words; k++) {
+		w = 0;
+		for (i = 0; i < 4 && 4 * k + i < bch->ecc_bytes; i++)
+			w |= (__u32)(read_ecc[4 * k + i] ^ calc_ecc[4 * k + i]) << (24 - 8 * i);
+
+		// ignore the pad bits of the last byte
+		if (k == bch->ecc_words - 1 && (bch->ecc_bits & 31))
+			w &= ~0U << (32 - (bch->ecc_bits & 31));
+
+		while (w) {
+			bit = ffs(w) - 1;
+			w &= w - 1;
+
+			// left aligned bit 31 - bit of word k
+			pos = bch->ecc_bits - 1 - (32 * k + 31 - bit);
+
+			for (j = 0; j < 2 * bch->t; j += 2)
+				syn[j] ^= bch->a_pow[((j + 1) * pos) % BCH_GF_N];
+
+			zero = false;
+		}
+	}
+
+	if (zero)
+		return 0;
+
+	for (j = 1; j < 2 * bch->t; j += 2)
+		syn[j] = gf_sqr(bch, syn[j / 2]);
+
+	return 1;
+}
+
+// error locator polynomial in elp[], returns its degree
+static int bch_berlekamp_massey(struct nand_bch *bch)
+{
+	int i, j, k = 1, deg = 0, t2 = 2 * bch->t;
+	__u32 d, b = 1, coef;
+	__u32 *elp = bch->elp, *prv = bch->prv, *tmp = bch->tmp;
+
+	memset(elp, 0, (t2 + 1) * sizeof(*elp));
+	memset(prv, 0, (t2 + 1) * sizeof(*prv));
+	elp[0] = prv[0] = 1;
+
+	for (i = 0; i < t2; i++) {
+		d = bch->syn[i];
+		for (j = 1; j <= deg; j++)
+			d ^= gf_mul(bch, elp[j], bch->syn[i - j]);
+
+		if (!d) {
+			k++;
+			continue;
+		}
+
+		coef = gf_div(bch, d, b);
+
+		if (2 * deg <= i) {
+			memcpy(tmp, elp, (t2 + 1) * sizeof(*tmp));
+
+			for (j = 0; j + k <= t2; j++)
+				elp[j + k] ^= gf_mul(bch, coef, prv[j]);
+
+			deg = i + 1 - deg;
+			memcpy(prv, tmp, (t2 + 1) * sizeof(*prv));
+			b = d;
+			k = 1;
+		} else {
+			for (j = 0; j + k <= t2; j++)
+				elp[j + k] ^= gf_mul(bch, coef, prv[j]);
+
+			k++;
+		}
+	}
+
+	if (deg > bch->t || !elp[deg])
+		return -EBADMSG;
+
+	return deg;
+}
+
+// error positions (codeword bit degrees) of locator elp[] into errloc[]
+static int bch_find_roots(struct nand_bch *bch, int deg, __u32 nbits)
+{
+	int i, count = 0;
+	__u32 j, sum, c, y;
+	__u32 *elp = bch->elp, *chien = bch->chien;
+
+	switch (deg) {
+	case 1:
+		bch->errloc[0] = bch->a_log[elp[1]];
+		return 1;
+
+	case 2:
+		// x^2 + e1 x + e2 = 0, x = e1 y: y^2 + y = e2 / e1^2
+		if (!elp[1])
+			return -EBADMSG;
+
+		c = gf_div(bch, elp[2], gf_sqr(bch, elp[1]));
+		y = bch->xi_tab[c];
+		if ((gf_sqr(bch, y) ^ y) != c)
+			return -EBADMSG;
+
+		bch->errloc[0] = bch->a_log[gf_mul(bch, elp[1], y)];
+		bch->errloc[1] = bch->a_log[gf_mul(bch, elp[1], y ^ 1)];
+		return 2;
+
+	default:
+		break;
+	}
+
+	// Chien search: elp(alpha^-j) == 0 <=> error at degree j
+	for (i = 1; i <= deg; i++)
+		chien[i] = elp[i] ? bch->a_log[elp[i]] : BCH_GF_N;
+
+	for (j = 0; j < nbits; j++) {
+		sum = 1;
+
+		for (i = 1; i <= deg; i++) {
+			if (chien[i] == BCH_GF_N)
+				continue;
+
+			sum ^= bch->a_pow[chien[i]];
+			chien[i] = gf_mod(chien[i] + BCH_GF_N - i);
+		}
+
+		if (!sum) {
+			bch->errloc[count++] = j;
+			if (count == deg)
+				break;
+		}
+	}
+
+	return count == deg ? count : -EBADMSG;
+}
+
+int nand_bch_decode(struct nand_bch *bch, __u8 *data, __u32 len,
+			const __u8 *read_ecc, const __u8 *calc_ecc)
+{
+	int i, deg;
+	__u32 pos, nbits = bch->ecc_bits + 8 * len;
+
+	if (!bch_syndromes(bch, read_ecc, calc_ecc))
+		return 0;
+
+	deg = bch_berlekamp_massey(bch);
+	if (deg <= 0)
+		return -EBADMSG;
+
+	if (bch_find_roots(bch, deg, nbits) != deg)
+		return -EBADMSG;
+
+	for (i = 0; i < deg; i++) {
+		if (bch->errloc[i] >= nbits)
+			return -EBADMSG;
+	}
+
+	for (i = 0; i < deg; i++) {
+		// flips inside the parity need no fixing
+		if (bch->errloc[i] < bch->ecc_bits)
+			continue;
+
+		pos = bch->errloc[i] - bch->ecc_bits;
+		data[len - 1 - pos / 8] ^= 1 << (pos & 7);
+	}
+
+	return deg;
+}
+
+int nand_bch_strength(const struct nand_bch *bch)
+{
+	return bch->t;
+}
+
+int nand_bch_code_len(const struct nand_bch *bch)
+{
+	return bch->ecc_bytes;
+}
+
+void nand_bch_free(struct nand_bch *bch)
+{
+	if (!bch)
+		return;
+
+	free(bch->a_pow);
+	free(bch->a_log);
+	free(bch->xi_tab);
+	free(bch->mod_tab);
+	free(bch->ff_ecc);
+	free(bch->reg);
+	free(bch);
+}
+
+struct nand_bch *nand_bch_new(int strength)
+{
+	int i;
+	__u8 *erased;
+	__u32 gen[NAND_BCH_MAX_T * BCH_GF_M / 32 + 1];
+	struct nand_bch *bch;
+
+	if (strength < 1 || strength > NAND_BCH_MAX_T)
+		return NULL;
+
+	bch = zalloc(sizeof(*bch));
+	if (!bch)
+		return NULL;
+
+	bch->t = strength;
+
+	bch->a_pow  = malloc((BCH_GF_N + 1) * sizeof(__u16));
+	bch->a_log  = malloc((BCH_GF_N + 1) * sizeof(__u16));
+	bch->xi_tab = zalloc((BCH_GF_N + 1) * sizeof(__u16));
+	if (!bch->a_pow || !bch->a_log || !bch->xi_tab)
+		goto L1;
+
+	if (bch_build_gf(bch) < 0 || bch_build_genpoly(bch, gen) < 0)
+		goto L1;
+
+	bch->mod_tab = malloc(256 * bch->ecc_words * sizeof(__u32));
+	bch->reg     = malloc(bch->ecc_words * sizeof(__u32));
+	bch->ff_ecc  = zalloc(bch->ecc_bytes);
+	erased       = malloc(NAND_BCH_DATA_LEN);
+	if (!bch->mod_tab || !bch->reg || !bch->ff_ecc || !erased) {
+		free(erased);
+		goto L1;
+	}
+
+	bch_build_mod_tab(bch, gen);
+
+	memset(erased, 0xFF, NAND_BCH_DATA_LEN);
+	bch_encode_raw(bch, erased, NAND_BCH_DATA_LEN, bch->ff_ecc);
+	for (i = 0; i < bch->ecc_bytes; i++)
+		bch->ff_ecc[i] ^= 0xFF;
+
+	free(erased);
+
+	return bch;
+
+L1:
+	nand_bch_free(bch);
+	return NULL;
+}
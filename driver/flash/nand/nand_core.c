@@ -43,7 +43,7 @@ static struct nand_oob_layout g_oob64_layout = {
 	.free_region = {{2, 38}}
 };
 
-static int  nand_do_write_oob(struct nand_chip *nand, __u32 to, struct mtd_oob_ops *opt);
+static int  nand_do_write_oob(struct nand_chip *nand, __u64 to, struct mtd_oob_ops *opt);
 
 static void nand_wait_ready(struct nand_chip *nand);
 
@@ -143,7 +143,7 @@ static int nand_verify_buff16(struct nand_ctrl *nfc, const __u8 *buff, int len)
 	return 0;
 }
 
-static int nand_blk_bad(struct nand_chip *nand, __u32 ofs, int getchip)
+static int nand_blk_bad(struct nand_chip *nand, __u64 ofs, int getchip)
 {
 	__u16 bad;
 	int page, res = 0;
@@ -178,7 +178,7 @@ static int nand_blk_bad(struct nand_chip *nand, __u32 ofs, int getchip)
 	return res;
 }
 
-static int nand_mark_blk_bad(struct nand_chip *nand, __u32 ofs)
+static int nand_mark_blk_bad(struct nand_chip *nand, __u64 ofs)
 {
 
 	__u8 buff[2] = { 0, 0 };
@@ -189,18 +189,18 @@ static int nand_mark_blk_bad(struct nand_chip *nand, __u32 ofs)
 	if (nand->bbt)
 		nand->bbt[block >> 2] |= 0x01 << ((block & 0x03) << 1);
 
+	// the marker is kept even with a flash BBT, so a rescan still finds it
+	ofs += mtd->oob_size;
+	nand->opt.len = nand->opt.ooblen = 2;
+	nand->opt.datbuf = NULL;
+	nand->opt.oobbuf = buff;
+	nand->opt.ooboffs = nand->bad_blk_oob_pos & ~0x01;
+
+	ret = nand_do_write_oob(nand, ofs, &nand->opt);
+	nand_release_chip(nand);
+
 	if (nand->flags & NAND_USE_FLASH_BBT)
-		ret = nand_update_bbt(nand, ofs);
-	else {
-		ofs += mtd->oob_size;
-		nand->opt.len = nand->opt.ooblen = 2;
-		nand->opt.datbuf = NULL;
-		nand->opt.oobbuf = buff;
-		nand->opt.ooboffs = nand->bad_blk_oob_pos & ~0x01;
-
-		ret = nand_do_write_oob(nand, ofs, &nand->opt);
-		nand_release_chip(nand);
-	}
+		ret = nand_update_bbt(nand, ofs - mtd->oob_size);
 
 	if (!ret)
 		mtd->eccstat.badblocks++;
@@ -220,7 +220,7 @@ static int nand_check_wp(struct nand_chip *nand)
 	return (status & NAND_STATUS_WP) ? 0 : 1;
 }
 
-static int nand_check_blk_bad(struct nand_chip *nand, __u32 ofs, int getchip)
+static int nand_check_blk_bad(struct nand_chip *nand, __u64 ofs, int getchip)
 {
 	struct nand_ctrl *nfc = nand->master;
 
@@ -367,6 +367,8 @@ static void nand_command_large(struct nand_chip *nand,
 
 	switch (command) {
 	case NAND_CMMD_CACHEDPROG:
+	case NAND_CMMD_MPLANE_PROG:
+	case NAND_CMMD_MPLANE_SEQIN:
 	case NAND_CMMD_PAGEPROG:
 	case NAND_CMMD_ERASE1:
 	case NAND_CMMD_ERASE2:
@@ -618,6 +620,72 @@ static int nand_read_page_hwecc(struct nand_chip *nand, __u8 *buff)
 	return 0;
 }
 
+static int nand_read_page_bch(struct nand_chip *nand, __u8 *buff)
+{
+	struct mtd_info *mtd = NAND_TO_FLASH(nand);
+	struct nand_ctrl *nfc = nand->master;
+	int i, stat;
+	__u8 *p;
+
+	int ecc_code_len = nand_bch_code_len(nfc->bch);
+
+	__u8 *ecc_calc = nand->buffers->ecccalc;
+	__u8 *ecc_code = nand->buffers->ecccode;
+	__u32 *ecc_pos = nfc->curr_oob_layout->ecc_pos;
+
+	nfc->read_page_raw(nand, buff);
+
+	for (i = 0; i < nfc->curr_oob_layout->ecc_code_len; i++)
+		ecc_code[i] = nand->oob_buf[ecc_pos[i]];
+
+	i = 0;
+	p = buff;
+
+	while (p < buff + mtd->write_size) {
+		nand_bch_encode(nfc->bch, p, NAND_BCH_DATA_LEN, ecc_calc + i);
+
+		stat = nand_bch_decode(nfc->bch, p, NAND_BCH_DATA_LEN, ecc_code + i, ecc_calc + i);
+
+		if (stat < 0)
+			mtd->eccstat.ecc_failed_count++;
+		else
+			mtd->eccstat.ecc_correct_count += stat;
+
+		i += ecc_code_len;
+		p += NAND_BCH_DATA_LEN;
+	}
+
+	return 0;
+}
+
+static void nand_write_page_bch(struct nand_chip *nand, const __u8 *buff)
+{
+	struct mtd_info *mtd = NAND_TO_FLASH(nand);
+	struct nand_ctrl *nfc = nand->master;
+	int i;
+	const __u8 *p;
+
+	int ecc_code_len = nand_bch_code_len(nfc->bch);
+
+	__u8 *ecc_code = nand->buffers->ecccalc;
+	__u32 *ecc_pos = nfc->curr_oob_layout->ecc_pos;
+
+	i = 0;
+	p = buff;
+
+	while (p < buff + mtd->write_size) {
+		nand_bch_encode(nfc->bch, p, NAND_BCH_DATA_LEN, ecc_code + i);
+
+		i += ecc_code_len;
+		p += NAND_BCH_DATA_LEN;
+	}
+
+	while (--i >= 0)
+		nand->oob_buf[ecc_pos[i]] = ecc_code[i];
+
+	nfc->write_page_raw(nand, buff);
+}
+
 static __u8 *nand_copy_oob(struct nand_chip *nand,
 				__u8 *oob_buf, struct mtd_oob_ops *opt, __u32 len)
 {
@@ -662,13 +730,42 @@ static __u8 *nand_copy_oob(struct nand_chip *nand,
 	return NULL;
 }
 
-static int nand_read_by_opt(struct nand_chip *nand, __u32 from, struct mtd_oob_ops *opt)
+/*
+ * Cache read: 31h moves page N into the cache register and starts
+ * loading page N + 1 while page N is clocked out, 3Fh ends the
+ * sequence with the last page. The sequence is restarted at each
+ * block boundary.
+ */
+static void nand_read_cache_cmd(struct nand_chip *nand, int page,
+	bool last, bool *streaming)
+{
+	struct nand_ctrl *nfc = nand->master;
+
+	if (!*streaming) {
+		nfc->command(nand, NAND_CMMD_READ0, 0x00, page);
+		if (last)
+			return;
+
+		nfc->command(nand, NAND_CMMD_READCACHESEQ, -1, -1);
+		*streaming = true;
+	} else if (!last) {
+		nfc->command(nand, NAND_CMMD_READCACHESEQ, -1, -1);
+	} else {
+		nfc->command(nand, NAND_CMMD_READCACHEEND, -1, -1);
+		*streaming = false;
+	}
+}
+
+static int nand_read_by_opt(struct nand_chip *nand, __u64 from, struct mtd_oob_ops *opt)
 {
 	int ret = 0;
 	__u32 readlen;
 	__u32 oobreadlen;
+	__u32 page_len;
 	__u8 *oob_buf, *buff;
 	int page, real_page;
+	int blk_page_mask;
+	bool cache_read, streaming = false;
 	struct mtd_info *mtd = NAND_TO_FLASH(nand);
 	struct nand_ctrl *nfc = nand->master;
 	struct ecc_stats stats;
@@ -687,9 +784,20 @@ static int nand_read_by_opt(struct nand_chip *nand, __u32 from, struct mtd_oob_o
 	readlen = 0;
 	oobreadlen = 0;
 
-	// TODO: support cache read
+	page_len = mtd->write_size;
+	if (FLASH_OOB_RAW == opt->mode)
+		page_len += mtd->oob_size;
+
+	cache_read = NAND_HAS_CACHEREAD(nand) && opt->len > page_len;
+	blk_page_mask = (1 << (mtd->erase_shift - mtd->write_shift)) - 1;
+
 	while (readlen < opt->len) {
-		nfc->command(nand, NAND_CMMD_READ0, 0x00, page);
+		if (cache_read)
+			nand_read_cache_cmd(nand, page,
+				readlen + page_len >= opt->len || !((page + 1) & blk_page_mask),
+				&streaming);
+		else
+			nfc->command(nand, NAND_CMMD_READ0, 0x00, page);
 
 		switch (opt->mode) {
 		case FLASH_OOB_RAW:
@@ -731,16 +839,22 @@ static int nand_read_by_opt(struct nand_chip *nand, __u32 from, struct mtd_oob_o
 		}
 
 		// here is the right place ?
-		if (!nfc->flash_ready)
-			udelay(nfc->chip_delay);
-		else
-			nand_wait_ready(nand);
+		if (!cache_read) {
+			if (!nfc->flash_ready)
+				udelay(nfc->chip_delay);
+			else
+				nand_wait_ready(nand);
+		}
 
 		real_page++;
 		page = real_page & nand->page_num_mask;
 	}
 
 L1:
+	// abort an unfinished cache read sequence
+	if (streaming)
+		nfc->command(nand, NAND_CMMD_RESET, -1, -1);
+
 	opt->retlen = readlen;
 
 	if (oob_buf)
@@ -756,7 +870,7 @@ L1:
 }
 
 static int nand_read(struct nand_chip *nand,
-				__u32 from, __u32 len, size_t *retlen, __u8 *buff)
+				__u64 from, __u32 len, size_t *retlen, __u8 *buff)
 {
 	int ret;
 	struct mtd_info *mtd = NAND_TO_FLASH(nand);
@@ -816,7 +930,7 @@ static int nand_write_oob_std(struct nand_chip *nand, int page)
 	return status & NAND_STATUS_FAIL ? -EIO : 0;
 }
 
-static int nand_do_read_oob(struct nand_chip *nand, __u32 from, struct mtd_oob_ops *opt)
+static int nand_do_read_oob(struct nand_chip *nand, __u64 from, struct mtd_oob_ops *opt)
 {
 	int page, real_page, chipnr, sndcmd = 1;
 	struct mtd_info *mtd = NAND_TO_FLASH(nand);
@@ -894,7 +1008,7 @@ static int nand_do_read_oob(struct nand_chip *nand, __u32 from, struct mtd_oob_o
 	return 0;
 }
 
-static int nand_read_oob(struct nand_chip *nand, __u32 from, struct mtd_oob_ops *opt)
+static int nand_read_oob(struct nand_chip *nand, __u64 from, struct mtd_oob_ops *opt)
 {
 
 	int ret = -ENOTSUPP;
@@ -986,19 +1100,139 @@ static inline bool check_aligned(__u32 align, __u32 val)
 	return (val & (align - 1)) == 0;
 }
 
-static int nand_write_by_opt(struct nand_chip *nand, long to, struct mtd_oob_ops *opt)
+// true if @buff is all 0xFF, i.e. what an erased page reads back
+static bool nand_buf_is_blank(const __u8 *buff, __u32 len)
+{
+	const __u32 *p;
+
+	for (; len && ((unsigned long)buff & 3); len--, buff++) {
+		if (*buff != 0xFF)
+			return false;
+	}
+
+	for (p = (const __u32 *)buff; len >= 4; len -= 4, p++) {
+		if (*p != 0xFFFFFFFF)
+			return false;
+	}
+
+	for (buff = (const __u8 *)p; len; len--, buff++) {
+		if (*buff != 0xFF)
+			return false;
+	}
+
+	return true;
+}
+
+// number of blocks (1 or 2) that can be handled at once from @page on
+static int nand_plane_count(struct nand_chip *nand, int page, __u64 len)
+{
+	struct mtd_info *mtd = NAND_TO_FLASH(nand);
+	int pages_per_blk = mtd->erase_size >> mtd->write_shift;
+
+	if (!NAND_HAS_2PLANE(nand) || len < 2 * mtd->erase_size)
+		return 1;
+
+	// a plane pair is an even block and its odd neighbour
+	if (page & (2 * pages_per_blk - 1))
+		return 1;
+
+	return 2;
+}
+
+static void nand_write_notify(struct mtd_info *mtd, int page)
+{
+	if (mtd->callback_func && mtd->callback_args) {
+		mtd->callback_args->page_index = page;
+		mtd->callback_args->block_index = \
+			page >> (mtd->erase_shift - mtd->write_shift);
+
+		mtd->callback_func(mtd, mtd->callback_args);
+	}
+}
+
+/*
+ * Program a plane pair (@page is the first page of the even block):
+ * page i of both blocks is loaded (80h ... 11h, 81h/80h ... 10h/15h) and
+ * programmed in one tPROG. The flash content is the same as that of
+ * a linear write of the two blocks.
+ */
+static int nand_write_plane_pair(struct nand_chip *nand, int page, __u8 *buff,
+	bool skip_blank)
+{
+	int i, status, pages_per_blk;
+	bool cached, streaming = false;
+	struct mtd_info *mtd = NAND_TO_FLASH(nand);
+	struct nand_ctrl *nfc = nand->master;
+
+	pages_per_blk = mtd->erase_size >> mtd->write_shift;
+
+	for (i = 0; i < pages_per_blk; i++) {
+		__u8 *even = buff + (i << mtd->write_shift);
+		__u8 *odd  = even + mtd->erase_size;
+
+		if (skip_blank && !streaming &&
+			nand_buf_is_blank(even, mtd->write_size) &&
+			nand_buf_is_blank(odd, mtd->write_size)) {
+			mtd->eccstat.skipped_pages += 2;
+			goto notify;
+		}
+
+		nfc->command(nand, NAND_CMMD_SEQIN, 0x00, page + i);
+		nfc->write_page(nand, even);
+		nfc->command(nand, NAND_CMMD_MPLANE_PROG, -1, -1);
+		nfc->wait_func(nand);
+
+		// close the cache sequence before a skipped pair
+		cached = NAND_HAS_CACHEPROG(nand) && i < pages_per_blk - 1 &&
+			!(skip_blank &&
+				nand_buf_is_blank(even + mtd->write_size, mtd->write_size) &&
+				nand_buf_is_blank(odd + mtd->write_size, mtd->write_size));
+
+		nfc->command(nand, nand->mplane_seqin, 0x00, page + pages_per_blk + i);
+		nfc->write_page(nand, odd);
+		nfc->command(nand, cached ? NAND_CMMD_CACHEDPROG : NAND_CMMD_PAGEPROG, -1, -1);
+
+		status = nfc->wait_func(nand);
+
+		// during cache program only the previous page status is valid
+		if (cached)
+			status &= NAND_STATUS_FAIL_N1;
+		else if (!streaming)
+			status &= NAND_STATUS_FAIL;
+
+		streaming = cached;
+
+		if (status & (NAND_STATUS_FAIL | NAND_STATUS_FAIL_N1)) {
+			DPRINT("%s(): error @ page 0x%x\n", __func__, page + i);
+			return -EIO;
+		}
+
+notify:
+		nand_write_notify(mtd, page + i);
+		nand_write_notify(mtd, page + pages_per_blk + i);
+	}
+
+	return 0;
+}
+
+static int nand_write_by_opt(struct nand_chip *nand, __u64 to, struct mtd_oob_ops *opt)
 {
 	int status;
 	int real_page, page;
 	__u32 write_len;
-	__u8 *buff, *oob_buf;
-	__u32 page_buff_offset;
+	__u8 *buff, *oob_buf, *oob;
+	__u32 oob_len;
+	bool cached, pairable, skip_blank, streaming = false;
 	struct mtd_info *mtd = NAND_TO_FLASH(nand);
 	struct nand_ctrl *nfc = nand->master;
 
 	buff = opt->datbuf;
 	oob_buf = opt->oobbuf;
 
+	// in-band data only: the oob of both planes would be interleaved
+	pairable = !oob_buf && opt->mode != FLASH_OOB_RAW;
+	skip_blank = nand->flags & NAND_SKIP_BLANK;
+
 	opt->retlen = 0;
 	if (!opt->len)
 		return 0;
@@ -1035,8 +1269,9 @@ static int nand_write_by_opt(struct nand_chip *nand, long to, struct mtd_oob_ops
 	page = real_page & nand->page_num_mask;
 	// blockmask = (1 << (nand->phy_erase_shift - mtd->write_shift)) - 1;
 
-	page_buff_offset = nand->page_in_buff << mtd->write_shift;
-	if (to <= page_buff_offset && page_buff_offset < to + opt->len)
+	// compared in pages, a byte offset may not fit 32 bits
+	if (real_page <= nand->page_in_buff &&
+		nand->page_in_buff < real_page + ((opt->len + mtd->write_size - 1) >> mtd->write_shift))
 		nand->page_in_buff = -1;
 
 	if (!oob_buf)
@@ -1047,49 +1282,93 @@ static int nand_write_by_opt(struct nand_chip *nand, long to, struct mtd_oob_ops
 	while (write_len < opt->len) {
 		__u8 *curr_buff = buff;
 
+		if (pairable && nand_plane_count(nand, page, opt->len - write_len) == 2) {
+			if (nand_write_plane_pair(nand, page, buff, skip_blank) < 0)
+				return -EIO;
+
+			buff += 2 * mtd->erase_size;
+			write_len += 2 * mtd->erase_size;
+			real_page += 2 << (mtd->erase_shift - mtd->write_shift);
+			page = real_page & nand->page_num_mask;
+
+			continue;
+		}
+
 		buff += mtd->write_size;
 		write_len += mtd->write_size;
 
-		nfc->command(nand, NAND_CMMD_SEQIN, 0x00, page);
+		oob = NULL;
+		oob_len = 0;
 
 		switch (opt->mode) {
 		case FLASH_OOB_RAW:
+			oob = buff;
 			buff = nand_fill_oob(nand, buff, opt);
+			oob_len = buff - oob;
 			write_len += mtd->oob_size; // or opt.oob_len;
-
-			nfc->write_page_raw(nand, curr_buff);
-
 			break;
 
 		case FLASH_OOB_PLACE:
 		case MTD_OPS_AUTO_OOB:
-			if (oob_buf)
+			if (oob_buf) {
+				oob = oob_buf;
 				oob_buf = nand_fill_oob(nand, oob_buf, opt);
-
-			nfc->write_page(nand, curr_buff);
-
+				oob_len = oob_buf - oob;
+			}
 			break;
 
 		default:
 			BUG();
 		}
 
-		nfc->command(nand, NAND_CMMD_PAGEPROG, -1, -1);
+		// an erased page stays as it is, no need to program 0xFF
+		if (skip_blank && !streaming &&
+			nand_buf_is_blank(curr_buff, mtd->write_size) &&
+			nand_buf_is_blank(oob, oob_len)) {
+			mtd->eccstat.skipped_pages++;
+			nand_write_notify(mtd, page);
+
+			real_page++;
+			page = real_page & nand->page_num_mask;
+
+			continue;
+		}
+
+		nfc->command(nand, NAND_CMMD_SEQIN, 0x00, page);
+
+		if (opt->mode == FLASH_OOB_RAW)
+			nfc->write_page_raw(nand, curr_buff);
+		else
+			nfc->write_page(nand, curr_buff);
+
+		/*
+		 * cache program (15h) returns as soon as the page register
+		 * is free, so the next page is loaded during tPROG. The
+		 * sequence is closed with 10h before a plane pair or a
+		 * skipped page.
+		 */
+		cached = NAND_HAS_CACHEPROG(nand) && write_len < opt->len &&
+			!(pairable && nand_plane_count(nand, (real_page + 1) & nand->page_num_mask,
+				opt->len - write_len) == 2) &&
+			!(skip_blank && nand_buf_is_blank(buff, mtd->write_size));
+
+		nfc->command(nand, cached ? NAND_CMMD_CACHEDPROG : NAND_CMMD_PAGEPROG, -1, -1);
 
 		status = nfc->wait_func(nand);
 
-		if (status & NAND_STATUS_FAIL) {
+		if (cached)
+			status &= NAND_STATUS_FAIL_N1;
+		else if (!streaming)
+			status &= NAND_STATUS_FAIL;
+
+		streaming = cached;
+
+		if (status & (NAND_STATUS_FAIL | NAND_STATUS_FAIL_N1)) {
 			DPRINT("%s(): error @ line %d\n", __func__, __LINE__);
 			return -EIO;
 		}
 
-		if (mtd->callback_func && mtd->callback_args) {
-			mtd->callback_args->page_index = page;
-			mtd->callback_args->block_index = \
-				page >> (mtd->erase_shift - mtd->write_shift);
-
-			mtd->callback_func(mtd, mtd->callback_args);
-		}
+		nand_write_notify(mtd, page);
 
 		real_page++;
 		page = real_page & nand->page_num_mask;
@@ -1104,7 +1383,7 @@ static int nand_write_by_opt(struct nand_chip *nand, long to, struct mtd_oob_ops
 }
 
 static int nand_write(struct nand_chip *nand,
-				__u32 to, __u32 len, __u32 *retlen, const __u8 *buff)
+				__u64 to, __u32 len, __u32 *retlen, const __u8 *buff)
 {
 	int ret;
 	struct mtd_info *mtd = NAND_TO_FLASH(nand);
@@ -1130,14 +1409,14 @@ static int nand_write(struct nand_chip *nand,
 	return ret;
 }
 
-static int nand_do_write_oob(struct nand_chip *nand, __u32 to, struct mtd_oob_ops *opt)
+static int nand_do_write_oob(struct nand_chip *nand, __u64 to, struct mtd_oob_ops *opt)
 {
 	int page, status, len;
 	struct mtd_info *mtd = NAND_TO_FLASH(nand);
 	struct nand_ctrl *nfc = nand->master;
 
-	DPRINT("%s(): to = 0x%08x, len = %i\n",
-		__func__, to, opt->ooblen);
+	DPRINT("%s(): page = 0x%08x, len = %i\n",
+		__func__, (__u32)(to >> mtd->write_shift), opt->ooblen);
 
 	if (opt->mode == MTD_OPS_AUTO_OOB)
 		len = nfc->curr_oob_layout->free_oob_sum;
@@ -1192,7 +1471,7 @@ static int nand_do_write_oob(struct nand_chip *nand, __u32 to, struct mtd_oob_op
 	return 0;
 }
 
-static int nand_write_oob(struct nand_chip *nand, __u32 to, struct mtd_oob_ops *opt)
+static int nand_write_oob(struct nand_chip *nand, __u64 to, struct mtd_oob_ops *opt)
 {
 	struct mtd_info *mtd = NAND_TO_FLASH(nand);
 	int ret;
@@ -1233,42 +1512,59 @@ static void erase_block_ex(struct nand_chip *nand, int page)
 	nfc->command(nand, NAND_CMMD_ERASE2, -1, -1);
 }
 
+// erase a plane pair (an even block and its odd neighbour) in one tBERS
+static void erase_plane_pair(struct nand_chip *nand, int page)
+{
+	struct mtd_info *mtd = NAND_TO_FLASH(nand);
+	struct nand_ctrl *nfc = nand->master;
+
+	nfc->command(nand, NAND_CMMD_ERASE1, -1, page);
+	if (nand->mplane_erase)
+		nfc->command(nand, nand->mplane_erase, -1, -1);
+	nfc->command(nand, NAND_CMMD_ERASE1, -1, page + (mtd->erase_size >> mtd->write_shift));
+	nfc->command(nand, NAND_CMMD_ERASE2, -1, -1);
+}
+
 // fixme: static
 int nand_erase(struct nand_chip *nand, struct erase_info *opt)
 {
-	int page_index, erase_count;
+	int i, planes, page_index;
 	int status, nPagesPerBlock, ret, chipnr = nand->bus_idx; // fixme!
+	__u64 erase_count;
 	struct mtd_info *mtd = NAND_TO_FLASH(nand);
 	struct nand_ctrl *nfc = nand->master;
 
-	int rewrite_bbt[NAND_MAX_CHIPS]={0};
+	__u64 rewrite_bbt[NAND_MAX_CHIPS] = {0};
 	unsigned int bbt_masked_page = 0xffffffff;
 
-	DPRINT("%s(): start = 0x%08x, size = 0x%08x\n",
-			__func__, opt->addr, opt->len);
+	// printf() takes 32-bit words only, so blocks are reported, not bytes
+	DPRINT("%s(): start block = %d, blocks = %d\n", __func__,
+		(__u32)(opt->addr >> mtd->erase_shift), (__u32)(opt->len >> mtd->erase_shift));
 
 	// fixme
 	if (opt->addr & (mtd->erase_size - 1)) {
-		printf("%s(): erase start not aligned! (0x%08x)\n", __func__, opt->addr);
+		printf("%s(): erase start not aligned! (0x%08x)\n", __func__, (__u32)opt->addr);
 		return -EINVAL;
 	}
 
 	if (opt->len & (mtd->erase_size - 1)) {
-		printf("%s(): erase size not aligned! (0x%08x)\n", __func__, opt->len);
+		printf("%s(): erase size not aligned! (0x%08x)\n", __func__, (__u32)opt->len);
 		return -EINVAL;
 	}
 
-	if ((opt->len + opt->addr) > mtd->chip_size) {
-		printf("%s(): Data range beyond chip size! (0x%08x > 0x%08x)\n",
+	// both sides are 64-bit, so an 8 Gbit+ range no longer wraps
+	if (opt->addr > mtd->chip_size || opt->len > mtd->chip_size - opt->addr) {
+		printf("%s(): Data range beyond chip size! (block %d + %d > %d)\n",
 			__func__,
-			opt->len + opt->addr,
-			mtd->chip_size
+			(__u32)(opt->addr >> mtd->erase_shift),
+			(__u32)(opt->len >> mtd->erase_shift),
+			(__u32)(mtd->chip_size >> mtd->erase_shift)
 			);
 
 		return -EINVAL;
 	}
 
-	opt->fail_addr = 0xffffffff;
+	opt->fail_addr = FLASH_FAIL_ADDR_UNKNOWN;
 
 	page_index     = opt->addr >> mtd->write_shift;
 	nPagesPerBlock = mtd->erase_size >> mtd->write_shift;
@@ -1290,69 +1586,82 @@ int nand_erase(struct nand_chip *nand, struct erase_info *opt)
 
 	while (erase_count) {
 		if (!(opt->flags & EDF_ALLOWBB)) {	// fixme!
-			if (nand_check_blk_bad(nand, page_index << mtd->write_shift, false)) {
-				printf("\n%s(): try to erase a bad block at 0x%08x!\n",
-					__func__, page_index << mtd->write_shift);
+			if (nand_check_blk_bad(nand, (__u64)page_index << mtd->write_shift, false)) {
+				printf("\n%s(): try to erase a bad block at page 0x%08x!\n",
+					__func__, page_index);
 
 				opt->state = FLASH_ERASE_FAILED;
 				goto erase_exit;
 			}
 		}
 
-		if (page_index <= nand->page_in_buff && nand->page_in_buff < page_index + nPagesPerBlock)
+		planes = nand_plane_count(nand, page_index & nand->page_num_mask, erase_count);
+
+		// the odd block is checked on its own in the next round
+		if (planes == 2 && !(opt->flags & EDF_ALLOWBB) &&
+			nand_check_blk_bad(nand, (__u64)(page_index + nPagesPerBlock) << mtd->write_shift, false))
+			planes = 1;
+
+		if (page_index <= nand->page_in_buff &&
+			nand->page_in_buff < page_index + planes * nPagesPerBlock)
 			nand->page_in_buff = -1;
 
-		nfc->erase_block(nand, page_index & nand->page_num_mask);
+		if (planes == 2)
+			erase_plane_pair(nand, page_index & nand->page_num_mask);
+		else
+			nfc->erase_block(nand, page_index & nand->page_num_mask);
 
 		status = nfc->wait_func(nand);
 
 		if (status & NAND_STATUS_FAIL) {
 			opt->state = FLASH_ERASE_FAILED;
-			opt->fail_addr = page_index << mtd->write_shift;
+			opt->fail_addr = (__u64)page_index << mtd->write_shift;
 
 			printf("\n%s(): Failed @ page 0x%08x\n", __func__, page_index);
 			// fixme!!
 			goto erase_exit;
 		}
 
-		if (bbt_masked_page != 0xffffffff && (page_index & BBT_PAGE_MASK) == bbt_masked_page)
-			rewrite_bbt[chipnr] = page_index << mtd->write_shift;
+		for (i = 0; i < planes; i++) {
+			if (bbt_masked_page != 0xffffffff && (page_index & BBT_PAGE_MASK) == bbt_masked_page)
+				rewrite_bbt[chipnr] = (__u64)page_index << mtd->write_shift;
 
-		if (opt->flags & EDF_JFFS2) {
-			// fixme
-			static struct jffs2_clean_mark cleanmark = {
-				0x1985,
-				0x2003
-			};
+			if (opt->flags & EDF_JFFS2) {
+				// fixme
+				static struct jffs2_clean_mark cleanmark = {
+					0x1985,
+					0x2003
+				};
 
-			switch (mtd->oob_size) {
-			case 16:
-				cleanmark.total_len = 8;
-				break;
+				switch (mtd->oob_size) {
+				case 16:
+					cleanmark.total_len = 8;
+					break;
 
-			default: // 64?
-				GEN_DBG("oob_size (%d) not supported now!\n", mtd->oob_size);
-				break;
-			};
+				default: // 64?
+					GEN_DBG("oob_size (%d) not supported now!\n", mtd->oob_size);
+					break;
+				};
 
-			nfc->command(nand, NAND_CMMD_SEQIN, nand->parent.write_size + 8, page_index);
+				nfc->command(nand, NAND_CMMD_SEQIN, nand->parent.write_size + 8, page_index);
 
-			nfc->write_buff(nfc, (__u8 *)&cleanmark, 8); // cleanmark.total_len
+				nfc->write_buff(nfc, (__u8 *)&cleanmark, 8); // cleanmark.total_len
 
-			nfc->command(nand, NAND_CMMD_PAGEPROG, -1, -1);
+				nfc->command(nand, NAND_CMMD_PAGEPROG, -1, -1);
 
-			nfc->wait_func(nand);
-		}
+				nfc->wait_func(nand);
+			}
 
-		if (mtd->callback_func && mtd->callback_args) {
-			mtd->callback_args->page_index  = page_index;
-			mtd->callback_args->block_index = page_index >> (mtd->erase_shift - mtd->write_shift);
+			if (mtd->callback_func && mtd->callback_args) {
+				mtd->callback_args->page_index  = page_index;
+				mtd->callback_args->block_index = page_index >> (mtd->erase_shift - mtd->write_shift);
 
-			mtd->callback_func(mtd, mtd->callback_args);
-		}
+				mtd->callback_func(mtd, mtd->callback_args);
+			}
 
-		erase_count -= mtd->erase_size;
-		page_index	+= nPagesPerBlock;
+			erase_count -= mtd->erase_size;
+			page_index	+= nPagesPerBlock;
+		}
 	}
 
 	opt->state = FLASH_ERASE_DONE;
@@ -1370,7 +1679,8 @@ erase_exit:
 			continue;
 
 		DPRINT("%s(): Updating bad block table (%d:0x%0x 0x%0x) ... \n",
-			__func__, chipnr, rewrite_bbt[chipnr], nand->bbt_td->pages[chipnr]);
+			__func__, chipnr, (__u32)(rewrite_bbt[chipnr] >> mtd->write_shift),
+			nand->bbt_td->pages[chipnr]);
 
 		nand_update_bbt(nand, rewrite_bbt[chipnr]);
 	}
@@ -1378,7 +1688,7 @@ erase_exit:
 	return ret;
 }
 
-static int nand_blk_is_bad(struct nand_chip *nand, __u32 offs)
+static int nand_blk_is_bad(struct nand_chip *nand, __u64 offs)
 {
 	struct mtd_info *mtd = NAND_TO_FLASH(nand);
 
@@ -1388,7 +1698,7 @@ static int nand_blk_is_bad(struct nand_chip *nand, __u32 offs)
 	return nand_check_blk_bad(nand, offs, 1);
 }
 
-static int nand_block_mark_bad(struct nand_chip *nand, __u32 ofs)
+static int nand_block_mark_bad(struct nand_chip *nand, __u64 ofs)
 {
 	int ret;
 	struct nand_ctrl *nfc = nand->master;
@@ -1458,6 +1768,97 @@ struct nand_ctrl *nand_ctrl_new(void)
 	return nfc;
 }
 
+__u16 nand_onfi_crc16(const __u8 *p, int len)
+{
+	int i;
+	__u16 crc = 0x4F4E;
+
+	while (len--) {
+		crc ^= *p++ << 8;
+		for (i = 0; i < 8; i++)
+			crc = (crc << 1) ^ (crc & 0x8000 ? 0x8005 : 0);
+	}
+
+	return crc;
+}
+
+// check the ONFI parameter page for read cache and two-plane support
+static bool nand_onfi_probe(struct nand_chip *nand)
+{
+	int i;
+	__u8 param[ONFI_PARAM_LEN];
+	struct nand_ctrl *nfc = nand->master;
+
+	nfc->command(nand, NAND_CMMD_READID, 0x20, -1);
+
+	if (nfc->read_byte(nfc) != 'O' || nfc->read_byte(nfc) != 'N' ||
+		nfc->read_byte(nfc) != 'F' || nfc->read_byte(nfc) != 'I')
+		return false;
+
+	nfc->command(nand, NAND_CMMD_PARAM, 0x00, -1);
+	if (!nfc->flash_ready)
+		udelay(100); // tR of the parameter page
+	else
+		nand_wait_ready(nand);
+
+	// 3 redundant copies
+	for (i = 0; i < 3; i++) {
+		nfc->read_buff(nfc, param, sizeof(param));
+
+		if (nand_onfi_crc16(param, 254) != (param[254] | param[255] << 8))
+			continue;
+
+		if (param[8] & ONFI_OPT_CACHE_READ)
+			nand->flags |= NAND_CACHERD;
+
+		// the parameter page overrides the ID bytes
+		nand->flags &= ~NAND_2PLANE;
+
+		// one interleaved address bit, i.e. an even block and its odd neighbour
+		if ((param[6] & ONFI_FEATURE_MPLANE) && (param[113] & 0xF) == 1) {
+			nand->flags |= NAND_2PLANE;
+			nand->mplane_seqin = NAND_CMMD_SEQIN;
+			nand->mplane_erase = NAND_CMMD_MPLANE_ERASE;
+		}
+
+		return true;
+	}
+
+	DPRINT("%s(): bad ONFI parameter page CRC!\n", __func__);
+
+	return false;
+}
+
+/*
+ * Without ONFI, the plane count is in bits 2-3 of the 5th ID byte. The
+ * command sequence is vendor specific, so only the known ones are used.
+ */
+static void nand_id_planes(struct nand_chip *nand, __u8 id5)
+{
+	if (((id5 >> 2) & 0x3) != 1)
+		return;
+
+	switch (nand->vendor_id) {
+	case NAND_MFR_SAMSUNG:
+	case NAND_MFR_HYNIX:
+		// 80h ... 11h 81h ... 10h, 60h 60h D0h
+		nand->mplane_seqin = NAND_CMMD_MPLANE_SEQIN;
+		nand->mplane_erase = 0;
+		break;
+
+	case NAND_MFR_MICRON:
+		// 80h ... 11h 80h ... 10h, 60h D1h 60h D0h
+		nand->mplane_seqin = NAND_CMMD_SEQIN;
+		nand->mplane_erase = NAND_CMMD_MPLANE_ERASE;
+		break;
+
+	default:
+		return;
+	}
+
+	nand->flags |= NAND_2PLANE;
+}
+
 static int probe_nand_chip(struct nand_chip *nand)
 {
 // #define BUFF_IDR
@@ -1486,7 +1887,7 @@ static int probe_nand_chip(struct nand_chip *nand)
 
 	for (i = 0; g_nand_chip_desc[i].name != NULL; i++) {
 		if (nand->device_id == g_nand_chip_desc[i].id) {
-			mtd->chip_size = g_nand_chip_desc[i].chip_size << 20;
+			mtd->chip_size = (__u64)g_nand_chip_desc[i].chip_size << 20;
 			nand->flags = g_nand_chip_desc[i].flags;
 			nand->name = g_nand_chip_desc[i].name;
 
@@ -1496,13 +1897,14 @@ static int probe_nand_chip(struct nand_chip *nand)
 				mtd->write_size = g_nand_chip_desc[i].write_size;
 				mtd->oob_size   = mtd->write_size / 32;
 			} else {
-				__u8 ext_id[2];
+				__u8 ext_id[3];
 
 #ifdef BUFF_IDR
-				nfc->read_buff(nfc, ext_id, 2);
+				nfc->read_buff(nfc, ext_id, 3);
 #else
 				ext_id[0] = nfc->read_byte(nfc);
 				ext_id[1] = nfc->read_byte(nfc);
+				ext_id[2] = nfc->read_byte(nfc);
 #endif
 
 				DPRINT("%s(): Extend ID of nand[%d] is 0x%02x (\"%s\")\n",
@@ -1521,9 +1923,9 @@ static int probe_nand_chip(struct nand_chip *nand)
 					nand->flags |= NAND_BUSWIDTH_16;
 				else
 					nand->flags &= ~NAND_BUSWIDTH_16;
-			}
 
-			nfc->select_chip(nand, false);
+				nand_id_planes(nand, ext_id[2]);
+			}
 
 			nand->flags |= NAND_NO_AUTOINCR;  // fix various modes
 
@@ -1534,6 +1936,14 @@ static int probe_nand_chip(struct nand_chip *nand)
 				nfc->verify_buff = nand_verify_buff16;
 			}
 
+			nand->flags |= NAND_SKIP_BLANK;
+
+			// cache read is only defined for large page chips
+			if (mtd->write_size > 512 && !(nand->flags & NAND_BUSWIDTH_16))
+				nand_onfi_probe(nand);
+
+			nfc->select_chip(nand, false);
+
 			return 0;
 		}
 	}
@@ -1544,7 +1954,7 @@ static int probe_nand_chip(struct nand_chip *nand)
 }
 
 static int flash2nand_read(struct mtd_info *mtd,
-				__u32 from, __u32 len, size_t *retlen, __u8 *buff)
+				__u64 from, __u32 len, size_t *retlen, __u8 *buff)
 {
 	struct nand_chip *nand = FLASH_TO_NAND(mtd);
 
@@ -1552,7 +1962,7 @@ static int flash2nand_read(struct mtd_info *mtd,
 }
 
 static int flash2nand_write(struct mtd_info *mtd,
-				__u32 to, __u32 len, __u32 *retlen, const __u8 *buff)
+				__u64 to, __u32 len, __u32 *retlen, const __u8 *buff)
 {
 	struct nand_chip *nand = FLASH_TO_NAND(mtd);
 
@@ -1567,7 +1977,7 @@ static int flash2nand_erase(struct mtd_info *mtd, struct erase_info *instr)
 }
 
 static int flash2nand_read_oob(struct mtd_info *mtd,
-				__u32 from, struct mtd_oob_ops *opt)
+				__u64 from, struct mtd_oob_ops *opt)
 {
 	struct nand_chip *nand = FLASH_TO_NAND(mtd);
 
@@ -1575,25 +1985,30 @@ static int flash2nand_read_oob(struct mtd_info *mtd,
 }
 
 static int flash2nand_write_oob(struct mtd_info *mtd,
-				__u32 to,	struct mtd_oob_ops *opt)
+				__u64 to,	struct mtd_oob_ops *opt)
 {
 	struct nand_chip *nand = FLASH_TO_NAND(mtd);
 
 	return nand_write_oob(nand, to, opt);
 }
 
-static int flash2nand_block_is_bad(struct mtd_info *mtd, __u32 offs)
+static int flash2nand_block_is_bad(struct mtd_info *mtd, __u64 offs)
 {
 	struct nand_chip *nand = FLASH_TO_NAND(mtd);
 
 	return nand_blk_is_bad(nand, offs);
 }
 
-static int flash2nand_block_mark_bad(struct mtd_info *mtd, __u32 ofs)
+static int flash2nand_block_mark_bad(struct mtd_info *mtd, __u64 ofs)
 {
+	int ret;
 	struct nand_chip *nand = FLASH_TO_NAND(mtd);
 
-	return nand_block_mark_bad(nand, ofs);
+	ret = nand_block_mark_bad(nand, ofs);
+	if (!ret)
+		flash_bad_block_notify(mtd, ofs);
+
+	return ret;
 }
 
 static int flash2nand_block_scan_bad_block(struct mtd_info *mtd)
@@ -1625,6 +2040,7 @@ static struct nand_chip *new_nand_chip(struct nand_ctrl *master, int bus_id)
 
 	mtd->type = MTD_NANDFLASH;
 	mtd->bad_allow = true;
+	mtd->plane_num = 1;
 
 	mtd->read  = flash2nand_read;
 	mtd->write = flash2nand_write;
@@ -1653,6 +2069,68 @@ static void delete_nand_chip(struct nand_chip *nand)
 	free(nand);
 }
 
+// BBT pattern at 8..11 and its version at 12 (see nand_bbt.c)
+#define NAND_BBT_OOB_END  13
+
+static struct nand_oob_layout g_bch_oob_layout;
+
+// BCH parity goes to the tail of the OOB, clear of the bad block marker
+static int nand_bch_setup(struct nand_ctrl *nfc, int strength)
+{
+	int i, ecc_len, ecc_start, free_start;
+	struct nand_chip *nand;
+	struct mtd_info *mtd;
+	struct nand_oob_layout *layout = &g_bch_oob_layout;
+
+	if (list_empty(&nfc->nand_list))
+		return -ENODEV;
+
+	nand = container_of(nfc->nand_list.next, struct nand_chip, nand_node);
+	mtd = NAND_TO_FLASH(nand);
+
+	if (mtd->write_size < NAND_BCH_DATA_LEN)
+		return -EINVAL;
+
+	if (!nfc->bch || nand_bch_strength(nfc->bch) != strength) {
+		nand_bch_free(nfc->bch);
+
+		nfc->bch = nand_bch_new(strength);
+		if (!nfc->bch)
+			return -ENOMEM;
+	}
+
+	ecc_len = mtd->write_size / NAND_BCH_DATA_LEN * nand_bch_code_len(nfc->bch);
+	ecc_start = mtd->oob_size - ecc_len;
+	free_start = mtd->write_size > 512 ? 2 : 6;
+
+	if (ecc_start < free_start ||
+		((nand->flags & NAND_USE_FLASH_BBT) && ecc_start < NAND_BBT_OOB_END))
+		return -ENOSPC;
+
+	memset(layout, 0, sizeof(*layout));
+
+	layout->ecc_code_len = ecc_len;
+	for (i = 0; i < ecc_len; i++)
+		layout->ecc_pos[i] = ecc_start + i;
+
+	layout->free_region[0].nOfOffset = free_start;
+	layout->free_region[0].nOfLen = ecc_start - free_start;
+
+	return 0;
+}
+
+static inline int nand_bch_mode_strength(ECC_MODE mode)
+{
+	switch (mode) {
+	case NAND_ECC_BCH4:
+		return 4;
+	case NAND_ECC_BCH8:
+		return 8;
+	default:
+		return 16;
+	}
+}
+
 ECC_MODE nand_set_ecc_mode(struct nand_ctrl *nfc, ECC_MODE new_mode)
 {
 	int i;
@@ -1701,6 +2179,23 @@ ECC_MODE nand_set_ecc_mode(struct nand_ctrl *nfc, ECC_MODE new_mode)
 		printf("Software\n");
 		break;
 
+	case NAND_ECC_BCH4:
+	case NAND_ECC_BCH8:
+	case NAND_ECC_BCH16:
+		i = nand_bch_setup(nfc, nand_bch_mode_strength(new_mode));
+		if (i < 0) {
+			printf("BCH-%d does not fit! (ret = %d)\n",
+				nand_bch_mode_strength(new_mode), i);
+			return -EINVAL;
+		}
+
+		nfc->read_page      = nand_read_page_bch;
+		nfc->write_page     = nand_write_page_bch;
+		nfc->curr_oob_layout = &g_bch_oob_layout;
+
+		printf("BCH-%d\n", nand_bch_strength(nfc->bch));
+		break;
+
 	case NAND_ECC_NONE:
 		nfc->read_page      = nand_read_page_raw;
 		nfc->write_page     = nand_write_page_raw;
@@ -1772,7 +2267,7 @@ int nand_register(struct nand_chip *nand)
 	struct mtd_info *mtd;
 	struct nand_ctrl *nfc;
 	char vendor_name[64];
-	char chip_size[32], block_size[32], write_size[32];
+	char block_size[32], write_size[32];
 
 	nfc = nand->master;
 
@@ -1791,33 +2286,40 @@ int nand_register(struct nand_chip *nand)
 	snprintf(mtd->name, sizeof(mtd->name), "%s.%d",
 		nfc->name, nand->bus_idx /* fixme */);
 
-	val_to_hr_str(mtd->chip_size, chip_size);
+	if (NAND_HAS_2PLANE(nand))
+		mtd->plane_num = 2;
+
 	val_to_hr_str(mtd->erase_size, block_size);
 	val_to_hr_str(mtd->write_size, write_size);
 
 	printf("NAND[%d] is detected! mtd details:\n"
 		"    vendor ID  = 0x%02x (%s)\n"
 		"    device ID  = 0x%02x (\"%s\")\n"
-		"    chip size  = 0x%08x (%s)\n"
+		"    chip size  = %d MiB\n"
 		"    block size = 0x%08x (%s)\n"
 		"    page size  = 0x%08x (%s)\n"
 		"    oob size   = %d\n"
-		"    bus width  = %d bits\n",
+		"    bus width  = %d bits\n"
+		"    cache read = %s\n"
+		"    planes     = %d\n",
 		nand->bus_idx,
 		nand->vendor_id, vendor_name,
 		nand->device_id, nand->name,
-		mtd->chip_size, chip_size,
+		(__u32)(mtd->chip_size >> 20),
 		mtd->erase_size, block_size,
 		mtd->write_size, write_size,
 		mtd->oob_size,
-		nand->flags & NAND_BUSWIDTH_16 ? 16 : 8
+		nand->flags & NAND_BUSWIDTH_16 ? 16 : 8,
+		NAND_HAS_CACHEREAD(nand) ? "yes" : "no",
+		mtd->plane_num
 		);
 
 	// fix for name
 
-	mtd->chip_shift  = ffs(mtd->chip_size) - 1; //fixme: to opt ffs()
 	mtd->erase_shift = ffs(mtd->erase_size) - 1;
 	mtd->write_shift = ffs(mtd->write_size) - 1;
+	// ffs() is 32-bit, the page count always fits
+	mtd->chip_shift  = ffs(mtd->chip_size >> mtd->write_shift) - 1 + mtd->write_shift;
 
 	nand->page_num_mask = (mtd->chip_size >> mtd->write_shift) - 1;
 
@@ -1863,10 +2365,23 @@ int nand_register(struct nand_chip *nand)
 	mtd->bdev.base = 0;
 	mtd->bdev.size = mtd->chip_size;
 
-	ret = flash_register(mtd);
-	if (ret < 0) {
-		printf("%s(): fail to register deivce!\n");
-		// fixme: destroy
+	// the on-flash BBT lives in the last blocks, keep them out of the partitions
+	if (nand->flags & NAND_USE_FLASH_BBT) {
+		if (nand_bbt_oob_clash(nand)) {
+			printf("OOB layout overlaps the BBT markers, keeping the BBT in RAM\n");
+			nand->flags &= ~NAND_USE_FLASH_BBT;
+		} else {
+			mtd->tail_blocks = NAND_BBT_SCAN_MAXBLOCKS;
+		}
+	}
+
+	// striped chips are registered together by nand_stripe_register()
+	if (!nfc->stripe) {
+		ret = flash_register(mtd);
+		if (ret < 0) {
+			printf("%s(): fail to register deivce!\n");
+			// fixme: destroy
+		}
 	}
 
 	if (nand->flags & NAND_SKIP_BBTSCAN)
@@ -1894,6 +2409,10 @@ int nand_ctrl_register(struct nand_ctrl *nfc)
 	int idx, ret;
 	struct nand_chip *nand;
 
+#ifdef CONFIG_NAND_STRIPE
+	nfc->stripe = nfc->max_slaves > 1;
+#endif
+
 	for (idx = 0; idx < nfc->max_slaves; idx++) {
 		nand = nand_probe(nfc, idx);
 		if (NULL == nand)
@@ -1904,6 +2423,12 @@ int nand_ctrl_register(struct nand_ctrl *nfc)
 			return ret;
 	}
 
+	if (nfc->stripe && nfc->slaves > 0) {
+		ret = nand_stripe_register(nfc);
+		if (ret < 0)
+			return ret;
+	}
+
 	// printf("Total: %d nand %s detected\n", nfc->slaves, nfc->slaves > 1 ? "chips" : "chip");
 
 	nfc->state = FL_READY;
@@ -0,0 +1,794 @@
+#include <stdio.h>
+#include <init.h>
+#include <errno.h>
+#include <string.h>
+#include <malloc.h>
+#include <bitops.h>
+#include <sysconf.h>
+#include <mtd/nand.h>
+#include <mtd/nand_sim.h>
+
+/*
+ * RAM backed NAND simulator, seen by nand_core through the command,
+ * address and data cycles of a real chip (large page, ID based geometry,
+ * optional ONFI parameter page, cache read, two-plane program/erase), so
+ * everything above runs unchanged.
+ *
+ * Geometry and timings come from sysconf, e.g.:
+ *   flash.nandsim.size = 256          # MB
+ *   flash.nandsim.page_size = 2048
+ *   flash.nandsim.oob_size = 64
+ *   flash.nandsim.block_size = 128    # KB
+ *   flash.nandsim.bus_width = 8
+ *   flash.nandsim.tR = 25             # us
+ *   flash.nandsim.tPROG = 200         # us
+ *   flash.nandsim.tBERS = 1500        # us
+ *   flash.nandsim.tRC = 25            # ns per bus cycle
+ *   flash.nandsim.bad_blocks = "5,1000"
+ *   flash.nandsim.onfi = 1            # Micron IDs plus a parameter page
+ *
+ * Busy times only advance a virtual clock, which keeps throughput and
+ * mount time figures independent of the host. Blocks are allocated on
+ * the first program and freed on erase.
+ */
+
+#define SIM_VENDOR_ID  NAND_MFR_SAMSUNG
+#define SIM_ONFI_ID    NAND_MFR_MICRON
+#define SIM_MAX_PLANES 2
+#define SIM_T_RCBSY    3 // us, data to cache register transfer
+
+extern const struct nand_desc g_nand_chip_desc[];
+
+enum {
+	SIM_IDLE,
+	SIM_READID,
+	SIM_STATUS,
+	SIM_READ,
+	SIM_PROG,
+	SIM_PARAM,
+};
+
+struct nand_sim {
+	__u32 page_size;
+	__u32 oob_size;
+	__u32 page_pages; // pages per block
+	__u32 blocks;
+	__u32 chip_mb;
+	bool  bus16;
+
+	__u32 t_r, t_prog, t_bers; // us
+	__u32 t_rc;                // ns
+
+	__u8  id[5];
+	bool  onfi;
+	__u8  param[ONFI_PARAM_LEN];
+	__u8  **blk;   // page + oob per page, NULL while erased
+	__u8  *bad;    // factory bad blocks
+	__u8  *reg;    // page register
+
+	bool  selected;
+	int   mode;
+	int   cmd;
+	__u8  addr[5];
+	int   addr_num;
+	bool  addr_latched;
+	__u32 col;
+	__u32 row;
+	__u8  status;
+
+	__u32 erase_row[SIM_MAX_PLANES];
+	int   erase_num;
+
+	// cache read: the next page loads while the current one is clocked out
+	bool  cache_busy;
+	__u32 cache_start; // clock_us when that load began
+
+	__u32 clock_ns;
+	__u32 rand;
+
+	struct nand_sim_opt  opt;
+	struct nand_sim_stat stat;
+};
+
+static struct nand_sim g_nand_sim;
+
+static inline __u32 sim_random(struct nand_sim *sim, __u32 range)
+{
+	sim->rand = sim->rand * 1103515245 + 12345;
+	return (sim->rand >> 16) % range;
+}
+
+// chance in ppm, drawn from 2^30 to cover the whole range
+static inline bool sim_chance(struct nand_sim *sim, __u32 ppm)
+{
+	__u32 r;
+
+	if (!ppm)
+		return false;
+
+	r = sim_random(sim, 1 << 15) << 15 | sim_random(sim, 1 << 15);
+
+	return r % 1000000 < ppm;
+}
+
+static void sim_clock(struct nand_sim *sim, __u32 us, __u32 ns)
+{
+	ns += sim->clock_ns;
+
+	sim->stat.clock_us += us + ns / 1000;
+	sim->clock_ns = ns % 1000;
+}
+
+static inline __u32 sim_raw_size(struct nand_sim *sim)
+{
+	return sim->page_size + sim->oob_size;
+}
+
+static __u8 *sim_page(struct nand_sim *sim, __u32 row, bool alloc)
+{
+	__u32 blk = row / sim->page_pages;
+	__u32 size = sim->page_pages * sim_raw_size(sim);
+
+	if (blk >= sim->blocks)
+		return NULL;
+
+	if (!sim->blk[blk]) {
+		if (!alloc)
+			return NULL;
+
+		sim->blk[blk] = malloc(size);
+		if (!sim->blk[blk])
+			return NULL;
+
+		memset(sim->blk[blk], 0xFF, size);
+	}
+
+	return sim->blk[blk] + row % sim->page_pages * sim_raw_size(sim);
+}
+
+static void sim_latch_addr(struct nand_sim *sim, bool with_row)
+{
+	int i;
+
+	if (sim->addr_latched)
+		return;
+
+	sim->col = sim->addr[0] | sim->addr[1] << 8;
+	if (sim->bus16)
+		sim->col <<= 1;
+
+	if (with_row) {
+		sim->row = 0;
+		for (i = 2; i < sim->addr_num; i++)
+			sim->row |= sim->addr[i] << (8 * (i - 2));
+	}
+
+	sim->addr_latched = true;
+}
+
+static void sim_fill_reg(struct nand_sim *sim)
+{
+	__u8 *page;
+	__u32 bit;
+
+	page = sim_page(sim, sim->row, false);
+	if (page)
+		memcpy(sim->reg, page, sim_raw_size(sim));
+	else
+		memset(sim->reg, 0xFF, sim_raw_size(sim));
+
+	if (sim_chance(sim, sim->opt.bitflip)) {
+		bit = sim_random(sim, sim->page_size) * 8 + sim_random(sim, 8);
+		sim->reg[bit / 8] ^= 1 << (bit & 7);
+		sim->stat.bitflips++;
+	}
+
+	sim->stat.reads++;
+}
+
+static void sim_load_page(struct nand_sim *sim)
+{
+	sim_latch_addr(sim, true);
+	sim_fill_reg(sim);
+	sim_clock(sim, sim->t_r, 0);
+
+	sim->cache_busy = false;
+	sim->mode = SIM_READ;
+}
+
+/*
+ * 31h hands out the loaded page and starts loading the next one, 3Fh
+ * hands out the last one. Only the part of tR not hidden behind the
+ * previous data output is charged.
+ */
+static void sim_cache_read(struct nand_sim *sim, bool last)
+{
+	__u32 busy = SIM_T_RCBSY, elapsed;
+
+	if (sim->cache_busy) {
+		elapsed = sim->stat.clock_us - sim->cache_start;
+		if (elapsed < sim->t_r)
+			busy += sim->t_r - elapsed;
+
+		sim->row++;
+		sim_fill_reg(sim);
+	}
+
+	sim_clock(sim, busy, 0);
+
+	sim->cache_busy  = !last;
+	sim->cache_start = sim->stat.clock_us;
+	sim->col  = 0;
+	sim->mode = SIM_READ;
+}
+
+// cells can only go from 1 to 0
+static void sim_program_page(struct nand_sim *sim)
+{
+	int i;
+	__u8 *page;
+
+	sim_latch_addr(sim, true);
+
+	sim->stat.programs++;
+
+	if (sim->row / sim->page_pages >= sim->blocks ||
+		sim->bad[sim->row / sim->page_pages] || sim_chance(sim, sim->opt.fail)) {
+		sim->status |= NAND_STATUS_FAIL;
+		sim->stat.prog_fails++;
+		return;
+	}
+
+	page = sim_page(sim, sim->row, true);
+	if (!page) {
+		sim->status |= NAND_STATUS_FAIL;
+		return;
+	}
+
+	for (i = 0; i < sim_raw_size(sim); i++)
+		page[i] &= sim->reg[i];
+}
+
+static void sim_erase_block(struct nand_sim *sim, __u32 row)
+{
+	__u32 blk = row / sim->page_pages;
+
+	sim->stat.erases++;
+
+	if (blk >= sim->blocks || sim->bad[blk] || sim_chance(sim, sim->opt.fail)) {
+		sim->status |= NAND_STATUS_FAIL;
+		sim->stat.erase_fails++;
+		return;
+	}
+
+	free(sim->blk[blk]);
+	sim->blk[blk] = NULL;
+}
+
+static void sim_erase_row(struct nand_sim *sim)
+{
+	int i;
+
+	if (sim->erase_num == SIM_MAX_PLANES)
+		return;
+
+	sim->erase_row[sim->erase_num] = 0;
+	for (i = 0; i < sim->addr_num; i++)
+		sim->erase_row[sim->erase_num] |= sim->addr[i] << (8 * i);
+
+	sim->erase_num++;
+}
+
+static void sim_command(struct nand_sim *sim, int cmd)
+{
+	int i;
+
+	switch (cmd) {
+	case NAND_CMMD_RESET:
+		sim->mode = SIM_IDLE;
+		sim->erase_num = 0;
+		sim->cache_busy = false;
+		sim->status = NAND_STATUS_READY | NAND_STATUS_TRUE_READY | NAND_STATUS_WP;
+		break;
+
+	case NAND_CMMD_READID:
+		sim->mode = SIM_READID;
+		break;
+
+	case NAND_CMMD_STATUS:
+		sim->mode = SIM_STATUS;
+		break;
+
+	case NAND_CMMD_READSTART:
+		sim_load_page(sim);
+		break;
+
+	case NAND_CMMD_READCACHESEQ:
+	case NAND_CMMD_READCACHEEND:
+		if (sim->mode == SIM_READ)
+			sim_cache_read(sim, cmd == NAND_CMMD_READCACHEEND);
+		break;
+
+	case NAND_CMMD_PARAM:
+		if (!sim->onfi)
+			break;
+
+		sim_clock(sim, sim->t_r, 0);
+		sim->col  = 0;
+		sim->mode = SIM_PARAM;
+		break;
+
+	case NAND_CMMD_RNDOUTSTART:
+		sim_latch_addr(sim, false);
+		sim->mode = SIM_READ;
+		break;
+
+	case NAND_CMMD_SEQIN:
+	case NAND_CMMD_MPLANE_SEQIN:
+		memset(sim->reg, 0xFF, sim_raw_size(sim));
+		sim->status &= ~NAND_STATUS_FAIL;
+		sim->mode = SIM_PROG;
+		break;
+
+	case NAND_CMMD_RNDIN:
+		sim->mode = SIM_PROG;
+		break;
+
+	case NAND_CMMD_MPLANE_PROG:
+		// both planes are programmed together, only tDBSY here
+		sim_program_page(sim);
+		sim_clock(sim, 1, 0);
+		sim->mode = SIM_IDLE;
+		break;
+
+	case NAND_CMMD_PAGEPROG:
+	case NAND_CMMD_CACHEDPROG:
+		sim_program_page(sim);
+		sim_clock(sim, sim->t_prog, 0);
+		sim->mode = SIM_IDLE;
+		break;
+
+	case NAND_CMMD_ERASE1:
+		if (sim->cmd == NAND_CMMD_ERASE1 && sim->addr_num)
+			sim_erase_row(sim);
+		else if (sim->cmd != NAND_CMMD_MPLANE_ERASE)
+			sim->erase_num = 0;
+
+		sim->status &= ~NAND_STATUS_FAIL;
+		sim->mode = SIM_IDLE;
+		break;
+
+	// ONFI style 60h ... D1h 60h ... D0h
+	case NAND_CMMD_MPLANE_ERASE:
+		sim_erase_row(sim);
+		sim_clock(sim, 1, 0);
+		sim->mode = SIM_IDLE;
+		break;
+
+	case NAND_CMMD_ERASE2:
+		sim_erase_row(sim);
+
+		for (i = 0; i < sim->erase_num; i++)
+			sim_erase_block(sim, sim->erase_row[i]);
+
+		sim_clock(sim, sim->t_bers, 0);
+		sim->erase_num = 0;
+		sim->mode = SIM_IDLE;
+		break;
+
+	default:
+		break;
+	}
+
+	sim->cmd = cmd;
+
+	// the following address cycles belong to this command
+	switch (cmd) {
+	case NAND_CMMD_READ0:
+	case NAND_CMMD_READID:
+	case NAND_CMMD_SEQIN:
+	case NAND_CMMD_MPLANE_SEQIN:
+	case NAND_CMMD_RNDIN:
+	case NAND_CMMD_RNDOUT:
+	case NAND_CMMD_ERASE1:
+	case NAND_CMMD_PARAM:
+		sim->addr_num = 0;
+		sim->addr_latched = false;
+		break;
+
+	default:
+		break;
+	}
+}
+
+static void nand_sim_cmd_ctrl(struct nand_chip *nand, int arg, unsigned int ctrl)
+{
+	struct nand_sim *sim = &g_nand_sim;
+
+	if (arg == NAND_CMMD_NONE || !sim->selected)
+		return;
+
+	if (ctrl & NAND_CLE) {
+		sim_command(sim, arg & 0xFF);
+	} else if (ctrl & NAND_ALE) {
+		if (sim->addr_num < sizeof(sim->addr))
+			sim->addr[sim->addr_num++] = arg;
+	}
+
+	sim_clock(sim, 0, sim->t_rc);
+}
+
+static void nand_sim_select(struct nand_chip *nand, bool chip_select)
+{
+	g_nand_sim.selected = chip_select && nand->bus_idx == 0;
+}
+
+static int nand_sim_ready(struct nand_chip *nand)
+{
+	return 1;
+}
+
+static __u8 sim_read_u8(struct nand_sim *sim)
+{
+	__u8 val = 0xFF;
+
+	if (!sim->selected)
+		return val;
+
+	switch (sim->mode) {
+	case SIM_READID:
+		if (sim->addr[0] == 0x00 && sim->col < sizeof(sim->id))
+			val = sim->id[sim->col];
+		else if (sim->addr[0] == 0x20 && sim->onfi && sim->col < 4)
+			val = sim->param[sim->col];
+		else
+			val = 0x00;
+		sim->col++;
+		break;
+
+	case SIM_PARAM:
+		if (sim->col < 3 * ONFI_PARAM_LEN)
+			val = sim->param[sim->col % ONFI_PARAM_LEN];
+		sim->col++;
+		break;
+
+	case SIM_STATUS:
+		val = sim->status;
+		break;
+
+	case SIM_READ:
+		if (sim->col < sim_raw_size(sim))
+			val = sim->reg[sim->col];
+		sim->col++;
+		break;
+
+	default:
+		break;
+	}
+
+	return val;
+}
+
+static __u8 nand_sim_read_byte(struct nand_ctrl *nfc)
+{
+	struct nand_sim *sim = &g_nand_sim;
+
+	if (sim->mode == SIM_READID && sim->cmd == NAND_CMMD_READID && !sim->addr_latched) {
+		sim->col = 0;
+		sim->addr_latched = true;
+	}
+
+	sim_clock(sim, 0, sim->t_rc);
+	sim->stat.bytes_out++;
+
+	return sim_read_u8(sim);
+}
+
+static __u16 nand_sim_read_word(struct nand_ctrl *nfc)
+{
+	__u16 val;
+
+	val = nand_sim_read_byte(nfc);
+	val |= nand_sim_read_byte(nfc) << 8;
+
+	return val;
+}
+
+static void nand_sim_read_buff(struct nand_ctrl *nfc, __u8 *buff, int len)
+{
+	struct nand_sim *sim = &g_nand_sim;
+	int n;
+
+	if (sim->selected && sim->mode == SIM_READ && sim->col < sim_raw_size(sim)) {
+		n = min(len, (int)(sim_raw_size(sim) - sim->col));
+
+		memcpy(buff, sim->reg + sim->col, n);
+		sim->col += n;
+		buff += n;
+		len -= n;
+
+		sim->stat.bytes_out += n;
+		sim_clock(sim, 0, n * sim->t_rc);
+	}
+
+	while (len-- > 0)
+		*buff++ = nand_sim_read_byte(nfc);
+}
+
+static void nand_sim_write_buff(struct nand_ctrl *nfc, const __u8 *buff, int len)
+{
+	struct nand_sim *sim = &g_nand_sim;
+	int n;
+
+	if (!sim->selected || sim->mode != SIM_PROG)
+		return;
+
+	sim_latch_addr(sim, sim->cmd != NAND_CMMD_RNDIN);
+
+	if (sim->col < sim_raw_size(sim)) {
+		n = min(len, (int)(sim_raw_size(sim) - sim->col));
+
+		memcpy(sim->reg + sim->col, buff, n);
+		sim->col += n;
+	}
+
+	sim->stat.bytes_in += len;
+	sim_clock(sim, 0, len * sim->t_rc);
+}
+
+static int nand_sim_verify_buff(struct nand_ctrl *nfc, const __u8 *buff, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++) {
+		if (buff[i] != nand_sim_read_byte(nfc))
+			return -EFAULT;
+	}
+
+	return 0;
+}
+
+int nand_sim_setup(const struct nand_sim_opt *opt)
+{
+	if (opt->bitflip > 1000000 || opt->fail > 1000000)
+		return -EINVAL;
+
+	g_nand_sim.opt = *opt;
+	g_nand_sim.rand = opt->seed;
+
+	return 0;
+}
+
+void nand_sim_get_info(struct nand_sim_opt *opt, struct nand_sim_stat *stat)
+{
+	if (opt)
+		*opt = g_nand_sim.opt;
+
+	if (stat)
+		*stat = g_nand_sim.stat;
+}
+
+void nand_sim_clear_stat(void)
+{
+	memset(&g_nand_sim.stat, 0, sizeof(g_nand_sim.stat));
+	g_nand_sim.clock_ns = 0;
+}
+
+static __u32 sim_get_conf(const char *attr, __u32 def)
+{
+	char buff[CONF_VAL_LEN];
+	unsigned long val;
+
+	if (conf_get_attr(attr, buff) < 0 || str_to_val(buff, &val) < 0)
+		return def;
+
+	return val;
+}
+
+// factory bad blocks carry a non-0xFF marker in the first two pages
+static void sim_mark_factory_bad(struct nand_sim *sim)
+{
+	char buff[CONF_VAL_LEN], *p, *q;
+	unsigned long blk;
+	__u8 *page;
+	int i;
+
+	if (conf_get_attr("flash.nandsim.bad_blocks", buff) < 0)
+		return;
+
+	for (p = buff; *p; p = q) {
+		q = strchr(p, ',');
+		if (q)
+			*q++ = '\0';
+		else
+			q = p + strlen(p);
+
+		if (str_to_val(p, &blk) < 0 || blk >= sim->blocks) {
+			printf("nandsim: invalid bad block \"%s\"\n", p);
+			continue;
+		}
+
+		sim->bad[blk] = 1;
+
+		for (i = 0; i < 2; i++) {
+			page = sim_page(sim, blk * sim->page_pages + i, true);
+			if (page)
+				memset(page + sim->page_size, 0x00, 2);
+		}
+	}
+}
+
+static inline void sim_put_le(__u8 *p, __u32 val, int len)
+{
+	while (len--) {
+		*p++ = val & 0xFF;
+		val >>= 8;
+	}
+}
+
+// ONFI 1.0 parameter page, only the fields nand_core and Linux look at
+static void sim_init_param(struct nand_sim *sim)
+{
+	__u8 *p = sim->param;
+	__u16 crc;
+
+	memset(p, 0, ONFI_PARAM_LEN);
+
+	memcpy(p, "ONFI", 4);
+	p[4] = 1 << 1; // revision 1.0
+	p[6] = ONFI_FEATURE_MPLANE | (sim->bus16 ? ONFI_FEATURE_BUS16 : 0);
+	p[8] = ONFI_OPT_CACHE_PROG | ONFI_OPT_CACHE_READ;
+
+	memcpy(p + 32, "MICRON      ", 12);
+	memcpy(p + 44, "NANDSIM             ", 20);
+	p[64] = SIM_ONFI_ID;
+
+	sim_put_le(p + 80, sim->page_size, 4);
+	sim_put_le(p + 84, sim->oob_size, 2);
+	sim_put_le(p + 92, sim->page_pages, 4);
+	sim_put_le(p + 96, sim->blocks, 4);
+	p[100] = 1; // LUNs
+	p[101] = 2 << 4 | (sim->chip_mb > 128 ? 3 : 2); // column and row cycles
+	p[102] = 1; // SLC
+	p[110] = 4; // partial programs per page
+	p[113] = ffs(SIM_MAX_PLANES) - 1; // interleaved address bits
+
+	crc = nand_onfi_crc16(p, 254);
+	p[254] = crc & 0xFF;
+	p[255] = crc >> 8;
+}
+
+static int sim_init_geometry(struct nand_sim *sim)
+{
+	int i;
+	__u32 block_size;
+	bool found = false;
+
+	sim->chip_mb   = sim_get_conf("flash.nandsim.size", 128);
+	sim->page_size = sim_get_conf("flash.nandsim.page_size", 2048);
+	sim->oob_size  = sim_get_conf("flash.nandsim.oob_size", 64);
+	block_size     = sim_get_conf("flash.nandsim.block_size", 128) << 10;
+	sim->bus16     = sim_get_conf("flash.nandsim.bus_width", 8) == 16;
+
+	sim->t_r    = sim_get_conf("flash.nandsim.tR", 25);
+	sim->t_prog = sim_get_conf("flash.nandsim.tPROG", 200);
+	sim->t_bers = sim_get_conf("flash.nandsim.tBERS", 1500);
+	sim->t_rc   = sim_get_conf("flash.nandsim.tRC", 25);
+
+	// what the 4th ID byte can describe
+	if ((sim->page_size != 1024 && sim->page_size != 2048) ||
+		sim->page_size > NAND_MAX_PAGESIZE ||
+		(sim->oob_size != sim->page_size / 512 * 8 &&
+			sim->oob_size != sim->page_size / 512 * 16) ||
+		sim->oob_size > NAND_MAX_OOB_SIZE ||
+		block_size < KB(64) || block_size > KB(512) ||
+		(block_size & (block_size - 1)))
+		return -EINVAL;
+
+	for (i = 0; g_nand_chip_desc[i].name; i++) {
+		if (g_nand_chip_desc[i].chip_size == sim->chip_mb &&
+			g_nand_chip_desc[i].write_size == PAGE_SIZE_AUTODETECT &&
+			!(g_nand_chip_desc[i].flags & NAND_BUSWIDTH_16) == !sim->bus16) {
+			found = true;
+			break;
+		}
+	}
+
+	if (!found)
+		return -ENODEV;
+
+	sim->onfi = sim_get_conf("flash.nandsim.onfi", 0) != 0;
+
+	sim->id[0] = sim->onfi ? SIM_ONFI_ID : SIM_VENDOR_ID;
+	sim->id[1] = g_nand_chip_desc[i].id;
+	sim->id[2] = 0x00;
+	sim->id[3] = (ffs(sim->page_size >> 10) - 1) |
+		(sim->oob_size == sim->page_size / 512 * 16) << 2 |
+		(ffs(block_size >> 16) - 1) << 4 |
+		sim->bus16 << 6;
+	sim->id[4] = (ffs(SIM_MAX_PLANES) - 1) << 2; // Samsung two-plane sequence
+
+	sim->page_pages = block_size / sim->page_size;
+	// in KiB, so that 4 GiB and larger parts do not overflow
+	sim->blocks = (sim->chip_mb << 10) / (block_size >> 10);
+
+	if (sim->onfi)
+		sim_init_param(sim);
+
+	return 0;
+}
+
+static void nand_sim_set_bus(struct nand_ctrl *nfc)
+{
+	nfc->read_byte   = nand_sim_read_byte;
+	nfc->read_word   = nand_sim_read_word;
+	nfc->read_buff   = nand_sim_read_buff;
+	nfc->write_buff  = nand_sim_write_buff;
+	nfc->verify_buff = nand_sim_verify_buff;
+}
+
+static int __init nand_sim_probe(void)
+{
+	int ret;
+	struct nand_sim *sim = &g_nand_sim;
+	struct nand_ctrl *nfc;
+	struct nand_chip *nand;
+
+	ret = sim_init_geometry(sim);
+	if (ret < 0) {
+		printf("nandsim: unsupported geometry (ret = %d)!\n", ret);
+		return ret;
+	}
+
+	sim->blk = zalloc(sim->blocks * sizeof(*sim->blk));
+	sim->bad = zalloc(sim->blocks);
+	sim->reg = malloc(sim_raw_size(sim));
+	if (!sim->blk || !sim->bad || !sim->reg) {
+		ret = -ENOMEM;
+		goto L1;
+	}
+
+	sim->status = NAND_STATUS_READY | NAND_STATUS_TRUE_READY | NAND_STATUS_WP;
+	sim_mark_factory_bad(sim);
+
+	nfc = nand_ctrl_new();
+	if (!nfc) {
+		ret = -ENOMEM;
+		goto L1;
+	}
+
+	nfc->name        = "nandsim";
+	nfc->chip_delay  = 0;
+	nfc->cmd_ctrl    = nand_sim_cmd_ctrl;
+	nfc->select_chip = nand_sim_select;
+	nfc->flash_ready = nand_sim_ready;
+	nand_sim_set_bus(nfc);
+
+	nand = nand_probe(nfc, 0);
+	if (!nand) {
+		ret = -ENODEV;
+		goto L2;
+	}
+
+	// probe switches 16-bit chips to the memory mapped helpers
+	nand_sim_set_bus(nfc);
+
+	// soft ECC keeps clear of the table markers, so the BBT goes to flash
+	nand->flags |= NAND_USE_FLASH_BBT;
+
+	ret = nand_register(nand);
+	if (ret < 0)
+		goto L2;
+
+	return 0;
+
+L2:
+	free(nfc);
+L1:
+	free(sim->reg);
+	free(sim->bad);
+	free(sim->blk);
+	return ret;
+}
+
+module_init(nand_sim_probe);
@@ -0,0 +1,494 @@
+#include <stdio.h>
+#include <errno.h>
+#include <delay.h>
+#include <string.h>
+#include <malloc.h>
+#include <bitops.h>
+#include <mtd/mtd.h>
+#include <mtd/nand.h>
+
+/*
+ * RAID0 view of the chips on one controller: virtual page v lives in
+ * page v / N of chip v % N, so a virtual block is the same block on
+ * every chip. While one chip is busy in tR/tPROG/tBERS the command for
+ * the next one is already on the bus; a chip is only polled (per chip
+ * status, R/B is usually shared) before it is used again.
+ */
+
+#define STRIPE_TIMEOUT  100000 // us
+
+struct nand_stripe {
+	struct mtd_info parent;
+	int num;
+	int shift;
+	struct nand_chip *member[NAND_MAX_CHIPS];
+	bool busy[NAND_MAX_CHIPS];
+};
+
+#define FLASH_TO_STRIPE(flash) container_of(flash, struct nand_stripe, parent)
+
+// command and address cycles only, never waits
+static void stripe_command(struct nand_chip *nand, int cmd, int col, int row)
+{
+	struct mtd_info *mtd = NAND_TO_FLASH(nand);
+	struct nand_ctrl *nfc = nand->master;
+	int ctrl = NAND_NCE | NAND_ALE | NAND_CTRL_CHANGE;
+
+	nfc->cmd_ctrl(nand, cmd, NAND_NCE | NAND_CLE | NAND_CTRL_CHANGE);
+
+	if (col != -1) {
+		if (nand->flags & NAND_BUSWIDTH_16)
+			col >>= 1;
+
+		nfc->cmd_ctrl(nand, col, ctrl);
+		ctrl &= ~NAND_CTRL_CHANGE;
+		nfc->cmd_ctrl(nand, col >> 8, ctrl);
+	}
+
+	if (row != -1) {
+		nfc->cmd_ctrl(nand, row, ctrl);
+		ctrl &= ~NAND_CTRL_CHANGE;
+		nfc->cmd_ctrl(nand, row >> 8, ctrl);
+
+		if (mtd->chip_size > (1 << 27))
+			nfc->cmd_ctrl(nand, row >> 16, ctrl);
+	}
+
+	nfc->cmd_ctrl(nand, NAND_CMMD_NONE, NAND_NCE | NAND_CTRL_CHANGE);
+}
+
+static int stripe_wait(struct nand_stripe *stripe, int idx)
+{
+	int to, status;
+	struct nand_chip *nand = stripe->member[idx];
+	struct nand_ctrl *nfc = nand->master;
+
+	nfc->select_chip(nand, true);
+	stripe_command(nand, NAND_CMMD_STATUS, -1, -1);
+
+	for (to = 0; to < STRIPE_TIMEOUT; to++) {
+		status = nfc->read_byte(nfc);
+		if (status & NAND_STATUS_READY) {
+			stripe->busy[idx] = false;
+			return status;
+		}
+
+		udelay(1);
+	}
+
+	printf("%s(): chip %d timeout!\n", __func__, nand->bus_idx);
+
+	return -ETIMEDOUT;
+}
+
+static int stripe_wait_all(struct nand_stripe *stripe)
+{
+	int i, status, ret = 0;
+
+	for (i = 0; i < stripe->num; i++) {
+		if (!stripe->busy[i])
+			continue;
+
+		status = stripe_wait(stripe, i);
+		if (status < 0)
+			ret = status;
+		else if ((status & NAND_STATUS_FAIL) && !ret)
+			ret = -EIO;
+	}
+
+	return ret;
+}
+
+static inline int stripe_member(struct nand_stripe *stripe, __u32 vpage, __u32 *page)
+{
+	*page = vpage >> stripe->shift;
+
+	return vpage & (stripe->num - 1);
+}
+
+static int stripe_read(struct mtd_info *mtd, __u64 from, __u32 len, size_t *retlen, __u8 *buff)
+{
+	int i, idx, group, ret = 0;
+	__u32 vpage, page, end;
+	struct nand_stripe *stripe = FLASH_TO_STRIPE(mtd);
+	struct nand_chip *nand;
+	struct nand_ctrl *nfc;
+	struct ecc_stats old[NAND_MAX_CHIPS];
+
+	*retlen = 0;
+
+	if ((from | len) & (mtd->write_size - 1) || from + len > mtd->chip_size)
+		return -EINVAL;
+
+	for (i = 0; i < stripe->num; i++)
+		old[i] = NAND_TO_FLASH(stripe->member[i])->eccstat;
+
+	vpage = from >> mtd->write_shift;
+	end = (from + len) >> mtd->write_shift;
+
+	while (vpage < end) {
+		group = min((int)(end - vpage), stripe->num);
+
+		// every chip of the group loads its page at the same time
+		for (i = 0; i < group; i++) {
+			idx = stripe_member(stripe, vpage + i, &page);
+			nand = stripe->member[idx];
+			nfc = nand->master;
+
+			nfc->select_chip(nand, true);
+			stripe_command(nand, NAND_CMMD_READ0, 0, page);
+			stripe_command(nand, NAND_CMMD_READSTART, -1, -1);
+			stripe->busy[idx] = true;
+			nand->page_in_buff = -1;
+		}
+
+		for (i = 0; i < group; i++) {
+			idx = stripe_member(stripe, vpage + i, &page);
+			nand = stripe->member[idx];
+			nfc = nand->master;
+
+			ret = stripe_wait(stripe, idx);
+			if (ret < 0)
+				goto L1;
+
+			// back to data output after the status poll
+			stripe_command(nand, NAND_CMMD_READ0, -1, -1);
+
+			ret = nfc->read_page(nand, buff);
+			if (ret < 0)
+				goto L1;
+
+			buff += mtd->write_size;
+			*retlen += mtd->write_size;
+		}
+
+		vpage += group;
+	}
+
+L1:
+	for (i = 0; i < stripe->num; i++) {
+		struct ecc_stats *cur = &NAND_TO_FLASH(stripe->member[i])->eccstat;
+
+		mtd->eccstat.ecc_failed_count  += cur->ecc_failed_count - old[i].ecc_failed_count;
+		mtd->eccstat.ecc_correct_count += cur->ecc_correct_count - old[i].ecc_correct_count;
+
+		if (cur->ecc_failed_count != old[i].ecc_failed_count && !ret)
+			ret = -EBADMSG;
+		else if (cur->ecc_correct_count != old[i].ecc_correct_count && !ret)
+			ret = -EUCLEAN;
+
+		stripe->member[i]->master->select_chip(stripe->member[i], false);
+	}
+
+	return ret;
+}
+
+static int stripe_write(struct mtd_info *mtd, __u64 to, __u32 len, __u32 *retlen, const __u8 *buff)
+{
+	int idx, status, ret = 0;
+	__u32 vpage, page, end;
+	struct nand_stripe *stripe = FLASH_TO_STRIPE(mtd);
+	struct nand_chip *nand;
+	struct nand_ctrl *nfc;
+
+	*retlen = 0;
+
+	if ((to | len) & (mtd->write_size - 1) || to + len > mtd->chip_size)
+		return -EINVAL;
+
+	vpage = to >> mtd->write_shift;
+	end = (to + len) >> mtd->write_shift;
+
+	for (; vpage < end; vpage++) {
+		idx = stripe_member(stripe, vpage, &page);
+		nand = stripe->member[idx];
+		nfc = nand->master;
+
+		// only the chip we are about to use has to be idle
+		if (stripe->busy[idx]) {
+			status = stripe_wait(stripe, idx);
+			if (status < 0 || (status & NAND_STATUS_FAIL)) {
+				ret = status < 0 ? status : -EIO;
+				break;
+			}
+		}
+
+		nfc->select_chip(nand, true);
+
+		memset(nand->oob_buf, 0xFF, mtd->oob_size);
+		nand->page_in_buff = -1;
+
+		stripe_command(nand, NAND_CMMD_SEQIN, 0, page);
+		nfc->write_page(nand, buff);
+		stripe_command(nand, NAND_CMMD_PAGEPROG, -1, -1);
+		stripe->busy[idx] = true;
+
+		buff += mtd->write_size;
+		*retlen += mtd->write_size;
+	}
+
+	status = stripe_wait_all(stripe);
+	if (!ret)
+		ret = status;
+
+	for (idx = 0; idx < stripe->num; idx++)
+		stripe->member[idx]->master->select_chip(stripe->member[idx], false);
+
+	return ret;
+}
+
+static int stripe_block_is_bad(struct mtd_info *mtd, __u64 off)
+{
+	int i;
+	struct nand_stripe *stripe = FLASH_TO_STRIPE(mtd);
+	struct mtd_info *sub;
+	__u32 blk = off >> mtd->erase_shift;
+
+	for (i = 0; i < stripe->num; i++) {
+		sub = NAND_TO_FLASH(stripe->member[i]);
+		if (sub->block_isbad(sub, (__u64)blk << sub->erase_shift))
+			return 1;
+	}
+
+	return 0;
+}
+
+static int stripe_block_mark_bad(struct mtd_info *mtd, __u64 off)
+{
+	int i, ret = 0;
+	struct nand_stripe *stripe = FLASH_TO_STRIPE(mtd);
+	struct mtd_info *sub;
+	__u32 blk = off >> mtd->erase_shift;
+
+	for (i = 0; i < stripe->num; i++) {
+		sub = NAND_TO_FLASH(stripe->member[i]);
+		if (!sub->block_isbad(sub, (__u64)blk << sub->erase_shift))
+			ret = sub->block_markbad(sub, (__u64)blk << sub->erase_shift);
+	}
+
+	flash_bad_block_notify(mtd, (__u64)blk << mtd->erase_shift);
+
+	return ret;
+}
+
+static int stripe_erase(struct mtd_info *mtd, struct erase_info *instr)
+{
+	int i, ret = 0;
+	__u32 blk, end, row;
+	struct nand_stripe *stripe = FLASH_TO_STRIPE(mtd);
+	struct nand_chip *nand;
+	struct mtd_info *sub;
+	struct erase_info sub_instr;
+
+	if ((instr->addr | instr->len) & (mtd->erase_size - 1) ||
+		instr->addr + instr->len > mtd->chip_size)
+		return -EINVAL;
+
+	instr->fail_addr = FLASH_FAIL_ADDR_UNKNOWN;
+	instr->state = FLASH_ERASING;
+
+	blk = instr->addr >> mtd->erase_shift;
+	end = (instr->addr + instr->len) >> mtd->erase_shift;
+
+	for (; blk < end; blk++) {
+		if (!(instr->flags & EDF_ALLOWBB) && stripe_block_is_bad(mtd, (__u64)blk << mtd->erase_shift)) {
+			printf("\n%s(): try to erase bad block %d!\n", __func__, blk);
+			ret = -EIO;
+			break;
+		}
+
+		// the cleanmarker is written by the chip driver
+		if (instr->flags & EDF_JFFS2) {
+			for (i = 0; i < stripe->num; i++) {
+				sub = NAND_TO_FLASH(stripe->member[i]);
+
+				memset(&sub_instr, 0, sizeof(sub_instr));
+				sub_instr.addr  = (__u64)blk << sub->erase_shift;
+				sub_instr.len   = sub->erase_size;
+				sub_instr.flags = instr->flags;
+
+				ret = sub->erase(sub, &sub_instr);
+				if (ret < 0)
+					break;
+			}
+		} else {
+			for (i = 0; i < stripe->num; i++) {
+				nand = stripe->member[i];
+				row = blk << (nand->phy_erase_shift - NAND_TO_FLASH(nand)->write_shift);
+
+				if (nand->page_in_buff >> (nand->phy_erase_shift - NAND_TO_FLASH(nand)->write_shift) == blk)
+					nand->page_in_buff = -1;
+
+				nand->master->select_chip(nand, true);
+				stripe_command(nand, NAND_CMMD_ERASE1, -1, row);
+				stripe_command(nand, NAND_CMMD_ERASE2, -1, -1);
+				stripe->busy[i] = true;
+			}
+
+			ret = stripe_wait_all(stripe);
+		}
+
+		if (ret < 0) {
+			instr->fail_addr = (__u64)blk << mtd->erase_shift;
+			printf("\n%s(): Failed @ block %d\n", __func__, blk);
+			break;
+		}
+
+		if (mtd->callback_func && mtd->callback_args) {
+			mtd->callback_args->page_index  = blk << (mtd->erase_shift - mtd->write_shift);
+			mtd->callback_args->block_index = blk;
+
+			mtd->callback_func(mtd, mtd->callback_args);
+		}
+	}
+
+	for (i = 0; i < stripe->num; i++)
+		stripe->member[i]->master->select_chip(stripe->member[i], false);
+
+	instr->state = ret < 0 ? FLASH_ERASE_FAILED : FLASH_ERASE_DONE;
+
+	return ret;
+}
+
+// spare area access stays page by page on the owning chip
+static int stripe_oob_addr(struct mtd_info *mtd, __u64 off, struct mtd_oob_ops *ops,
+			struct mtd_info **sub, __u64 *sub_off)
+{
+	int idx;
+	__u32 page;
+	struct nand_stripe *stripe = FLASH_TO_STRIPE(mtd);
+
+	if (ops->datbuf && ops->len > mtd->write_size)
+		return -EINVAL;
+
+	idx = stripe_member(stripe, off >> mtd->write_shift, &page);
+
+	*sub = NAND_TO_FLASH(stripe->member[idx]);
+	*sub_off = ((__u64)page << mtd->write_shift) | (off & (mtd->write_size - 1));
+
+	return 0;
+}
+
+static int stripe_read_oob(struct mtd_info *mtd, __u64 from, struct mtd_oob_ops *ops)
+{
+	int ret;
+	__u64 off;
+	struct mtd_info *sub;
+
+	ret = stripe_oob_addr(mtd, from, ops, &sub, &off);
+	if (ret < 0)
+		return ret;
+
+	return sub->read_oob(sub, off, ops);
+}
+
+static int stripe_write_oob(struct mtd_info *mtd, __u64 to, struct mtd_oob_ops *ops)
+{
+	int ret;
+	__u64 off;
+	struct mtd_info *sub;
+
+	ret = stripe_oob_addr(mtd, to, ops, &sub, &off);
+	if (ret < 0)
+		return ret;
+
+	return sub->write_oob(sub, off, ops);
+}
+
+static int stripe_scan_bad_block(struct mtd_info *mtd)
+{
+	int i, ret = 0;
+	struct nand_stripe *stripe = FLASH_TO_STRIPE(mtd);
+	struct mtd_info *sub;
+
+	for (i = 0; i < stripe->num; i++) {
+		sub = NAND_TO_FLASH(stripe->member[i]);
+		if (sub->scan_bad_block(sub) < 0)
+			ret = -EIO;
+	}
+
+	return ret;
+}
+
+static bool stripe_can_join(struct mtd_info *a, struct mtd_info *b)
+{
+	return a->write_size == b->write_size && a->erase_size == b->erase_size &&
+		a->chip_size == b->chip_size && a->oob_size == b->oob_size;
+}
+
+int nand_stripe_register(struct nand_ctrl *nfc)
+{
+	int num = 0, ret;
+	struct nand_chip *nand;
+	struct nand_stripe *stripe;
+	struct mtd_info *mtd, *sub;
+
+	stripe = zalloc(sizeof(*stripe));
+	if (!stripe)
+		return -ENOMEM;
+
+	list_for_each_entry(nand, &nfc->nand_list, nand_node) {
+		if (num == NAND_MAX_CHIPS)
+			break;
+
+		stripe->member[num++] = nand;
+	}
+
+	sub = NAND_TO_FLASH(stripe->member[0]);
+
+	// power of 2 identical large page chips, else one mtd per chip
+	if (num < 2 || (num & (num - 1)) || sub->write_size <= 512)
+		goto L1;
+
+	for (stripe->num = 1; stripe->num < num; stripe->num++) {
+		if (!stripe_can_join(sub, NAND_TO_FLASH(stripe->member[stripe->num])))
+			goto L1;
+	}
+
+	stripe->shift = ffs(num) - 1;
+
+	mtd = &stripe->parent;
+	snprintf(mtd->name, sizeof(mtd->name), "%s.stripe", nfc->name);
+
+	mtd->type        = sub->type;
+	mtd->write_size  = sub->write_size;
+	mtd->oob_size    = sub->oob_size;
+	mtd->oob_mode    = sub->oob_mode;
+	mtd->erase_size  = sub->erase_size << stripe->shift;
+	mtd->chip_size   = sub->chip_size << stripe->shift;
+	mtd->write_shift = sub->write_shift;
+	mtd->erase_shift = sub->erase_shift + stripe->shift;
+	mtd->chip_shift  = sub->chip_shift + stripe->shift;
+	mtd->plane_num   = 1;
+	mtd->tail_blocks = sub->tail_blocks; // the same blocks on every chip
+
+	mtd->read  = stripe_read;
+	mtd->write = stripe_write;
+	mtd->erase = stripe_erase;
+	mtd->read_oob  = stripe_read_oob;
+	mtd->write_oob = stripe_write_oob;
+	mtd->block_isbad    = stripe_block_is_bad;
+	mtd->block_markbad  = stripe_block_mark_bad;
+	mtd->scan_bad_block = stripe_scan_bad_block;
+
+	mtd->bdev.base = 0;
+	mtd->bdev.size = mtd->chip_size;
+
+	printf("NAND stripe: %d chips, block size = 0x%08x, chip size = %d MiB\n",
+		num, mtd->erase_size, (__u32)(mtd->chip_size >> 20));
+
+	return flash_register(mtd);
+
+L1:
+	printf("NAND stripe: %d chip(s) can not be striped\n", num);
+
+	list_for_each_entry(nand, &nfc->nand_list, nand_node) {
+		ret = flash_register(NAND_TO_FLASH(nand));
+		if (ret < 0)
+			break;
+	}
+
+	free(stripe);
+
+	return ret;
+}
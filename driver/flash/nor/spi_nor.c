@@ -0,0 +1,552 @@
+#include <stdio.h>
+#include <init.h>
+#include <errno.h>
+#include <string.h>
+#include <malloc.h>
+#include <delay.h>
+#include <bitops.h>
+#include <spi.h>
+#include <mtd/mtd.h>
+#include <mtd/spi_nor.h>
+
+/*
+ * Generic SPI NOR flash on top of spi_core. The geometry comes from the
+ * JEDEC ID table and, when the chip has one, from its SFDP basic flash
+ * parameter table. A read of any length is one fast read transfer, on
+ * two or four data lines when both the chip and the controller support
+ * it. Programs go one page per command. Each erase uses the largest
+ * erase size that is aligned and fits in what is left of the range.
+ */
+
+#define SPI_NOR_PROG_TIMEOUT   40 // ms
+#define SPI_NOR_ERASE_TIMEOUT  3000
+#define SPI_NOR_CHIP_TIMEOUT   400000
+
+#define SPI_NOR_MFR_WINBOND     0xEF
+#define SPI_NOR_MFR_GIGADEVICE  0xC8
+
+#define SFDP_BFPT_DWORDS  9
+
+static const struct spi_nor_id g_spi_nor_ids[] = {
+	// Winbond
+	{"w25x10",  {0xEF, 0x30, 0x11}, KB(64), 2,   SECT_4K | SECT_32K | SPI_NOR_DUAL_READ},
+	{"w25x20",  {0xEF, 0x30, 0x12}, KB(64), 4,   SECT_4K | SECT_32K | SPI_NOR_DUAL_READ},
+	{"w25x40",  {0xEF, 0x30, 0x13}, KB(64), 8,   SECT_4K | SECT_32K | SPI_NOR_DUAL_READ},
+	{"w25x80",  {0xEF, 0x30, 0x14}, KB(64), 16,  SECT_4K | SECT_32K | SPI_NOR_DUAL_READ},
+	{"w25x16",  {0xEF, 0x30, 0x15}, KB(64), 32,  SECT_4K | SECT_32K | SPI_NOR_DUAL_READ},
+	{"w25x32",  {0xEF, 0x30, 0x16}, KB(64), 64,  SECT_4K | SECT_32K | SPI_NOR_DUAL_READ},
+	{"w25x64",  {0xEF, 0x30, 0x17}, KB(64), 128, SECT_4K | SECT_32K | SPI_NOR_DUAL_READ},
+	{"w25q16",  {0xEF, 0x40, 0x15}, KB(64), 32,  SECT_4K | SECT_32K | SPI_NOR_DUAL_READ | SPI_NOR_QUAD_READ},
+	{"w25q32",  {0xEF, 0x40, 0x16}, KB(64), 64,  SECT_4K | SECT_32K | SPI_NOR_DUAL_READ | SPI_NOR_QUAD_READ},
+	{"w25q64",  {0xEF, 0x40, 0x17}, KB(64), 128, SECT_4K | SECT_32K | SPI_NOR_DUAL_READ | SPI_NOR_QUAD_READ},
+	{"w25q128", {0xEF, 0x40, 0x18}, KB(64), 256, SECT_4K | SECT_32K | SPI_NOR_DUAL_READ | SPI_NOR_QUAD_READ},
+	{"w25q256", {0xEF, 0x40, 0x19}, KB(64), 512, SECT_4K | SECT_32K | SPI_NOR_DUAL_READ | SPI_NOR_QUAD_READ},
+	// GigaDevice
+	{"gd25q32", {0xC8, 0x40, 0x16}, KB(64), 64,  SECT_4K | SECT_32K | SPI_NOR_DUAL_READ | SPI_NOR_QUAD_READ},
+	{"gd25q64", {0xC8, 0x40, 0x17}, KB(64), 128, SECT_4K | SECT_32K | SPI_NOR_DUAL_READ | SPI_NOR_QUAD_READ},
+	// Macronix
+	{"mx25l3205d", {0xC2, 0x20, 0x16}, KB(64), 64,  SECT_4K},
+	{"mx25l6405d", {0xC2, 0x20, 0x17}, KB(64), 128, SECT_4K},
+	// Spansion
+	{"s25fl032p", {0x01, 0x02, 0x15}, KB(64), 64,  SECT_4K | SPI_NOR_DUAL_READ},
+	{"s25fl064p", {0x01, 0x02, 0x16}, KB(64), 128, SECT_4K | SPI_NOR_DUAL_READ},
+	{NULL},
+};
+
+static inline struct spi_nor *SPI_NOR(struct mtd_info *mtd)
+{
+	return container_of(mtd, struct spi_nor, parent);
+}
+
+// nor->cmd (opcode, address, dummy) then an optional data phase, chip selected throughout
+static int spi_nor_xfer(struct spi_nor *nor, __u32 cmd_len,
+			const __u8 *tx, __u8 *rx, __u32 len, __u8 rx_nbits)
+{
+	struct spi_trans_msg msg[2];
+
+	memset(msg, 0, sizeof(msg));
+
+	msg[0].tx_buf = nor->cmd;
+	msg[0].len    = cmd_len;
+
+	if (!len)
+		return spi_sync(nor->spi, msg, 1);
+
+	msg[1].tx_buf   = (__u8 *)tx;
+	msg[1].rx_buf   = rx;
+	msg[1].len      = len;
+	msg[1].rx_nbits = rx_nbits;
+
+	return spi_sync(nor->spi, msg, 2);
+}
+
+static int spi_nor_read_reg(struct spi_nor *nor, __u8 opcode, __u8 *val, __u32 len)
+{
+	nor->cmd[0] = opcode;
+	return spi_nor_xfer(nor, 1, NULL, val, len, 1);
+}
+
+static int spi_nor_write_reg(struct spi_nor *nor, __u8 opcode, const __u8 *val, __u32 len)
+{
+	nor->cmd[0] = opcode;
+	return spi_nor_xfer(nor, 1, val, NULL, len, 0);
+}
+
+// returns the command length
+static __u32 spi_nor_set_cmd(struct spi_nor *nor, __u8 opcode, __u32 addr)
+{
+	int i;
+
+	nor->cmd[0] = opcode;
+	for (i = 0; i < nor->addr_width; i++)
+		nor->cmd[1 + i] = addr >> (8 * (nor->addr_width - 1 - i));
+
+	return 1 + nor->addr_width;
+}
+
+static int spi_nor_wait_ready(struct spi_nor *nor, __u32 timeout)
+{
+	int ret;
+	__u32 i;
+	__u8 sr;
+
+	for (i = 0; i <= timeout * 10; i++) {
+		ret = spi_nor_read_reg(nor, SPINOR_OP_RDSR, &sr, 1);
+		if (ret < 0)
+			return ret;
+
+		if (!(sr & SR_WIP))
+			return 0;
+
+		udelay(100);
+	}
+
+	return -ETIMEDOUT;
+}
+
+static int spi_nor_write_enable(struct spi_nor *nor)
+{
+	return spi_nor_write_reg(nor, SPINOR_OP_WREN, NULL, 0);
+}
+
+static int spi_nor_read(struct mtd_info *mtd, __u64 from, __u32 len, size_t *retlen, __u8 *buff)
+{
+	int ret;
+	__u32 cmd_len;
+	struct spi_nor *nor = SPI_NOR(mtd);
+
+	*retlen = 0;
+
+	if (from >= mtd->chip_size || len > mtd->chip_size - from)
+		return -EINVAL;
+
+	if (!len)
+		return 0;
+
+	cmd_len = spi_nor_set_cmd(nor, nor->read_opcode, (__u32)from);
+	memset(nor->cmd + cmd_len, 0, nor->read_dummy);
+	cmd_len += nor->read_dummy;
+
+	ret = spi_nor_xfer(nor, cmd_len, NULL, buff, len, nor->read_nbits);
+	if (ret < 0)
+		return ret;
+
+	*retlen = len;
+
+	return 0;
+}
+
+static int spi_nor_write(struct mtd_info *mtd, __u64 to, __u32 len, __u32 *retlen, const __u8 *buff)
+{
+	int ret = 0;
+	__u32 addr, size, done = 0;
+	struct spi_nor *nor = SPI_NOR(mtd);
+
+	*retlen = 0;
+
+	if (to >= mtd->chip_size || len > mtd->chip_size - to)
+		return -EINVAL;
+
+	addr = (__u32)to;
+
+	while (done < len) {
+		// a program wraps around within its page, so stop at the page end
+		size = min(len - done, nor->page_size - (addr & (nor->page_size - 1)));
+
+		ret = spi_nor_write_enable(nor);
+		if (ret < 0)
+			break;
+
+		ret = spi_nor_xfer(nor, spi_nor_set_cmd(nor, SPINOR_OP_PP, addr),
+				buff + done, NULL, size, 0);
+		if (ret < 0)
+			break;
+
+		ret = spi_nor_wait_ready(nor, SPI_NOR_PROG_TIMEOUT);
+		if (ret < 0)
+			break;
+
+		addr += size;
+		done += size;
+	}
+
+	*retlen = done;
+
+	return ret;
+}
+
+static int spi_nor_erase(struct mtd_info *mtd, struct erase_info *opt)
+{
+	int i, ret;
+	__u8 opcode;
+	__u32 addr, end, size, timeout;
+	struct spi_nor *nor = SPI_NOR(mtd);
+
+	opt->fail_addr = FLASH_FAIL_ADDR_UNKNOWN;
+
+	if (opt->addr >= mtd->chip_size || opt->len > mtd->chip_size - opt->addr ||
+		(opt->addr | opt->len) & (mtd->erase_size - 1)) {
+		printf("%s(): erase range not aligned! (0x%08x + 0x%08x)\n",
+			__func__, (__u32)opt->addr, (__u32)opt->len);
+		opt->state = FLASH_ERASE_FAILED;
+		return -EINVAL;
+	}
+
+	addr = (__u32)opt->addr;
+	end  = addr + (__u32)opt->len;
+
+	opt->state = FLASH_ERASING;
+
+	while (addr < end) {
+		if (!addr && end == mtd->chip_size) {
+			opcode  = SPINOR_OP_CHIP_ERASE;
+			size    = end;
+			timeout = SPI_NOR_CHIP_TIMEOUT;
+		} else {
+			for (i = nor->erase_num - 1; i > 0; i--) {
+				if (!(addr & (nor->erase[i].size - 1)) && end - addr >= nor->erase[i].size)
+					break;
+			}
+
+			opcode  = nor->erase[i].opcode;
+			size    = nor->erase[i].size;
+			timeout = SPI_NOR_ERASE_TIMEOUT;
+		}
+
+		ret = spi_nor_write_enable(nor);
+		if (ret < 0)
+			goto L1;
+
+		if (SPINOR_OP_CHIP_ERASE == opcode) {
+			nor->cmd[0] = opcode;
+			ret = spi_nor_xfer(nor, 1, NULL, NULL, 0, 0);
+		} else {
+			ret = spi_nor_xfer(nor, spi_nor_set_cmd(nor, opcode, addr), NULL, NULL, 0, 0);
+		}
+
+		if (ret < 0)
+			goto L1;
+
+		ret = spi_nor_wait_ready(nor, timeout);
+		if (ret < 0)
+			goto L1;
+
+		if (mtd->callback_func && mtd->callback_args) {
+			mtd->callback_args->page_index  = addr >> mtd->write_shift;
+			mtd->callback_args->block_index = addr >> mtd->erase_shift;
+
+			mtd->callback_func(mtd, mtd->callback_args);
+		}
+
+		addr += size;
+	}
+
+	opt->state = FLASH_ERASE_DONE;
+
+	return 0;
+
+L1:
+	opt->state = FLASH_ERASE_FAILED;
+	opt->fail_addr = addr;
+	return ret;
+}
+
+static int spi_nor_read_sfdp(struct spi_nor *nor, __u32 addr, void *buff, __u32 len)
+{
+	nor->cmd[0] = SPINOR_OP_RDSFDP;
+	nor->cmd[1] = addr >> 16;
+	nor->cmd[2] = addr >> 8;
+	nor->cmd[3] = addr;
+	nor->cmd[4] = 0; // dummy
+
+	return spi_nor_xfer(nor, 5, NULL, buff, len, 1);
+}
+
+// fast read settings: wait states [4:0], mode clocks [7:5], opcode [15:8]
+static bool sfdp_read_usable(__u32 settings, __u8 opcode)
+{
+	return (settings >> 8 & 0xff) == opcode &&
+		(settings & 0x1f) + (settings >> 5 & 0x7) == 8;
+}
+
+/*
+ * Basic flash parameter table (JESD216): density, 1-1-2/1-1-4 fast read
+ * support, address width and up to four erase types. Dual/quad reads
+ * are only taken with the single dummy byte the driver sends.
+ */
+static int spi_nor_parse_sfdp(struct spi_nor *nor)
+{
+	int i, j, ret, n = 0;
+	__u8 hdr[16];
+	__u32 bfpt[SFDP_BFPT_DWORDS], ptr, dw, exp;
+	struct spi_nor_erase erase[SPI_NOR_MAX_ERASE], tmp;
+	struct mtd_info *mtd = &nor->parent;
+
+	ret = spi_nor_read_sfdp(nor, 0, hdr, sizeof(hdr));
+	if (ret < 0)
+		return ret;
+
+	// SFDP header, then the first parameter header which must be the BFPT
+	if (memcmp(hdr, "SFDP", 4) || hdr[8] != 0x00 || hdr[15] != 0xFF ||
+		hdr[11] < SFDP_BFPT_DWORDS)
+		return -ENODEV;
+
+	ptr = hdr[12] | hdr[13] << 8 | hdr[14] << 16;
+
+	ret = spi_nor_read_sfdp(nor, ptr, bfpt, sizeof(bfpt));
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < SFDP_BFPT_DWORDS; i++)
+		bfpt[i] = le32_to_cpu(bfpt[i]);
+
+	// density in bits: N - 1, or 2^N with bit 31 set
+	dw = bfpt[1];
+	if (dw & (1 << 31)) {
+		dw &= ~(1 << 31);
+		if (dw < 3 || dw > 34)
+			return -EINVAL;
+
+		mtd->chip_size = (__u64)1 << (dw - 3);
+	} else {
+		mtd->chip_size = (dw >> 3) + 1;
+	}
+
+	nor->flags &= ~(SPI_NOR_DUAL_READ | SPI_NOR_QUAD_READ);
+
+	if (bfpt[0] & (1 << 16) && sfdp_read_usable(bfpt[3], SPINOR_OP_READ_1_1_2))
+		nor->flags |= SPI_NOR_DUAL_READ;
+
+	if (bfpt[0] & (1 << 22) && sfdp_read_usable(bfpt[2] >> 16, SPINOR_OP_READ_1_1_4))
+		nor->flags |= SPI_NOR_QUAD_READ;
+
+	// 4-byte addressing only
+	if ((bfpt[0] >> 17 & 0x3) == 2)
+		nor->addr_width = 4;
+
+	// erase types: size exponent [7:0] and opcode [15:8], two per dword
+	for (i = 0; i < SPI_NOR_MAX_ERASE; i++) {
+		dw  = bfpt[7 + i / 2] >> (16 * (i % 2));
+		exp = dw & 0xff;
+		if (!exp || exp > 31)
+			continue;
+
+		erase[n].size   = 1 << exp;
+		erase[n].opcode = dw >> 8 & 0xff;
+
+		for (j = n; j > 0 && erase[j - 1].size > erase[j].size; j--) {
+			tmp = erase[j - 1];
+			erase[j - 1] = erase[j];
+			erase[j] = tmp;
+		}
+
+		n++;
+	}
+
+	if (n) {
+		memcpy(nor->erase, erase, n * sizeof(erase[0]));
+		nor->erase_num = n;
+	}
+
+	return 0;
+}
+
+// QE is bit 1 of status register 2, written along with status register 1
+static int spi_nor_quad_enable(struct spi_nor *nor)
+{
+	int ret;
+	__u8 sr[2];
+
+	ret = spi_nor_read_reg(nor, SPINOR_OP_RDSR, &sr[0], 1);
+	if (ret < 0)
+		return ret;
+
+	ret = spi_nor_read_reg(nor, SPINOR_OP_RDSR2, &sr[1], 1);
+	if (ret < 0)
+		return ret;
+
+	if (sr[1] & SR2_QE)
+		return 0;
+
+	sr[1] |= SR2_QE;
+
+	ret = spi_nor_write_enable(nor);
+	if (ret < 0)
+		return ret;
+
+	ret = spi_nor_write_reg(nor, SPINOR_OP_WRSR, sr, 2);
+	if (ret < 0)
+		return ret;
+
+	ret = spi_nor_wait_ready(nor, SPI_NOR_PROG_TIMEOUT);
+	if (ret < 0)
+		return ret;
+
+	ret = spi_nor_read_reg(nor, SPINOR_OP_RDSR2, &sr[1], 1);
+	if (ret < 0)
+		return ret;
+
+	return sr[1] & SR2_QE ? 0 : -EIO;
+}
+
+static void spi_nor_setup_read(struct spi_nor *nor)
+{
+	__u32 mode = nor->spi->master->mode;
+
+	nor->read_opcode = SPINOR_OP_READ_FAST;
+	nor->read_dummy  = 1;
+	nor->read_nbits  = 1;
+
+	if (nor->flags & SPI_NOR_QUAD_READ && mode & SPI_RX_QUAD &&
+		!spi_nor_quad_enable(nor)) {
+		nor->read_opcode = SPINOR_OP_READ_1_1_4;
+		nor->read_nbits  = 4;
+	} else if (nor->flags & SPI_NOR_DUAL_READ && mode & SPI_RX_DUAL) {
+		nor->read_opcode = SPINOR_OP_READ_1_1_2;
+		nor->read_nbits  = 2;
+	}
+}
+
+int spi_nor_register(struct spi_slave *spi)
+{
+	int i, ret;
+	__u8 id[SPI_NOR_MAX_ID_LEN];
+	const struct spi_nor_id *info = NULL;
+	struct spi_nor *nor;
+	struct mtd_info *mtd;
+
+	nor = zalloc(sizeof(*nor));
+	if (!nor)
+		return -ENOMEM;
+
+	mtd = &nor->parent;
+	nor->spi = spi;
+	nor->addr_width = 3;
+	nor->page_size  = 256;
+
+	ret = spi_nor_read_reg(nor, SPINOR_OP_RDID, id, sizeof(id));
+	if (ret < 0)
+		goto L1;
+
+	for (i = 0; g_spi_nor_ids[i].name; i++) {
+		if (!memcmp(g_spi_nor_ids[i].id, id, sizeof(id))) {
+			info = &g_spi_nor_ids[i];
+			break;
+		}
+	}
+
+	if (info) {
+		mtd->chip_size = info->sector_size * info->n_sectors;
+		nor->flags = info->flags;
+
+		if (info->flags & SECT_4K) {
+			nor->erase[nor->erase_num].size   = KB(4);
+			nor->erase[nor->erase_num].opcode = SPINOR_OP_BE_4K;
+			nor->erase_num++;
+		}
+
+		if (info->flags & SECT_32K) {
+			nor->erase[nor->erase_num].size   = KB(32);
+			nor->erase[nor->erase_num].opcode = SPINOR_OP_BE_32K;
+			nor->erase_num++;
+		}
+
+		nor->erase[nor->erase_num].size   = info->sector_size;
+		nor->erase[nor->erase_num].opcode = SPINOR_OP_SE;
+		nor->erase_num++;
+	}
+
+	// SFDP, when present, describes the chip better than the table
+	ret = spi_nor_parse_sfdp(nor);
+	if (ret < 0 && !info) {
+		printf("SPI NOR flash not detected! (ID = %02x %02x %02x)\n",
+			id[0], id[1], id[2]);
+		ret = -ENODEV;
+		goto L1;
+	}
+
+	if (!nor->erase_num || !mtd->chip_size) {
+		ret = -ENODEV;
+		goto L1;
+	}
+
+	// quad output needs QE, which is only set for the status register 2 layout
+	if (id[0] != SPI_NOR_MFR_WINBOND && id[0] != SPI_NOR_MFR_GIGADEVICE)
+		nor->flags &= ~SPI_NOR_QUAD_READ;
+
+	if (nor->addr_width == 3 && mtd->chip_size > MB(16)) {
+		ret = spi_nor_write_reg(nor, SPINOR_OP_EN4B, NULL, 0);
+		if (ret < 0)
+			goto L1;
+
+		nor->addr_width = 4;
+	}
+
+	spi_nor_setup_read(nor);
+
+	strncpy(mtd->name, info ? info->name : "spi-nor", sizeof(mtd->name));
+	mtd->type  = MTD_NORFLASH;
+	mtd->flags = MTD_WRITEABLE;
+
+	mtd->write_size  = nor->page_size;
+	mtd->erase_size  = nor->erase[0].size;
+	mtd->write_shift = ffs(mtd->write_size) - 1;
+	mtd->erase_shift = ffs(mtd->erase_size) - 1;
+	mtd->chip_shift  = ffs((__u32)mtd->chip_size) - 1;
+	mtd->oob_size    = 0;
+
+	mtd->read  = spi_nor_read;
+	mtd->write = spi_nor_write;
+	mtd->erase = spi_nor_erase;
+
+	printf("SPI NOR flash detected! flash details:\n"
+		"\tname   = %s (ID = %02x %02x %02x)\n"
+		"\tsize   = 0x%08x, erase = 0x%x, page = 0x%x\n"
+		"\tread   = 0x%02x on %d line(s)\n",
+		mtd->name, id[0], id[1], id[2], (__u32)mtd->chip_size,
+		mtd->erase_size, mtd->write_size, nor->read_opcode, nor->read_nbits);
+
+	ret = flash_register(mtd);
+	if (ret < 0)
+		goto L1;
+
+	return 0;
+
+L1:
+	free(nor);
+	return ret;
+}
+
+static int __init spi_nor_probe(void)
+{
+	struct spi_slave *spi;
+
+	// fixme: board specific
+	spi = get_spi_slave("w25x_nor_flash");
+	if (!spi || !spi->master)
+		return -ENODEV;
+
+	return spi_nor_register(spi);
+}
+
+module_init(spi_nor_probe);
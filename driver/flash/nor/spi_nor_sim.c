@@ -0,0 +1,459 @@
+#include <stdio.h>
+#include <init.h>
+#include <errno.h>
+#include <string.h>
+#include <malloc.h>
+#include <bitops.h>
+#include <sysconf.h>
+#include <spi.h>
+#include <mtd/spi_nor.h>
+
+/*
+ * RAM backed SPI NOR simulator behind its own spi_master. It decodes the
+ * command stream of a W25Q part (JEDEC ID, SFDP, status registers, fast,
+ * dual and quad output reads, page program, 4K/32K/64K/chip erase and
+ * 4-byte addressing), so spi_nor runs on it unchanged.
+ *
+ * Configured from sysconf, e.g.:
+ *   flash.norsim.size = 8     # MB, power of 2 from 2 to 32
+ *   flash.norsim.lines = 4    # data lines the master receives on: 1, 2 or 4
+ *
+ * Sectors are allocated on the first program and freed on erase. A
+ * program or erase keeps WIP set for a few status reads, so the driver's
+ * ready polling gets exercised.
+ */
+
+#define SIM_SECT_SIZE   KB(64)
+#define SIM_PAGE_SIZE   256
+#define SIM_SFDP_SIZE   0x60
+#define SIM_BFPT_OFF    0x30
+#define SIM_MAX_HDR     6
+
+#define SIM_PROG_BUSY   1 // status reads
+#define SIM_ERASE_BUSY  3
+
+struct nor_sim {
+	__u32 size;
+	__u32 sects;
+	__u8  **sect; // NULL while erased
+	__u8  id[SPI_NOR_MAX_ID_LEN];
+	__u8  sfdp[SIM_SFDP_SIZE];
+	__u8  sr1, sr2;
+	bool  addr4;
+	int   busy;
+
+	// current transfer
+	__u8  hdr[SIM_MAX_HDR];
+	__u32 hdr_len, pos, addr;
+	bool  wel;
+};
+
+static struct nor_sim g_nor_sim;
+
+static __u32 sim_get_conf(const char *attr, __u32 def)
+{
+	char buff[CONF_VAL_LEN];
+	unsigned long val;
+
+	if (conf_get_attr(attr, buff) < 0 || str_to_val(buff, &val) < 0)
+		return def;
+
+	return val;
+}
+
+static __u8 *sim_sect(struct nor_sim *sim, __u32 addr, bool alloc)
+{
+	__u32 n = addr / SIM_SECT_SIZE;
+
+	if (!sim->sect[n] && alloc) {
+		sim->sect[n] = malloc(SIM_SECT_SIZE);
+		if (sim->sect[n])
+			memset(sim->sect[n], 0xFF, SIM_SECT_SIZE);
+	}
+
+	return sim->sect[n];
+}
+
+static __u8 sim_read_byte(struct nor_sim *sim, __u32 addr)
+{
+	__u8 *sect = sim_sect(sim, addr, false);
+
+	return sect ? sect[addr % SIM_SECT_SIZE] : 0xFF;
+}
+
+// programming only clears bits
+static void sim_prog_byte(struct nor_sim *sim, __u32 addr, __u8 val)
+{
+	__u8 *sect = sim_sect(sim, addr, true);
+
+	if (sect)
+		sect[addr % SIM_SECT_SIZE] &= val;
+}
+
+static void sim_erase(struct nor_sim *sim, __u32 addr, __u32 size)
+{
+	__u8 *sect;
+
+	addr &= ~(size - 1);
+
+	if (size >= SIM_SECT_SIZE) {
+		for (; size; size -= SIM_SECT_SIZE, addr += SIM_SECT_SIZE) {
+			free(sim->sect[addr / SIM_SECT_SIZE]);
+			sim->sect[addr / SIM_SECT_SIZE] = NULL;
+		}
+	} else {
+		sect = sim_sect(sim, addr, false);
+		if (sect)
+			memset(sect + addr % SIM_SECT_SIZE, 0xFF, size);
+	}
+
+	sim->busy = SIM_ERASE_BUSY;
+}
+
+static __u32 sim_addr_bytes(struct nor_sim *sim, __u8 op)
+{
+	switch (op) {
+	case SPINOR_OP_RDSFDP:
+		return 3;
+
+	case SPINOR_OP_READ:
+	case SPINOR_OP_READ_FAST:
+	case SPINOR_OP_READ_1_1_2:
+	case SPINOR_OP_READ_1_1_4:
+	case SPINOR_OP_PP:
+	case SPINOR_OP_BE_4K:
+	case SPINOR_OP_BE_32K:
+	case SPINOR_OP_SE:
+		return sim->addr4 ? 4 : 3;
+
+	default:
+		return 0;
+	}
+}
+
+static __u32 sim_dummy_bytes(__u8 op)
+{
+	switch (op) {
+	case SPINOR_OP_RDSFDP:
+	case SPINOR_OP_READ_FAST:
+	case SPINOR_OP_READ_1_1_2:
+	case SPINOR_OP_READ_1_1_4:
+		return 1;
+
+	default:
+		return 0;
+	}
+}
+
+// command and address are in, act on the ones without a data phase
+static void sim_start(struct nor_sim *sim)
+{
+	int i;
+	__u8 op = sim->hdr[0];
+
+	sim->addr = 0;
+	for (i = 0; i < sim_addr_bytes(sim, op); i++)
+		sim->addr = sim->addr << 8 | sim->hdr[1 + i];
+
+	if (op != SPINOR_OP_RDSFDP)
+		sim->addr &= sim->size - 1;
+
+	switch (op) {
+	case SPINOR_OP_WREN:
+		sim->sr1 |= SR_WEL;
+		break;
+
+	case SPINOR_OP_WRDI:
+		sim->sr1 &= ~SR_WEL;
+		break;
+
+	case SPINOR_OP_EN4B:
+		sim->addr4 = true;
+		break;
+
+	case SPINOR_OP_BE_4K:
+	case SPINOR_OP_BE_32K:
+	case SPINOR_OP_SE:
+	case SPINOR_OP_CHIP_ERASE:
+		if (!sim->wel)
+			break;
+
+		if (SPINOR_OP_BE_4K == op)
+			sim_erase(sim, sim->addr, KB(4));
+		else if (SPINOR_OP_BE_32K == op)
+			sim_erase(sim, sim->addr, KB(32));
+		else if (SPINOR_OP_SE == op)
+			sim_erase(sim, sim->addr, KB(64));
+		else
+			sim_erase(sim, 0, sim->size);
+
+		break;
+
+	default:
+		break;
+	}
+}
+
+static __u8 sim_data_out(struct nor_sim *sim)
+{
+	__u8 val;
+
+	switch (sim->hdr[0]) {
+	case SPINOR_OP_RDID:
+		return sim->pos < sizeof(sim->id) ? sim->id[sim->pos++] : 0x00;
+
+	case SPINOR_OP_RDSR:
+		val = sim->sr1 | (sim->busy ? SR_WIP : 0);
+		if (sim->busy)
+			sim->busy--;
+		return val;
+
+	case SPINOR_OP_RDSR2:
+		return sim->sr2;
+
+	case SPINOR_OP_RDSFDP:
+		return sim->addr < SIM_SFDP_SIZE ? sim->sfdp[sim->addr++] : 0xFF;
+
+	case SPINOR_OP_READ:
+	case SPINOR_OP_READ_FAST:
+	case SPINOR_OP_READ_1_1_2:
+	case SPINOR_OP_READ_1_1_4:
+		val = sim_read_byte(sim, sim->addr);
+		sim->addr = (sim->addr + 1) & (sim->size - 1);
+		return val;
+
+	default:
+		return 0xFF;
+	}
+}
+
+static void sim_data_in(struct nor_sim *sim, __u8 val)
+{
+	switch (sim->hdr[0]) {
+	case SPINOR_OP_PP:
+		if (!sim->wel)
+			break;
+
+		// the column wraps within the page
+		sim_prog_byte(sim, (sim->addr & ~(SIM_PAGE_SIZE - 1)) |
+			((sim->addr + sim->pos++) & (SIM_PAGE_SIZE - 1)), val);
+		sim->busy = SIM_PROG_BUSY;
+		break;
+
+	case SPINOR_OP_WRSR:
+		if (!sim->wel)
+			break;
+
+		if (!sim->pos++)
+			sim->sr1 = (sim->sr1 & (SR_WIP | SR_WEL)) | (val & ~(SR_WIP | SR_WEL));
+		else
+			sim->sr2 = val;
+
+		sim->busy = SIM_PROG_BUSY;
+		break;
+
+	default:
+		break;
+	}
+}
+
+static int sim_check_lines(struct nor_sim *sim, struct spi_trans_msg *msg)
+{
+	if (!msg->rx_buf || msg->rx_nbits <= 1)
+		return 0;
+
+	if (2 == msg->rx_nbits && SPINOR_OP_READ_1_1_2 == sim->hdr[0])
+		return 0;
+
+	// IO2/IO3 are WP#/HOLD# until QE is set
+	if (4 == msg->rx_nbits && SPINOR_OP_READ_1_1_4 == sim->hdr[0] && sim->sr2 & SR2_QE)
+		return 0;
+
+	printf("norsim: command 0x%02x cannot be read on %d lines!\n",
+		sim->hdr[0], msg->rx_nbits);
+
+	return -EIO;
+}
+
+// one transfer is one chip select cycle
+static int nor_sim_transfer(struct spi_slave *slave)
+{
+	__u32 i;
+	__u8 tx;
+	bool busy;
+	struct nor_sim *sim = &g_nor_sim;
+	struct spi_trans_msg *msg;
+	struct list_head *iter;
+
+	sim->hdr[0]  = 0x00;
+	sim->hdr_len = 1;
+	sim->pos = 0;
+	busy = sim->busy > 0;
+
+	// the write enable latch is used up by the command that follows
+	sim->wel = sim->sr1 & SR_WEL;
+
+	list_for_each(iter, &slave->msg_qu) {
+		msg = container_of(iter, struct spi_trans_msg, msg_node);
+
+		for (i = 0; i < msg->len; i++) {
+			tx = msg->tx_buf ? msg->tx_buf[i] : 0xFF;
+
+			if (sim->pos < sim->hdr_len) {
+				sim->hdr[sim->pos++] = tx;
+
+				if (1 == sim->pos)
+					sim->hdr_len = 1 + sim_addr_bytes(sim, tx) + sim_dummy_bytes(tx);
+
+				if (msg->rx_buf)
+					msg->rx_buf[i] = 0xFF;
+
+				if (sim->pos == sim->hdr_len) {
+					// only the status can be read while busy
+					if (busy && sim->hdr[0] != SPINOR_OP_RDSR)
+						sim->hdr[0] = 0x00;
+
+					if (sim_check_lines(sim, msg) < 0)
+						return -EIO;
+
+					sim_start(sim);
+					sim->pos = 0;
+					sim->hdr_len = 0;
+				}
+
+				continue;
+			}
+
+			if (sim_check_lines(sim, msg) < 0)
+				return -EIO;
+
+			if (msg->tx_buf)
+				sim_data_in(sim, tx);
+
+			if (msg->rx_buf)
+				msg->rx_buf[i] = sim_data_out(sim);
+		}
+	}
+
+	switch (sim->hdr[0]) {
+	case SPINOR_OP_PP:
+	case SPINOR_OP_WRSR:
+	case SPINOR_OP_BE_4K:
+	case SPINOR_OP_BE_32K:
+	case SPINOR_OP_SE:
+	case SPINOR_OP_CHIP_ERASE:
+		sim->sr1 &= ~SR_WEL;
+		break;
+
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static void sim_put_le32(__u8 *p, __u32 val)
+{
+	p[0] = val;
+	p[1] = val >> 8;
+	p[2] = val >> 16;
+	p[3] = val >> 24;
+}
+
+// JESD216 header and a 9 dword basic flash parameter table
+static void sim_init_sfdp(struct nor_sim *sim)
+{
+	__u8 *bfpt = sim->sfdp + SIM_BFPT_OFF;
+
+	memset(sim->sfdp, 0xFF, sizeof(sim->sfdp));
+
+	memcpy(sim->sfdp, "SFDP", 4);
+	sim->sfdp[4] = 0x00; // minor
+	sim->sfdp[5] = 0x01; // major
+	sim->sfdp[6] = 0x00; // parameter headers - 1
+
+	sim->sfdp[8]  = 0x00; // BFPT id LSB
+	sim->sfdp[9]  = 0x00;
+	sim->sfdp[10] = 0x01;
+	sim->sfdp[11] = 9;    // dwords
+	sim->sfdp[12] = SIM_BFPT_OFF;
+	sim->sfdp[13] = 0x00;
+	sim->sfdp[14] = 0x00;
+	sim->sfdp[15] = 0xFF; // BFPT id MSB
+
+	// 4K erase (0x20), 1-1-2 and 1-1-4 reads, 3-byte or 3/4-byte addresses
+	sim_put_le32(bfpt, 0xFF800000 | 1 << 22 | 1 << 16 | SPINOR_OP_BE_4K << 8 | 1 << 2 | 0x1 |
+		(sim->size > MB(16) ? 1 << 17 : 0));
+	sim_put_le32(bfpt + 4, sim->size * 8 - 1);
+	sim_put_le32(bfpt + 8, (SPINOR_OP_READ_1_1_4 << 8 | 8) << 16);
+	sim_put_le32(bfpt + 12, SPINOR_OP_READ_1_1_2 << 8 | 8);
+	sim_put_le32(bfpt + 16, 0xFFFFFFEE);
+	sim_put_le32(bfpt + 20, 0x0000FFFF);
+	sim_put_le32(bfpt + 24, 0x0000FFFF);
+	sim_put_le32(bfpt + 28, (SPINOR_OP_BE_32K << 8 | 15) << 16 | SPINOR_OP_BE_4K << 8 | 12);
+	sim_put_le32(bfpt + 32, SPINOR_OP_SE << 8 | 16);
+}
+
+static int __init nor_sim_probe(void)
+{
+	int ret;
+	__u32 mb, lines;
+	struct nor_sim *sim = &g_nor_sim;
+	struct spi_master *master;
+	struct spi_slave *slave;
+
+	mb    = sim_get_conf("flash.norsim.size", 8);
+	lines = sim_get_conf("flash.norsim.lines", 4);
+
+	if (mb < 2 || mb > 32 || (mb & (mb - 1))) {
+		printf("norsim: unsupported size %d MB!\n", mb);
+		return -EINVAL;
+	}
+
+	sim->size  = MB(mb);
+	sim->sects = sim->size / SIM_SECT_SIZE;
+	sim->sect  = zalloc(sim->sects * sizeof(*sim->sect));
+	if (!sim->sect)
+		return -ENOMEM;
+
+	// W25Q16 .. W25Q256
+	sim->id[0] = 0xEF;
+	sim->id[1] = 0x40;
+	sim->id[2] = 0x15 + ffs(mb >> 1) - 1;
+
+	sim_init_sfdp(sim);
+
+	master = spi_master_alloc();
+	slave  = spi_slave_alloc();
+	if (!master || !slave) {
+		ret = -ENOMEM;
+		goto L1;
+	}
+
+	master->name     = "norsim";
+	master->transfer = nor_sim_transfer;
+	if (lines >= 4)
+		master->mode = SPI_RX_DUAL | SPI_RX_QUAD;
+	else if (lines >= 2)
+		master->mode = SPI_RX_DUAL;
+
+	slave->name = "norsim";
+	spi_slave_attach(master, slave);
+
+	ret = spi_nor_register(slave);
+	if (ret < 0)
+		goto L1;
+
+	// only hands out a bus number, the flash is up already
+	spi_master_register(master);
+
+	return 0;
+
+L1:
+	free(slave);
+	free(master);
+	free(sim->sect);
+	return ret;
+}
+
+module_init(nor_sim_probe);
@@ -9,6 +9,7 @@
 #define BLKNR 1
 #define MMC_BLK_SIZE 512
 #define MMC_HOST_NUM 5
+#define MMC_BUSY_TIMEOUT 100000 // status polls, 10us apart
 
 static int mmc_card_count = 0; // fixme
 
@@ -40,47 +41,162 @@ out:
 	return ret;
 }
 
-int mmc_read_blk(struct mmc_host *host, __u8 *buf, int start)
+// poll the card status instead of waiting a fixed time after a transfer
+static int mmc_wait_ready(struct mmc_host *host)
 {
-	int ret = 0;
+	int ret, timeout;
+
+	for (timeout = 0; timeout < MMC_BUSY_TIMEOUT; timeout++) {
+		ret = host->send_cmd(host, MMC_SEND_STATUS, host->card.rca << 16, R1);
+		if (ret < 0)
+			return ret;
+
+		if ((host->resp[0] & MMC_STATUS_READY_FOR_DATA) &&
+			MMC_STATUS_STATE(host->resp[0]) == MMC_STATE_TRAN)
+			return 0;
+
+		udelay(10);
+	}
+
+	printf("%s(): card busy timeout!\n", __func__);
+
+	return -ETIMEDOUT;
+}
 
+// high capacity cards are addressed in blocks, the others in bytes
+static inline __u32 mmc_data_addr(struct mmc_host *host, sector_t sect)
+{
 	if (host->card.raw_csd[3] & 3 << 29)
-		start = start >> 9;
+		return sect;
 
-	ret = host->send_cmd(host, MMC_READ_SINGLE_BLOCK, start, R1);
-	if (ret < 0)
-		return ret;
+	return sect * MMC_BLK_SIZE;
+}
 
-	ret = host->read_data(host, buf);
-	if (ret < 0)
-		return ret;
+static inline int mmc_max_blocks(struct mmc_host *host)
+{
+	return host->max_blocks > 1 ? host->max_blocks : 1;
+}
 
-	udelay(1000);
+static int mmc_start_data(struct mmc_host *host, __u32 single, __u32 multi,
+			sector_t sect, int count)
+{
+	int ret;
 
+	host->blocks = count;
 
-	return 0;
+	if (count == 1)
+		return host->send_cmd(host, single, mmc_data_addr(host, sect), R1);
+
+	if (host->caps & MMC_CAP_SET_BLOCK_COUNT) {
+		ret = host->send_cmd(host, MMC_SET_BLOCK_COUNT, count, R1);
+		if (ret < 0)
+			return ret;
+	}
+
+	return host->send_cmd(host, multi, mmc_data_addr(host, sect), R1);
 }
 
-int mmc_write_blk(struct mmc_host *host, const __u8 *buf, int start)
+/*
+ * After a failed command or block the host has not stopped the card,
+ * whatever its caps say, and its block count is stale.
+ */
+static int mmc_abort_data(struct mmc_host *host)
 {
-	int ret = 0;
+	int ret;
 
-	if (host->card.raw_csd[3] & 3 << 29)
-		start = start >> 9;
+	host->blocks = 0;
+	ret = host->send_cmd(host, MMC_STOP_TRANSMISSION, 0, R1b);
 
-	ret = host->send_cmd(host, MMC_WRITE_BLOCK, start, R1);
-	if (ret < 0)
-		return ret;
+	if (host->reset_data)
+		host->reset_data(host);
 
-	ret = host->write_data(host, buf);
-	if (ret < 0)
-		return ret;
+	return ret;
+}
+
+static int mmc_stop_data(struct mmc_host *host, int count, int err)
+{
+	if (err < 0)
+		return mmc_abort_data(host);
+
+	if (count == 1 || host->caps & (MMC_CAP_AUTO_STOP | MMC_CAP_SET_BLOCK_COUNT))
+		return 0;
 
-	udelay(1000);
+	return host->send_cmd(host, MMC_STOP_TRANSMISSION, 0, R1b);
+}
+
+// data comes from buf, or sector by sector from the request iterator
+static int mmc_xfer(struct mmc_host *host, int rw, sector_t start, int count,
+			__u8 *buf, struct req_iter *it)
+{
+	int ret, i, n;
+	void *data;
+
+	while (count > 0) {
+		n = min(count, mmc_max_blocks(host));
+
+		if (READ == rw)
+			ret = mmc_start_data(host, MMC_READ_SINGLE_BLOCK, MMC_READ_MULTIPLE_BLOCK, start, n);
+		else
+			ret = mmc_start_data(host, MMC_WRITE_BLOCK, MMC_WRITE_MULTIPLE_BLOCK, start, n);
+		if (ret < 0) {
+			mmc_abort_data(host);
+			return ret;
+		}
+
+		for (i = 0; i < n; i++) {
+			data = it ? req_iter_next(it) : buf + i * MMC_BLK_SIZE;
+
+			if (READ == rw)
+				ret = host->read_data(host, data);
+			else
+				ret = host->write_data(host, data);
+			if (ret < 0)
+				break;
+		}
+
+		// stop the card even after a failed block
+		if (mmc_stop_data(host, n, ret) < 0 && ret >= 0)
+			ret = -EIO;
+
+		if (ret < 0)
+			return ret;
+
+		// the card is programming until it returns to the tran state
+		if (WRITE == rw) {
+			ret = mmc_wait_ready(host);
+			if (ret < 0)
+				return ret;
+		}
+
+		if (buf)
+			buf += n * MMC_BLK_SIZE;
+		start += n;
+		count -= n;
+	}
 
 	return 0;
 }
 
+int mmc_read_blks(struct mmc_host *host, __u8 *buf, sector_t start, int count)
+{
+	return mmc_xfer(host, READ, start, count, buf, NULL);
+}
+
+int mmc_write_blks(struct mmc_host *host, const __u8 *buf, sector_t start, int count)
+{
+	return mmc_xfer(host, WRITE, start, count, (__u8 *)buf, NULL);
+}
+
+int mmc_read_blk(struct mmc_host *host, __u8 *buf, int start)
+{
+	return mmc_read_blks(host, buf, (__u32)start / MMC_BLK_SIZE, 1);
+}
+
+int mmc_write_blk(struct mmc_host *host, const __u8 *buf, int start)
+{
+	return mmc_write_blks(host, buf, (__u32)start / MMC_BLK_SIZE, 1);
+}
+
 int mmc_decode_cid(struct mmc_host *host)
 {
 	char *name = host->card.card_name;
@@ -113,6 +229,31 @@ static int mmc_put_block(struct disk_drive *drive, int start, const void *buff)
 	return mmc_write_blk(card->host, buff, start);
 }
 
+static int mmc_get_blocks(struct disk_drive *drive, sector_t start, int count, void *buff)
+{
+	struct mmc_card *card = container_of(drive, struct mmc_card, drive);
+
+	return mmc_read_blks(card->host, buff, start, count);
+}
+
+static int mmc_put_blocks(struct disk_drive *drive, sector_t start, int count, const void *buff)
+{
+	struct mmc_card *card = container_of(drive, struct mmc_card, drive);
+
+	return mmc_write_blks(card->host, buff, start, count);
+}
+
+// a merged request goes out as CMD18/CMD25 runs, whatever its segments
+static int mmc_request(struct disk_drive *drive, struct request *req)
+{
+	struct req_iter it;
+	struct mmc_card *card = container_of(drive, struct mmc_card, drive);
+
+	req_iter_init(&it, req);
+
+	return mmc_xfer(card->host, req->rw, req->sect, req->count, NULL, &it);
+}
+
 static int mmc_card_register(struct mmc_card *card)
 {
 	struct disk_drive *drive = &card->drive;
@@ -127,6 +268,9 @@ static int mmc_card_register(struct mmc_card *card)
 
 	drive->get_block = mmc_get_block;
 	drive->put_block = mmc_put_block;
+	drive->get_blocks = mmc_get_blocks;
+	drive->put_blocks = mmc_put_blocks;
+	drive->request = mmc_request;
 
 	return disk_drive_register(&card->drive);
 }
@@ -17,6 +17,14 @@
 #define MMC_INIT_SEQ_CLK        (MMC_CLOCK_REFERENCE * 1000 / 80)
 #define MMC_400kHz_CLK          (MMC_CLOCK_REFERENCE * 1000 / 400)
 
+#define MMC_STAT_TC             (1 << 1)
+#define MMC_STAT_BWR            (1 << 4)
+#define MMC_STAT_BRR            (1 << 5)
+#define MMC_STAT_ERRI           (1 << 15)
+
+#define MMC_DATA_TIMEOUT        100000 // polls, 10us apart
+#define MMC_MAX_BLOCKS          0xffff // MMCHS_BLK.NBLK
+
 #ifdef CONFIG_MMC_DEBUG
 #define MMC_PRINT(fmt, args ...)	printf(fmt, ##args)
 #else
@@ -35,20 +43,23 @@ static int omap3_mmc_write_data(struct mmc_host *mmc, const void *buf);
 static void mmc_clock_config(__u32 iclk, __u16 clk_div);
 static void omap3_set_hclk(void);
 static void omap3_set_lclk(void);
-static void omap3_soft_reset(void);
+static void omap3_mmc_reset_data(struct mmc_host *mmc);
 
+// ACEN is set for CMD18/CMD25, so the controller sends CMD12 itself
 static struct mmc_host omap3_mmc = {
 	.send_cmd = omap3_send_cmd,
 	.read_data = omap3_mmc_read_data,
 	.write_data = omap3_mmc_write_data,
+	.reset_data = omap3_mmc_reset_data,
 	.set_hclk = omap3_set_hclk,
 	.set_lclk = omap3_set_lclk,
+	.caps = MMC_CAP_AUTO_STOP,
+	.max_blocks = MMC_MAX_BLOCKS,
 };
 
 static void omap3_set_hclk(void)
 {
 	mmc_clock_config(CLK_MISC, 20);
-
 }
 
 static void omap3_set_lclk(void)
@@ -56,82 +67,119 @@ static void omap3_set_lclk(void)
 	mmc_clock_config(CLK_400KHZ, 0);
 }
 
-static int omap3_mmc_write_data(struct mmc_host *mmc, const void *buf)
+// wait for a MMCHS_STAT event, polling rather than sleeping a fixed time
+static int omap3_mmc_wait_stat(__u32 mask)
 {
 	__u32 val;
-	int i, timeout = 0;
+	int timeout;
 
-	do {
+	for (timeout = 0; timeout < MMC_DATA_TIMEOUT; timeout++) {
 		val = omap3_mmc_read(MMCHS_STAT);
-		MMC_PRINT("MMCHS_STAT = 0x%x %s(), line: %d\n", val, __FUNCTION__, __LINE__);
-		udelay(1000);
-		timeout++;
-	} while (!(val & 1 << 4) && timeout < 5);
+		if (val & mask)
+			return 0;
 
-	if (val & (1 << 4)) {
-		for (i = 0; i < 512 / 4; i++) {
-			val = ((__u32*)buf)[i];
-			omap3_mmc_write(MMCHS_DATA, val);
+		if (val & MMC_STAT_ERRI) {
+			MMC_PRINT("MMCHS_STAT = 0x%x %s(), line: %d\n", val, __FUNCTION__, __LINE__);
+			return -EIO;
 		}
-	} else {
-		MMC_PRINT("Write Buff is not ready!\n");
-		return -EBUSY;
+
+		udelay(10);
 	}
 
-	timeout = 0;
-	while (1) {
-		val = omap3_mmc_read(MMCHS_STAT);
-		timeout++;
-		udelay(1000);
-		MMC_PRINT("MMCHS_STAT = 0x%x %s(), line: %d\n", val, __FUNCTION__, __LINE__);
-		if ((val & (1 << 1)) || timeout > 5)
-			break;
+	MMC_PRINT("MMCHS_STAT = 0x%x timeout!\n", val);
+
+	return -ETIMEDOUT;
+}
+
+// after the last block of a command, wait for transfer (and auto CMD12) completion
+static int omap3_mmc_data_done(struct mmc_host *mmc)
+{
+	int ret;
+
+	if (mmc->blocks > 1) {
+		mmc->blocks--;
+		return 0;
 	}
 
-	return 0;
+	ret = omap3_mmc_wait_stat(MMC_STAT_TC);
+	omap3_mmc_write(MMCHS_STAT, omap3_mmc_read(MMCHS_STAT));
+
+	return ret;
+}
+
+static int omap3_mmc_write_data(struct mmc_host *mmc, const void *buf)
+{
+	int i, ret;
+
+	ret = omap3_mmc_wait_stat(MMC_STAT_BWR);
+	if (ret < 0) {
+		MMC_PRINT("Write Buff is not ready!\n");
+		return ret;
+	}
+
+	omap3_mmc_write(MMCHS_STAT, MMC_STAT_BWR);
+
+	for (i = 0; i < 512 / 4; i++)
+		omap3_mmc_write(MMCHS_DATA, ((__u32 *)buf)[i]);
+
+	return omap3_mmc_data_done(mmc);
 }
 
 static int omap3_mmc_read_data(struct mmc_host *mmc, void *buf)
+{
+	int i, ret;
+
+	ret = omap3_mmc_wait_stat(MMC_STAT_BRR);
+	if (ret < 0) {
+		MMC_PRINT("Read Buff is not ready!\n");
+		return ret;
+	}
+
+	omap3_mmc_write(MMCHS_STAT, MMC_STAT_BRR);
+
+	for (i = 0; i < 512 / 4; i++)
+		((__u32 *)buf)[i] = omap3_mmc_read(MMCHS_DATA);
+
+	return omap3_mmc_data_done(mmc);
+}
+
+// SRD: flush the data line and its buffer
+static void omap3_mmc_reset_data(struct mmc_host *mmc)
 {
 	__u32 val;
-	int i, timeout = 0;
+
+	val = omap3_mmc_read(MMCHS_SYSCTL);
+	val |= 1 << 26;
+	omap3_mmc_write(MMCHS_SYSCTL, val);
 
 	do {
-		val = omap3_mmc_read(MMCHS_STAT);
-		MMC_PRINT("MMCHS_STAT = 0x%x %s(), line: %d\n", val, __FUNCTION__, __LINE__);
-		udelay(1000);
-		timeout++;
-	} while (!(val & 1 << 5) && timeout < 5);
+		val = omap3_mmc_read(MMCHS_SYSCTL);
+		MMC_PRINT("MMCHS_SYSCTL = %x, line: %d\n", val, __LINE__);
+	} while (val & (1 << 26));
 
-	if (val & (1 << 5)) {
-		for (i = 0; i < 512 / 4; i++) {
-			val = omap3_mmc_read(MMCHS_DATA);
-			((__u32*)buf)[i] = val;
-		}
-	}else
-	{
-		MMC_PRINT("Read Buff is not ready!\n");
-		return -EBUSY;
-	}
+	omap3_mmc_write(MMCHS_STAT, 0xffffffff);
+}
 
-	timeout = 0;
-	while (1) {
-		val = omap3_mmc_read(MMCHS_STAT);
-		timeout++;
-		udelay(1000);
-		MMC_PRINT("MMCHS_STAT = 0x%x %s(), line: %d\n", val, __FUNCTION__, __LINE__);
-		if ((val & (1 << 1)) || timeout > 5)
-			break;
+// data path commands are paced by status polling, not by a fixed delay
+static inline bool omap3_is_data_cmd(__u32 index)
+{
+	switch (index) {
+	case MMC_STOP_TRANSMISSION:
+	case MMC_SEND_STATUS:
+	case MMC_READ_SINGLE_BLOCK:
+	case MMC_READ_MULTIPLE_BLOCK:
+	case MMC_SET_BLOCK_COUNT:
+	case MMC_WRITE_BLOCK:
+	case MMC_WRITE_MULTIPLE_BLOCK:
+		return true;
 	}
-	val = omap3_mmc_read(MMCHS_STAT);
-	omap3_mmc_write(MMCHS_STAT, val);
 
-	return 0;
+	return false;
 }
 
 static int omap3_send_cmd(struct mmc_host *mmc, __u32 index, __u32 arg, RESP type)
 {
-	__u32 cval, val, timeout;
+	__u32 cval, val, timeout, blk;
 
 	cval = index << 24;
 
@@ -164,6 +212,15 @@ static int omap3_send_cmd(struct mmc_host *mmc, __u32 index, __u32 arg, RESP typ
 	if (index == MMC_WRITE_BLOCK || index == MMC_WRITE_MULTIPLE_BLOCK)
 		cval |= 1 << 21;
 
+	blk = 0x200;
+	if (index == MMC_READ_MULTIPLE_BLOCK || index == MMC_WRITE_MULTIPLE_BLOCK) {
+		// MSBS + BCE, plus ACEN unless CMD23 already set the count
+		cval |= 1 << 5 | 1 << 1;
+		if (!(mmc->caps & MMC_CAP_SET_BLOCK_COUNT))
+			cval |= 1 << 2;
+		blk |= mmc->blocks << 16;
+	}
+
 	while (1) {
 		timeout = 0;
 		do {
@@ -173,17 +230,8 @@ static int omap3_send_cmd(struct mmc_host *mmc, __u32 index, __u32 arg, RESP typ
 		} while ((val & (1 << 1)) && (timeout < 10));
 
 		if (timeout == 10) {
-
 			MMC_PRINT("timeout, reset data line!\n");
-			val = omap3_mmc_read(MMCHS_SYSCTL);
-			val |= 1 << 26;
-			omap3_mmc_write(MMCHS_SYSCTL, val);
-
-			do {
-				val = omap3_mmc_read(MMCHS_SYSCTL);
-				MMC_PRINT("MMCHS_SYSCTL = %x, line: %d\n", val, __LINE__);
-			} while (val & (1 << 26));
-
+			omap3_mmc_reset_data(mmc);
 			continue;
 		}
 
@@ -191,7 +239,7 @@ static int omap3_send_cmd(struct mmc_host *mmc, __u32 index, __u32 arg, RESP typ
 
 	}
 	omap3_mmc_write(MMCHS_STAT, 0xffffffff);
-	omap3_mmc_write(MMCHS_BLK, 0x200);
+	omap3_mmc_write(MMCHS_BLK, blk);
 
 	omap3_mmc_write(MMCHS_ARG, arg);
 	omap3_mmc_write(MMCHS_CMD, cval);
@@ -233,7 +281,8 @@ static int omap3_send_cmd(struct mmc_host *mmc, __u32 index, __u32 arg, RESP typ
 		MMC_PRINT("cmd%d: arg = 0x%x val =0x%x\nresp[0]=0x%8x\nresp[1]=0x%8x\nresp[2]=0x%8x\nresp[3]=0x%8x\n",
 			index, arg, cval, mmc->resp[0], mmc->resp[1], mmc->resp[2], mmc->resp[3]);
 #else
-		udelay(8000);
+		if (!omap3_is_data_cmd(index))
+			udelay(8000);
 #endif
 
 	return 0;
@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <delay.h>
+#include <timer.h>
+#include <net/net.h>
+#include <net/skb.h>
+#include <net/netem.h>
+
+/*
+ * Link model of the netsim NIC: frames from the peer are held back in
+ * a delay line (latency + jitter), randomly dropped or allowed to
+ * overtake the queued ones, and frames to the peer are randomly
+ * dropped. A private seeded PRNG keeps a given setup reproducible.
+ */
+
+struct netem_pkt {
+	struct list_head node;
+	struct sock_buff *skb;
+	__u32 due;
+};
+
+static bool g_netem_on, g_netem_init;
+static struct netem_opt g_netem_opt;
+static struct netem_stat g_netem_stat;
+static __u32 g_netem_rand;
+
+static struct netem_pkt g_netem_pool[NETEM_QUEUE_LEN];
+static LIST_HEAD(g_netem_free);
+static LIST_HEAD(g_netem_queue); // sorted by due tick
+static __u32 g_netem_qlen;
+
+static inline __u32 netem_random(__u32 range)
+{
+	g_netem_rand = g_netem_rand * 1103515245 + 12345;
+	return (g_netem_rand >> 16) % range;
+}
+
+static inline bool netem_chance(__u32 percent)
+{
+	return percent && netem_random(100) < percent;
+}
+
+static inline bool tick_after_eq(__u32 a, __u32 b)
+{
+	return (int)(a - b) >= 0;
+}
+
+static void netem_flush(void)
+{
+	struct netem_pkt *pkt;
+
+	while (!list_empty(&g_netem_queue)) {
+		pkt = container_of(g_netem_queue.next, struct netem_pkt, node);
+		list_del(&pkt->node);
+		list_add_tail(&pkt->node, &g_netem_free);
+		netif_rx(pkt->skb);
+	}
+
+	g_netem_qlen = 0;
+}
+
+int netem_setup(const struct netem_opt *opt)
+{
+	int i;
+	__UNUSED__ __u32 psr;
+
+	if (opt->loss > 100 || opt->reorder > 100)
+		return -EINVAL;
+
+	// the delay line is paced by get_tick(), make sure it advances
+	if (opt->latency || opt->jitter) {
+		__u32 tick = get_tick();
+
+		for (i = 0; i < 100 && get_tick() == tick; i++)
+			udelay(1000);
+
+		if (get_tick() == tick)
+			return -ENOSYS;
+	}
+
+	lock_irq_psr(psr);
+
+	netem_flush();
+
+	if (!g_netem_init) {
+		for (i = 0; i < NETEM_QUEUE_LEN; i++)
+			list_add_tail(&g_netem_pool[i].node, &g_netem_free);
+		g_netem_init = true;
+	}
+
+	g_netem_opt = *opt;
+	g_netem_rand = opt->seed;
+	memset(&g_netem_stat, 0, sizeof(g_netem_stat));
+	g_netem_on = opt->latency || opt->jitter || opt->loss || opt->reorder;
+
+	unlock_irq_psr(psr);
+
+	return 0;
+}
+
+void netem_get_info(struct netem_opt *opt, struct netem_stat *stat)
+{
+	if (opt)
+		*opt = g_netem_opt;
+
+	if (stat)
+		*stat = g_netem_stat;
+}
+
+bool netem_active(void)
+{
+	return g_netem_on;
+}
+
+// returns true if the frame was consumed (queued or dropped)
+bool netem_rx(struct sock_buff *skb)
+{
+	__u32 delay;
+	struct list_head *iter;
+	struct netem_pkt *pkt, *pos;
+	__UNUSED__ __u32 psr;
+
+	if (!g_netem_on)
+		return false;
+
+	if (netem_chance(g_netem_opt.loss)) {
+		g_netem_stat.rx_dropped++;
+		skb_free(skb);
+		return true;
+	}
+
+	if (g_netem_qlen && netem_chance(g_netem_opt.reorder)) {
+		g_netem_stat.rx_reordered++;
+		return false;
+	}
+
+	delay = g_netem_opt.latency;
+	if (g_netem_opt.jitter)
+		delay += netem_random(g_netem_opt.jitter + 1);
+
+	if (!delay) {
+		g_netem_stat.rx_passed++;
+		return false;
+	}
+
+	lock_irq_psr(psr);
+
+	if (list_empty(&g_netem_free)) {
+		unlock_irq_psr(psr);
+		g_netem_stat.overflow++;
+		skb_free(skb);
+		return true;
+	}
+
+	pkt = container_of(g_netem_free.next, struct netem_pkt, node);
+	list_del(&pkt->node);
+	pkt->skb = skb;
+	pkt->due = get_tick() + delay;
+
+	// jitter may reorder frames, just as a real path would
+	list_for_each(iter, &g_netem_queue) {
+		pos = container_of(iter, struct netem_pkt, node);
+		if (!tick_after_eq(pkt->due, pos->due))
+			break;
+	}
+	list_add_tail(&pkt->node, iter);
+
+	g_netem_qlen++;
+	if (g_netem_qlen > g_netem_stat.max_queue)
+		g_netem_stat.max_queue = g_netem_qlen;
+
+	unlock_irq_psr(psr);
+
+	g_netem_stat.rx_delayed++;
+
+	return true;
+}
+
+bool netem_tx_drop(void)
+{
+	if (!g_netem_on || !netem_chance(g_netem_opt.loss))
+		return false;
+
+	g_netem_stat.tx_dropped++;
+	return true;
+}
+
+// deliver the frames whose delay has expired
+int netem_poll(void)
+{
+	int count = 0;
+	__u32 now = get_tick();
+	struct netem_pkt *pkt;
+	struct sock_buff *skb;
+	__UNUSED__ __u32 psr;
+
+	while (1) {
+		lock_irq_psr(psr);
+
+		if (list_empty(&g_netem_queue)) {
+			unlock_irq_psr(psr);
+			break;
+		}
+
+		pkt = container_of(g_netem_queue.next, struct netem_pkt, node);
+		if (!tick_after_eq(now, pkt->due)) {
+			unlock_irq_psr(psr);
+			break;
+		}
+
+		skb = pkt->skb;
+		list_del(&pkt->node);
+		list_add_tail(&pkt->node, &g_netem_free);
+		g_netem_qlen--;
+
+		unlock_irq_psr(psr);
+
+		netif_rx(skb);
+		count++;
+	}
+
+	return count;
+}
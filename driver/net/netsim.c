@@ -0,0 +1,990 @@
+#include <init.h>
+#include <stdio.h>
+#include <errno.h>
+#include <timer.h>
+#include <string.h>
+#include <sysconf.h>
+#include <net/net.h>
+#include <net/tftp.h>
+#include <net/nfs.h>
+#include <net/netem.h>
+#include <net/netsim.h>
+
+/*
+ * Virtual NIC whose wire ends in a stand-in peer host, so the stack,
+ * the sockets, DHCP and TFTP can be exercised and timed without a board
+ * NIC or a LAN. The peer answers ARP and ICMP echo, hands out an address
+ * by DHCP (Rapid Commit included) and serves TFTP: a read of any file
+ * name returns a generated file, a write is received and discarded.
+ * It also exports a read-only NFSv3 directory over UDP (portmap, MOUNT
+ * and NFS), in which any name looks up to that same generated file.
+ * Frames to the stack pass through netem, so its latency, jitter, loss
+ * and reordering settings apply to the link.
+ *
+ * The peer is set by sysconf, e.g.:
+ *   net.netsim.peer = 10.0.0.1       # peer (server) address
+ *   net.netsim.client = 10.0.0.2     # address offered by DHCP
+ *   net.netsim.file_size = 4M        # size of the file TFTP and NFS serve
+ *
+ * The stack sends through the first NIC, so build netsim without one.
+ */
+
+#ifdef CONFIG_IRQ_SUPPORT
+#error "netsim delivers frames from ndev_poll(), build it without CONFIG_IRQ_SUPPORT"
+#endif
+
+#define NETSIM_RX_QUEUE_LEN  64
+#define NETSIM_TFTP_PORT     1069 // server side TID
+#define NETSIM_TFTP_TIMEOUT  250  // ms, before the peer resends a block
+#define NETSIM_TFTP_RETRY    5
+#define NETSIM_LEASE_TIME    86400
+#define NETSIM_MOUNT_PORT    635
+#define NETSIM_NFS_PORT      2049
+#define NETSIM_FH_MAGIC      0x6e73696d // "nsim"
+#define NETSIM_ROOT_ID       1 // fileid of the export root
+#define NETSIM_FILE_ID       2 // fileid of the generated file
+#define NETSIM_RPC_WORDS     ((MAX_ETH_LEN + 3) / 4)
+
+#define DHCP_SERVER_PORT   67
+#define DHCP_CLIENT_PORT   68
+#define DHCP_OPT_LEN       64 // for the replies
+
+#define DHCP_PAD           0
+#define DHCP_SUBNET_MASK   1
+#define DHCP_ROUTER        3
+#define DHCP_REQUEST_IP    50
+#define DHCP_LEASE_TIME    51
+#define DHCP_MESSAGE       53
+#define DHCP_SERVER_ID     54
+#define DHCP_RAPID_COMMIT  80
+#define DHCP_END           0xff
+
+#define DHCPDISCOVER  1
+#define DHCPOFFER     2
+#define DHCPREQUEST   3
+#define DHCPACK       5
+#define DHCPNAK       6
+
+#define RPC_VERSION        2
+#define RPC_CALL           0
+#define RPC_REPLY          1
+#define RPC_MSG_ACCEPTED   0
+#define RPC_SUCCESS        0
+#define RPC_PROG_UNAVAIL   1
+#define RPC_PROC_UNAVAIL   3
+#define RPC_GARBAGE_ARGS   4
+#define RPC_AUTH_NULL      0
+#define RPC_AUTH_UNIX      1
+
+#define PMAPPROC_GETPORT   3
+#define MOUNTPROC3_MNT     1
+#define NFSPROC3_GETATTR   1
+#define NFSPROC3_LOOKUP    3
+#define NFSPROC3_READ      6
+
+#define NFS3_OK            0
+#define NFS3ERR_NOENT      2
+#define NFS3ERR_NOTDIR     20
+#define NFS3ERR_ISDIR      21
+#define NFS3ERR_BADHANDLE  10001
+
+struct dhcp_header {
+	__u8  op;
+	__u8  htype;
+	__u8  hlen;
+	__u8  hops;
+	__u32 xid;
+	__u16 secs;
+	__u16 flags;
+	__u32 ciaddr;
+	__u32 yiaddr;
+	__u32 siaddr;
+	__u32 giaddr;
+	__u8  chaddr[16];
+	__u8  sname[64];
+	__u8  file[128];
+	__u8  magic_cookie[4];
+} __PACKED__;
+
+struct tftp_packet {
+	__u16 op_code;
+	union {
+		__u16 block;
+		__u16 error;
+	};
+	__u8 data[0];
+} __PACKED__;
+
+struct netsim_tftp {
+	bool  active;
+	bool  write;
+	__u32 client_ip;
+	__u16 client_port; // network order
+	__u16 block;       // read: block in flight, write: last block received
+	__u32 len;         // read: length of the block in flight
+	__u32 sent;        // tick the block went out
+	int   retry;
+};
+
+// the decoded part of an RPC call, args is left at the procedure arguments
+struct rpc_call {
+	__u32 xid;
+	__u32 prog;
+	__u32 vers;
+	__u32 proc;
+	const __u32 *args, *end;
+};
+
+struct netsim {
+	__u8  peer_mac[MAC_ADR_LEN];
+	__u8  client_mac[MAC_ADR_LEN];
+	__u32 peer_ip;   // network order, as ndev->ip
+	__u32 client_ip;
+	__u32 file_size;
+	__u16 ip_id;
+
+	struct list_head rx_queue; // peer frames not yet polled by the stack
+	__u32 rx_qlen;
+
+	struct netsim_tftp tftp;
+	struct netsim_stat stat;
+};
+
+static const __u8 g_peer_mac[MAC_ADR_LEN] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+
+static struct netsim *g_netsim;
+
+// a frame from the peer to the stack, with room for @len bytes after the MAC header
+static struct sock_buff *peer_frame(struct netsim *sim, __u16 type, __u32 len)
+{
+	struct sock_buff *skb;
+	struct ether_header *eth;
+
+	if (sim->rx_qlen == NETSIM_RX_QUEUE_LEN) {
+		sim->stat.rx_overflow++;
+		return NULL;
+	}
+
+	skb = skb_alloc(0, ETH_HDR_LEN + len);
+	if (!skb)
+		return NULL;
+
+	eth = (struct ether_header *)skb->data;
+	memcpy(eth->des_mac, sim->client_mac, MAC_ADR_LEN);
+	memcpy(eth->src_mac, sim->peer_mac, MAC_ADR_LEN);
+	eth->frame_type = type;
+
+	return skb;
+}
+
+static void peer_queue(struct netsim *sim, struct sock_buff *skb)
+{
+	list_add_tail(&skb->node, &sim->rx_queue);
+	sim->rx_qlen++;
+}
+
+static void *peer_ip_frame(struct netsim *sim, struct sock_buff **pskb,
+			__u8 proto, __u32 dst_ip, __u32 len)
+{
+	struct sock_buff *skb;
+	struct ip_header *ip;
+
+	skb = peer_frame(sim, ETH_TYPE_IP, IP_HDR_LEN + len);
+	if (!skb)
+		return NULL;
+
+	ip = (struct ip_header *)(skb->data + ETH_HDR_LEN);
+	ip->ver_len   = 0x45;
+	ip->tos       = 0;
+	ip->total_len = htons(IP_HDR_LEN + len);
+	ip->id        = htons(sim->ip_id++);
+	ip->flag_frag = 0;
+	ip->ttl       = 64;
+	ip->up_prot   = proto;
+	ip->chksum    = 0;
+	memcpy(ip->src_ip, &sim->peer_ip, IPV4_ADR_LEN);
+	memcpy(ip->des_ip, &dst_ip, IPV4_ADR_LEN);
+	ip->chksum = ~net_calc_checksum(ip, IP_HDR_LEN);
+
+	*pskb = skb;
+
+	return ip + 1;
+}
+
+static void peer_udp_send(struct netsim *sim, __u32 dst_ip, __u16 src_port,
+			__u16 dst_port, const void *data, __u32 len)
+{
+	struct sock_buff *skb;
+	struct udp_header *udp;
+
+	udp = peer_ip_frame(sim, &skb, PROT_UDP, dst_ip, UDP_HDR_LEN + len);
+	if (!udp)
+		return;
+
+	udp->src_port = src_port;
+	udp->dst_port = dst_port;
+	udp->udp_len  = htons(UDP_HDR_LEN + len);
+	udp->checksum = 0; // optional over IPv4
+	memcpy(udp + 1, data, len);
+
+	peer_queue(sim, skb);
+}
+
+static void peer_arp(struct netsim *sim, const struct arp_packet *req)
+{
+	struct sock_buff *skb;
+	struct arp_packet *arp;
+
+	if (req->op_code != ARP_OP_REQ || memcmp(req->des_ip, &sim->peer_ip, IPV4_ADR_LEN))
+		return;
+
+	skb = peer_frame(sim, ETH_TYPE_ARP, ARP_PKT_LEN);
+	if (!skb)
+		return;
+
+	arp = (struct arp_packet *)(skb->data + ETH_HDR_LEN);
+	*arp = *req;
+	arp->op_code = ARP_OP_REP;
+	memcpy(arp->des_mac, req->src_mac, MAC_ADR_LEN);
+	memcpy(arp->des_ip, req->src_ip, IPV4_ADR_LEN);
+	memcpy(arp->src_mac, sim->peer_mac, MAC_ADR_LEN);
+	memcpy(arp->src_ip, &sim->peer_ip, IPV4_ADR_LEN);
+
+	sim->stat.arp++;
+	peer_queue(sim, skb);
+}
+
+static void peer_icmp(struct netsim *sim, const struct ip_header *ip,
+			const __u8 *data, __u32 len)
+{
+	__u32 src_ip;
+	struct sock_buff *skb;
+	struct ping_packet *ping;
+
+	if (len < sizeof(*ping) || data[0] != ICMP_TYPE_ECHO_REQUEST)
+		return;
+
+	memcpy(&src_ip, ip->src_ip, IPV4_ADR_LEN);
+
+	ping = peer_ip_frame(sim, &skb, PROT_ICMP, src_ip, len);
+	if (!ping)
+		return;
+
+	memcpy(ping, data, len);
+	ping->type   = ICMP_TYPE_ECHO_REPLY;
+	ping->chksum = 0;
+	ping->chksum = ~net_calc_checksum(ping, len);
+
+	sim->stat.icmp++;
+	peer_queue(sim, skb);
+}
+
+static const __u8 *dhcp_find_option(const __u8 *opt, int size, __u8 code, int *len)
+{
+	int pos = 0;
+
+	while (pos < size && opt[pos] != DHCP_END) {
+		if (opt[pos] == DHCP_PAD) {
+			pos++;
+			continue;
+		}
+
+		if (pos + 2 > size || pos + 2 + opt[pos + 1] > size)
+			break;
+
+		if (opt[pos] == code) {
+			*len = opt[pos + 1];
+			return opt + pos + 2;
+		}
+
+		pos += 2 + opt[pos + 1];
+	}
+
+	return NULL;
+}
+
+static int dhcp_put_option(__u8 *opt, int pos, __u8 code, __u8 len, const void *data)
+{
+	opt[pos++] = code;
+	opt[pos++] = len;
+	memcpy(opt + pos, data, len);
+
+	return pos + len;
+}
+
+// OFFER or (Rapid Commit) ACK for a DISCOVER, ACK or NAK for a REQUEST
+static void peer_dhcp(struct netsim *sim, const __u8 *data, __u32 len)
+{
+	int opt_len, opt_size, pos;
+	__u8 type;
+	__u32 want, lease;
+	bool rapid = false;
+	const __u8 *opt, *val;
+	struct dhcp_header req, *rep;
+	__u8 buff[sizeof(struct dhcp_header) + DHCP_OPT_LEN];
+	static const __u8 mask[] = {255, 255, 255, 0};
+
+	if (len < sizeof(req))
+		return;
+
+	// the header sits unaligned in the frame
+	memcpy(&req, data, sizeof(req));
+	opt = data + sizeof(req);
+	opt_size = len - sizeof(req);
+
+	if (req.op != 1)
+		return;
+
+	val = dhcp_find_option(opt, opt_size, DHCP_MESSAGE, &opt_len);
+	if (!val || opt_len != 1)
+		return;
+
+	switch (*val) {
+	case DHCPDISCOVER:
+		rapid = dhcp_find_option(opt, opt_size, DHCP_RAPID_COMMIT, &opt_len) != NULL;
+		type = rapid ? DHCPACK : DHCPOFFER;
+		break;
+
+	case DHCPREQUEST:
+		want = req.ciaddr;
+		val = dhcp_find_option(opt, opt_size, DHCP_REQUEST_IP, &opt_len);
+		if (val && opt_len == IPV4_ADR_LEN)
+			memcpy(&want, val, IPV4_ADR_LEN);
+
+		type = want == sim->client_ip ? DHCPACK : DHCPNAK;
+		break;
+
+	default:
+		return;
+	}
+
+	memset(buff, 0, sizeof(buff));
+	rep = (struct dhcp_header *)buff;
+
+	rep->op    = 2;
+	rep->htype = 1;
+	rep->hlen  = MAC_ADR_LEN;
+	rep->xid   = req.xid;
+	rep->flags = req.flags;
+	memcpy(rep->chaddr, req.chaddr, sizeof(rep->chaddr));
+	memcpy(rep->magic_cookie, req.magic_cookie, sizeof(rep->magic_cookie));
+
+	if (type != DHCPNAK) {
+		rep->yiaddr = sim->client_ip;
+		rep->siaddr = sim->peer_ip;
+	}
+
+	opt = buff + sizeof(*rep);
+	pos = dhcp_put_option((__u8 *)opt, 0, DHCP_MESSAGE, 1, &type);
+	pos = dhcp_put_option((__u8 *)opt, pos, DHCP_SERVER_ID, IPV4_ADR_LEN, &sim->peer_ip);
+
+	if (type != DHCPNAK) {
+		lease = htonl(NETSIM_LEASE_TIME);
+		pos = dhcp_put_option((__u8 *)opt, pos, DHCP_LEASE_TIME, sizeof(lease), &lease);
+		pos = dhcp_put_option((__u8 *)opt, pos, DHCP_SUBNET_MASK, sizeof(mask), mask);
+		pos = dhcp_put_option((__u8 *)opt, pos, DHCP_ROUTER, IPV4_ADR_LEN, &sim->peer_ip);
+		if (rapid)
+			pos = dhcp_put_option((__u8 *)opt, pos, DHCP_RAPID_COMMIT, 0, NULL);
+	}
+
+	((__u8 *)opt)[pos++] = DHCP_END;
+
+	sim->stat.dhcp++;
+	peer_udp_send(sim, 0xFFFFFFFF, htons(DHCP_SERVER_PORT), htons(DHCP_CLIENT_PORT),
+		buff, sizeof(*rep) + pos);
+}
+
+static void tftp_send_ack(struct netsim *sim, __u16 block)
+{
+	struct tftp_packet pkt;
+	struct netsim_tftp *tftp = &sim->tftp;
+
+	pkt.op_code = TFTP_ACK;
+	pkt.block   = htons(block);
+
+	peer_udp_send(sim, tftp->client_ip, htons(NETSIM_TFTP_PORT), tftp->client_port,
+		&pkt, TFTP_HDR_LEN);
+}
+
+// the file content is its own offset, so a transfer can be checked
+static void tftp_send_block(struct netsim *sim)
+{
+	__u32 i, offset;
+	__u8 buff[TFTP_BUF_LEN];
+	struct tftp_packet *pkt = (struct tftp_packet *)buff;
+	struct netsim_tftp *tftp = &sim->tftp;
+
+	offset = (tftp->block - 1) * TFTP_PKT_LEN;
+
+	tftp->len = sim->file_size - offset;
+	if (tftp->len > TFTP_PKT_LEN)
+		tftp->len = TFTP_PKT_LEN;
+
+	pkt->op_code = TFTP_DAT;
+	pkt->block   = htons(tftp->block);
+	for (i = 0; i < tftp->len; i++)
+		pkt->data[i] = (__u8)(offset + i);
+
+	peer_udp_send(sim, tftp->client_ip, htons(NETSIM_TFTP_PORT), tftp->client_port,
+		buff, TFTP_HDR_LEN + tftp->len);
+
+	tftp->sent = get_tick();
+}
+
+static void peer_tftp(struct netsim *sim, const struct ip_header *ip,
+			const struct udp_header *udp, const __u8 *data, __u32 len)
+{
+	__u16 block;
+	const struct tftp_packet *pkt = (const struct tftp_packet *)data;
+	struct netsim_tftp *tftp = &sim->tftp;
+
+	if (len < TFTP_HDR_LEN)
+		return;
+
+	// a new request replaces the current session
+	if (udp->dst_port == htons(STD_PORT_TFTP)) {
+		if (pkt->op_code != TFTP_RRQ && pkt->op_code != TFTP_WRQ)
+			return;
+
+		memcpy(&tftp->client_ip, ip->src_ip, IPV4_ADR_LEN);
+		tftp->client_port = udp->src_port;
+		tftp->write  = pkt->op_code == TFTP_WRQ;
+		tftp->active = true;
+		tftp->retry  = 0;
+
+		sim->stat.tftp_sessions++;
+
+		if (tftp->write) {
+			tftp->block = 0;
+			tftp_send_ack(sim, 0);
+		} else {
+			tftp->block = 1;
+			tftp_send_block(sim);
+		}
+
+		return;
+	}
+
+	if (!tftp->active || udp->dst_port != htons(NETSIM_TFTP_PORT) ||
+		udp->src_port != tftp->client_port)
+		return;
+
+	block = ntohs(pkt->block);
+
+	if (!tftp->write && pkt->op_code == TFTP_ACK) {
+		// a stale ACK is left to the resend timer
+		if (block != tftp->block)
+			return;
+
+		sim->stat.tftp_bytes_out += tftp->len;
+
+		if (tftp->len < TFTP_PKT_LEN) {
+			tftp->active = false;
+			return;
+		}
+
+		tftp->block++;
+		tftp->retry = 0;
+		tftp_send_block(sim);
+	} else if (tftp->write && pkt->op_code == TFTP_DAT) {
+		if (block == (__u16)(tftp->block + 1)) {
+			tftp->block = block;
+			sim->stat.tftp_bytes_in += len - TFTP_HDR_LEN;
+
+			if (len - TFTP_HDR_LEN < TFTP_PKT_LEN)
+				tftp->active = false;
+		}
+
+		// a duplicate is acked again, its ACK may have been lost
+		if (block == tftp->block)
+			tftp_send_ack(sim, block);
+	}
+}
+
+static void peer_tftp_timer(struct netsim *sim)
+{
+	struct netsim_tftp *tftp = &sim->tftp;
+
+	if (!tftp->active || tftp->write || get_tick() - tftp->sent < NETSIM_TFTP_TIMEOUT)
+		return;
+
+	if (++tftp->retry > NETSIM_TFTP_RETRY) {
+		tftp->active = false;
+		return;
+	}
+
+	sim->stat.tftp_rexmits++;
+	tftp_send_block(sim);
+}
+
+static inline __u32 *rpc_put(__u32 *p, __u32 val)
+{
+	*p++ = htonl(val);
+	return p;
+}
+
+static __u32 *rpc_put_opaque(__u32 *p, const void *data, __u32 len)
+{
+	*p++ = htonl(len);
+	if (len & 3)
+		p[len >> 2] = 0;
+	memcpy(p, data, len);
+
+	return p + ((len + 3) >> 2);
+}
+
+static bool rpc_get(struct rpc_call *call, __u32 *val)
+{
+	if (call->args >= call->end)
+		return false;
+
+	*val = ntohl(*call->args++);
+	return true;
+}
+
+static const void *rpc_get_opaque(struct rpc_call *call, __u32 *len)
+{
+	const void *data;
+
+	if (!rpc_get(call, len) || *len > (call->end - call->args) * 4)
+		return NULL;
+
+	data = call->args;
+	call->args += (*len + 3) >> 2;
+
+	return data;
+}
+
+// xid, accepted, null verifier, accept_stat
+static __u32 *rpc_put_reply(__u32 *p, __u32 xid, __u32 stat)
+{
+	p = rpc_put(p, xid);
+	p = rpc_put(p, RPC_REPLY);
+	p = rpc_put(p, RPC_MSG_ACCEPTED);
+	p = rpc_put(p, RPC_AUTH_NULL);
+	p = rpc_put(p, 0);
+
+	return rpc_put(p, stat);
+}
+
+static __u32 *peer_put_fh(__u32 *p, __u32 fileid)
+{
+	__u32 fh[2];
+
+	fh[0] = htonl(NETSIM_FH_MAGIC);
+	fh[1] = htonl(fileid);
+
+	return rpc_put_opaque(p, fh, sizeof(fh));
+}
+
+// 0 for a handle this peer did not hand out
+static __u32 peer_get_fh(struct rpc_call *call)
+{
+	__u32 len, fh[2];
+	const void *data;
+
+	data = rpc_get_opaque(call, &len);
+	if (!data || len != sizeof(fh))
+		return 0;
+
+	memcpy(fh, data, sizeof(fh));
+	if (ntohl(fh[0]) != NETSIM_FH_MAGIC)
+		return 0;
+
+	len = ntohl(fh[1]);
+
+	return len == NETSIM_ROOT_ID || len == NETSIM_FILE_ID ? len : 0;
+}
+
+// fattr3
+static __u32 *peer_put_fattr(struct netsim *sim, __u32 *p, __u32 fileid)
+{
+	bool dir = fileid == NETSIM_ROOT_ID;
+	__u32 size = dir ? 4096 : sim->file_size;
+	int i;
+
+	p = rpc_put(p, dir ? NFS3_DIR : NFS3_REG);
+	p = rpc_put(p, dir ? 0755 : 0644);
+	p = rpc_put(p, dir ? 2 : 1);  // nlink
+	p = rpc_put(p, 0);            // uid
+	p = rpc_put(p, 0);            // gid
+	p = rpc_put(p, 0);
+	p = rpc_put(p, size);
+	p = rpc_put(p, 0);
+	p = rpc_put(p, size);         // used
+	p = rpc_put(p, 0);            // rdev
+	p = rpc_put(p, 0);
+	p = rpc_put(p, 0);            // fsid
+	p = rpc_put(p, 1);
+	p = rpc_put(p, 0);
+	p = rpc_put(p, fileid);
+
+	// atime, mtime, ctime
+	for (i = 0; i < 6; i++)
+		p = rpc_put(p, 0);
+
+	return p;
+}
+
+static __u32 *peer_pmap(struct netsim *sim, struct rpc_call *call, __u32 *p)
+{
+	__u32 prog, vers, prot, port = 0;
+
+	if (call->proc != PMAPPROC_GETPORT)
+		return rpc_put_reply(p, call->xid, RPC_PROC_UNAVAIL);
+
+	if (!rpc_get(call, &prog) || !rpc_get(call, &vers) || !rpc_get(call, &prot))
+		return rpc_put_reply(p, call->xid, RPC_GARBAGE_ARGS);
+
+	if (prot == PROT_UDP && vers == 3) {
+		if (prog == RPC_PROG_MOUNT)
+			port = NETSIM_MOUNT_PORT;
+		else if (prog == RPC_PROG_NFS)
+			port = NETSIM_NFS_PORT;
+	}
+
+	p = rpc_put_reply(p, call->xid, RPC_SUCCESS);
+
+	return rpc_put(p, port);
+}
+
+// any absolute path mounts the export root
+static __u32 *peer_mount(struct netsim *sim, struct rpc_call *call, __u32 *p)
+{
+	__u32 len;
+	const char *path;
+
+	if (call->proc != MOUNTPROC3_MNT)
+		return rpc_put_reply(p, call->xid, RPC_PROC_UNAVAIL);
+
+	path = rpc_get_opaque(call, &len);
+	if (!path)
+		return rpc_put_reply(p, call->xid, RPC_GARBAGE_ARGS);
+
+	p = rpc_put_reply(p, call->xid, RPC_SUCCESS);
+
+	if (!len || path[0] != '/')
+		return rpc_put(p, NFS3ERR_NOENT);
+
+	p = rpc_put(p, NFS3_OK);
+	p = peer_put_fh(p, NETSIM_ROOT_ID);
+	p = rpc_put(p, 1); // auth flavors
+	p = rpc_put(p, RPC_AUTH_UNIX);
+
+	return p;
+}
+
+// the generated file: each byte is its own offset, as for TFTP
+static __u32 *peer_nfs_read(struct netsim *sim, struct rpc_call *call, __u32 *p, __u32 fileid)
+{
+	__u32 hi, lo, count, i;
+	__u8 *data;
+
+	if (!rpc_get(call, &hi) || !rpc_get(call, &lo) || !rpc_get(call, &count))
+		return NULL;
+
+	if (fileid != NETSIM_FILE_ID) {
+		p = rpc_put(p, NFS3ERR_ISDIR);
+		return rpc_put(p, 0);
+	}
+
+	if (hi || lo >= sim->file_size)
+		count = 0;
+	else if (count > sim->file_size - lo)
+		count = sim->file_size - lo;
+
+	if (count > NFS_MAX_RSIZE)
+		count = NFS_MAX_RSIZE;
+
+	p = rpc_put(p, NFS3_OK);
+	p = rpc_put(p, 1);
+	p = peer_put_fattr(sim, p, fileid);
+	p = rpc_put(p, count);
+	p = rpc_put(p, hi || lo + count >= sim->file_size);
+	p = rpc_put(p, count);
+
+	data = (__u8 *)p;
+	for (i = 0; i < count; i++)
+		data[i] = (__u8)(lo + i);
+	for (; i & 3; i++)
+		data[i] = 0;
+
+	sim->stat.nfs_bytes_out += count;
+
+	return p + (i >> 2);
+}
+
+static __u32 *peer_nfs(struct netsim *sim, struct rpc_call *call, __u32 *p)
+{
+	__u32 fileid, len;
+	__u32 *res;
+
+	if (call->proc != NFSPROC3_GETATTR && call->proc != NFSPROC3_LOOKUP &&
+		call->proc != NFSPROC3_READ)
+		return rpc_put_reply(p, call->xid, RPC_PROC_UNAVAIL);
+
+	res = rpc_put_reply(p, call->xid, RPC_SUCCESS);
+
+	fileid = peer_get_fh(call);
+	if (!fileid) {
+		res = rpc_put(res, NFS3ERR_BADHANDLE);
+		// GETATTR has nothing else, LOOKUP and READ an empty post_op_attr
+		return call->proc == NFSPROC3_GETATTR ? res : rpc_put(res, 0);
+	}
+
+	switch (call->proc) {
+	case NFSPROC3_GETATTR:
+		res = rpc_put(res, NFS3_OK);
+		return peer_put_fattr(sim, res, fileid);
+
+	case NFSPROC3_LOOKUP:
+		if (!rpc_get_opaque(call, &len))
+			break;
+
+		if (fileid != NETSIM_ROOT_ID) {
+			res = rpc_put(res, NFS3ERR_NOTDIR);
+			return rpc_put(res, 0);
+		}
+
+		res = rpc_put(res, NFS3_OK);
+		res = peer_put_fh(res, NETSIM_FILE_ID);
+		res = rpc_put(res, 1);
+		res = peer_put_fattr(sim, res, NETSIM_FILE_ID);
+		res = rpc_put(res, 1);
+		return peer_put_fattr(sim, res, NETSIM_ROOT_ID);
+
+	default:
+		res = peer_nfs_read(sim, call, res, fileid);
+		if (res)
+			return res;
+		break;
+	}
+
+	return rpc_put_reply(p, call->xid, RPC_GARBAGE_ARGS);
+}
+
+// portmap, MOUNT and NFS calls, each answered from the port it came to
+static void peer_rpc(struct netsim *sim, const struct ip_header *ip,
+			const struct udp_header *udp, const __u8 *data, __u32 len)
+{
+	__u32 msg, vers, flavor, cred_len, client_ip;
+	__u32 call_buff[NETSIM_RPC_WORDS], reply[NETSIM_RPC_WORDS];
+	__u32 *p;
+	struct rpc_call call;
+
+	if (len > sizeof(call_buff))
+		return;
+
+	// the call sits unaligned in the frame
+	memcpy(call_buff, data, len);
+	call.args = call_buff;
+	call.end  = call_buff + len / 4;
+
+	if (!rpc_get(&call, &call.xid) || !rpc_get(&call, &msg) || msg != RPC_CALL ||
+		!rpc_get(&call, &vers) || vers != RPC_VERSION ||
+		!rpc_get(&call, &call.prog) || !rpc_get(&call, &call.vers) ||
+		!rpc_get(&call, &call.proc))
+		return;
+
+	// credential and verifier, neither is checked
+	if (!rpc_get(&call, &flavor) || !rpc_get_opaque(&call, &cred_len) ||
+		!rpc_get(&call, &flavor) || !rpc_get_opaque(&call, &cred_len))
+		return;
+
+	sim->stat.nfs_calls++;
+
+	if (udp->dst_port == htons(STD_PORT_PORTMAP) && call.prog == RPC_PROG_PORTMAP && call.vers == 2)
+		p = peer_pmap(sim, &call, reply);
+	else if (udp->dst_port == htons(NETSIM_MOUNT_PORT) && call.prog == RPC_PROG_MOUNT && call.vers == 3)
+		p = peer_mount(sim, &call, reply);
+	else if (udp->dst_port == htons(NETSIM_NFS_PORT) && call.prog == RPC_PROG_NFS && call.vers == 3)
+		p = peer_nfs(sim, &call, reply);
+	else
+		p = rpc_put_reply(reply, call.xid, RPC_PROG_UNAVAIL);
+
+	memcpy(&client_ip, ip->src_ip, IPV4_ADR_LEN);
+	peer_udp_send(sim, client_ip, udp->dst_port, udp->src_port,
+		reply, (p - reply) * 4);
+}
+
+static void peer_input(struct netsim *sim, const __u8 *frame, __u32 len)
+{
+	__u32 hdr_len, ip_len, dst_ip;
+	const struct ether_header *eth = (const struct ether_header *)frame;
+	const struct ip_header *ip;
+	const struct udp_header *udp;
+	static const __u8 bcast_mac[MAC_ADR_LEN] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+
+	if (len < ETH_HDR_LEN)
+		return;
+
+	if (memcmp(eth->des_mac, sim->peer_mac, MAC_ADR_LEN) &&
+		memcmp(eth->des_mac, bcast_mac, MAC_ADR_LEN))
+		return;
+
+	memcpy(sim->client_mac, eth->src_mac, MAC_ADR_LEN);
+
+	frame += ETH_HDR_LEN;
+	len   -= ETH_HDR_LEN;
+
+	if (eth->frame_type == ETH_TYPE_ARP) {
+		if (len >= ARP_PKT_LEN)
+			peer_arp(sim, (const struct arp_packet *)frame);
+		return;
+	}
+
+	if (eth->frame_type != ETH_TYPE_IP || len < IP_HDR_LEN)
+		return;
+
+	ip = (const struct ip_header *)frame;
+	hdr_len = (ip->ver_len & 0xf) << 2;
+	ip_len  = ntohs(ip->total_len);
+	if (hdr_len < IP_HDR_LEN || ip_len < hdr_len || ip_len > len)
+		return;
+
+	memcpy(&dst_ip, ip->des_ip, IPV4_ADR_LEN);
+	if (dst_ip != sim->peer_ip && dst_ip != 0xFFFFFFFF)
+		return;
+
+	frame += hdr_len;
+	len    = ip_len - hdr_len;
+
+	switch (ip->up_prot) {
+	case PROT_ICMP:
+		peer_icmp(sim, ip, frame, len);
+		break;
+
+	case PROT_UDP:
+		if (len < UDP_HDR_LEN)
+			break;
+
+		udp = (const struct udp_header *)frame;
+
+		if (udp->dst_port == htons(DHCP_SERVER_PORT))
+			peer_dhcp(sim, frame + UDP_HDR_LEN, len - UDP_HDR_LEN);
+		else if (udp->dst_port == htons(STD_PORT_PORTMAP) ||
+			udp->dst_port == htons(NETSIM_MOUNT_PORT) ||
+			udp->dst_port == htons(NETSIM_NFS_PORT))
+			peer_rpc(sim, ip, udp, frame + UDP_HDR_LEN, len - UDP_HDR_LEN);
+		else
+			peer_tftp(sim, ip, udp, frame + UDP_HDR_LEN, len - UDP_HDR_LEN);
+		break;
+
+	default:
+		break;
+	}
+}
+
+static int netsim_send_packet(struct net_device *ndev, struct sock_buff *skb)
+{
+	struct netsim *sim = ndev->chip;
+
+	ndev->stat.tx_packets++;
+
+	if (netem_tx_drop())
+		return skb->size; // lost on the wire
+
+	sim->stat.tx_frames++;
+	peer_input(sim, skb->data, skb->size);
+
+	return skb->size;
+}
+
+static int netsim_poll(struct net_device *ndev)
+{
+	struct netsim *sim = ndev->chip;
+	struct sock_buff *skb;
+
+	peer_tftp_timer(sim);
+
+	while (!list_empty(&sim->rx_queue)) {
+		skb = container_of(sim->rx_queue.next, struct sock_buff, node);
+		list_del_init(&skb->node);
+		sim->rx_qlen--;
+
+		sim->stat.rx_frames++;
+		ndev->stat.rx_packets++;
+
+		if (!netem_rx(skb))
+			netif_rx(skb);
+	}
+
+	netem_poll();
+
+	return 0;
+}
+
+static int netsim_set_mac(struct net_device *ndev, const __u8 mac[])
+{
+	return 0;
+}
+
+void netsim_get_stat(struct netsim_stat *stat)
+{
+	if (g_netsim)
+		*stat = g_netsim->stat;
+	else
+		memset(stat, 0, sizeof(*stat));
+}
+
+void netsim_clear_stat(void)
+{
+	if (g_netsim)
+		memset(&g_netsim->stat, 0, sizeof(g_netsim->stat));
+}
+
+static void netsim_get_ip(const char *attr, __u32 *ip, __u32 def)
+{
+	char buff[CONF_VAL_LEN];
+
+	if (conf_get_attr(attr, buff) < 0 || str_to_ip((__u8 *)ip, buff) < 0)
+		*ip = def;
+}
+
+static int __init netsim_init(void)
+{
+	int ret;
+	unsigned long val;
+	char buff[CONF_VAL_LEN];
+	struct net_device *ndev;
+	struct netsim *sim;
+
+	ndev = ndev_new(sizeof(*sim));
+	if (!ndev)
+		return -ENOMEM;
+
+	sim = ndev->chip;
+	INIT_LIST_HEAD(&sim->rx_queue);
+	memcpy(sim->peer_mac, g_peer_mac, MAC_ADR_LEN);
+
+	netsim_get_ip("net.netsim.peer", &sim->peer_ip, MKIP(10, 0, 0, 1));
+	netsim_get_ip("net.netsim.client", &sim->client_ip, MKIP(10, 0, 0, 2));
+
+	if (conf_get_attr("net.netsim.file_size", buff) < 0 || hr_str_to_val(buff, &val) < 0)
+		val = MB(1);
+
+	// TFTP block numbers are 16-bit
+	if (val >= 0xFFFF * TFTP_PKT_LEN)
+		val = 0xFFFF * TFTP_PKT_LEN - 1;
+	sim->file_size = val;
+
+	ndev->chip_name    = "netsim";
+	ndev->phy_mask     = 0;
+	ndev->set_mac_addr = netsim_set_mac;
+	ndev->send_packet  = netsim_send_packet;
+	ndev->ndev_poll    = netsim_poll;
+	ndev->link.connected = true;
+	ndev->link.speed     = ETHER_SPEED_100M_FD;
+
+	ret = ndev_register(ndev);
+	if (ret < 0) {
+		ndev_del(ndev);
+		return ret;
+	}
+
+	g_netsim = sim;
+
+	return 0;
+}
+
+module_init(netsim_init);
@@ -17,11 +17,24 @@ int spi_transfer(struct spi_slave *slave)
 	return master->transfer(slave);
 }
 
+int spi_sync(struct spi_slave *slave, struct spi_trans_msg msg[], int n)
+{
+	int i;
+
+	INIT_LIST_HEAD(&slave->msg_qu);
+	for (i = 0; i < n; i++)
+		list_add_tail(&msg[i].msg_node, &slave->msg_qu);
+
+	return spi_transfer(slave);
+}
+
 int spi_write_then_read(struct spi_slave *slave, __u8 *tx_buf, __u32 n_tx, __u8 *rx_buf, __u32 n_rx)
 {
 	enum TX_TYPE {TX, RX};
 	struct spi_trans_msg tx[2];
 
+	memset(tx, 0, sizeof(tx));
+
 	tx[TX].tx_buf = tx_buf;
 	tx[TX].rx_buf = NULL;
 	tx[TX].len= n_tx;
@@ -30,11 +43,7 @@ int spi_write_then_read(struct spi_slave *slave, __u8 *tx_buf, __u32 n_tx, __u8
 	tx[RX].rx_buf = rx_buf;
 	tx[RX].len   = n_rx;
 
-	INIT_LIST_HEAD(&slave->msg_qu);
-	list_add_tail(&tx[TX].msg_node, &slave->msg_qu);
-	list_add_tail(&tx[RX].msg_node, &slave->msg_qu);
-
-	return spi_transfer(slave);
+	return spi_sync(slave, tx, 2);
 }
 
 struct spi_master *spi_master_alloc()
@@ -46,6 +55,7 @@ struct spi_master *spi_master_alloc()
 		return NULL;
 
 	master->bus_num = -1;
+	master->mode = 0;
 	INIT_LIST_HEAD(&master->slave_list);
 	master->transfer = NULL;
 
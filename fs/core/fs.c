@@ -18,6 +18,7 @@ struct super_block *sget(struct file_system_type *type, void *data)
 		return NULL;
 	}
 
+	sb->s_type = type;
 	sb->s_bdev = data;
 
 	return sb;
@@ -48,13 +49,72 @@ struct dentry *mount_bdev(struct file_system_type *fs_type,
 	return sb->s_root;
 }
 
+/*
+ * Dentries are hashed on (parent, name hash) so that path_walk() finds a
+ * component without scanning the parent's children. Names the filesystem
+ * failed to find stay hashed as negative entries (no inode, off the
+ * parent's child list) until the name gets created.
+ */
+static struct list_head *dentry_hashtable;
+
+static struct list_head *d_hash(const struct dentry *parent, unsigned int hash)
+{
+	int i;
+
+	if (!dentry_hashtable) {
+		dentry_hashtable = malloc(DENTRY_HASH_SIZE * sizeof(*dentry_hashtable));
+		if (!dentry_hashtable)
+			return NULL;
+
+		for (i = 0; i < DENTRY_HASH_SIZE; i++)
+			INIT_LIST_HEAD(&dentry_hashtable[i]);
+	}
+
+	hash += (unsigned long)parent >> 4;
+
+	return &dentry_hashtable[hash & (DENTRY_HASH_SIZE - 1)];
+}
+
+struct dentry *d_lookup(struct dentry *parent, const struct qstr *unit)
+{
+	struct list_head *bucket, *iter;
+	struct dentry *de;
+
+	bucket = d_hash(parent, unit->hash);
+	if (!bucket)
+		return NULL;
+
+	list_for_each(iter, bucket) {
+		de = container_of(iter, struct dentry, d_hash);
+		if (de->d_parent == parent && de->d_name.hash == unit->hash && \
+			de->d_name.len == unit->len && \
+			!strncmp(de->d_name.name, unit->name, unit->len))
+			return de;
+	}
+
+	return NULL;
+}
+
 struct dentry *d_alloc(struct dentry *parent, const struct qstr *str)
 {
-	struct dentry *de = __d_alloc(parent->d_sb, str);
+	struct list_head *bucket;
+	struct dentry *de, *old;
+
+	de = __d_alloc(parent->d_sb, str);
+	if (!de)
+		return NULL;
+
+	old = d_lookup(parent, &de->d_name);
+	if (old && !old->d_inode)
+		d_free(old);
 
 	de->d_parent = parent;
 	list_add_tail(&de->d_child, &parent->d_subdirs);
 
+	bucket = d_hash(parent, de->d_name.hash);
+	if (bucket)
+		list_add(&de->d_hash, bucket);
+
 	return de;
 }
 
@@ -71,6 +131,7 @@ struct dentry *__d_alloc(struct super_block *sb, const struct qstr *str)
 	de->d_parent = de;
 	INIT_LIST_HEAD(&de->d_child);
 	INIT_LIST_HEAD(&de->d_subdirs);
+	INIT_LIST_HEAD(&de->d_hash);
 
 	de->d_name.len = str->len;
 	if (str->len >= DNAME_INLINE_LEN) {
@@ -85,10 +146,22 @@ struct dentry *__d_alloc(struct super_block *sb, const struct qstr *str)
 	de->d_name.name = name;
 	strncpy(name, str->name, str->len);
 	name[str->len] = '\0';
+	de->d_name.hash = full_name_hash(name, str->len);
 
 	return de;
 }
 
+void d_free(struct dentry *dentry)
+{
+	list_del(&dentry->d_hash);
+	list_del(&dentry->d_child);
+
+	if (dentry->d_name.name != dentry->d_iname)
+		free((void *)dentry->d_name.name);
+
+	free(dentry);
+}
+
 struct dentry *d_make_root(struct inode *root_inode)
 {
 	struct dentry *root_dir = NULL;
@@ -106,7 +179,8 @@ struct dentry *d_make_root(struct inode *root_inode)
 
 void dput(struct dentry *dentry)
 {
-	list_del(&dentry->d_child);
+	list_del_init(&dentry->d_child);
+	list_del_init(&dentry->d_hash);
 }
 
 struct inode *iget(struct super_block *sb, unsigned long ino)
@@ -208,13 +282,12 @@ long sys_mkdir(const char *name, unsigned int /*fixme*/ mode)
 	unit.len = strlen(name);
 
 	de = d_alloc(nd.path.dentry, &unit);
+	if (!de)
+		return -ENOMEM;
 
 	ret = vfs_mkdir(nd.path.dentry->d_inode, de, mode | S_IFDIR);
-	if (ret < 0) {
-		// fixme: use d_free() instead
-		list_del(&de->d_child);
-		free(de);
-	}
+	if (ret < 0)
+		d_free(de);
 
 	return ret;
 }
@@ -15,21 +15,6 @@ static inline void path_to_nameidata(const struct path *path,
 	nd->path.dentry = path->dentry;
 }
 
-struct dentry *d_lookup(struct dentry *parent, struct qstr *unit)
-{
-	struct dentry *de;
-	struct list_head *iter;
-
-	list_for_each(iter, &parent->d_subdirs) {
-		de = container_of(iter, struct dentry, d_child);
-		if (de->d_name.len == unit->len && \
-			!strncmp(de->d_name.name, unit->name, unit->len))
-			return de;
-	}
-
-	return NULL;
-}
-
 static int real_lookup(struct dentry *parent, struct qstr *unit,
 		     struct nameidata *nd, struct dentry **result)
 {
@@ -40,10 +25,21 @@ static int real_lookup(struct dentry *parent, struct qstr *unit,
 		struct inode *dir = parent->d_inode;
 
 		ret = dir->i_op->lookup(dir, dentry, nd);
+		if (!ret && !dentry->d_inode)
+			ret = -ENOENT;
+
+		// keep the miss as a negative entry, unless the file may show up later
+		if (-ENOENT == ret && !(dir->i_sb->s_type->fs_flags & (FS_REMOTE | FS_DYNAMIC))) {
+			list_del_init(&dentry->d_child);
+			dentry->d_inode = NULL;
+			return -ENOENT;
+		}
+
 		if (ret < 0) {
-			GEN_DBG("fail to lookup \"%s\" (ret = %d)!\n",
-				dentry->d_name.name, ret);
-			dput(dentry);
+			if (ret != -ENOENT)
+				GEN_DBG("fail to lookup \"%s\" (ret = %d)!\n",
+					dentry->d_name.name, ret);
+			d_free(dentry);
 			return ret;
 		}
 
@@ -113,6 +109,8 @@ static int do_lookup(struct nameidata *nd, struct qstr *name,
 		ret = real_lookup(nd->path.dentry, name, nd, &dentry);
 		if (ret < 0)
 			return ret;
+	} else if (!dentry->d_inode) {
+		return -ENOENT;
 	}
 
 	path->mnt = mnt;
@@ -146,7 +144,9 @@ int path_walk(const char *path, struct nameidata *nd)
 			break;
 
 		unit.name = path;
+		unit.hash = 0;
 		do {
+			unit.hash = partial_name_hash(*path, unit.hash);
 			path++;
 		} while (*path && '/' != *path);
 		unit.len = path - unit.name;
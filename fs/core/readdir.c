@@ -2,30 +2,52 @@
 #include <string.h>
 #include <fs.h>
 
-int filldir(void *de, const char *name, int size, loff_t offset,
+// where filldir() places the next entry of a getdents() call
+struct getdents_buf {
+	struct linux_dirent *cur;
+	size_t count; // bytes left
+	int error;
+};
+
+// returns -EINVAL once the entry no longer fits, the fs keeps it for the next call
+int filldir(void *buf, const char *name, int size, loff_t offset,
 		   u64 ino, unsigned type)
 {
 	size_t reclen;
-	struct linux_dirent *lde = de;
+	struct getdents_buf *gb = buf;
+	struct linux_dirent *lde = gb->cur;
+
+	reclen = (size_t)(&((struct linux_dirent *)0)->d_name) + size + 2;
+	ALIGN_UP(reclen, sizeof(long));
+
+	if (reclen > gb->count) {
+		gb->error = -EINVAL;
+		return -EINVAL;
+	}
 
 	lde->d_ino  = ino;
 	lde->d_off  = offset;
 	lde->d_type = type;
-
-	reclen = (size_t)(&((struct linux_dirent *)0)->d_name) + size + 2;
-	ALIGN_UP(reclen, sizeof(long));
 	lde->d_reclen = reclen;
 
 	memcpy(lde->d_name, name, size);
 	lde->d_name[size] = '\0';
 
+	gb->cur = (struct linux_dirent *)((char *)lde + reclen);
+	gb->count -= reclen;
+
 	return 0;
 }
 
+/*
+ * Fill the buffer with as many entries as it holds: readdir() returns the
+ * number of entries it passed on, 0 at the end of the directory.
+ */
 int sys_getdents(unsigned int fd, struct linux_dirent *lde, unsigned int count)
 {
 	int ret;
 	struct file *fp;
+	struct getdents_buf gb;
 
 	fp = fget(fd);
 	if (!fp || !fp->f_op) {
@@ -38,6 +60,16 @@ int sys_getdents(unsigned int fd, struct linux_dirent *lde, unsigned int count)
 		return -ENOTSUPP;
 	}
 
-	ret = fp->f_op->readdir(fp, lde, filldir);
-	return ret;
+	gb.cur   = lde;
+	gb.count = count;
+	gb.error = 0;
+
+	do {
+		ret = fp->f_op->readdir(fp, &gb, filldir);
+	} while (ret > 0 && !gb.error);
+
+	if (gb.count < count)
+		return count - gb.count;
+
+	return ret < 0 ? ret : gb.error;
 }
@@ -6,6 +6,7 @@
 #include <assert.h>
 #include <dirent.h>
 #include <fs.h>
+#include <block.h>
 #include <fs/devfs.h>
 
 struct devfs_super_block {
@@ -172,19 +173,57 @@ static void devfs_kill_sb(struct super_block *sb)
 {
 }
 
+static int devfs_bdev_lookup(struct inode *parent, struct dentry *dentry)
+{
+	struct inode *in;
+	struct devfs_inode *di;
+	struct block_device *bdev;
+	char name[MAX_DEV_NAME];
+
+	if (dentry->d_name.len >= MAX_DEV_NAME)
+		return -ENOENT;
+
+	memcpy(name, dentry->d_name.name, dentry->d_name.len);
+	name[dentry->d_name.len] = '\0';
+
+	bdev = bdev_get(name);
+	if (!bdev)
+		return -ENOENT;
+
+	in = devfs_inode_create(parent->i_sb, 0666 | S_IFBLK);
+	if (!in)
+		return -ENOMEM;
+
+	in->i_size = bdev->size;
+	in->i_private = bdev;
+
+	di = DEV_I(in);
+	strcpy(di->name, name);
+	list_add_tail(&di->dev_node, &g_devfs_list);
+
+	dentry->d_inode = in;
+	// readdir stops at i_size
+	parent->i_size++;
+
+	return 0;
+}
+
 static int devfs_lookup(struct inode *parent, struct dentry *dentry,
 	struct nameidata *nd)
 {
 	struct devfs_inode *di;
 
 	list_for_each_entry(di, &g_devfs_list, dev_node) {
-		if (!strncmp(di->name, dentry->d_name.name, dentry->d_name.len)) {
+		if (dentry->d_name.len < FILE_NAME_SIZE && !di->name[dentry->d_name.len] && \
+			!strncmp(di->name, dentry->d_name.name, dentry->d_name.len)) {
 			dentry->d_inode = &di->vfs_inode;
 			return 0;
 		}
 	}
 
-	return -ENOENT;
+	// block devices register before devfs is mounted, so their nodes
+	// are made on the first lookup
+	return devfs_bdev_lookup(parent, dentry);
 }
 
 static int devfs_opendir(struct file *fp, struct inode *inode)
@@ -207,7 +246,8 @@ static int devfs_readdir(struct file *fp, void *dirent, filldir_t filldir)
 
 	in = de->d_inode;
 	// TODO: fix the offset and type
-	filldir(dirent, de->d_name.name, de->d_name.len, 0, in->i_ino, in->i_mode);
+	if (filldir(dirent, de->d_name.name, de->d_name.len, 0, in->i_ino, in->i_mode) < 0)
+		return 0;
 
 	fp->private_data = iter->next;
 	fp->f_pos++;
@@ -241,9 +281,10 @@ static int devfs_mknod(struct inode *dir, struct dentry *dentry,
 }
 
 static struct file_system_type devfs_fs_type = {
-	.name    = "devfs",
-	.mount   = devfs_mount,
-	.kill_sb = devfs_kill_sb,
+	.name     = "devfs",
+	.fs_flags = FS_DYNAMIC, // block nodes are made on lookup, once the drive registers
+	.mount    = devfs_mount,
+	.kill_sb  = devfs_kill_sb,
 };
 
 static int __init devfs_init(void)
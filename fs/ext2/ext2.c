@@ -5,6 +5,7 @@
 #include <errno.h>
 #include <assert.h>
 #include <block.h>
+#include <bcache.h>
 #include <dirent.h>
 #include <fs.h>
 #include <fs/ext2_fs.h>
@@ -37,7 +38,10 @@ static const struct file_operations ext2_reg_file_operations = {
 
 static int ext2_readdir(struct file *fp, void *dirent, filldir_t filldir);
 
+static int ext2_dir_close(struct file *fp);
+
 static const struct file_operations ext2_dir_file_operations = {
+	.close   = ext2_dir_close,
 	.readdir = ext2_readdir,
 };
 
@@ -54,38 +58,31 @@ static struct inode *ext2_alloc_inode(struct super_block *sb)
 	return &eii->vfs_inode;
 }
 
+// copy out of the buffer cache, the range may span several blocks
 static ssize_t ext2_read_block(struct super_block *sb, void *buff, int blk_no, size_t off, size_t size)
 {
-	ssize_t ret, start_blk;
-	struct bio *bio;
-	struct ext2_sb_info *e2_sbi = sb->s_fs_info;
-	struct ext2_super_block *e2_sb;
+	size_t len, count = 0;
+	size_t block_size = sb->s_blocksize;
+	struct buffer_head *bh;
 
-	e2_sb = &e2_sbi->e2_sb;
-	start_blk = blk_no << (e2_sb->s_log_block_size + 1);
+	blk_no += off / block_size;
+	off    %= block_size;
 
-	bio = bio_alloc();
-	if (!bio)
-		return -ENOMEM;
-
-	bio->size = (off + size + SECT_SIZE - 1) & ~(SECT_SIZE - 1);
-	bio->data = malloc(bio->size);
-	if (!bio->data) {
-		ret = -ENOMEM;
-		goto L1;
-	}
+	while (count < size) {
+		bh = bread(sb->s_bdev, blk_no, block_size);
+		if (!bh)
+			return -EIO;
 
-	bio->bdev = sb->s_bdev;
-	bio->sect = start_blk;
-	submit_bio(READ, bio);
+		len = min(size - count, block_size - off);
+		memcpy(buff + count, bh->b_data + off, len);
+		brelse(bh);
 
-	memcpy(buff, bio->data + off, size);
-	ret = size;
+		count += len;
+		off = 0;
+		blk_no++;
+	}
 
-	free(bio->data);
-L1:
-	bio_free(bio);
-	return ret;
+	return count;
 }
 
 static size_t get_start_layer(size_t start_block, size_t index_per_block)
@@ -481,52 +478,35 @@ static int ext2_close(struct file *fp)
 
 static ssize_t ext2_read(struct file *fp, void *buff, size_t size, loff_t *off)
 {
-	ssize_t i, len;
+	ssize_t ret;
 	size_t blocks;
 	size_t offset, real_size, block_size;
 	struct dentry *de = fp->f_dentry;
 	struct inode *in;
 	struct super_block *sb;
 	struct ext2_inode *e2_in;
-	struct ext2_sb_info *e2_sbi;
 
 	sb     = de->d_sb;
 	in     = de->d_inode;
-	e2_sbi = sb->s_fs_info;
-
-	e2_in = ext2_get_inode(sb, in->i_ino);
-	if (!e2_in)
-		return -ENOENT;
+	e2_in  = EXT2_I(in)->i_e2in;
 
-	// fixme!!!
-	if (fp->f_pos == e2_in->i_size)
+	if (fp->f_pos >= e2_in->i_size)
 		return 0;
 
-	block_size = 1 << (e2_sbi->e2_sb.s_log_block_size + 10);
-	char tmp_buff[block_size];
+	block_size = sb->s_blocksize;
+	real_size  = min(size, e2_in->i_size - fp->f_pos);
+	offset     = fp->f_pos % block_size;
 
-	real_size = min(size, e2_in->i_size - fp->f_pos);
-
-	blocks = (real_size + (block_size - 1)) / block_size;
+	blocks = (offset + real_size + block_size - 1) / block_size;
 	__le32 block_indexs[blocks];
 
 	get_block_indexs(sb, e2_in, fp->f_pos / block_size, block_indexs, blocks);
 
-	offset = fp->f_pos % block_size;
-	len = block_size - offset;
-
-	for(i = 0; i < blocks; i++) {
-		if(i == blocks - 1)
-			len = real_size % block_size == 0 ? block_size : (real_size % block_size);
-
-		ext2_read_block(sb, tmp_buff, block_indexs[i], offset, len);
+	ret = blk_read_runs(sb->s_bdev, buff, block_indexs, block_size, offset, real_size);
+	if (ret < 0)
+		return ret;
 
-		memcpy(buff, tmp_buff, len);
-		buff += len;
-		fp->f_pos += len;
-		offset = 0;
-		len = block_size;
-	}
+	fp->f_pos += real_size;
 
 	return real_size;
 }
@@ -559,47 +539,89 @@ static int ext2_lookup(struct inode *parent, struct dentry *dentry, struct namei
 	return 0;
 }
 
-static int ext2_inode_read_block(struct inode *in, int blk_no, char *blk_buf)
+static struct buffer_head *ext2_dir_bread(struct inode *in, __u32 lblk)
 {
-	struct ext2_inode_info *e2_info = EXT2_I(in);
-	int blk_index[in->i_size / in->i_sb->s_blocksize];
+	__le32 blk;
 
-	get_block_indexs(in->i_sb, e2_info->i_e2in, 0, (__le32 *)blk_index, ARRAY_ELEM_NUM(blk_index));
-
-	ext2_read_block(in->i_sb, blk_buf, blk_index[blk_no], 0, in->i_sb->s_blocksize);
+	if (get_block_indexs(in->i_sb, EXT2_I(in)->i_e2in, lblk, &blk, 1) != 1 || !blk)
+		return NULL;
 
-	return 0;
+	return bread(in->i_sb->s_bdev, blk, in->i_sb->s_blocksize);
 }
 
+// directory block kept across readdir() calls of an open directory
+struct ext2_dir_ctx {
+	__u32 lblk;
+	struct buffer_head *bh;
+};
+
 static int ext2_readdir(struct file *fp, void *dirent, filldir_t filldir)
 {
-	int blk_num;
-	int blk_off;
-	char buff[fp->f_dentry->d_inode->i_sb->s_blocksize];
-	struct inode *in;
+	int count = 0;
+	__u32 lblk;
+	size_t offset;
+	struct inode *in = fp->f_dentry->d_inode;
+	struct super_block *sb = in->i_sb;
+	struct ext2_dir_ctx *ctx = fp->private_data;
 	struct ext2_dir_entry_2 *e2_de;
 
-	in = fp->f_dentry->d_inode;
+	if (!ctx) {
+		ctx = zalloc(sizeof(*ctx));
+		if (!ctx)
+			return -ENOMEM;
 
-	if (fp->f_pos == in->i_size)
-		return 0;
+		fp->private_data = ctx;
+	}
 
-	blk_num = fp->f_pos / in->i_sb->s_blocksize;
-	blk_off = fp->f_pos % in->i_sb->s_blocksize;
+	while (fp->f_pos < in->i_size) {
+		lblk = fp->f_pos / sb->s_blocksize;
 
-	ext2_inode_read_block(in, blk_num, buff);
+		if (!ctx->bh || ctx->lblk != lblk || ctx->bh->b_stale) {
+			brelse(ctx->bh);
 
-	e2_de = (struct ext2_dir_entry_2 *)(buff + blk_off);
+			ctx->bh = ext2_dir_bread(in, lblk);
+			if (!ctx->bh) {
+				GEN_DBG("Fail to read dir block 0x%x\n", lblk);
+				return -EIO;
+			}
+
+			ctx->lblk = lblk;
+		}
 
-	if (e2_de->rec_len + fp->f_pos > in->i_size)
-		return -ENODATA;
+		offset = fp->f_pos % sb->s_blocksize;
+		e2_de  = ctx->bh->b_data + offset;
 
-	filldir(dirent, e2_de->name, e2_de->name_len, fp->f_pos /*fixme*/,
-		in->i_ino, e2_de->file_type);
+		if (e2_de->rec_len < 12 || offset + e2_de->rec_len > sb->s_blocksize)
+			return -ENODATA;
 
-	fp->f_pos += e2_de->rec_len;
+		if (e2_de->inode) {
+			if (filldir(dirent, e2_de->name, e2_de->name_len, fp->f_pos + e2_de->rec_len,
+					e2_de->inode, e2_de->file_type) < 0)
+				return count;
 
-	return e2_de->rec_len;
+			count++;
+		}
+
+		fp->f_pos += e2_de->rec_len;
+	}
+
+	brelse(ctx->bh);
+	ctx->bh = NULL;
+
+	return count;
+}
+
+static int ext2_dir_close(struct file *fp)
+{
+	struct ext2_dir_ctx *ctx = fp->private_data;
+
+	if (ctx) {
+		brelse(ctx->bh);
+		free(ctx);
+		fp->private_data = NULL;
+	}
+
+	return 0;
 }
 
 #if 0
@@ -5,6 +5,7 @@
 #include <errno.h>
 #include <assert.h>
 #include <block.h>
+#include <bcache.h>
 #include <dirent.h>
 #include <fs.h>
 #include <fs/ext4_fs.h>
@@ -37,7 +38,10 @@ static const struct file_operations ext4_reg_file_operations = {
 
 static int ext4_readdir(struct file *fp, void *dirent, filldir_t filldir);
 
+static int ext4_dir_close(struct file *fp);
+
 static const struct file_operations ext4_dir_file_operations = {
+	.close   = ext4_dir_close,
 	.readdir = ext4_readdir,
 };
 
@@ -54,35 +58,30 @@ static struct inode *ext4_alloc_inode(struct super_block *sb)
 	return &eii->vfs_inode;
 }
 
+// copy out of the buffer cache, the range may span several blocks
 static ssize_t __ext4_read_buff(struct super_block *sb, size_t offset, void *buff, size_t size)
 {
-	ssize_t ret, start_blk;
-	struct bio *bio;
-
-	start_blk = offset / SECT_SIZE;
-
-	bio = bio_alloc();
-	if (!bio)
-		return -ENOMEM;
-
-	bio->size = (offset % SECT_SIZE + size + SECT_SIZE - 1) & ~(SECT_SIZE - 1);
-	bio->data = malloc(bio->size);
-	if (!bio->data) {
-		ret = -ENOMEM;
-		goto L1;
+	size_t len, count = 0;
+	size_t block_size = sb->s_blocksize;
+	size_t blk_no = offset / block_size;
+	size_t off = offset % block_size;
+	struct buffer_head *bh;
+
+	while (count < size) {
+		bh = bread(sb->s_bdev, blk_no, block_size);
+		if (!bh)
+			return -EIO;
+
+		len = min(size - count, block_size - off);
+		memcpy(buff + count, bh->b_data + off, len);
+		brelse(bh);
+
+		count += len;
+		off = 0;
+		blk_no++;
 	}
 
-	bio->bdev = sb->s_bdev;
-	bio->sect = start_blk;
-	submit_bio(READ, bio);
-
-	memcpy(buff, bio->data + offset % SECT_SIZE, size);
-	ret = size;
-
-	free(bio->data);
-L1:
-	bio_free(bio);
-	return ret;
+	return count;
 }
 
 static ssize_t __ext4_read_block(struct super_block *sb, void *buff, int blk_no)
@@ -259,66 +258,170 @@ static bool is_extent(struct inode *in)
 	return false;
 }
 
-static int __extent_idx(struct ext4_extent_header *extent_header)
+static bool ext4_ext_cache_find(struct ext4_inode_info *e4_ini, __u32 lblk, struct ext4_ext_cache *ce)
 {
-	// fixme
-	GEN_DBG("extent_idx not support\n");
+	int i;
+	struct ext4_ext_cache *iter;
 
-	return 0;
+	for (i = 0; i < EXT4_EXT_CACHE_SIZE; i++) {
+		iter = &e4_ini->i_ext_cache[i];
+
+		if (iter->len && lblk - iter->lblk < iter->len) {
+			*ce = *iter;
+			return true;
+		}
+	}
+
+	return false;
 }
 
-static int ext4_get_extent_blkbums(struct inode *in, size_t skip, __le32 block[], size_t nums)
+static void ext4_ext_cache_add(struct ext4_inode_info *e4_ini, const struct ext4_ext_cache *ce)
 {
-	struct ext4_inode *ext4_in;
-	struct ext4_inode_info *ext4_ini;
-	struct ext4_extent_header *extent_header;
-	struct ext4_extent *extent;
-	struct ext4_extent_idx *extent_idx;
-	int i;
-	int iter;
+	e4_ini->i_ext_cache[e4_ini->i_ext_next] = *ce;
+	e4_ini->i_ext_next = (e4_ini->i_ext_next + 1) % EXT4_EXT_CACHE_SIZE;
+}
 
-	ext4_ini = EXT4_I(in);
-	ext4_in  = ext4_ini->i_e4in;
+/*
+ * Walk the extent tree down to the leaf covering lblk. ce returns the
+ * extent, or for a hole (pblk 0) the unmapped range up to the next
+ * extent of that leaf. Uninitialized extents read as holes.
+ */
+static int ext4_ext_lookup(struct inode *in, __u32 lblk, struct ext4_ext_cache *ce)
+{
+	int lo, hi, mid, depth, entries, ret = 0;
+	__u32 len;
+	__u64 phys;
+	struct super_block *sb = in->i_sb;
+	struct ext4_extent_header *eh;
+	struct ext4_extent_idx *ei;
+	struct ext4_extent *ex;
+	struct buffer_head *bh = NULL;
+
+	eh = (struct ext4_extent_header *)EXT4_I(in)->i_e4in->i_block;
+	depth = le16_to_cpu(eh->eh_depth);
+
+	while (1) {
+		entries = le16_to_cpu(eh->eh_entries);
+
+		if (eh->eh_magic != EXT4_EXT_MAGIC || le16_to_cpu(eh->eh_depth) != depth) {
+			GEN_DBG("bad extent node (inode %d, depth %d)!\n", in->i_ino, depth);
+			ret = -EIO;
+			goto L1;
+		}
 
-	extent_header = (struct ext4_extent_header *)ext4_in->i_block;
-	if (extent_header->eh_magic != EXT4_EXT_MAGIC) {
-		GEN_DBG("check extent magic num error!\n");
-		return -EINVAL;
-	}
+		if (depth == 0)
+			break;
 
-	if (extent_header->eh_depth > 0) {
-		extent_idx = (void *)extent_header + sizeof(*extent_header);
-		for (i = 0; i < extent_header->eh_entries; i++) {
-			// ...
-			__extent_idx(extent_header);
-			extent_idx += sizeof(*extent_idx);
+		if (entries == 0) {
+			ret = -EIO;
+			goto L1;
 		}
 
-		return 0;
+		// the last index starting at or before lblk
+		ei = (struct ext4_extent_idx *)(eh + 1);
+		lo = 0;
+		hi = entries - 1;
+		while (lo < hi) {
+			mid = (lo + hi + 1) / 2;
+			if (le32_to_cpu(ei[mid].ei_block) <= lblk)
+				lo = mid;
+			else
+				hi = mid - 1;
+		}
+
+		phys = (__u64)le16_to_cpu(ei[lo].ei_leaf_hi) << 32 | le32_to_cpu(ei[lo].ei_leaf_lo);
+		// its sector must fit in sector_t
+		if (phys > ULONG_MAX / (sb->s_blocksize >> 9)) {
+			ret = -EOVERFLOW;
+			goto L1;
+		}
+
+		brelse(bh);
+		bh = bread(sb->s_bdev, (sector_t)phys, sb->s_blocksize);
+		if (!bh) {
+			ret = -EIO;
+			goto L1;
+		}
+
+		eh = bh->b_data;
+		depth--;
+	}
+
+	ex = (struct ext4_extent *)(eh + 1);
+
+	ce->lblk = lblk;
+	ce->len  = 1;
+	ce->pblk = 0;
+
+	if (entries == 0 || le32_to_cpu(ex[0].ee_block) > lblk) {
+		if (entries)
+			ce->len = le32_to_cpu(ex[0].ee_block) - lblk;
+		goto L1;
 	}
 
-	extent = (void *)extent_header + sizeof(*extent_header);
-	i = 0;
-	iter = 0;
+	lo = 0;
+	hi = entries - 1;
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (le32_to_cpu(ex[mid].ee_block) <= lblk)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	len = le16_to_cpu(ex[lo].ee_len);
+	if (len > EXT_INIT_MAX_LEN)
+		len -= EXT_INIT_MAX_LEN;
+
+	if (lblk - le32_to_cpu(ex[lo].ee_block) >= len) {
+		if (lo + 1 < entries)
+			ce->len = le32_to_cpu(ex[lo + 1].ee_block) - lblk;
+		goto L1;
+	}
 
-	while (i < extent_header->eh_entries) {
-		size_t start = extent->ee_block;
-		size_t len   = extent->ee_len;
-		size_t addr  = extent->ee_start_lo; // fixme
+	ce->lblk = le32_to_cpu(ex[lo].ee_block);
+	ce->len  = len;
 
-		while (iter < nums &&
-				(iter + skip) >= start &&
-				(iter + skip) < (start + len)) {
-			block[iter] = addr + (iter + skip - start);
-			iter++;
+	if (le16_to_cpu(ex[lo].ee_len) <= EXT_INIT_MAX_LEN) {
+		phys = (__u64)le16_to_cpu(ex[lo].ee_start_hi) << 32 | le32_to_cpu(ex[lo].ee_start_lo);
+		// the sector of the last block must fit in sector_t
+		if (phys + len - 1 > ULONG_MAX / (sb->s_blocksize >> 9)) {
+			ret = -EOVERFLOW;
+			goto L1;
 		}
 
-		if (iter == nums) {
-			break;
+		ce->pblk = phys;
+	}
+
+L1:
+	brelse(bh);
+	return ret;
+}
+
+static int ext4_get_extent_blkbums(struct inode *in, size_t skip, __le32 block[], size_t nums)
+{
+	int ret;
+	size_t iter = 0, n, off;
+	__u32 lblk;
+	struct ext4_ext_cache ce;
+	struct ext4_inode_info *e4_ini = EXT4_I(in);
+
+	while (iter < nums) {
+		lblk = skip + iter;
+
+		if (!ext4_ext_cache_find(e4_ini, lblk, &ce)) {
+			ret = ext4_ext_lookup(in, lblk, &ce);
+			if (ret < 0)
+				return ret;
+
+			ext4_ext_cache_add(e4_ini, &ce);
 		}
 
-		extent += sizeof(*extent);
-		i++;
+		off = lblk - ce.lblk;
+		n   = min(nums - iter, ce.len - off);
+
+		for (; n > 0; n--, off++, iter++)
+			block[iter] = ce.pblk ? ce.pblk + off : 0;
 	}
 
 	return 0;
@@ -530,6 +633,161 @@ static void ext4_kill_sb(struct super_block *sb)
 {
 }
 
+static bool is_hbtree_dir(struct inode *in)
+{
+	struct ext4_sb_info *fs_info;
+	struct ext4_super_block *ext4_sb;
+	struct ext4_inode *ext4_in;
+
+	fs_info = in->i_sb->s_fs_info;
+	ext4_sb = &fs_info->e4_sb;
+	ext4_in = EXT4_I(in)->i_e4in;
+
+	if ((ext4_sb->s_feature_compat & EXT4_FEATURE_COMPAT_DIR_INDEX) &&
+		(ext4_in->i_flags & EXT4_INDEX_FL))
+		return true;
+
+	return false;
+}
+
+static struct buffer_head *ext4_dir_bread(struct inode *dir, __u32 lblk)
+{
+	__le32 blk = 0;
+	struct super_block *sb = dir->i_sb;
+
+	if (ext4_get_blknums(dir, lblk, &blk, 1) < 0 || !blk)
+		return NULL;
+
+	return bread(sb->s_bdev, blk, sb->s_blocksize);
+}
+
+// returns the inode number, 0 if the name is not in this block
+static int ext4_dir_search_block(struct inode *dir, __u32 lblk, const struct qstr *unit)
+{
+	int ino = 0;
+	size_t off, rec_len;
+	size_t block_size = dir->i_sb->s_blocksize;
+	struct buffer_head *bh;
+	struct ext4_dir_entry_2 *de;
+
+	bh = ext4_dir_bread(dir, lblk);
+	if (!bh)
+		return -EIO;
+
+	for (off = 0; off + EXT4_DIR_REC_MIN <= block_size; off += rec_len) {
+		de = bh->b_data + off;
+		rec_len = le16_to_cpu(de->rec_len);
+		if (rec_len < EXT4_DIR_REC_MIN)
+			break;
+
+		if (de->inode && de->name_len == unit->len &&
+			!memcmp(de->name, unit->name, unit->len)) {
+			ino = le32_to_cpu(de->inode);
+			break;
+		}
+	}
+
+	brelse(bh);
+
+	return ino;
+}
+
+// the last entry whose hash is not above the given one
+static struct dx_entry *dx_search(struct dx_entry *entries, int count, __u32 hash)
+{
+	struct dx_entry *p = entries + 1, *q = entries + count - 1, *m;
+
+	while (p <= q) {
+		m = p + (q - p) / 2;
+		if (le32_to_cpu(m->hash) > hash)
+			q = m - 1;
+		else
+			p = m + 1;
+	}
+
+	return p - 1;
+}
+
+/*
+ * htree lookup: hash the name, walk dx_root and the dx_node levels to
+ * the leaf block and search only that one (and its successors while
+ * they continue the same hash). Returns the inode number, 0 if not
+ * found, or a negative error if the index can't be used.
+ */
+static int ext4_dx_find(struct inode *dir, const struct qstr *unit)
+{
+	int ret, levels, count, limit;
+	struct ext4_sb_info *e4_sbi = dir->i_sb->s_fs_info;
+	struct ext4_super_block *e4_sb = &e4_sbi->e4_sb;
+	struct buffer_head *bh, *nbh;
+	struct dx_root *root;
+	struct dx_countlimit *cl;
+	struct dx_entry *entries, *at, *end;
+	struct dx_hash_info hinfo;
+
+	bh = ext4_dir_bread(dir, 0);
+	if (!bh)
+		return -EIO;
+
+	root = bh->b_data;
+	if (root->info.reserved_zero || root->info.info_length < 8 ||
+		root->info.hash_version > DX_HASH_TEA ||
+		root->info.indirect_levels >= EXT4_HTREE_LEVEL) {
+		GEN_DBG("unsupported htree (version %d, levels %d)\n",
+			root->info.hash_version, root->info.indirect_levels);
+		ret = -EINVAL;
+		goto L1;
+	}
+
+	hinfo.hash_version = root->info.hash_version;
+	if (le32_to_cpu(e4_sb->s_flags) & EXT2_FLAGS_UNSIGNED_HASH)
+		hinfo.hash_version += DX_HASH_LEGACY_UNSIGNED;
+	hinfo.seed = e4_sb->s_hash_seed;
+
+	ret = ext4_dirhash(unit->name, unit->len, &hinfo);
+	if (ret < 0)
+		goto L1;
+
+	entries = (struct dx_entry *)((char *)&root->info + root->info.info_length);
+	levels  = root->info.indirect_levels;
+
+	while (1) {
+		cl    = (struct dx_countlimit *)entries;
+		count = le16_to_cpu(cl->count);
+		limit = le16_to_cpu(cl->limit);
+		if (!count || count > limit) {
+			ret = -EIO;
+			goto L1;
+		}
+
+		at = dx_search(entries, count, hinfo.hash);
+		if (!levels--)
+			break;
+
+		nbh = ext4_dir_bread(dir, le32_to_cpu(at->block));
+		brelse(bh);
+		bh = nbh;
+		if (!bh)
+			return -EIO;
+
+		entries = ((struct dx_node *)bh->b_data)->entries;
+	}
+
+	// bit 0 of the next hash marks a collision chain spilling over
+	end = entries + count;
+	do {
+		ret = ext4_dir_search_block(dir, le32_to_cpu(at->block), unit);
+		if (ret)
+			break;
+		at++;
+	} while (at < end && (le32_to_cpu(at->hash) & 1) &&
+		(le32_to_cpu(at->hash) & ~1) == hinfo.hash);
+
+L1:
+	brelse(bh);
+	return ret;
+}
+
 static unsigned long ext4_inode_by_name(struct inode *inode, struct qstr *unit)
 {
 	struct super_block *sb = inode->i_sb;
@@ -542,6 +800,15 @@ static unsigned long ext4_inode_by_name(struct inode *inode, struct qstr *unit)
 	int blocks, i;
 	size_t block_size;
 
+	if (is_hbtree_dir(inode)) {
+		int ino = ext4_dx_find(inode, unit);
+
+		if (ino >= 0)
+			return ino;
+
+		GEN_DBG("htree lookup failed (%d), scanning linearly\n", ino);
+	}
+
 	e4_sbi = sb->s_fs_info;
 	block_size = 1024 << e4_sbi->e4_sb.s_log_block_size;
 
@@ -587,54 +854,38 @@ static int ext4_close(struct file *fp)
 
 static ssize_t ext4_read(struct file *fp, void *buff, size_t size, loff_t *off)
 {
-	struct inode *in;
-	struct dentry *de;
-	size_t cur_blk;
-	size_t offset;
-	size_t blks;
-	__le32 blk_num[(size - 1) / fp->f_dentry->d_sb->s_blocksize + 2];
-	size_t blk_size = fp->f_dentry->d_sb->s_blocksize;
-	int ret;
-	int i = 0;
-	size_t count = 0;
-
-	de = fp->f_dentry;
-	in = de->d_inode;
+	ssize_t ret;
+	size_t blocks;
+	size_t offset, real_size, blk_size;
+	struct dentry *de = fp->f_dentry;
+	struct inode *in = de->d_inode;
 
 	if (fp->f_pos >= in->i_size)
 		return 0;
 
-	cur_blk = fp->f_pos / in->i_sb->s_blocksize;
-	offset  = fp->f_pos % in->i_sb->s_blocksize;
+	blk_size  = in->i_sb->s_blocksize;
+	real_size = min(size, in->i_size - fp->f_pos);
+	offset    = fp->f_pos % blk_size;
 
-	if (offset != 0) {
-		blks = (size - (blk_size - offset) - 1) / blk_size + 2;
-	} else {
-		blks = (size - 1) / blk_size + 1;
-	}
+	blocks = (offset + real_size + blk_size - 1) / blk_size;
+	__le32 blk_num[blocks];
+
+	// unmapped blocks stay 0, i.e. holes
+	memset(blk_num, 0, sizeof(blk_num));
 
-	ret = ext4_get_blknums(in, cur_blk, blk_num, blks);
+	ret = ext4_get_blknums(in, fp->f_pos / blk_size, blk_num, blocks);
 	if (ret < 0) {
-		GEN_DBG("Fail to get blk num 0x%x\n", cur_blk);
+		GEN_DBG("Fail to get blk num 0x%x\n", fp->f_pos / blk_size);
 		return ret;
 	}
 
-	if (offset != 0) {
-		__ext4_read_buff(in->i_sb, blk_num[0] * blk_size, buff, blk_size - (offset + 1));
-		count += blk_size - (offset + 1);
-		i = 1;
-	}
-
-	for (; i < blks - 1; i++) {
-		__ext4_read_block(in->i_sb, buff + i * blk_size, blk_num[i]);
-		count += blk_size;
-	}
-
-	__ext4_read_buff(in->i_sb, blk_num[i] * blk_size, buff + count, size - count);
+	ret = blk_read_runs(in->i_sb->s_bdev, buff, blk_num, blk_size, offset, real_size);
+	if (ret < 0)
+		return ret;
 
-	fp->f_pos += size;
+	fp->f_pos += real_size;
 
-	return size;
+	return real_size;
 }
 
 static ssize_t ext4_write(struct file *fp, const void *buff, size_t size, loff_t *off)
@@ -680,70 +931,81 @@ static int ext4_inode_read_block(struct inode *in, int blk_no, char *blk_buf)
 }
 #endif
 
-static bool is_hbtree_dir(struct inode *in)
-{
-	struct ext4_sb_info *fs_info;
-	struct ext4_super_block *ext4_sb;
-	struct ext4_inode *ext4_in;
+// directory block kept across readdir() calls of an open directory
+struct ext4_dir_ctx {
+	__u32 lblk;
+	struct buffer_head *bh;
+};
 
-	fs_info = in->i_sb->s_fs_info;
-	ext4_sb = &fs_info->e4_sb;
-	ext4_in = EXT4_I(in)->i_e4in;
+// dx nodes hide in empty (inode 0) entries, so indexed directories read linearly too
+static int ext4_readdir(struct file *fp, void *dirent, filldir_t filldir)
+{
+	int rec_len, count = 0;
+	__u32 lblk;
+	size_t offset;
+	struct inode *in = fp->f_dentry->d_inode;
+	struct super_block *sb = in->i_sb;
+	struct ext4_dir_ctx *ctx = fp->private_data;
+	struct ext4_dir_entry_2 *ext4_de;
 
-	if ((ext4_sb->s_feature_compat & EXT4_FEATURE_COMPAT_DIR_INDEX) &&
-		(ext4_in->i_flags & EXT4_INDEX_FL))
-		return true;
+	if (!ctx) {
+		ctx = zalloc(sizeof(*ctx));
+		if (!ctx)
+			return -ENOMEM;
 
-	return false;
-}
+		fp->private_data = ctx;
+	}
 
-static int ext4_dx_readdir(struct file *fp, void *dirent, filldir_t filldir)
-{
-	// fixme
+	while (fp->f_pos < in->i_size) {
+		lblk = fp->f_pos / sb->s_blocksize;
 
-	GEN_DBG("Not support dx read!\n");
+		if (!ctx->bh || ctx->lblk != lblk || ctx->bh->b_stale) {
+			brelse(ctx->bh);
 
-	return 0;
-}
+			ctx->bh = ext4_dir_bread(in, lblk);
+			if (!ctx->bh) {
+				GEN_DBG("Fail to read dir block 0x%x\n", lblk);
+				return -EIO;
+			}
 
-static int ext4_readdir(struct file *fp, void *dirent, filldir_t filldir)
-{
-	struct inode *in;
-	struct dentry *de;
-	size_t cur_blk;
-	size_t offset;
-	__le32 blk_num;
-	int ret;
-	char blk_buff[fp->f_dentry->d_sb->s_blocksize];
-	struct ext4_dir_entry_2 *ext4_de;
+			ctx->lblk = lblk;
+		}
 
-	de = fp->f_dentry;
-	in = de->d_inode;
+		offset  = fp->f_pos % sb->s_blocksize;
+		ext4_de = ctx->bh->b_data + offset;
+		rec_len = le16_to_cpu(ext4_de->rec_len);
 
-	if (is_hbtree_dir(in)) {
-		return ext4_dx_readdir(fp, dirent, filldir);
-	}
+		if (rec_len < EXT4_DIR_REC_MIN || offset + rec_len > sb->s_blocksize)
+			return -EIO;
 
-	if (fp->f_pos >= in->i_size)
-		return 0;
+		if (ext4_de->inode) {
+			if (filldir(dirent, ext4_de->name, ext4_de->name_len, fp->f_pos + rec_len,
+					le32_to_cpu(ext4_de->inode), ext4_de->file_type) < 0)
+				return count;
 
-	cur_blk = fp->f_pos / in->i_sb->s_blocksize;
-	offset  = fp->f_pos % in->i_sb->s_blocksize;
+			count++;
+		}
 
-	ret = ext4_get_blknums(in, cur_blk, &blk_num, 1);
-	if (ret < 0) {
-		GEN_DBG("Fail to get blk num 0x%x\n", cur_blk);
-		return ret;
+		fp->f_pos += rec_len;
 	}
 
-	__ext4_read_block(in->i_sb, blk_buff, blk_num);
+	brelse(ctx->bh);
+	ctx->bh = NULL;
 
-	ext4_de = (struct ext4_dir_entry_2 *)(blk_buff + offset);
-	filldir(dirent, ext4_de->name, ext4_de->name_len, ext4_de->rec_len, ext4_de->inode, ext4_de->file_type);
+	return count;
+}
 
-	fp->f_pos += ext4_de->rec_len;
+static int ext4_dir_close(struct file *fp)
+{
+	struct ext4_dir_ctx *ctx = fp->private_data;
 
-	return ext4_de->rec_len;
+	if (ctx) {
+		brelse(ctx->bh);
+		free(ctx);
+		fp->private_data = NULL;
+	}
+
+	return 0;
 }
 
 extern int ck_ext4_feature(uint32_t fc,uint32_t frc,uint32_t fi);
@@ -0,0 +1,203 @@
+#include <types.h>
+#include <errno.h>
+#include <string.h>
+#include <fs/ext4.h>
+
+/*
+ * Directory index hashes, bit compatible with the kernel's
+ * fs/ext4/hash.c: the legacy hash, half MD4 and TEA, each in a
+ * signed and an unsigned char flavour.
+ */
+
+#define DELTA 0x9E3779B9
+
+static inline __u32 rol32(__u32 word, unsigned int shift)
+{
+	return (word << shift) | (word >> (32 - shift));
+}
+
+static void tea_transform(__u32 buf[4], const __u32 in[])
+{
+	__u32 sum = 0;
+	__u32 b0 = buf[0], b1 = buf[1];
+	__u32 a = in[0], b = in[1], c = in[2], d = in[3];
+	int n = 16;
+
+	do {
+		sum += DELTA;
+		b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+		b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+	} while (--n);
+
+	buf[0] += b0;
+	buf[1] += b1;
+}
+
+#define F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define H(x, y, z) ((x) ^ (y) ^ (z))
+
+#define ROUND(f, a, b, c, d, x, s) \
+	(a += f(b, c, d) + x, a = rol32(a, s))
+
+#define K1 0
+#define K2 013240474631UL
+#define K3 015666365641UL
+
+static void half_md4_transform(__u32 buf[4], const __u32 in[8])
+{
+	__u32 a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+	ROUND(F, a, b, c, d, in[0] + K1,  3);
+	ROUND(F, d, a, b, c, in[1] + K1,  7);
+	ROUND(F, c, d, a, b, in[2] + K1, 11);
+	ROUND(F, b, c, d, a, in[3] + K1, 19);
+	ROUND(F, a, b, c, d, in[4] + K1,  3);
+	ROUND(F, d, a, b, c, in[5] + K1,  7);
+	ROUND(F, c, d, a, b, in[6] + K1, 11);
+	ROUND(F, b, c, d, a, in[7] + K1, 19);
+
+	ROUND(G, a, b, c, d, in[1] + K2,  3);
+	ROUND(G, d, a, b, c, in[3] + K2,  5);
+	ROUND(G, c, d, a, b, in[5] + K2,  9);
+	ROUND(G, b, c, d, a, in[7] + K2, 13);
+	ROUND(G, a, b, c, d, in[0] + K2,  3);
+	ROUND(G, d, a, b, c, in[2] + K2,  5);
+	ROUND(G, c, d, a, b, in[4] + K2,  9);
+	ROUND(G, b, c, d, a, in[6] + K2, 13);
+
+	ROUND(H, a, b, c, d, in[3] + K3,  3);
+	ROUND(H, d, a, b, c, in[7] + K3,  9);
+	ROUND(H, c, d, a, b, in[2] + K3, 11);
+	ROUND(H, b, c, d, a, in[6] + K3, 15);
+	ROUND(H, a, b, c, d, in[1] + K3,  3);
+	ROUND(H, d, a, b, c, in[5] + K3,  9);
+	ROUND(H, c, d, a, b, in[0] + K3, 11);
+	ROUND(H, b, c, d, a, in[4] + K3, 15);
+
+	buf[0] += a;
+	buf[1] += b;
+	buf[2] += c;
+	buf[3] += d;
+}
+
+static __u32 dx_hack_hash(const char *name, int len, bool is_unsigned)
+{
+	__u32 hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+	int c;
+
+	while (len--) {
+		c = is_unsigned ? (int)(unsigned char)*name : (int)(signed char)*name;
+		name++;
+
+		hash = hash1 + (hash0 ^ (c * 7152373));
+		if (hash & 0x80000000)
+			hash -= 0x7fffffff;
+
+		hash1 = hash0;
+		hash0 = hash;
+	}
+
+	return hash0 << 1;
+}
+
+static void str2hashbuf(const char *msg, int len, __u32 *buf, int num, bool is_unsigned)
+{
+	__u32 pad, val;
+	int i, c;
+
+	pad = (__u32)len | ((__u32)len << 8);
+	pad |= pad << 16;
+
+	val = pad;
+	if (len > num * 4)
+		len = num * 4;
+
+	for (i = 0; i < len; i++) {
+		c = is_unsigned ? (int)(unsigned char)msg[i] : (int)(signed char)msg[i];
+		val = c + (val << 8);
+
+		if ((i % 4) == 3) {
+			*buf++ = val;
+			val = pad;
+			num--;
+		}
+	}
+
+	if (--num >= 0)
+		*buf++ = val;
+
+	while (--num >= 0)
+		*buf++ = pad;
+}
+
+int ext4_dirhash(const char *name, int len, struct dx_hash_info *hinfo)
+{
+	int i;
+	__u32 hash, minor_hash = 0;
+	__u32 in[8], buf[4];
+	bool is_unsigned = false;
+
+	buf[0] = 0x67452301;
+	buf[1] = 0xefcdab89;
+	buf[2] = 0x98badcfe;
+	buf[3] = 0x10325476;
+
+	// an all-zero seed means the default one
+	if (hinfo->seed) {
+		for (i = 0; i < 4; i++) {
+			if (hinfo->seed[i]) {
+				memcpy(buf, hinfo->seed, sizeof(buf));
+				break;
+			}
+		}
+	}
+
+	switch (hinfo->hash_version) {
+	case DX_HASH_LEGACY_UNSIGNED:
+		is_unsigned = true;
+		// fall through
+	case DX_HASH_LEGACY:
+		hash = dx_hack_hash(name, len, is_unsigned);
+		break;
+
+	case DX_HASH_HALF_MD4_UNSIGNED:
+		is_unsigned = true;
+		// fall through
+	case DX_HASH_HALF_MD4:
+		for (; len > 0; len -= 32, name += 32) {
+			str2hashbuf(name, len, in, 8, is_unsigned);
+			half_md4_transform(buf, in);
+		}
+
+		minor_hash = buf[2];
+		hash = buf[1];
+		break;
+
+	case DX_HASH_TEA_UNSIGNED:
+		is_unsigned = true;
+		// fall through
+	case DX_HASH_TEA:
+		for (; len > 0; len -= 16, name += 16) {
+			str2hashbuf(name, len, in, 4, is_unsigned);
+			tea_transform(buf, in);
+		}
+
+		hash = buf[0];
+		minor_hash = buf[1];
+		break;
+
+	default:
+		hinfo->hash = 0;
+		return -EINVAL;
+	}
+
+	hash &= ~1;
+	if (hash == (EXT4_HTREE_EOF_32BIT << 1))
+		hash = (EXT4_HTREE_EOF_32BIT - 1) << 1;
+
+	hinfo->hash = hash;
+	hinfo->minor_hash = minor_hash;
+
+	return 0;
+}
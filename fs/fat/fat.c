@@ -1,342 +1,605 @@
+#include <stdio.h>
+#include <init.h>
 #include <malloc.h>
 #include <errno.h>
 #include <string.h>
 #include <types.h>
+#include <block.h>
+#include <bcache.h>
+#include <dirent.h>
 #include <fs.h>
 #include <fs/fat.h>
-#include <drive.h>
 
-static ssize_t fat_read_block(struct fat_fs *fs, void *buff, int blk_no, size_t off, size_t size)
-{
-	struct block_device *bdev = fs->bdev;
-	struct disk_drive *drive = container_of(bdev, struct disk_drive, bdev);
+/*
+ * FAT32, read only. Directories are read straight from their cluster
+ * chain, with VFAT long names; files through a run map built on the
+ * first read.
+ */
+
+#define FAT_READ_BATCH 64 // clusters mapped per blk_read_runs() call
+
+static int fat_lookup(struct inode *parent, struct dentry *dentry,
+						struct nameidata *nd);
+
+static const struct inode_operations fat_reg_inode_operations = {
+};
+
+static const struct inode_operations fat_dir_inode_operations = {
+	.lookup = fat_lookup,
+};
+
+static int fat_open(struct file *fp, struct inode *inode);
+static int fat_close(struct file *fp);
+static ssize_t fat_read(struct file *fp, void *buff, size_t size, loff_t *off);
+static ssize_t fat_write(struct file *fp, const void *buff, size_t size, loff_t *off);
+
+static const struct file_operations fat_reg_file_operations = {
+	.open  = fat_open,
+	.close = fat_close,
+	.read  = fat_read,
+	.write = fat_write,
+};
 
-	size_t buf_len = (off + size + drive->sect_size - 1) & ~(drive->sect_size - 1);
-	char blk_buf[buf_len];
-	int start_blk, cur_blk;
+static int fat_readdir(struct file *fp, void *dirent, filldir_t filldir);
 
-	start_blk = blk_no * fs->clus_size / drive->sect_size;
+static int fat_dir_close(struct file *fp);
 
-	for (cur_blk = 0; cur_blk < buf_len / drive->sect_size; cur_blk++)
-		drive->get_block(drive, (start_blk + cur_blk) * drive->sect_size, blk_buf + cur_blk * drive->sect_size);
+static const struct file_operations fat_dir_file_operations = {
+	.close   = fat_dir_close,
+	.readdir = fat_readdir,
+};
 
-	memcpy(buff, blk_buf + off, size);
+// the FAT is read in sectors, it need not be cluster aligned
+static int fat_get_fat_table(struct fat_fs *fs, __u32 fat_num, __u32 *next)
+{
+	__u32 per_sect = fs->sect_size / sizeof(fat_num);
+	struct buffer_head *bh;
 
-	return size;
+	bh = bread(fs->bdev, fs->fat + fat_num / per_sect, fs->sect_size);
+	if (!bh)
+		return -EIO;
+
+	*next = ((__u32 *)bh->b_data)[fat_num % per_sect] & FAT_CLUS_MASK;
+	brelse(bh);
+
+	return 0;
 }
 
-static __u32 fat_get_fat_table(struct fat_fs *fs, __u32 fat_num)
+/*
+ * Follow the chain for at most nclus clusters and collapse it into runs.
+ * Returns the number of runs, which are stored only if runs is not NULL.
+ */
+static int fat_walk_chain(struct fat_fs *fs, __u32 clus, __u32 nclus, struct fat_run *runs)
 {
-	int ret;
-	static __u32 old_fat = ~0;
-	static __u32 fat_catch[2048];
+	int ret, nr = 0;
+	__u32 lclus, last = 0;
+
+	for (lclus = 0; lclus < nclus; lclus++) {
+		if (clus < 2 || clus >= FAT_CLUS_BAD) {
+			GEN_DBG("broken cluster chain (0x%x @ %d)\n", clus, lclus);
+			return -EIO;
+		}
+
+		if (!nr || clus != last + 1) {
+			if (runs) {
+				runs[nr].lclus = lclus;
+				runs[nr].clus  = clus;
+				runs[nr].count = 0;
+			}
+			nr++;
+		}
 
-	if (old_fat == ~0 || fat_num < old_fat || fat_num > (fs->clus_size / sizeof(fat_num) + old_fat - 1)) {
-		ret = fat_read_block(fs, fat_catch, fs->dbr.resv_size / fs->dbr.sec_per_clus + fat_num * sizeof(fat_num) / (fs->clus_size),
-			0, fs->clus_size);
+		if (runs)
+			runs[nr - 1].count++;
 
-		if (ret < 0)
-			return ret;
+		last = clus;
 
-		old_fat = (fat_num / fs->clus_size / sizeof(fat_num)) * (fs->clus_size / sizeof(fat_num));
+		if (lclus + 1 < nclus) {
+			ret = fat_get_fat_table(fs, clus, &clus);
+			if (ret < 0)
+				return ret;
+		}
 	}
 
-	return fat_catch[fat_num % (fs->clus_size / sizeof(fat_num))];
+	return nr;
 }
 
-static struct dentry *fat_mount(struct file_system_type *fs_type, unsigned long flags, struct block_device *bdev)
+static struct fat_map *fat_build_map(struct fat_fs *fs, __u32 clus, __u32 nclus)
 {
-	int ret;
-	__u16 blk_size;
-	__u32 clus_size;
-	__u32 data_off;
-	__u32 root;
-	struct dentry *root_dir;
-	struct inode *root_ino;
-	struct fat_fs *fat_fs;
-	struct fat_boot_sector *dbr;
-	struct disk_drive *drive = container_of(bdev, struct disk_drive, bdev);
+	int nr;
+	struct fat_map *map;
 
-	fat_fs = zalloc(sizeof(*fat_fs));
-	if (fat_fs == NULL) {
-		DPRINT("%s(): no mem\n", __func__);
+	nr = fat_walk_chain(fs, clus, nclus, NULL);
+	if (nr < 0)
+		return NULL;
+
+	map = zalloc(sizeof(*map) + nr * sizeof(struct fat_run));
+	if (!map)
 		return NULL;
-	}
 
-	dbr = &fat_fs->dbr;
+	map->nr   = nr;
+	map->runs = (struct fat_run *)(map + 1);
 
-	ret = drive->get_block(drive, 0, dbr);
-	if (ret < 0) {
-		DPRINT("%s(): read dbr err\n", __func__);
+	if (fat_walk_chain(fs, clus, nclus, map->runs) != nr) {
+		free(map);
 		return NULL;
 	}
 
-	blk_size = dbr->sector_size[1] << 8 | dbr->sector_size[0];
+	return map;
+}
+
+static struct fat_run *fat_map_find(struct fat_map *map, __u32 lclus)
+{
+	__u32 lo = 0, hi = map->nr, mid;
+	struct fat_run *run;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		run = &map->runs[mid];
+
+		if (lclus < run->lclus)
+			hi = mid;
+		else if (lclus >= run->lclus + run->count)
+			lo = mid + 1;
+		else
+			return run;
+	}
+
+	return NULL;
+}
 
-	if (blk_size < 512 || blk_size > 4096 || (blk_size & (blk_size - 1))) {
-		DPRINT("%s %s() line %d\n", __FILE__, __func__, __LINE__);
+static struct inode *fat_iget(struct super_block *sb, __u32 clus, __u8 attr, __u32 size)
+{
+	struct fat_fs *fs = sb->s_fs_info;
+	struct fat_inode_info *fi;
+	struct inode *inode;
+
+	fi = zalloc(sizeof(*fi));
+	if (!fi)
 		return NULL;
+
+	inode = &fi->vfs_inode;
+	inode->i_sb = sb;
+
+	if (attr & FAT_ATTR_DIR) {
+		// ".." of a top level directory points to cluster 0
+		fi->clus = clus ? clus : fs->root;
+		inode->i_mode = S_IFDIR | 0755;
+		inode->i_op   = &fat_dir_inode_operations;
+		inode->i_fop  = &fat_dir_file_operations;
+	} else {
+		fi->clus = clus;
+		inode->i_mode = S_IFREG | (attr & FAT_ATTR_RDONLY ? 0444 : 0644);
+		inode->i_size = size;
+		inode->i_op   = &fat_reg_inode_operations;
+		inode->i_fop  = &fat_reg_file_operations;
 	}
 
-	// TODO: check if bk_size != drive->sect_size ...
+	inode->i_ino = fi->clus;
 
-	data_off = (dbr->resv_size + dbr->fats * dbr->fat32_length) / dbr->sec_per_clus - 2;
+	return inode;
+}
 
-	clus_size = blk_size * dbr->sec_per_clus; // fat block size
+static int fat_fill_super(struct super_block *sb)
+{
+	int ret;
+	__u32 sect_size, data_sect;
+	struct fat_fs *fs;
+	struct fat_boot_sector *dbr;
+	struct bio *bio;
 
-	root = dbr->root_cluster;
+	fs = zalloc(sizeof(*fs));
+	if (!fs)
+		return -ENOMEM;
 
-	fat_fs->root = root;
-	fat_fs->bdev = bdev;
-	fat_fs->data = data_off;
-	fat_fs->clus_size = clus_size;
+	dbr = &fs->dbr;
 
-	// fixme
-	drive->sect_size = blk_size;
+	bio = bio_alloc();
+	if (!bio) {
+		ret = -ENOMEM;
+		goto L1;
+	}
 
-	// fixme
-	root_ino = zalloc(sizeof(*root_ino));
-	if (!root_ino)
-		return NULL;
+	bio->bdev = sb->s_bdev;
+	bio->sect = 0;
+	bio->size = sizeof(*dbr);
+	bio->data = dbr;
+	submit_bio(READ, bio);
+	bio_free(bio);
 
-	root_ino->i_fs = fat_fs;
-	root_ino->i_ext = (void *)root;
+	sect_size = dbr->sector_size[1] << 8 | dbr->sector_size[0];
 
-	root_dir = zalloc(sizeof(*root_dir));
-	if (!root_dir)
-		return NULL;
+	if (dbr->blk_sign[0] != 0x55 || dbr->blk_sign[1] != 0xAA || !dbr->sec_per_clus ||
+		sect_size < 512 || sect_size > 4096 || (sect_size & (sect_size - 1))) {
+		GEN_DBG("Invalid FAT boot sector!\n");
+		ret = -EINVAL;
+		goto L1;
+	}
 
-	root_dir->inode = root_ino;
+	if (dbr->fat_length || !dbr->fat32_length) {
+		GEN_DBG("only FAT32 is supported!\n");
+		ret = -EINVAL;
+		goto L1;
+	}
+
+	// the data area is read in cluster units
+	data_sect = dbr->resv_size + dbr->fats * dbr->fat32_length;
+	if (data_sect % dbr->sec_per_clus) {
+		GEN_DBG("FAT data area not cluster aligned!\n");
+		ret = -EINVAL;
+		goto L1;
+	}
 
-	/////
+	fs->fat  = dbr->resv_size;
+	fs->data = data_sect / dbr->sec_per_clus - 2;
+	fs->root = dbr->root_cluster;
+	fs->bdev = sb->s_bdev;
+	fs->sect_size = sect_size;
+	fs->clus_size = sect_size * dbr->sec_per_clus;
+
+	sb->s_fs_info = fs;
+	sb->s_blocksize = fs->clus_size;
+
+	return 0;
 
-	return root_dir;
+L1:
+	free(fs);
+	return ret;
 }
 
-#if 0
-static int fat_umount(struct fat_fs *fs, const char *path, const char *type, unsigned long flags)
+static int fat_read_super(struct super_block *sb, void *data, int flags)
 {
-	// free
+	int ret;
+	struct inode *in;
+	struct dentry *root;
+	struct fat_fs *fs;
+
+	ret = fat_fill_super(sb);
+	if (ret < 0)
+		return ret;
+
+	fs = sb->s_fs_info;
+
+	in = fat_iget(sb, fs->root, FAT_ATTR_DIR, 0);
+	if (!in)
+		return -ENOMEM;
+
+	root = d_make_root(in);
+	if (!root)
+		return -ENOMEM;
+
+	sb->s_root = root;
+
 	return 0;
 }
-#endif
 
-static int strxcpy(char *dst, const char *src, __u32 n)
+static struct dentry *fat_mount(struct file_system_type *fs_type,
+			int flags, const char *dev_name, void *data)
 {
-	int i, j;
-
-	for (i = 0, j = 0; i < n; i += 2) {
-		if (*(src + i) != '\0') {
-			*(dst + j) = *(src + i);
-			j++;
-		} else if (*(src + i) == '\0' && *(src + i + 1) == '\0') {
-			*(dst + j) = '\0';
-			j++;
-		}
-	}
+	return mount_bdev(fs_type, flags, dev_name, data, fat_read_super);
+}
 
-	return j;
+// fixme
+static void fat_kill_sb(struct super_block *sb)
+{
 }
 
-static int fat_find_next_file(struct fat_fs *fs,
-			__u32 *block_num, char *name, struct fat_dentry *dir)
+static void fat_short_name(char name[], const struct fat_dentry *de)
 {
-	char buf[fs->clus_size];
-	static struct fat_dentry *dir_pos;
-	static __u32 old_block_num;
+	int i, n = 0;
 
-	name[0] = '\0';
+	for (i = 0; i < 8 && de->name[i] != ' '; i++)
+		name[n++] = de->name[i];
 
-	do {
-		if (*block_num != old_block_num
-			|| dir_pos - (struct fat_dentry *)buf == fs->clus_size / sizeof(*dir_pos)) // find next cluster
-		{
-			old_block_num = *block_num;
+	if (de->name[8] != ' ') {
+		name[n++] = '.';
 
-			if (*block_num > 0x0ffffff8 || *block_num == 0)
-				return -1;
+		for (i = 8; i < 11 && de->name[i] != ' '; i++)
+			name[n++] = de->name[i];
+	}
 
-			if (dir_pos - (struct fat_dentry *)buf == fs->clus_size / sizeof(*dir_pos)) {
-				*block_num = fat_get_fat_table(fs, *block_num);
-				if (*block_num < 0)
-					goto L1;
-				old_block_num = *block_num;
-			}
+	name[n] = '\0';
 
-			fat_read_block(fs, buf, fs->data + *block_num, 0, fs->clus_size);
+	// 0x05 stands for a leading 0xe5
+	if ((__u8)name[0] == 0x05)
+		name[0] = (char)FAT_DE_FREE;
+}
 
-			dir_pos = (struct fat_dentry *)buf;
-		}
+// 13 UCS-2 characters per long name entry, the last piece comes first
+static void fat_lfn_copy(char name[], const struct fat_dentry *de)
+{
+	static const __u8 off[FAT_LFN_CHARS] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+	const __u8 *raw = (const __u8 *)de;
+	int i, pos, seq = raw[0] & 0x1f;
+	__u16 ch;
+
+	if (!seq || seq * FAT_LFN_CHARS >= FAT_NAME_LEN)
+		return;
 
-		DPRINT("name = %s, attribute = %d\n", dir_pos->name, dir_pos->attr);
+	pos = (seq - 1) * FAT_LFN_CHARS;
 
-		switch ((__u8)dir_pos->name[0]) {
-		case 0xe5:
+	if (raw[0] & FAT_LFN_LAST)
+		name[pos + FAT_LFN_CHARS] = '\0';
+
+	for (i = 0; i < FAT_LFN_CHARS; i++) {
+		ch = raw[off[i]] | raw[off[i] + 1] << 8;
+		if (!ch) {
+			name[pos + i] = '\0';
 			break;
+		}
+
+		name[pos + i] = ch < 0x80 ? ch : '_';
+	}
+}
 
-		case 0x0:
-			goto L1;
+// directory cluster kept across calls
+struct fat_dir_ctx {
+	__u32 lclus;
+	__u32 clus;
+	struct buffer_head *bh;
+};
 
-		default:
-			switch (dir_pos->attr) {
-			case 0x10:
-			case 0x20:
-				if (!name[0]) {
-					int i, j;
+// returns 1 with the cluster loaded, 0 past the end of the chain
+static int fat_dir_seek(struct inode *dir, struct fat_dir_ctx *ctx, __u32 lclus)
+{
+	int ret;
+	__u32 i = 0, clus = FAT_I(dir)->clus;
+	struct fat_fs *fs = dir->i_sb->s_fs_info;
 
-					for (i = 0; i < 8 && dir_pos->name[i] != ' '; i++)
-							name[i] = dir_pos->name[i];
+	// go on from the current cluster when seeking forward
+	if (ctx->clus && lclus >= ctx->lclus) {
+		clus = ctx->clus;
+		i = ctx->lclus;
+	}
 
-					name[i++] = '.'; // fixme
+	brelse(ctx->bh);
+	ctx->bh = NULL;
 
-					for (j = 8; j < 11 && dir_pos->name[j] != ' '; j++, i++)
-						name[i]	= dir_pos->name[j];
+	for (; i < lclus; i++) {
+		ret = fat_get_fat_table(fs, clus, &clus);
+		if (ret < 0)
+			return ret;
 
-					*(__u16 *)(name + i) = 0;
-				}
+		if (clus >= FAT_CLUS_EOC)
+			return 0;
+	}
 
-				memcpy(dir, dir_pos, sizeof(*dir_pos));
-				dir_pos++;
-				return 1;
+	if (clus < 2 || clus >= FAT_CLUS_BAD) {
+		GEN_DBG("broken directory chain (0x%x @ %d)\n", clus, lclus);
+		return -EIO;
+	}
 
-			case 0x0f:
-				strxcpy(name + ((dir_pos->name[0] & 0x0f) - 1) * 13, (char *)dir_pos + 1, 10);
-				strxcpy(name + ((dir_pos->name[0] & 0x0f) - 1) * 13 + 5, (char *)dir_pos + 14, 12);
-				strxcpy(name + ((dir_pos->name[0] & 0x0f) - 1) * 13 + 11, (char *)dir_pos + 28, 4);
-				break;
+	ctx->bh = bread(fs->bdev, fs->data + clus, fs->clus_size);
+	if (!ctx->bh)
+		return -EIO;
 
-			default:
-				break;
-			}
+	ctx->clus  = clus;
+	ctx->lclus = lclus;
+
+	return 1;
+}
+
+/*
+ * Get the entry at or after *pos (in entries), with its long name if it
+ * has one. *pos is left past the entry. Returns 0 at the end.
+ */
+static int fat_dir_next(struct inode *dir, struct fat_dir_ctx *ctx, loff_t *pos,
+			struct fat_dentry *de, char name[])
+{
+	int ret;
+	__u32 lclus, per_clus;
+	const struct fat_dentry *ent;
+	struct fat_fs *fs = dir->i_sb->s_fs_info;
+
+	per_clus = fs->clus_size / sizeof(*ent);
+	name[0] = '\0';
+
+	while (1) {
+		lclus = *pos / per_clus;
+
+		if (!ctx->bh || ctx->lclus != lclus || ctx->bh->b_stale) {
+			ret = fat_dir_seek(dir, ctx, lclus);
+			if (ret <= 0)
+				return ret;
 		}
 
-		dir_pos++;
-	}while(dir_pos->name[0]);
+		ent = (const struct fat_dentry *)ctx->bh->b_data + *pos % per_clus;
+		if (!ent->name[0])
+			return 0;
 
-L1:
-	return -1;
+		(*pos)++;
+
+		if ((__u8)ent->name[0] == FAT_DE_FREE) {
+			name[0] = '\0';
+			continue;
+		}
+
+		if (ent->attr == FAT_ATTR_LFN) {
+			fat_lfn_copy(name, ent);
+			continue;
+		}
+
+		if (ent->attr & FAT_ATTR_VOLUME) {
+			name[0] = '\0';
+			continue;
+		}
+
+		if (!name[0])
+			fat_short_name(name, ent);
+
+		*de = *ent;
+
+		return 1;
+	}
 }
 
-static struct dentry *fat_lookup(struct inode *parent, const char *name)
+static int fat_lookup(struct inode *parent, struct dentry *dentry, struct nameidata *nd)
 {
 	int ret;
-	char sname[FILE_NAME_SIZE];
-	__u32 blk_num;
-	struct dentry *de;
-	struct inode *ino;
-	struct fat_dentry *fat_de;
-	struct fat_fs *fat_fs = parent->i_fs;
-
-	fat_de = (struct fat_dentry *)malloc(sizeof(*fat_de));
-	if (fat_de == NULL) {
-		DPRINT("%s(): malloc err\n", __func__);
-		return NULL;
+	loff_t pos = 0;
+	char name[FAT_NAME_LEN], sname[FAT_NAME_LEN], unit[FAT_NAME_LEN];
+	struct fat_dentry de;
+	struct fat_dir_ctx ctx;
+	struct inode *inode;
+
+	if (dentry->d_name.len >= FAT_NAME_LEN)
+		return -ENAMETOOLONG;
+
+	memcpy(unit, dentry->d_name.name, dentry->d_name.len);
+	unit[dentry->d_name.len] = '\0';
+
+	memset(&ctx, 0, sizeof(ctx));
+
+	// names are case insensitive, and the 8.3 alias matches too
+	while ((ret = fat_dir_next(parent, &ctx, &pos, &de, name)) > 0) {
+		if (!strcasecmp(name, unit))
+			break;
+
+		fat_short_name(sname, &de);
+		if (!strcasecmp(sname, unit))
+			break;
 	}
 
-	blk_num = (__u32)parent->i_ext;
+	brelse(ctx.bh);
 
-	while (1) {
-		// fixme
-		ret = fat_find_next_file(fat_fs, &blk_num, sname, fat_de);
-		printf("%s(): ret = %d, sname = %s\n",
-			__func__, ret, sname);
-		if (ret < 0) {
-			DPRINT("can't find file\n");
-			goto err;
-		}
+	if (ret <= 0)
+		return ret < 0 ? ret : -ENOENT;
 
-		if (strcmp(sname, name) == 0) {
-			name = strchr(name, '/');
-			if (name != NULL) {	// last file
-				if (fat_de->attr == 0x10) {
-					blk_num = fat_de->clus_hi << 16 | fat_de->clus_lo;
-					continue;
-				} else
-					goto err;
-			}
+	inode = fat_iget(parent->i_sb, (__u32)de.clus_hi << 16 | de.clus_lo, de.attr, de.size);
+	if (!inode)
+		return -ENOMEM;
 
-			ino = zalloc(sizeof(*ino));
-			if (!ino)
-				return NULL;
+	d_add(dentry, inode);
 
-			ino->mode = ~0;
-			ino->i_fs = parent->i_fs;
-			ino->i_ext = (void *)blk_num;
+	return 0;
+}
 
-			de = zalloc(sizeof(*de));
-			if (!de)
-				return NULL;
+static int fat_readdir(struct file *fp, void *dirent, filldir_t filldir)
+{
+	int ret, count = 0;
+	loff_t pos;
+	char name[FAT_NAME_LEN];
+	struct fat_dentry de;
+	struct inode *in = fp->f_dentry->d_inode;
+	struct fat_dir_ctx *ctx = fp->private_data;
+
+	if (!ctx) {
+		ctx = zalloc(sizeof(*ctx));
+		if (!ctx)
+			return -ENOMEM;
+
+		fp->private_data = ctx;
+	}
+
+	while (1) {
+		pos = fp->f_pos;
 
-			de->d_ext = fat_de;
-			de->inode = ino;
+		ret = fat_dir_next(in, ctx, &pos, &de, name);
+		if (ret < 0)
+			return count ? count : ret;
 
-			return de;
-		}
+		if (!ret)
+			break;
+
+		if (filldir(dirent, name, strlen(name), pos, (__u32)de.clus_hi << 16 | de.clus_lo,
+				de.attr & FAT_ATTR_DIR ? DT_DIR : DT_REG) < 0)
+			return count;
+
+		fp->f_pos = pos;
+		count++;
 	}
 
-err:
-	free(fat_de);
-	return NULL;
+	brelse(ctx->bh);
+	ctx->bh = NULL;
+
+	return count;
 }
 
-#define MAX_FILE_NAME_SIZE 256
+static int fat_dir_close(struct file *fp)
+{
+	struct fat_dir_ctx *ctx = fp->private_data;
+
+	if (ctx) {
+		brelse(ctx->bh);
+		free(ctx);
+		fp->private_data = NULL;
+	}
+
+	return 0;
+}
 
-// fixme
 static int fat_open(struct file *fp, struct inode *inode)
 {
+	fp->private_data = NULL;
+
 	return 0;
 }
 
 static int fat_close(struct file *fp)
 {
+	free(fp->private_data);
+	fp->private_data = NULL;
+
 	return 0;
 }
 
 static ssize_t fat_read(struct file *fp, void *buff, size_t size, loff_t *off)
 {
-	__u32 clus_num, clus_size;
-	size_t pos;
-	size_t count = 0;
-	size_t tmp_size;
-	struct fat_fs *fs = fp->de->inode->i_fs;
-	struct fat_dentry *de = (struct fat_dentry *)fp->de;
-
-	clus_size = fs->clus_size;
-	clus_num = de->clus_hi << 16 | de->clus_lo;
-	pos = fp->pos;
-
-	if (size + pos > de->size)
-		size = de->size - pos;
-
-	while (pos >= clus_size) {
-		clus_num = fat_get_fat_table(fs, clus_num);
-
-#if 0
-		if (clus_num < 0)
-			return clus_num;
-#endif
-
-		pos -= clus_size;
+	ssize_t ret = 0;
+	__u32 i, lclus, nclus;
+	__u32 blk[FAT_READ_BATCH];
+	size_t offset, len, count = 0;
+	struct inode *in = fp->f_dentry->d_inode;
+	struct fat_fs *fs = in->i_sb->s_fs_info;
+	struct fat_map *map = fp->private_data;
+	struct fat_run *run = NULL;
+
+	if (fp->f_pos >= in->i_size)
+		return 0;
+
+	size = min(size, in->i_size - fp->f_pos);
+
+	// the chain is walked once per open file
+	if (!map) {
+		map = fat_build_map(fs, FAT_I(in)->clus,
+				(in->i_size + fs->clus_size - 1) / fs->clus_size);
+		if (!map)
+			return -EIO;
+
+		fp->private_data = map;
 	}
 
-	while (size > count) {
-		if (size + pos - count > clus_size)
-			tmp_size = clus_size - pos;
-		else
-			tmp_size = size - count;
+	while (count < size) {
+		lclus  = (fp->f_pos + count) / fs->clus_size;
+		offset = (fp->f_pos + count) % fs->clus_size;
+		len    = min(size - count, FAT_READ_BATCH * fs->clus_size - offset);
+		nclus  = (offset + len + fs->clus_size - 1) / fs->clus_size;
+
+		for (i = 0; i < nclus; i++) {
+			if (!run || lclus + i < run->lclus || lclus + i >= run->lclus + run->count) {
+				run = fat_map_find(map, lclus + i);
+				if (!run) {
+					ret = -EIO;
+					goto L1;
+				}
+			}
 
-		tmp_size = fat_read_block(fs, buff + count, fs->data + clus_num, pos, tmp_size);
-		if (tmp_size < 0)
-			break;
-		count += tmp_size;
+			blk[i] = fs->data + run->clus + lclus + i - run->lclus;
+		}
 
-		clus_num = fat_get_fat_table(fs, clus_num);
-		if (clus_num < 0)
+		ret = blk_read_runs(fs->bdev, buff + count, blk, fs->clus_size, offset, len);
+		if (ret < 0)
 			break;
 
-		pos = 0;
+		count += len;
 	}
 
+L1:
+	if (!count)
+		return ret;
+
+	fp->f_pos += count;
+
 	return count;
 }
 
@@ -345,18 +608,10 @@ static ssize_t fat_write(struct file *fp, const void *buff, size_t size, loff_t
 	return 0;
 }
 
-static const struct file_operations fat_fops = {
-	.open  = fat_open,
-	.close = fat_close,
-	.read  = fat_read,
-	.write = fat_write,
-};
-
 static struct file_system_type fat_fs_type = {
-	.name   = "vfat",
-	.fops   = &fat_fops,
-	.mount  = fat_mount,
-	.lookup = fat_lookup,
+	.name    = "vfat",
+	.mount   = fat_mount,
+	.kill_sb = fat_kill_sb,
 };
 
 static int __init fat_init(void)
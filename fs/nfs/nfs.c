@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <init.h>
+#include <malloc.h>
+#include <string.h>
+#include <errno.h>
+#include <sysconf.h>
+#include <fs.h>
+#include <net/nfs.h>
+
+/*
+ * Read-only NFSv3 mount, e.g.:
+ *   mount -t nfs 192.168.0.1:/srv/boot /mnt
+ * "net.nfs.rsize" and "net.nfs.window" tune the READ pipeline.
+ */
+
+struct nfs_sb_info {
+	struct nfs_client clnt;
+};
+
+struct nfs_inode {
+	struct inode vfs_inode;
+	struct nfs_fh fh;
+};
+
+static int nfs_inode_lookup(struct inode *parent, struct dentry *dentry,
+	struct nameidata *nd);
+
+static const struct inode_operations nfs_reg_inode_operations = {
+};
+
+static const struct inode_operations nfs_dir_inode_operations = {
+	.lookup = nfs_inode_lookup,
+};
+
+static int nfs_open(struct file *fp, struct inode *inode);
+static int nfs_close(struct file *fp);
+static ssize_t nfs_file_read(struct file *fp, void *buff, size_t size, loff_t *off);
+static ssize_t nfs_file_write(struct file *fp, const void *buff, size_t size, loff_t *off);
+
+static const struct file_operations nfs_reg_file_operations = {
+	.open  = nfs_open,
+	.close = nfs_close,
+	.read  = nfs_file_read,
+	.write = nfs_file_write,
+};
+
+static const struct file_operations nfs_dir_file_operations = {
+};
+
+static inline struct nfs_inode *NFS_I(struct inode *inode)
+{
+	return container_of(inode, struct nfs_inode, vfs_inode);
+}
+
+static inline struct nfs_client *NFS_CLNT(struct super_block *sb)
+{
+	return &((struct nfs_sb_info *)sb->s_fs_info)->clnt;
+}
+
+static struct inode *nfs_iget(struct super_block *sb, const struct nfs_fh *fh,
+	const struct nfs_fattr *attr)
+{
+	struct inode *inode;
+	struct nfs_inode *nin;
+
+	nin = zalloc(sizeof(*nin));
+	if (!nin)
+		return NULL;
+
+	nin->fh = *fh;
+
+	inode = &nin->vfs_inode;
+	inode->i_sb   = sb;
+	inode->i_ino  = (unsigned long)attr->fileid;
+	inode->i_size = (loff_t)attr->size;
+	inode->i_mode = attr->mode & S_IALLUGO;
+
+	switch (attr->type) {
+	case NFS3_REG:
+		inode->i_mode |= S_IFREG;
+		inode->i_op  = &nfs_reg_inode_operations;
+		inode->i_fop = &nfs_reg_file_operations;
+		break;
+
+	case NFS3_DIR:
+		inode->i_mode |= S_IFDIR;
+		inode->i_op  = &nfs_dir_inode_operations;
+		inode->i_fop = &nfs_dir_file_operations;
+		break;
+
+	default:
+		GEN_DBG("file type %d not supported!\n", attr->type);
+		free(nin);
+		return NULL;
+	}
+
+	return inode;
+}
+
+static int nfs_get_conf(const char *attr, int def)
+{
+	char buff[CONF_VAL_LEN];
+	unsigned long val;
+
+	if (conf_get_attr(attr, buff) < 0 || str_to_val(buff, &val) < 0)
+		return def;
+
+	return val;
+}
+
+static int nfs_fill_super(struct super_block *sb, const char *dev_name)
+{
+	int ret;
+	struct nfs_sb_info *nsi;
+	struct nfs_client *clnt;
+	struct nfs_fattr attr;
+	struct inode *in;
+
+	nsi = zalloc(sizeof(*nsi));
+	if (!nsi)
+		return -ENOMEM;
+
+	clnt = &nsi->clnt;
+	clnt->rsize  = nfs_get_conf("net.nfs.rsize", NFS_DEF_RSIZE);
+	clnt->window = nfs_get_conf("net.nfs.window", NFS_DEF_WINDOW);
+
+	if (clnt->rsize < NFS_MIN_RSIZE)
+		clnt->rsize = NFS_MIN_RSIZE;
+	if (clnt->window < 1)
+		clnt->window = 1;
+
+	ret = nfs_client_open(clnt, dev_name);
+	if (ret < 0)
+		goto L1;
+
+	ret = nfs_getattr(clnt, &clnt->root, &attr);
+	if (ret < 0)
+		goto L2;
+
+	sb->s_fs_info = nsi;
+	sb->s_flags = MS_RDONLY;
+	sb->s_blocksize = clnt->rsize;
+
+	DPRINT("%s: rsize = %d, window = %d\n", dev_name, clnt->rsize, clnt->window);
+
+	in = nfs_iget(sb, &clnt->root, &attr);
+	if (!in) {
+		ret = -ENOTDIR;
+		goto L2;
+	}
+
+	sb->s_root = d_make_root(in);
+	if (!sb->s_root) {
+		ret = -ENOMEM;
+		goto L3;
+	}
+
+	return 0;
+
+L3:
+	free(NFS_I(in));
+L2:
+	nfs_client_close(clnt);
+L1:
+	free(nsi);
+	return ret;
+}
+
+static struct dentry *nfs_mount(struct file_system_type *fs_type, int flags,
+	const char *dev_name, void *data)
+{
+	int ret;
+	struct super_block *sb;
+
+	sb = sget(fs_type, NULL);
+	if (!sb)
+		return NULL;
+
+	ret = nfs_fill_super(sb, dev_name);
+	if (ret < 0) {
+		GEN_DBG("fail to mount %s (ret = %d)!\n", dev_name, ret);
+		free(sb);
+		return NULL;
+	}
+
+	return sb->s_root;
+}
+
+static void nfs_kill_sb(struct super_block *sb)
+{
+	nfs_client_close(NFS_CLNT(sb));
+}
+
+static int nfs_open(struct file *fp, struct inode *inode)
+{
+	return 0;
+}
+
+static int nfs_close(struct file *fp)
+{
+	return 0;
+}
+
+static ssize_t nfs_file_read(struct file *fp, void *buff, size_t size, loff_t *off)
+{
+	ssize_t ret;
+	struct inode *in = fp->f_dentry->d_inode;
+
+	if (*off >= in->i_size)
+		return 0;
+
+	if (size > in->i_size - *off)
+		size = in->i_size - *off;
+
+	ret = nfs_read(NFS_CLNT(in->i_sb), &NFS_I(in)->fh, *off, buff, size);
+	if (ret < 0)
+		return ret;
+
+	*off += ret;
+
+	return ret;
+}
+
+static ssize_t nfs_file_write(struct file *fp, const void *buff, size_t size, loff_t *off)
+{
+	return -EROFS;
+}
+
+static int nfs_inode_lookup(struct inode *parent, struct dentry *dentry,
+	struct nameidata *nd)
+{
+	int ret;
+	struct nfs_fh fh;
+	struct nfs_fattr attr;
+	struct inode *inode;
+
+	ret = nfs_lookup(NFS_CLNT(parent->i_sb), &NFS_I(parent)->fh,
+			dentry->d_name.name, dentry->d_name.len, &fh, &attr);
+	if (ret < 0)
+		return ret;
+
+	inode = nfs_iget(parent->i_sb, &fh, &attr);
+	if (!inode)
+		return -ENOTSUPP;
+
+	d_add(dentry, inode);
+
+	return 0;
+}
+
+static struct file_system_type nfs_fs_type = {
+	.name     = "nfs",
+	.fs_flags = FS_REMOTE,
+	.mount    = nfs_mount,
+	.kill_sb  = nfs_kill_sb,
+};
+
+static int __init nfs_init(void)
+{
+	return register_filesystem(&nfs_fs_type);
+}
+
+module_init(nfs_init);
@@ -241,7 +241,8 @@ static int ramfs_readdir(struct file *fp, void *dirent, filldir_t filldir)
 
 	in = de->d_inode;
 	// TODO: fix the offset and type
-	filldir(dirent, de->d_name.name, de->d_name.len, 0, in->i_ino, in->i_mode);
+	if (filldir(dirent, de->d_name.name, de->d_name.len, 0, in->i_ino, in->i_mode) < 0)
+		return 0;
 
 	fp->private_data = iter->next;
 	fp->f_pos++;
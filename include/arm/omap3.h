@@ -25,6 +25,8 @@
 
 int omap3_irq_init(void);
 
+int omap3_timer_init(void);
+
 // fixme: move to omapfb.h
 struct omapfb_panel {
 	int width, height;
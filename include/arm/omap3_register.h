@@ -180,6 +180,10 @@
 #define MMCHS_CUR_CAPA  0x148
 #define MMCHS_REV       0x1fc
 
+// 32KHz sync timer
+#define SYNCTIMER_BASE  0x48320000
+#define SYNCTIMER_CR    0x010
+
 // WDT
 #define WDTTIMER1 0x4830c000
 #define WDTTIMER2 0x48314000
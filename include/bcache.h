@@ -0,0 +1,42 @@
+#pragma once
+
+#include <types.h>
+#include <list.h>
+#include <block.h>
+
+#define BCACHE_DEF_SIZE  KB(256) // overridden by sysconf "block.bcache.size"
+#define BCACHE_HASH_SIZE 64
+
+struct buffer_head {
+	struct block_device *b_bdev;
+	sector_t b_blocknr;  // in b_size units
+	size_t   b_size;
+	void    *b_data;
+	int      b_count;
+	bool     b_stale;    // invalidated while in use, freed by the last brelse()
+
+	struct list_head b_hash;
+	struct list_head b_lru;
+};
+
+struct bcache_stat {
+	__u32 hits;
+	__u32 misses;
+	__u32 evictions;
+	__u32 buffers;
+	__u32 bytes;
+	__u32 limit;
+};
+
+// returns a referenced, up to date buffer or NULL on I/O error
+struct buffer_head *bread(struct block_device *bdev, sector_t block, size_t size);
+
+void brelse(struct buffer_head *bh);
+
+// drop the buffers covering the given sectors of bdev, through whichever
+// of the master drive and its partitions they were read, e.g. before a write
+void bcache_invalidate(struct block_device *bdev, sector_t sect, size_t count);
+
+int bcache_setup(size_t limit);
+void bcache_get_stat(struct bcache_stat *stat);
+void bcache_clear_stat(void);
@@ -13,14 +13,15 @@
 #define BDEV_NAME_NBD    "nbd"
 
 #define BDF_RDONLY       (1 << 0)
+#define BDF_PART         (1 << 1) // partition of a disk drive, bdev.base is its offset
 
 typedef unsigned long sector_t;
 
 struct block_device;
 
 struct part_attr {
-	__u32 base;
-	__u32 size;
+	__u64 base;
+	__u64 size;
 	char  label[LABEL_NAME_SIZE];
 	__u32 flags;
 };
@@ -31,8 +32,8 @@ struct block_device {
 
 	// use part_attr instead?
 	__u32  flags;
-	size_t base;
-	size_t size;
+	__u64  base;
+	__u64  size;
 	char   label[LABEL_NAME_SIZE];
 
 	const struct file_operations *fops;
@@ -47,18 +48,72 @@ enum {
 	WRITE,
 };
 
+#define BIO_MAX_VECS     8
+
+struct bio_vec {
+	void   *base;
+	size_t len;       // multiple of 512
+};
+
 struct bio {
-	void     *data;
+	void     *data;   // single segment shorthand, used when no vec was added
 	size_t   size;
 	sector_t sect;
 	struct block_device *bdev;
 	unsigned long flags;
+
+	struct bio_vec vec[BIO_MAX_VECS];
+	int      vcnt;
+	size_t   count;   // in 512-byte sectors
+
+	int      error;
+	void     (*end_io)(struct bio *bio, int error);
+	void     *private;
+
+	struct list_head node;
+};
+
+// adjacent bios of one direction, merged by the queue
+struct request {
+	int      rw;
+	sector_t sect;
+	size_t   count;
+	struct list_head bios;
+
+	struct list_head node;
+};
+
+// walks the 512-byte sectors of a request, across bios and segments
+struct req_iter {
+	struct list_head *head;
+	struct list_head *bio_node;
+	int    vec;
+	size_t off;
 };
 
 struct bio *bio_alloc();
 
 void bio_free(struct bio *bio);
 
-void submit_bio(int rw,struct bio * bio);
+int bio_add_seg(struct bio *bio, void *base, size_t len);
+
+// queue a bio, bio->end_io() is called once it has been served
+void blk_queue_bio(int rw, struct bio *bio);
+
+// hold back dispatching so that queued bios can be merged
+void blk_plug(void);
+
+void blk_unplug(void);
+
+// synchronous: returns once the bio is done, error in bio->error
+void submit_bio(int rw, struct bio *bio);
+
+// read a file range whose blocks are listed in blk[], 0 for a hole
+ssize_t blk_read_runs(struct block_device *bdev, void *buff, const __u32 blk[],
+			size_t blk_size, size_t off, size_t size);
+
+void req_iter_init(struct req_iter *it, struct request *req);
+
+void *req_iter_next(struct req_iter *it);
 
 struct block_device *bdev_get(const char *name);
@@ -6,9 +6,7 @@
 
 typedef unsigned long ino_t;
 
-typedef struct {
-	int fd;
-} DIR;
+#define DIR_BUF_SIZE        1024
 
 // copy from Linux man page
 struct dirent {
@@ -19,6 +17,13 @@ struct dirent {
 	char           d_name[256]; /* filename */
 };
 
+typedef struct {
+	int fd;
+	size_t pos, len; // entries handed out / filled by getdents()
+	struct dirent ent;
+	unsigned long buf[DIR_BUF_SIZE / sizeof(long)];
+} DIR;
+
 DIR *GAPI opendir(const char *name);
 struct dirent * GAPI readdir(DIR *dir);
 int GAPI closedir(DIR *dir);
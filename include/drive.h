@@ -10,6 +10,14 @@ struct disk_drive {
 
 	int (*get_block)(struct disk_drive *drive, int start, void *buff);
 	int (*put_block)(struct disk_drive *drive, int start, const void *buff);
+	// multi-sector transfers, start and count in 512-byte sectors
+	int (*get_blocks)(struct disk_drive *drive, sector_t start, int count, void *buff);
+	int (*put_blocks)(struct disk_drive *drive, sector_t start, int count, const void *buff);
+	// serves one merged request, defaults to get_blocks()/put_blocks() per segment
+	int (*request)(struct disk_drive *drive, struct request *req);
+
+	struct list_head queue;
+	struct list_head plug_node;
 
 	union {
 		struct list_head master_node;
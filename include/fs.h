@@ -75,8 +75,24 @@ struct file;
 struct qstr {
 	const char *name;
 	unsigned int len;
+	unsigned int hash;
 };
 
+static inline unsigned int partial_name_hash(unsigned char c, unsigned int hash)
+{
+	return (hash + (c << 4) + (c >> 4)) * 11;
+}
+
+static inline unsigned int full_name_hash(const char *name, unsigned int len)
+{
+	unsigned int hash = 0;
+
+	while (len--)
+		hash = partial_name_hash(*name++, hash);
+
+	return hash;
+}
+
 struct path {
 	struct mount *mnt;
 	struct dentry *dentry;
@@ -87,8 +103,12 @@ struct nameidata {
 	unsigned int flag;
 };
 
+#define FS_REMOTE  1 // files may change behind our back, lookup misses are not cached
+#define FS_DYNAMIC 2 // nodes appear without going through the VFS, misses not cached either
+
 struct file_system_type {
 	const char *name;
+	int fs_flags;
 	struct file_system_type *next;
 
 	struct dentry *(*mount)(struct file_system_type *, int,
@@ -294,13 +314,21 @@ struct dentry {
 	struct super_block *d_sb;
 	struct dentry *d_parent;
 	struct list_head d_subdirs, d_child;
+	struct list_head d_hash;
 	// int d_type; // fixme
 };
 
+#define DENTRY_HASH_SIZE 256
+
 struct dentry *__d_alloc(struct super_block *sb, const struct qstr *str);
 
 struct dentry *d_alloc(struct dentry *parent, const struct qstr *str);
 
+// unit->hash must be set, d_inode is NULL for a negative entry
+struct dentry *d_lookup(struct dentry *parent, const struct qstr *unit);
+
+void d_free(struct dentry *dentry);
+
 struct dentry *d_make_root(struct inode *root_inode);
 
 void dput(struct dentry *dentry);
@@ -328,6 +356,7 @@ int filldir(struct linux_dirent *, const char * name, int namlen, loff_t offset,
 */
 
 struct super_block {
+	struct file_system_type *s_type;
 	__u32 s_blocksize;
 	unsigned char s_blocksize_bits;
 	unsigned long s_flags;
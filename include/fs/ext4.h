@@ -8,12 +8,33 @@ struct ext4_sb_info {
 	struct ext4_group_desc *gdt;
 };
 
+#define EXT4_EXT_CACHE_SIZE 4
+
+// a resolved extent, pblk 0 for holes
+struct ext4_ext_cache {
+	__u32 lblk;
+	__u32 len; // 0: unused slot
+	__u32 pblk;
+};
+
 struct ext4_inode_info {
 	struct inode vfs_inode;
 	// __le32	i_data[EXT4_N_BLOCKS];
 	struct ext4_inode *i_e4in;
+
+	struct ext4_ext_cache i_ext_cache[EXT4_EXT_CACHE_SIZE];
+	int i_ext_next;
 };
 
+struct dx_hash_info {
+	__u32 hash;
+	__u32 minor_hash;
+	int   hash_version;
+	const __u32 *seed;
+};
+
+int ext4_dirhash(const char *name, int len, struct dx_hash_info *hinfo);
+
 static inline struct ext4_inode_info *EXT4_I(struct inode *inode)
 {
 	return container_of(inode, struct ext4_inode_info, vfs_inode);
@@ -290,6 +290,7 @@ struct ext4_super_block {
  * Structure of a directory entry
  */
 #define EXT4_NAME_LEN 255
+#define EXT4_DIR_REC_MIN 12 /* rec_len of a one character name */
 
 struct ext4_dir_entry {
 	__le32	inode;			/* Inode number */
@@ -329,6 +330,63 @@ enum {
 };
 
 
+/*------------------ htree -------------------*/
+
+#define EXT2_FLAGS_SIGNED_HASH		0x0001
+#define EXT2_FLAGS_UNSIGNED_HASH	0x0002
+
+#define DX_HASH_LEGACY			0
+#define DX_HASH_HALF_MD4		1
+#define DX_HASH_TEA			2
+#define DX_HASH_LEGACY_UNSIGNED		3
+#define DX_HASH_HALF_MD4_UNSIGNED	4
+#define DX_HASH_TEA_UNSIGNED		5
+
+#define EXT4_HTREE_EOF_32BIT		0x7fffffff
+#define EXT4_HTREE_LEVEL		3
+
+struct fake_dirent {
+	__le32	inode;
+	__le16	rec_len;
+	__u8	name_len;
+	__u8	file_type;
+};
+
+struct dx_countlimit {
+	__le16	limit;
+	__le16	count;
+};
+
+/* the first entry has the count/limit pair in place of its hash */
+struct dx_entry {
+	__le32	hash;
+	__le32	block;		/* logical block of the directory */
+};
+
+struct dx_root_info {
+	__le32	reserved_zero;
+	__u8	hash_version;
+	__u8	info_length;	/* 8 */
+	__u8	indirect_levels;
+	__u8	unused_flags;
+};
+
+/* block 0 of an indexed directory, still readable as "." and ".." */
+struct dx_root {
+	struct fake_dirent dot;
+	char	dot_name[4];
+	struct fake_dirent dotdot;
+	char	dotdot_name[4];
+	struct dx_root_info info;
+	struct dx_entry entries[0];
+};
+
+struct dx_node {
+	struct fake_dirent fake;
+	struct dx_entry entries[0];
+};
+
+
 /*------------------ extents -------------------*/
 
  /*
@@ -375,3 +433,6 @@ enum {
  };
 
 #define EXT4_EXT_MAGIC		cpu_to_le16(0xf30a)
+
+/* longer ee_len values mark uninitialized extents */
+#define EXT_INIT_MAX_LEN	(1 << 15)
@@ -48,11 +48,49 @@ struct fat_dentry {
 	__u32 size;
 };
 
+#define FAT_ATTR_RDONLY  0x01
+#define FAT_ATTR_VOLUME  0x08
+#define FAT_ATTR_DIR     0x10
+#define FAT_ATTR_LFN     0x0f
+
+#define FAT_DE_FREE      0xe5
+#define FAT_LFN_LAST     0x40
+#define FAT_LFN_CHARS    13
+#define FAT_NAME_LEN     (20 * FAT_LFN_CHARS + 1)
+
+#define FAT_CLUS_MASK  0x0fffffff
+#define FAT_CLUS_BAD   0x0ffffff7
+#define FAT_CLUS_EOC   0x0ffffff8 // and above
+
+// physically contiguous clusters of a file
+struct fat_run {
+	__u32 lclus; // first cluster index within the file
+	__u32 clus;
+	__u32 count;
+};
+
+// cluster chain of an open file, sorted by lclus
+struct fat_map {
+	__u32 nr;
+	struct fat_run *runs;
+};
+
 struct fat_fs {
-	// __u32  fat;
-	__u32 data;
+	__u32 fat;  // first FAT sector
+	__u32 data; // data area in clusters, biased by the 2 reserved ones
 	__u32 root;
+	__u32 sect_size;
 	__u32 clus_size;
 	struct fat_boot_sector dbr;
 	struct block_device *bdev;
 };
+
+struct fat_inode_info {
+	struct inode vfs_inode;
+	__u32 clus; // first cluster, 0 for an empty file
+};
+
+static inline struct fat_inode_info *FAT_I(struct inode *inode)
+{
+	return container_of(inode, struct fat_inode_info, vfs_inode);
+}
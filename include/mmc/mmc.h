@@ -62,6 +62,15 @@
 #define SD_APP_OP_COND           41   /* bcr  [31:0] OCR         R3  */
 
 #define MMC_CMD_RETRIES        20
+
+/* R1 card status */
+#define MMC_STATUS_READY_FOR_DATA (1 << 8)
+#define MMC_STATUS_STATE(x)       (((x) >> 9) & 0xf)
+#define MMC_STATE_TRAN            4
+
+/* host capabilities */
+#define MMC_CAP_AUTO_STOP         (1 << 0) /* host sends CMD12 after the last block */
+#define MMC_CAP_SET_BLOCK_COUNT   (1 << 1) /* card and host take CMD23 before CMD18/CMD25 */
 #define SD_BUS_WIDTH_1		0
 #define SD_BUS_WIDTH_4		2
 
@@ -139,7 +148,11 @@ struct mmc_host {
 	void (*set_lclk)(void);
 	int (*read_data)(struct mmc_host *mmc, void *buf);
 	int (*write_data)(struct mmc_host *mmc, const void *buf);
+	void (*reset_data)(struct mmc_host *mmc); // optional, after an aborted transfer
 
+	__u32 caps;
+	__u32 max_blocks; // per CMD18/CMD25, 0 for single block commands only
+	__u32 blocks;     // block count of the data command being sent
 };
 
 int mmc_register(struct mmc_host * mmc);
@@ -150,6 +163,10 @@ int mmc_read_blk(struct mmc_host *host, __u8 *buf, int start);
 
 int mmc_write_blk(struct mmc_host *host, const __u8 *buf, int start);
 
+int mmc_read_blks(struct mmc_host *host, __u8 *buf, sector_t start, int count);
+
+int mmc_write_blks(struct mmc_host *host, const __u8 *buf, sector_t start, int count);
+
 int mmc_erase_blk(struct mmc_host *host, int start);
 
 int mmc_decode_cid(struct mmc_host *host);
@@ -64,6 +64,7 @@ struct ecc_stats {
 	__u32 ecc_failed_count;
 	__u32 badblocks;
 	__u32 bbtblocks;
+	__u32 skipped_pages; // blank pages not programmed
 };
 
 typedef struct {
@@ -93,6 +94,8 @@ typedef struct {
 #define EDF_JFFS2      (1 << 0)
 #define EDF_ALLOWBB    (1 << 8)
 
+#define FLASH_FAIL_ADDR_UNKNOWN  ((uint64_t)-1)
+
 struct erase_info {
 	struct mtd_info *mtd;
 	uint64_t addr;
@@ -148,9 +151,10 @@ struct flash_info {
 	size_t oob_size;
 	OOB_MODE oob_mode;
 	const char *name;
-	size_t bdev_base;
-	size_t bdev_size;
+	__u64 bdev_base;
+	__u64 bdev_size;
 	const char *bdev_label;
+	__u32 skipped_pages;
 };
 
 #define MTD_MAX_OOBFREE_ENTRIES_LARGE	32
@@ -188,13 +192,15 @@ struct mtd_info {
 
 	size_t write_size;
 	size_t erase_size;
-	size_t chip_size; // fixme
+	__u64  chip_size; // 8 Gbit and larger parts overflow 32 bits
 
 	__u32 write_shift;
 	__u32 erase_shift;
 	__u32 chip_shift;
 
 	__u32 oob_size;
+	__u32 plane_num; // blocks that can be programmed/erased at once
+	__u32 tail_blocks; // reserved at the chip end (on-flash BBT), not partitioned
 
 	struct ecc_stats eccstat;
 
@@ -203,20 +209,25 @@ struct mtd_info {
 	FLASH_HOOK_PARAM *callback_args;
 	FLASH_HOOK_FUNC   callback_func;
 
-	int (*read)(struct mtd_info *, __u32, __u32, size_t *, __u8 *);
-	int (*write)(struct mtd_info *, __u32, __u32 , __u32 *, const __u8 *);
+	// offsets are 64-bit, a single transfer stays within 32 bits
+	int (*read)(struct mtd_info *, __u64, __u32, size_t *, __u8 *);
+	int (*write)(struct mtd_info *, __u64, __u32 , __u32 *, const __u8 *);
 	int (*erase)(struct mtd_info *, struct erase_info *);
 
-	int (*read_oob)(struct mtd_info *, __u32, struct mtd_oob_ops *);
-	int (*write_oob)(struct mtd_info *,__u32, struct mtd_oob_ops *);
+	int (*read_oob)(struct mtd_info *, __u64, struct mtd_oob_ops *);
+	int (*write_oob)(struct mtd_info *, __u64, struct mtd_oob_ops *);
 
-	int (*block_isbad)(struct mtd_info *, __u32);
-	int (*block_markbad)(struct mtd_info *, __u32);
+	int (*block_isbad)(struct mtd_info *, __u64);
+	int (*block_markbad)(struct mtd_info *, __u64);
 	int (*scan_bad_block)(struct mtd_info *); // fixme: to be removed
 
 	OOB_MODE oob_mode;
 	//
 	struct nand_ecclayout *ecclayout;
+
+	// partitions: logical (good) block -> physical block, built on first use
+	__u32 *blk_map;
+	__u32 blk_good;
 };
 
 static __u32 inline flash_write_is_align(struct mtd_info *mtd, __u32 size)
@@ -239,6 +250,9 @@ typedef enum {
 	NAND_ECC_HW,
 //	NAND_ECC_YAFFS,
 	NAND_ECC_YAFFS2,
+	NAND_ECC_BCH4,
+	NAND_ECC_BCH8,
+	NAND_ECC_BCH16,
 } ECC_MODE;
 
 int flash_set_ecc_mode(struct mtd_info *mtd, ECC_MODE newMode, ECC_MODE *pOldMode);
@@ -246,3 +260,9 @@ int flash_set_ecc_mode(struct mtd_info *mtd, ECC_MODE newMode, ECC_MODE *pOldMod
 int flash_fops_init(struct block_device *bdev);
 
 struct mtd_info *get_mtd_device(void *nil, unsigned int num);
+
+struct mtd_info *flash_get_master(struct mtd_info *mtd);
+
+int flash_map_addr(struct mtd_info *mtd, __u64 off, __u32 len, __u64 *phys);
+
+void flash_bad_block_notify(struct mtd_info *master, __u64 off);
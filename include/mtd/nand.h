@@ -20,6 +20,12 @@
 #define NAND_CMMD_READSTART     0x30
 #define NAND_CMMD_RNDOUTSTART   0xE0
 #define NAND_CMMD_CACHEDPROG    0x15
+#define NAND_CMMD_MPLANE_PROG   0x11
+#define NAND_CMMD_MPLANE_SEQIN  0x81
+#define NAND_CMMD_READCACHESEQ  0x31
+#define NAND_CMMD_READCACHEEND  0x3F
+#define NAND_CMMD_PARAM         0xEC
+#define NAND_CMMD_MPLANE_ERASE  0xD1
 
 #define NAND_CMMD_DEPLETE1      0x100
 #define NAND_CMMD_DEPLETE2      0x38
@@ -38,6 +44,9 @@
 #define SOFT_ECC_DATA_LEN  256
 #define SOFT_ECC_CODE_NUM  3
 
+#define NAND_BCH_DATA_LEN  512
+#define NAND_BCH_MAX_T     16
+
 #define NAND_MAX_CHIPS        8
 #define NAND_MAX_OOB_SIZE    64
 #define NAND_MAX_PAGESIZE    2048
@@ -70,6 +79,8 @@
 #define BBT_AUTO_REFRESH    0x00000080
 #define NAND_NO_READRDY        0x00000100
 #define NAND_NO_SUBPAGE_WRITE    0x00000200
+#define NAND_CACHERD        0x00000400
+#define NAND_2PLANE         0x00000800
 
 #define NAND_SAMSUNG_LP_OPTIONS \
 	(NAND_NO_PADDING | NAND_CACHEPRG | NAND_COPYBACK)
@@ -78,11 +89,14 @@
 #define NAND_MUST_PAD(nand) (!(nand->flags & NAND_NO_PADDING))
 #define NAND_HAS_CACHEPROG(nand) ((nand->flags & NAND_CACHEPRG))
 #define NAND_HAS_COPYBACK(nand) ((nand->flags & NAND_COPYBACK))
+#define NAND_HAS_CACHEREAD(nand) ((nand->flags & NAND_CACHERD))
+#define NAND_HAS_2PLANE(nand) ((nand->flags & NAND_2PLANE))
 
 #define NAND_CHIP_OPTIONS_MSK    (0x0000ffff & ~NAND_NO_AUTOINCR)
 #define NAND_USE_FLASH_BBT    0x00010000
 #define NAND_SKIP_BBTSCAN    0x00020000
 #define NAND_OWN_BUFFERS    0x00040000
+#define NAND_SKIP_BLANK     0x00080000 // don't program all-0xFF pages
 
 #define LP_OPTIONS (NAND_SAMSUNG_LP_OPTIONS | NAND_NO_READRDY | NAND_NO_AUTOINCR)
 #define LP_OPTIONS16 (LP_OPTIONS | NAND_BUSWIDTH_16)
@@ -114,6 +128,7 @@ typedef enum {
 } NAND_STATE;
 
 struct nand_ctrl;
+struct nand_bch;
 
 struct nand_buffer {
 	__u8 ecccalc[NAND_MAX_OOB_SIZE];
@@ -140,6 +155,7 @@ struct nand_ctrl {
 
 	int   slaves;
 	__u32   max_slaves;
+	bool  stripe; // slaves are registered as one interleaved mtd
 
 	int   chip_delay;
 	NAND_STATE  state;
@@ -151,8 +167,8 @@ struct nand_ctrl {
 	void  (*read_buff)(struct nand_ctrl *, __u8 *, int);
 	int   (*verify_buff)(struct nand_ctrl *, const __u8 *, int);
 	void  (*select_chip)(struct nand_chip *, bool);
-	int   (*block_bad)(struct nand_chip *, __u32, int);
-	int   (*block_markbad)(struct nand_chip *, __u32);
+	int   (*block_bad)(struct nand_chip *, __u64, int);
+	int   (*block_markbad)(struct nand_chip *, __u64);
 	void  (*cmd_ctrl)(struct nand_chip *, int, unsigned int);
 	int   (*flash_ready)(struct nand_chip *);
 	void  (*command)(struct nand_chip * nand, __u32 cmd, int col, int row);
@@ -181,6 +197,8 @@ struct nand_ctrl {
 	int   (*ecc_generate)(struct nand_chip *nand, const __u8 *data, __u8 *ecc);
 	int   (*ecc_correct)(struct nand_chip *nand, __u8 *data, __u8 *ecc_read, __u8 *ecc_calc);
 
+	struct nand_bch *bch;
+
 	const char *name;
 
 	struct list_head nand_list;
@@ -196,6 +214,15 @@ struct nand_ctrl {
 #define NAND_MFR_MICRON        0x2c
 #define NAND_MFR_AMD        0x01
 
+// ONFI parameter page, returned three times after ECh
+#define ONFI_PARAM_LEN       256
+#define ONFI_FEATURE_BUS16   (1 << 0)
+#define ONFI_FEATURE_MPLANE  (1 << 3)
+#define ONFI_OPT_CACHE_PROG  (1 << 0)
+#define ONFI_OPT_CACHE_READ  (1 << 1)
+
+__u16 nand_onfi_crc16(const __u8 *p, int len);
+
 struct nand_vendor_name {
 	int  id;
 	const char *name;
@@ -222,8 +249,9 @@ struct nand_vendor_name {
 #define NAND_BBT_SCAN_MAXBLOCKS    4
 
 int nand_scan_bbt(struct nand_chip *nand);
-int nand_update_bbt(struct nand_chip *nand, __u32 offs);
-int nand_is_bad_bbt(struct nand_chip *nand, __u32 offs);
+bool nand_bbt_oob_clash(struct nand_chip *nand);
+int nand_update_bbt(struct nand_chip *nand, __u64 offs);
+int nand_is_bad_bbt(struct nand_chip *nand, __u64 offs);
 int nand_erase(struct nand_chip *nand, struct erase_info *opt);
 
 #define NAND_BBP_LARGE        0
@@ -238,6 +266,16 @@ int nand_calculate_ecc(struct nand_chip *nand, const __u8 *data, __u8 *ecc);
 
 int nand_correct_data(struct nand_chip *nand, __u8 *dat, __u8 *read_ecc, __u8 *calc_ecc);
 
+struct nand_bch *nand_bch_new(int strength);
+void nand_bch_free(struct nand_bch *bch);
+int nand_bch_strength(const struct nand_bch *bch);
+int nand_bch_code_len(const struct nand_bch *bch);
+
+void nand_bch_encode(struct nand_bch *bch, const __u8 *data, __u32 len, __u8 *ecc);
+// returns the number of corrected bits, or -EBADMSG
+int nand_bch_decode(struct nand_bch *bch, __u8 *data, __u32 len,
+			const __u8 *read_ecc, const __u8 *calc_ecc);
+
 #define PAGE_SIZE_AUTODETECT 0
 
 int nand_ctrl_register(struct nand_ctrl *);
@@ -248,6 +286,8 @@ struct nand_chip *nand_probe(struct nand_ctrl *nfc, int bus_idx);
 
 int nand_register(struct nand_chip * nand);
 
+int nand_stripe_register(struct nand_ctrl *nfc);
+
 struct nand_chip {
 	struct mtd_info parent;
 	struct nand_ctrl *master;
@@ -265,6 +305,10 @@ struct nand_chip {
 
 	int  bad_blk_oob_pos;
 
+	// two-plane sequence (NAND_2PLANE), which is vendor specific
+	__u8 mplane_seqin; // loads the second plane: 81h or 80h
+	__u8 mplane_erase; // between the two erase addresses: D1h, or none
+
 	struct mtd_oob_ops opt;
 
 	__u8 *bbt;
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <types.h>
+
+struct nand_sim_opt {
+	__u32 bitflip;   // ppm of page reads returned with one flipped data bit
+	__u32 fail;      // ppm of program/erase operations reporting failure
+	__u32 seed;
+};
+
+struct nand_sim_stat {
+	__u32 reads;
+	__u32 programs;
+	__u32 erases;
+	__u32 bytes_in;
+	__u32 bytes_out;
+	__u32 bitflips;
+	__u32 prog_fails;
+	__u32 erase_fails;
+	__u32 clock_us;  // virtual time the chip has been busy or on the bus
+};
+
+int nand_sim_setup(const struct nand_sim_opt *opt);
+void nand_sim_get_info(struct nand_sim_opt *opt, struct nand_sim_stat *stat);
+void nand_sim_clear_stat(void);
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <types.h>
+#include <spi.h>
+#include <mtd/mtd.h>
+
+#define SPINOR_OP_WREN        0x06
+#define SPINOR_OP_WRDI        0x04
+#define SPINOR_OP_RDSR        0x05
+#define SPINOR_OP_RDSR2       0x35
+#define SPINOR_OP_WRSR        0x01
+#define SPINOR_OP_READ        0x03
+#define SPINOR_OP_READ_FAST   0x0B
+#define SPINOR_OP_READ_1_1_2  0x3B
+#define SPINOR_OP_READ_1_1_4  0x6B
+#define SPINOR_OP_PP          0x02
+#define SPINOR_OP_BE_4K       0x20
+#define SPINOR_OP_BE_32K      0x52
+#define SPINOR_OP_SE          0xD8
+#define SPINOR_OP_CHIP_ERASE  0xC7
+#define SPINOR_OP_RDID        0x9F
+#define SPINOR_OP_RDSFDP      0x5A
+#define SPINOR_OP_EN4B        0xB7
+
+#define SR_WIP   (1 << 0)
+#define SR_WEL   (1 << 1)
+#define SR2_QE   (1 << 1)
+
+#define SPI_NOR_MAX_ID_LEN  3
+#define SPI_NOR_MAX_ERASE   4
+#define SPI_NOR_MAX_CMD     6 // opcode, up to 4 address bytes and a dummy byte
+
+// spi_nor_id flags
+#define SECT_4K             (1 << 0)
+#define SECT_32K            (1 << 1)
+#define SPI_NOR_DUAL_READ   (1 << 2)
+#define SPI_NOR_QUAD_READ   (1 << 3)
+
+struct spi_nor_id {
+	const char *name;
+	__u8  id[SPI_NOR_MAX_ID_LEN];
+	__u32 sector_size; // erased by SPINOR_OP_SE
+	__u32 n_sectors;
+	__u32 flags;
+};
+
+struct spi_nor_erase {
+	__u32 size;
+	__u8  opcode;
+};
+
+struct spi_nor {
+	struct mtd_info parent;
+	struct spi_slave *spi;
+
+	__u32 page_size;
+	__u32 flags;
+	__u8  addr_width;
+
+	__u8  read_opcode;
+	__u8  read_dummy; // bytes, sent on a single line
+	__u8  read_nbits;
+
+	int erase_num;
+	struct spi_nor_erase erase[SPI_NOR_MAX_ERASE]; // smallest first
+
+	__u8 cmd[SPI_NOR_MAX_CMD];
+};
+
+// identify the chip behind spi (JEDEC ID and SFDP) and register it as an MTD
+int spi_nor_register(struct spi_slave *spi);
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <types.h>
+
+#define NETCON_DEF_PORT  6666
+#define NETCON_BUF_LEN   1024 // fits in one UDP datagram
+#define NETCON_FLUSH_MS  20
+
+// UART policy while the network console is active
+#define NETCON_UART_ON    -1
+#define NETCON_UART_OFF    0
+// a positive value limits UART output to that many bytes per second
+
+void netcon_init(void);
+
+int netcon_setup(const char *target, int uart_policy);
+
+void netcon_stop(void);
+
+bool netcon_active(void);
+
+bool netcon_putchar(int ch);
+
+void netcon_flush(void);
+
+// call from idle and busy loops, so that a partial line goes out
+void netcon_poll(void);
+
+int netcon_getchar(char *ch);
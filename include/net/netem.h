@@ -0,0 +1,34 @@
+#pragma once
+
+#include <types.h>
+
+#define NETEM_QUEUE_LEN 64
+
+struct sock_buff;
+
+struct netem_opt {
+	__u32 latency; // ms, added to every received frame
+	__u32 jitter;  // ms, random extra delay in [0, jitter]
+	__u32 loss;    // %, applied to both rx and tx
+	__u32 reorder; // %, frames that overtake the delayed ones
+	__u32 seed;
+};
+
+struct netem_stat {
+	__u32 rx_passed;
+	__u32 rx_delayed;
+	__u32 rx_reordered;
+	__u32 rx_dropped;
+	__u32 tx_dropped;
+	__u32 overflow;
+	__u32 max_queue;
+};
+
+// all-zero options (but seed) switch the emulator off
+int netem_setup(const struct netem_opt *opt);
+void netem_get_info(struct netem_opt *opt, struct netem_stat *stat);
+bool netem_active(void);
+
+bool netem_rx(struct sock_buff *skb);
+bool netem_tx_drop(void);
+int netem_poll(void);
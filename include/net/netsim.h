@@ -0,0 +1,21 @@
+#pragma once
+
+#include <types.h>
+
+struct netsim_stat {
+	__u32 tx_frames;   // stack -> peer
+	__u32 rx_frames;   // peer -> stack
+	__u32 rx_overflow; // peer frames dropped, the stack did not poll
+	__u32 arp;
+	__u32 icmp;
+	__u32 dhcp;
+	__u32 tftp_sessions;
+	__u32 tftp_bytes_out;
+	__u32 tftp_bytes_in;
+	__u32 tftp_rexmits;
+	__u32 nfs_calls;     // portmap, MOUNT and NFS
+	__u32 nfs_bytes_out;
+};
+
+void netsim_get_stat(struct netsim_stat *stat);
+void netsim_clear_stat(void);
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <net/net.h>
+#include <net/socket.h>
+
+#define STD_PORT_PORTMAP  111
+
+#define RPC_PROG_PORTMAP  100000
+#define RPC_PROG_NFS      100003
+#define RPC_PROG_MOUNT    100005
+
+#define NFS3_FHSIZE       64
+
+#define NFS3_REG          1
+#define NFS3_DIR          2
+
+/*
+ * No IP reassembly in the stack, so a READ reply (~128 bytes of RPC/NFS
+ * header plus data) must fit in one Ethernet frame.
+ */
+#define NFS_MAX_RSIZE     1024
+#define NFS_DEF_RSIZE     NFS_MAX_RSIZE
+#define NFS_MIN_RSIZE     256
+
+#define NFS_MAX_WINDOW    16
+#define NFS_DEF_WINDOW    8
+
+#define NFS_DEF_TIMEOUT   500 // ms
+#define NFS_DEF_RETRIES   8
+
+struct nfs_fh {
+	__u32 size;
+	__u8  data[NFS3_FHSIZE];
+};
+
+struct nfs_fattr {
+	__u32 type;
+	__u32 mode;
+	u64   size;
+	u64   fileid;
+};
+
+struct nfs_client {
+	int    sockfd;
+	__u32  server_ip;
+	__u16  mnt_port;
+	__u16  nfs_port;
+	__u32  xid;
+	int    rsize;
+	int    window;
+	int    timeout; // in ms
+	int    retries;
+	struct nfs_fh root;
+};
+
+// export: "<server_ip>:<path>"
+int nfs_client_open(struct nfs_client *clnt, const char *export);
+void nfs_client_close(struct nfs_client *clnt);
+
+int nfs_getattr(struct nfs_client *clnt, const struct nfs_fh *fh,
+	struct nfs_fattr *attr);
+int nfs_lookup(struct nfs_client *clnt, const struct nfs_fh *dir,
+	const char *name, int len, struct nfs_fh *fh, struct nfs_fattr *attr);
+ssize_t nfs_read(struct nfs_client *clnt, const struct nfs_fh *fh,
+	u64 offset, void *buff, size_t size);
@@ -70,6 +70,7 @@ struct socket {
 	int type;
 	int protocol;
 	int obstruct_flags;
+	int rx_timeout; // in ms, only for non-blocking sockets
 	struct list_head tx_qu, rx_qu;
 	struct sockaddr_in saddr[2]; // fixme: sockaddr instead
 	enum tcp_state state;
@@ -106,6 +107,10 @@ ssize_t sendto(int fd, const void *buf, __u32 n, int flags, const struct sockadd
 ssize_t recvfrom(int fd, void *buf, __u32 n, int flags, struct sockaddr *src_addr, socklen_t *addrlen);
 int sk_close(int fd);
 
-#define SKIOCS_FLAGS 1
+#define SKIOCS_FLAGS   1
+#define SKIOCS_TIMEOUT 2
 
 int socket_ioctl(int fd, int cmd, int flags);
+
+// fixme: to be removed
+int qu_is_empty(int fd);
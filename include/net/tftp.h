@@ -1,12 +1,14 @@
 #pragma once
 
 #include <block.h>
+#include <net/net.h>
 
 #define TFTP_RRQ   CPU_TO_BE16(1)
 #define TFTP_WRQ   CPU_TO_BE16(2)
 #define TFTP_DAT   CPU_TO_BE16(3)
 #define TFTP_ACK   CPU_TO_BE16(4)
 #define TFTP_ERR   CPU_TO_BE16(5)
+#define TFTP_OACK  CPU_TO_BE16(6)
 
 #define TFTP_HDR_LEN   4
 #define TFTP_PKT_LEN   512
@@ -14,6 +16,22 @@
 
 #define TFTP_MODE_OCTET  "octet"
 
+// RFC 2347/2348/2349/7440 options
+#define TFTP_OPT_BLKSIZE  "blksize"
+#define TFTP_OPT_WINSIZE  "windowsize"
+#define TFTP_OPT_TSIZE    "tsize"
+
+#define TFTP_MIN_BLKSIZE  8
+#define TFTP_MAX_BLKSIZE  (MAX_ETH_LEN - ETH_HDR_LEN - IP_HDR_LEN - UDP_HDR_LEN - TFTP_HDR_LEN)
+#define TFTP_MAX_WINSIZE  64
+
+// error codes
+#define TFTP_EUNDEF   0
+#define TFTP_ENOTFOUND 1
+#define TFTP_EACCESS  2
+#define TFTP_EBADOP   4
+#define TFTP_EOPTNEG  8
+
 #undef  TFTP_DEBUG  // fixme: depend on configuration
 #define TFTP_VERBOSE
 
@@ -34,3 +52,17 @@ struct tftp_opt {
 
 int tftp_download(struct tftp_opt *opt);
 int tftp_upload(struct tftp_opt *opt);
+
+#define TFTPD_MEM_PREFIX "mem:"
+
+struct tftpd_opt {
+	bool  verbose;
+	const char *root; // prefix for relative file names
+	int   timeout; // in ms
+	int   retries;
+	int   max_blksize;
+	int   max_winsize;
+	bool  once; // exit after the first transfer
+};
+
+int tftpd_serve(struct tftpd_opt *opt);
@@ -4,9 +4,14 @@
 
 struct spi_slave;
 
+// spi_master mode: data lines the controller can receive on
+#define SPI_RX_DUAL  (1 << 0)
+#define SPI_RX_QUAD  (1 << 1)
+
 struct spi_master {
 	char *name;
 	int bus_num;
+	__u32 mode;
 	struct list_head slave_list;
 	int (*transfer)(struct spi_slave *);
 };
@@ -23,6 +28,7 @@ struct spi_trans_msg {
 	__u8 *tx_buf;
 	__u8 *rx_buf;
 	__u32 len;
+	__u8 rx_nbits; // 2 or 4 for dual/quad input, 0 or 1 otherwise
 };
 
 struct spi_master *spi_master_alloc();
@@ -37,6 +43,9 @@ int spi_write_then_read(struct spi_slave *slave, __u8 *tx_buf, __u32 n_tx, __u8
 
 int spi_transfer(struct spi_slave *slave);
 
+// all messages in one transfer, i.e. with the chip selected throughout
+int spi_sync(struct spi_slave *slave, struct spi_trans_msg msg[], int n);
+
 struct spi_slave *get_spi_slave(char *name);
 
 struct spi_master *get_spi_master(char *name);
@@ -30,3 +30,5 @@ int conf_set_attr(const char *attr, const char *val);
 int conf_add_attr(const char *attr, const char *val);
 int conf_del_attr(const char *attr);
 int conf_list_attr(void);
+int conf_store(void);
+int conf_load(void);
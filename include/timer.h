@@ -7,3 +7,6 @@ __u32 get_tick(void);
 void inc_tick(void);
 
 void calibrate_delay(__u32);
+
+// for platforms without a tick interrupt: a free-running clock in ms
+void set_tick_source(__u32 (*read_ms)(void));
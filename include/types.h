@@ -12,7 +12,7 @@ typedef unsigned short __u16, u16, uint16_t;
 typedef unsigned int   __u32, u32, uint32_t, umode_t;
 typedef unsigned long  size_t, u_long, blkcnt_t;
 typedef signed int     ssize_t;
-typedef unsigned long long uint64_t, u64;
+typedef unsigned long long __u64, uint64_t, u64;
 typedef unsigned long loff_t; // fixme : unsigned long long
 
 // fixme
@@ -65,6 +65,7 @@ typedef enum {false, true} bool;
 	void reset(void) __attribute__((alias(#func)))
 
 #define NULL              ((void *)0)
+#define ULONG_MAX         (~0UL)
 #define KB(n)             ((n) << 10)
 #define MB(n)             ((n) << 20)
 #define GB(n)             ((n) << 30)
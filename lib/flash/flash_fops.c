@@ -8,7 +8,7 @@
 #include <mtd/mtd.h>
 
 // fixme
-static inline int __flash_read(struct mtd_info *mtd, void *buff, int count, int start)
+static inline int __flash_read(struct mtd_info *mtd, void *buff, int count, __u64 start)
 {
 	int ret;
 	size_t ret_len;
@@ -51,7 +51,7 @@ static inline int __flash_read(struct mtd_info *mtd, void *buff, int count, int
 	return 0;
 }
 
-static inline ssize_t __flash_write(struct mtd_info *mtd, const void *buff, __u32 count, __u32 ppos)
+static inline ssize_t __flash_write(struct mtd_info *mtd, const void *buff, __u32 count, __u64 ppos)
 {
 	int ret = 0;
 	__u32 ret_len;
@@ -133,15 +133,132 @@ static inline ssize_t __flash_write(struct mtd_info *mtd, const void *buff, __u3
 	return 0;
 }
 
+static inline bool flash_has_oob(struct mtd_info *mtd)
+{
+	return mtd->oob_mode == FLASH_OOB_RAW || mtd->oob_mode == MTD_OPS_AUTO_OOB;
+}
+
+// in the oob modes, the buffer holds (page + oob) records
+static __u32 flash_buff_to_data(struct mtd_info *mtd, __u32 count)
+{
+	__u32 unit = mtd->write_size + mtd->oob_size;
+
+	if (!flash_has_oob(mtd))
+		return count;
+
+	return (count + unit - 1) / unit << mtd->write_shift;
+}
+
+static __u32 flash_data_to_buff(struct mtd_info *mtd, __u32 data)
+{
+	if (!flash_has_oob(mtd))
+		return data;
+
+	return (data >> mtd->write_shift) * (mtd->write_size + mtd->oob_size);
+}
+
+/*
+ * Bad blocks of a partition are skipped: the request is split into
+ * physically contiguous runs.
+ */
+static int flash_read_mapped(struct mtd_info *mtd, void *buff, __u32 count, __u64 pos)
+{
+	int ret;
+	__u64 phys;
+	__u32 len, done = 0;
+
+	while (done < count) {
+		ret = flash_map_addr(mtd, pos, flash_buff_to_data(mtd, count - done), &phys);
+		if (ret < 0)
+			return done ? done : ret;
+
+		len = min(flash_data_to_buff(mtd, ret), count - done);
+
+		ret = __flash_read(mtd, (__u8 *)buff + done, len, phys);
+		if (ret < 0)
+			return ret;
+
+		done += ret;
+		if (ret < len)
+			break;
+
+		pos += flash_buff_to_data(mtd, len);
+	}
+
+	return done;
+}
+
+static ssize_t flash_write_mapped(struct mtd_info *mtd, const void *buff, __u32 count, __u64 pos)
+{
+	ssize_t ret;
+	__u64 phys;
+	__u32 len, done = 0;
+
+	while (done < count) {
+		ret = flash_map_addr(mtd, pos, flash_buff_to_data(mtd, count - done), &phys);
+		if (ret < 0)
+			return ret;
+
+		len = min(flash_data_to_buff(mtd, ret), count - done);
+
+		ret = __flash_write(mtd, (const __u8 *)buff + done, len, phys);
+		if (ret < 0)
+			return ret;
+
+		done += len;
+		pos  += flash_buff_to_data(mtd, len);
+	}
+
+	return done;
+}
+
+/*
+ * in-band writes are buffered a plane group at a time, so that the
+ * driver can program the blocks of a multi-plane chip in parallel.
+ */
+static size_t flash_blk_size(struct mtd_info *mtd, OOB_MODE mode)
+{
+	int planes = mtd->plane_num > 1 ? mtd->plane_num : 1;
+
+	switch (mode) {
+	case FLASH_OOB_RAW:
+	case MTD_OPS_AUTO_OOB:
+		return (mtd->write_size + mtd->oob_size) << \
+				(mtd->erase_shift - mtd->write_shift);
+
+	case FLASH_OOB_PLACE:
+	default:
+		return mtd->erase_size * planes;
+	}
+}
+
+/*
+ * in the oob modes the file holds (page + oob) records. The divide is
+ * done on the 32-bit file position, only the shift is 64-bit.
+ */
+static __u64 flash_file_to_pos(struct mtd_info *mtd, loff_t f_pos)
+{
+	switch (mtd->oob_mode) {
+	case FLASH_OOB_RAW:
+	case MTD_OPS_AUTO_OOB:
+		return (__u64)(f_pos / (mtd->write_size + mtd->oob_size)) << mtd->write_shift;
+
+	case FLASH_OOB_PLACE:
+	default:
+		return f_pos;
+	}
+}
+
 static int flash_open(struct file *fp, struct inode *inode)
 {
-	void *buff;
 	size_t size;
 	struct mtd_info *mtd;
+	struct block_device *bdev;
 	struct block_buff *blk_buf = &fp->blk_buf;
 
-	mtd = NULL; // container_of(inode, struct mtd_info, bdev);
-	assert(mtd);
+	// devfs keeps the block device in the node
+	bdev = inode->i_private;
+	mtd = container_of(bdev, struct mtd_info, bdev);
 
 	if (fp->flags == O_WRONLY || fp->flags == O_RDWR) {
 		if (mtd->bdev.flags & BDF_RDONLY) {
@@ -152,15 +269,14 @@ static int flash_open(struct file *fp, struct inode *inode)
 	mtd->callback_func = NULL;
 	mtd->oob_mode = FLASH_OOB_PLACE;
 
-	size = (mtd->write_size + mtd->oob_size) << \
-				(mtd->erase_shift - mtd->write_shift);
-
-	buff = malloc(size);
-	if (!buff)
-		return -ENOMEM;
+	size = flash_blk_size(mtd, FLASH_OOB_RAW);
+	if (size < flash_blk_size(mtd, FLASH_OOB_PLACE))
+		size = flash_blk_size(mtd, FLASH_OOB_PLACE);
 
-	blk_buf->blk_base = blk_buf->blk_off = buff;
-	blk_buf->blk_size = blk_buf->max_size = size;
+	// allocated on demand, aligned writes bypass it
+	blk_buf->blk_base = blk_buf->blk_off = NULL;
+	blk_buf->max_size = size;
+	blk_buf->blk_size = flash_blk_size(mtd, mtd->oob_mode);
 
 	fp->private_data = mtd;
 
@@ -168,6 +284,40 @@ static int flash_open(struct file *fp, struct inode *inode)
 }
 
 
+// runs are mapped at most 1 GiB at a time, the length is returned as an int
+#define FLASH_MAX_RUN  (1U << 30)
+
+static int flash_erase_mapped(struct mtd_info *mtd, struct erase_info *opt)
+{
+	int ret;
+	__u64 phys;
+	struct erase_info run;
+	uint64_t off = opt->addr, end = opt->addr + opt->len;
+
+	while (off < end) {
+		ret = flash_map_addr(mtd, off,
+				end - off > FLASH_MAX_RUN ? FLASH_MAX_RUN : end - off, &phys);
+		if (ret < 0)
+			return ret;
+
+		run = *opt;
+		run.addr = phys;
+		run.len  = ret;
+
+		ret = mtd->erase(mtd, &run);
+
+		opt->state = run.state;
+		opt->fail_addr = run.fail_addr;
+
+		if (ret < 0)
+			return ret;
+
+		off += run.len;
+	}
+
+	return 0;
+}
+
 static int __flash_erase(struct mtd_info *mtd, struct erase_info *opt)
 {
 	int ret;
@@ -183,16 +333,17 @@ static int __flash_erase(struct mtd_info *mtd, struct erase_info *opt)
 
 	if (opt->len & (mtd->erase_size - 1)) {
 #ifdef CONFIG_DEBUG
-		size_t size = opt->len;
+		__u32 size = opt->len;
 #endif
 
-		ALIGN_UP(opt->len, mtd->erase_size);
+		// not ALIGN_UP(), its ~(align - 1) mask is only 32-bit wide
+		opt->len = (opt->len + mtd->erase_size - 1) & ~((__u64)mtd->erase_size - 1);
 		GEN_DBG("size (0x%08x) not aligned with mtd erase size (0x%08x)!"
 			" adjusted to 0x%08x\n",
-			size, mtd->erase_size, opt->len);
+			size, mtd->erase_size, (__u32)opt->len);
 	}
 
-	ret = mtd->erase(mtd, opt);
+	ret = flash_erase_mapped(mtd, opt);
 
 #ifdef CONFIG_DEBUG
 	if (ret < 0)
@@ -219,12 +370,8 @@ static int flash_ioctl(struct file *fp, int cmd, unsigned long arg)
 		switch (arg) {
 		case FLASH_OOB_RAW:
 		case MTD_OPS_AUTO_OOB:
-			fp->blk_buf.blk_size = (mtd->write_size + mtd->oob_size) << \
-									(mtd->erase_shift - mtd->write_shift);
-			break;
-
 		case FLASH_OOB_PLACE:
-			fp->blk_buf.blk_size = mtd->erase_size;
+			fp->blk_buf.blk_size = flash_blk_size(mtd, (OOB_MODE)arg);
 			break;
 
 		default:
@@ -257,7 +404,8 @@ static int flash_ioctl(struct file *fp, int cmd, unsigned long arg)
 		return ret;
 
 	case FLASH_IOCG_SIZE:
-		*(size_t *)arg = mtd->bdev.size;
+		*(__u64 *)arg = mtd->bdev.size;
+		break;
 
 	case FLASH_IOCG_INFO:
 		((struct flash_info *)arg)->name       = mtd->name;
@@ -268,6 +416,9 @@ static int flash_ioctl(struct file *fp, int cmd, unsigned long arg)
 		((struct flash_info *)arg)->bdev_base  = mtd->bdev.base;
 		((struct flash_info *)arg)->bdev_size  = mtd->bdev.size;
 		((struct flash_info *)arg)->bdev_label = mtd->bdev.label;
+		((struct flash_info *)arg)->skipped_pages = \
+			flash_get_master(mtd)->eccstat.skipped_pages;
+		break;
 
 	default:
 		return -ENOTSUPP;
@@ -278,9 +429,54 @@ static int flash_ioctl(struct file *fp, int cmd, unsigned long arg)
 
 static ssize_t flash_read(struct file *fp, void *buff, size_t size, loff_t *off)
 {
+	int ret;
+	__u32 file_size, rec, skip;
+	__u8 *tmp;
 	struct mtd_info *mtd = fp->private_data;
 
-	return __flash_read(mtd, buff, size, fp->f_pos);
+	// in the oob modes the file is larger than the partition by the oob records
+	file_size = flash_data_to_buff(mtd, mtd->bdev.size);
+	if (*off >= file_size)
+		return 0;
+
+	size = min(size, file_size - *off);
+
+	// whole (page + oob) records only, a partial one goes through a bounce buffer
+	if (flash_has_oob(mtd)) {
+		rec = mtd->write_size + mtd->oob_size;
+		skip = *off % rec;
+
+		if (skip || size < rec) {
+			tmp = malloc(rec);
+			if (!tmp)
+				return -ENOMEM;
+
+			ret = flash_read_mapped(mtd, tmp, rec, flash_file_to_pos(mtd, *off));
+			if (ret > (int)skip) {
+				ret = min(size, ret - skip);
+				memcpy(buff, tmp + skip, ret);
+			} else if (ret >= 0) {
+				ret = 0;
+			}
+
+			free(tmp);
+			goto L1;
+		}
+
+		size -= size % rec;
+	}
+
+	ret = flash_read_mapped(mtd, buff, size, flash_file_to_pos(mtd, *off));
+
+L1:
+	// bad blocks are skipped, so the data may end before the partition does
+	if (ret == -ENOSPC)
+		return 0;
+
+	if (ret > 0)
+		*off += ret;
+
+	return ret;
 }
 
 #if 0
@@ -297,7 +493,7 @@ static ssize_t flash_read(struct file *fp, void *buff, size_t size, loff_t *off)
 static ssize_t flash_write(struct file *fp, const void *buff, size_t size, loff_t *off)
 {
 	int ret = 0;
-	__u32 buff_room, flash_pos;
+	__u32 buff_room, count;
 	struct mtd_info   *mtd = fp->private_data;
 	struct block_buff   *blk_buff;
 	struct block_device *bdev = &mtd->bdev;
@@ -319,56 +515,46 @@ static ssize_t flash_write(struct file *fp, const void *buff, size_t size, loff_
 	buff_room = blk_buff->blk_size - (blk_buff->blk_off - blk_buff->blk_base);
 
 	while (size > 0) {
-		if (size >= buff_room) {
-			// __u32 size_adj;
-
-			memcpy(blk_buff->blk_off, buff, buff_room);
-
-			size -= buff_room;
-			buff  = (__u8 *)buff + buff_room;
-			buff_room = blk_buff->blk_size;
-
-#if 1
-			switch (mtd->oob_mode) {
-			case FLASH_OOB_RAW:
-			case MTD_OPS_AUTO_OOB:
-				// fixme: use macro: RATIO_TO_PAGE(n)
-				// size_adj = blk_buff->blk_size / (mtd->write_size + mtd->oob_size) << mtd->write_shift;
-				flash_pos = fp->f_pos / (mtd->write_size + mtd->oob_size) << mtd->write_shift;
-				break;
-
-			case FLASH_OOB_PLACE:
-			default:
-				// size_adj = blk_buff->blk_size;
-				flash_pos = fp->f_pos;
-				break;
-			}
-#endif
-
-#if 0
-		if (flag == AUTO_ERASE)
-			ret = flash_erase(mtd, flash_pos, size_adj, eflag);
+		/*
+		 * nothing pending, so f_pos is block aligned: program the
+		 * whole blocks straight from the caller's buffer (word aligned
+		 * for the 16-bit bus accessors).
+		 */
+		if (blk_buff->blk_off == blk_buff->blk_base && size >= blk_buff->blk_size &&
+			!((unsigned long)buff & 3)) {
+			count = size - size % blk_buff->blk_size;
+
+			ret = flash_write_mapped(mtd, buff, count, flash_file_to_pos(mtd, fp->f_pos));
 			if (ret < 0) {
-				printf("%s(), line %d\n", __func__, __LINE__);
+				DPRINT("%s(), line %d\n", __func__, __LINE__);
 				goto L1;
 			}
 
-			switch (img_type) {
-			case IMG_YAFFS1:
-				ret = flash_ioctl(mtd, FLASH_IOCS_OOB_MODE, FLASH_OOB_RAW);
-				break;
+			fp->f_pos += count;
+			buff  = (__u8 *)buff + count;
+			size -= count;
 
-			case IMG_YAFFS2:
-				ret = flash_ioctl(mtd, FLASH_IOCS_OOB_MODE, MTD_OPS_AUTO_OOB);
-				break;
+			continue;
+		}
 
-			default:
-				ret = flash_ioctl(mtd, FLASH_IOCS_OOB_MODE, FLASH_OOB_PLACE);
-				break;
-			}
-#endif
+		// unaligned head or tail
+		if (!blk_buff->blk_base) {
+			blk_buff->blk_base = malloc(blk_buff->max_size);
+			if (!blk_buff->blk_base)
+				return -ENOMEM;
 
-			ret = __flash_write(mtd, blk_buff->blk_base, blk_buff->blk_size, flash_pos);
+			blk_buff->blk_off = blk_buff->blk_base;
+		}
+
+		if (size >= buff_room) {
+			memcpy(blk_buff->blk_off, buff, buff_room);
+
+			size -= buff_room;
+			buff  = (__u8 *)buff + buff_room;
+			buff_room = blk_buff->blk_size;
+
+			ret = flash_write_mapped(mtd, blk_buff->blk_base, blk_buff->blk_size,
+					flash_file_to_pos(mtd, fp->f_pos));
 			if (ret < 0) {
 				DPRINT("%s(), line %d\n", __func__, __LINE__);
 				goto L1;
@@ -390,7 +576,8 @@ L1:
 static int flash_close(struct file *fp)
 {
 	int ret = 0, rest;
-	__u32 flash_pos;
+	__u32 size;
+	__u64 flash_pos;
 	struct block_buff *blk_buff;
 	struct mtd_info *mtd = fp->private_data;
 
@@ -401,21 +588,16 @@ static int flash_close(struct file *fp)
 		//printf("%s(): pos = 0x%08x, blk_base = 0x%08x, blk_off = 0x%08x, rest = 0x%08x\n",
 			// __func__, fp->f_pos + fp->attr->base, blk_buff->blk_base, blk_buff->blk_off, rest);
 
-		switch (mtd->oob_mode) {
-		case FLASH_OOB_RAW:
-		case MTD_OPS_AUTO_OOB:
-			flash_pos = fp->f_pos / (mtd->write_size + mtd->oob_size) * mtd->write_size;
-			break;
+		flash_pos = flash_file_to_pos(mtd, fp->f_pos);
 
-		case FLASH_OOB_PLACE:
-		default: // fixme
-			flash_pos = fp->f_pos;
-			break;
-		}
+		memset(blk_buff->blk_off, 0xFF, blk_buff->blk_size - rest);
 
-		memset(blk_buff->blk_off, 0xFF, rest);
+		// a plane group may reach beyond the partition, so only the used blocks
+		size = blk_buff->blk_size;
+		if (mtd->oob_mode == FLASH_OOB_PLACE)
+			size = flash_erase_is_align(mtd, rest);
 
-		ret = __flash_write(mtd, blk_buff->blk_base, blk_buff->blk_size /* not just the rest */, flash_pos);
+		ret = flash_write_mapped(mtd, blk_buff->blk_base, size /* not just the rest */, flash_pos);
 		if (ret < 0) {
 			DPRINT("%s(), line %d\n", __func__, __LINE__);
 			goto L1;
@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <timer.h>
+#include <net/net.h>
+#include <net/netconsole.h>
+
+/*
+ * UDP network console: printf/puts output is batched into datagrams
+ * sent to "net.console" (host[:port]), and datagrams received on the
+ * same port are fed back to the shell as input.
+ */
+
+enum {
+	NETCON_ACTIVE,
+	NETCON_DISABLED,
+};
+
+static int g_netcon_state = NETCON_DISABLED;
+static int g_netcon_fd;
+static bool g_netcon_busy;
+static struct sockaddr_in g_netcon_peer;
+
+static char g_tx_buff[NETCON_BUF_LEN];
+static int  g_tx_len;
+static __u32 g_tx_tick;
+
+static char g_rx_buff[NETCON_BUF_LEN];
+static int  g_rx_pos, g_rx_len;
+
+static int   g_uart_policy = NETCON_UART_ON;
+static __u32 g_uart_tick, g_uart_bytes;
+
+static int netcon_parse_target(const char *target, struct sockaddr_in *sin)
+{
+	char ip[IPV4_STR_LEN];
+	const char *colon;
+	unsigned long port = NETCON_DEF_PORT;
+	int len;
+
+	colon = strchr(target, ':');
+	len = colon ? colon - target : strlen(target);
+	if (len >= IPV4_STR_LEN)
+		return -EINVAL;
+
+	strncpy(ip, target, len);
+	ip[len] = '\0';
+
+	if (colon && (str_to_val(colon + 1, &port) < 0 || port == 0 || port > 0xffff))
+		return -EINVAL;
+
+	memset(sin, 0, sizeof(*sin));
+	sin->sin_family = AF_INET;
+	sin->sin_port = htons(port);
+
+	return str_to_ip((__u8 *)&sin->sin_addr.s_addr, ip);
+}
+
+int netcon_setup(const char *target, int uart_policy)
+{
+	int ret, fd;
+	struct sockaddr_in peer, local_addr;
+
+	if (list_empty(ndev_get_list()))
+		return -ENODEV;
+
+	ret = netcon_parse_target(target, &peer);
+	if (ret < 0)
+		return ret;
+
+	netcon_stop();
+
+	// resolve the peer once, so that flushing never blocks on ARP
+	if (!getaddr(peer.sin_addr.s_addr) && !gethostaddr(peer.sin_addr.s_addr))
+		return -EHOSTUNREACH;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd <= 0)
+		return -EIO;
+
+	memset(&local_addr, 0, sizeof(local_addr));
+	local_addr.sin_family = AF_INET;
+	local_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	local_addr.sin_port = peer.sin_port;
+
+	ret = bind(fd, (struct sockaddr *)&local_addr, sizeof(local_addr));
+	if (ret < 0) {
+		sk_close(fd);
+		return ret;
+	}
+
+	g_netcon_fd = fd;
+	g_netcon_peer = peer;
+	g_uart_policy = uart_policy;
+	g_tx_len = g_rx_len = g_rx_pos = 0;
+	g_tx_tick = g_uart_tick = get_tick();
+	g_uart_bytes = 0;
+	g_netcon_state = NETCON_ACTIVE;
+
+	return 0;
+}
+
+void netcon_stop(void)
+{
+	if (g_netcon_state == NETCON_ACTIVE) {
+		netcon_flush();
+		sk_close(g_netcon_fd);
+	}
+
+	g_netcon_state = NETCON_DISABLED;
+	g_uart_policy = NETCON_UART_ON;
+}
+
+bool netcon_active(void)
+{
+	return g_netcon_state == NETCON_ACTIVE;
+}
+
+// start the console from sysconf, called once the drivers are up
+void netcon_init(void)
+{
+	char target[CONF_VAL_LEN], buff[CONF_VAL_LEN];
+	unsigned long rate;
+	int policy = NETCON_UART_ON;
+
+	if (list_empty(ndev_get_list()))
+		return;
+
+	if (conf_get_attr("net.console", target) < 0)
+		return;
+
+	g_netcon_busy = true; // keep setup messages off the network
+
+	if (netcon_setup(target, NETCON_UART_ON) < 0) {
+		g_netcon_busy = false;
+		printf("netconsole: fail to reach \"%s\"!\n", target);
+		return;
+	}
+
+	g_netcon_busy = false;
+
+	if (!conf_get_attr("net.console.uart", buff)) {
+		if (!strcmp(buff, "off"))
+			policy = NETCON_UART_OFF;
+		else if (str_to_val(buff, &rate) >= 0 && rate > 0)
+			policy = rate;
+	}
+
+	printf("netconsole: logging to %s\n", target);
+
+	g_uart_policy = policy;
+}
+
+void netcon_flush(void)
+{
+	if (g_netcon_state != NETCON_ACTIVE || g_netcon_busy || !g_tx_len)
+		return;
+
+	// the network stack may print while sending, which must not recurse
+	g_netcon_busy = true;
+	sendto(g_netcon_fd, g_tx_buff, g_tx_len, 0,
+		(struct sockaddr *)&g_netcon_peer, sizeof(g_netcon_peer));
+	g_netcon_busy = false;
+
+	g_tx_len = 0;
+	g_tx_tick = get_tick();
+}
+
+// batch output into one datagram per NETCON_FLUSH_MS at most
+void netcon_poll(void)
+{
+	if (g_tx_len && get_tick() - g_tx_tick >= NETCON_FLUSH_MS)
+		netcon_flush();
+}
+
+static bool netcon_uart_allowed(void)
+{
+	__u32 tick;
+
+	if (g_uart_policy == NETCON_UART_ON)
+		return true;
+
+	if (g_uart_policy == NETCON_UART_OFF)
+		return false;
+
+	tick = get_tick();
+	if (tick - g_uart_tick >= 1000) {
+		g_uart_tick = tick;
+		g_uart_bytes = 0;
+	}
+
+	return g_uart_bytes++ < g_uart_policy;
+}
+
+/*
+ * queue a character for the network console.
+ * return true if the character should also go to the UART.
+ */
+bool netcon_putchar(int ch)
+{
+	if (g_netcon_state != NETCON_ACTIVE || g_netcon_busy)
+		return true;
+
+	g_tx_buff[g_tx_len++] = ch;
+
+	if (g_tx_len == NETCON_BUF_LEN)
+		netcon_flush();
+	else if (ch == '\n')
+		netcon_poll();
+
+	return netcon_uart_allowed();
+}
+
+int netcon_getchar(char *ch)
+{
+	int ret;
+	socklen_t addrlen;
+	struct sockaddr_in from;
+
+	if (g_netcon_state != NETCON_ACTIVE || g_netcon_busy)
+		return 0;
+
+	netcon_poll();
+
+	if (g_rx_pos == g_rx_len) {
+		g_netcon_busy = true;
+
+		ret = 0;
+		if (!qu_is_empty(g_netcon_fd))
+			ret = recvfrom(g_netcon_fd, g_rx_buff, sizeof(g_rx_buff), 0,
+					(struct sockaddr *)&from, &addrlen);
+
+		g_netcon_busy = false;
+
+		if (ret <= 0)
+			return 0;
+
+		g_rx_pos = 0;
+		g_rx_len = ret;
+	}
+
+	*ch = g_rx_buff[g_rx_pos++];
+
+	return 1;
+}
@@ -0,0 +1,648 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <timer.h>
+#include <net/net.h>
+#include <net/nfs.h>
+
+/*
+ * Read-only NFSv3 client over UDP (RFC 1813), with just enough
+ * ONC RPC (RFC 5531), portmap and MOUNT v3 to get a root handle.
+ *
+ * READ keeps up to clnt->window requests in flight, so large files
+ * are not RTT-bound: replies are matched to requests by xid and copied
+ * straight into the caller's buffer at their own offset.
+ */
+
+#define RPC_VERSION       2
+#define RPC_CALL          0
+#define RPC_REPLY         1
+#define RPC_MSG_ACCEPTED  0
+#define RPC_SUCCESS       0
+#define RPC_AUTH_NULL     0
+#define RPC_AUTH_UNIX     1
+
+#define PMAP_VERSION      2
+#define PMAPPROC_GETPORT  3
+
+#define MOUNT_VERSION     3
+#define MOUNTPROC3_MNT    1
+
+#define NFS_VERSION       3
+#define NFSPROC3_GETATTR  1
+#define NFSPROC3_LOOKUP   3
+#define NFSPROC3_READ     6
+
+#define NFS3_OK           0
+#define NFS3_FATTR_LEN    84
+
+// keep well below the portmap/mountd "secure" limit of 1024
+#define NFS_RESV_PORT_MAX 1023
+#define NFS_RESV_PORT_MIN 600
+
+#define RPC_MACHINE_NAME  "g-bios"
+#define RPC_BUF_WORDS     ((MAX_ETH_LEN + 3) / 4)
+
+#define XDR_QUADLEN(len)  (((len) + 3) >> 2)
+
+struct xdr_stream {
+	const __u32 *p, *end;
+};
+
+struct nfs_read_slot {
+	bool  busy;
+	__u32 xid;
+	u64   offset;
+	__u32 count;
+};
+
+static inline __u32 *xdr_put_u32(__u32 *p, __u32 val)
+{
+	*p++ = htonl(val);
+	return p;
+}
+
+static inline __u32 *xdr_put_u64(__u32 *p, u64 val)
+{
+	p = xdr_put_u32(p, (__u32)(val >> 32));
+	return xdr_put_u32(p, (__u32)val);
+}
+
+static __u32 *xdr_put_opaque(__u32 *p, const void *data, __u32 len)
+{
+	*p++ = htonl(len);
+	if (len & 3)
+		p[len >> 2] = 0; // zero the pad bytes
+	memcpy(p, data, len);
+
+	return p + XDR_QUADLEN(len);
+}
+
+static inline __u32 *xdr_put_fh(__u32 *p, const struct nfs_fh *fh)
+{
+	return xdr_put_opaque(p, fh->data, fh->size);
+}
+
+static inline void xdr_init(struct xdr_stream *xdr, const __u32 *buff, int len)
+{
+	xdr->p = buff;
+	xdr->end = buff + len / 4;
+}
+
+static int xdr_get_u32(struct xdr_stream *xdr, __u32 *val)
+{
+	if (xdr->p + 1 > xdr->end)
+		return -EPROTO;
+
+	*val = ntohl(*xdr->p++);
+	return 0;
+}
+
+static int xdr_get_u64(struct xdr_stream *xdr, u64 *val)
+{
+	__u32 hi, lo;
+
+	if (xdr_get_u32(xdr, &hi) < 0 || xdr_get_u32(xdr, &lo) < 0)
+		return -EPROTO;
+
+	*val = (u64)hi << 32 | lo;
+	return 0;
+}
+
+static int xdr_skip(struct xdr_stream *xdr, __u32 len)
+{
+	if (xdr->p + XDR_QUADLEN(len) > xdr->end)
+		return -EPROTO;
+
+	xdr->p += XDR_QUADLEN(len);
+	return 0;
+}
+
+static const void *xdr_get_opaque(struct xdr_stream *xdr, __u32 *len)
+{
+	const void *data;
+
+	if (xdr_get_u32(xdr, len) < 0)
+		return NULL;
+
+	data = xdr->p;
+	if (xdr_skip(xdr, *len) < 0)
+		return NULL;
+
+	return data;
+}
+
+static int xdr_get_fh(struct xdr_stream *xdr, struct nfs_fh *fh)
+{
+	const void *data;
+	__u32 len;
+
+	data = xdr_get_opaque(xdr, &len);
+	if (!data || len > NFS3_FHSIZE)
+		return -EPROTO;
+
+	fh->size = len;
+	memcpy(fh->data, data, len);
+
+	return 0;
+}
+
+static int xdr_get_fattr(struct xdr_stream *xdr, struct nfs_fattr *attr)
+{
+	if (xdr->p + XDR_QUADLEN(NFS3_FATTR_LEN) > xdr->end)
+		return -EPROTO;
+
+	if (!attr)
+		return xdr_skip(xdr, NFS3_FATTR_LEN);
+
+	xdr_get_u32(xdr, &attr->type);
+	xdr_get_u32(xdr, &attr->mode);
+	xdr_skip(xdr, 12); // nlink, uid, gid
+	xdr_get_u64(xdr, &attr->size);
+	xdr_skip(xdr, 24); // used, rdev, fsid
+	xdr_get_u64(xdr, &attr->fileid);
+	xdr_skip(xdr, 24); // atime, mtime, ctime
+
+	return 0;
+}
+
+// post_op_attr: an optional fattr3
+static int xdr_get_post_op_attr(struct xdr_stream *xdr, struct nfs_fattr *attr,
+	bool *follows)
+{
+	__u32 val;
+
+	if (xdr_get_u32(xdr, &val) < 0)
+		return -EPROTO;
+
+	if (follows)
+		*follows = val != 0;
+
+	return val ? xdr_get_fattr(xdr, attr) : 0;
+}
+
+static inline int nfs_status_to_errno(__u32 status)
+{
+	// NFS3ERR_* below 100 are plain errno values
+	return status < 100 ? -(int)status : -EIO;
+}
+
+static __u32 *rpc_put_header(__u32 *p, __u32 xid,
+	__u32 prog, __u32 vers, __u32 proc)
+{
+	int name_len = sizeof(RPC_MACHINE_NAME) - 1;
+
+	p = xdr_put_u32(p, xid);
+	p = xdr_put_u32(p, RPC_CALL);
+	p = xdr_put_u32(p, RPC_VERSION);
+	p = xdr_put_u32(p, prog);
+	p = xdr_put_u32(p, vers);
+	p = xdr_put_u32(p, proc);
+
+	// AUTH_UNIX as root: stamp, machine name, uid, gid, no aux gids
+	p = xdr_put_u32(p, RPC_AUTH_UNIX);
+	p = xdr_put_u32(p, 4 * (5 + XDR_QUADLEN(name_len)));
+	p = xdr_put_u32(p, 0);
+	p = xdr_put_opaque(p, RPC_MACHINE_NAME, name_len);
+	p = xdr_put_u32(p, 0);
+	p = xdr_put_u32(p, 0);
+	p = xdr_put_u32(p, 0);
+
+	p = xdr_put_u32(p, RPC_AUTH_NULL);
+	p = xdr_put_u32(p, 0);
+
+	return p;
+}
+
+// returns -EAGAIN for a reply to some other (stale) call
+static int rpc_check_reply(struct xdr_stream *xdr, __u32 xid)
+{
+	__u32 val, len;
+
+	if (xdr_get_u32(xdr, &val) < 0 || val != xid)
+		return -EAGAIN;
+
+	if (xdr_get_u32(xdr, &val) < 0 || val != RPC_REPLY)
+		return -EAGAIN;
+
+	if (xdr_get_u32(xdr, &val) < 0)
+		return -EPROTO;
+
+	if (val != RPC_MSG_ACCEPTED)
+		return -EACCES;
+
+	// verifier
+	if (xdr_get_u32(xdr, &val) < 0 || !xdr_get_opaque(xdr, &len))
+		return -EPROTO;
+
+	if (xdr_get_u32(xdr, &val) < 0)
+		return -EPROTO;
+
+	if (val != RPC_SUCCESS) {
+		GEN_DBG("RPC call %d rejected (accept_stat = %d)\n", xid, val);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static int rpc_send(struct nfs_client *clnt, __u16 port, const __u32 *req, int len)
+{
+	struct sockaddr_in sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(port);
+	sa.sin_addr.s_addr = clnt->server_ip;
+
+	return sendto(clnt->sockfd, req, len, 0, (struct sockaddr *)&sa, sizeof(sa));
+}
+
+static int rpc_recv(struct nfs_client *clnt, __u32 *reply, int size)
+{
+	int ret;
+	socklen_t addrlen;
+	struct sockaddr_in from;
+
+	ret = recvfrom(clnt->sockfd, reply, size, 0, (struct sockaddr *)&from, &addrlen);
+	if (ret > 0 && from.sin_addr.s_addr != clnt->server_ip)
+		return -EAGAIN;
+
+	return ret;
+}
+
+/*
+ * Synchronous call: the xid is taken from req, and on success xdr is
+ * left at the procedure-specific results.
+ */
+static int rpc_call(struct nfs_client *clnt, __u16 port, const __u32 *req,
+	int len, __u32 *reply, int size, struct xdr_stream *xdr)
+{
+	int ret, retry;
+	__u32 xid = ntohl(req[0]);
+
+	for (retry = 0; retry <= clnt->retries; retry++) {
+		ret = rpc_send(clnt, port, req, len);
+		if (ret < 0)
+			return ret;
+
+		while (1) {
+			ret = rpc_recv(clnt, reply, size);
+			if (ret == -EAGAIN)
+				continue;
+
+			if (ret <= 0)
+				break;
+
+			xdr_init(xdr, reply, ret);
+			ret = rpc_check_reply(xdr, xid);
+			if (ret != -EAGAIN)
+				return ret;
+		}
+	}
+
+	return -ETIMEDOUT;
+}
+
+static int pmap_getport(struct nfs_client *clnt, __u32 prog, __u32 vers,
+	__u16 *port)
+{
+	int ret;
+	__u32 *p, val;
+	__u32 req[32], reply[32];
+	struct xdr_stream xdr;
+
+	p = rpc_put_header(req, ++clnt->xid, RPC_PROG_PORTMAP, PMAP_VERSION, PMAPPROC_GETPORT);
+	p = xdr_put_u32(p, prog);
+	p = xdr_put_u32(p, vers);
+	p = xdr_put_u32(p, PROT_UDP);
+	p = xdr_put_u32(p, 0);
+
+	ret = rpc_call(clnt, STD_PORT_PORTMAP, req, (p - req) * 4,
+			reply, sizeof(reply), &xdr);
+	if (ret < 0)
+		return ret;
+
+	if (xdr_get_u32(&xdr, &val) < 0)
+		return -EPROTO;
+
+	if (val == 0 || val > 0xffff) {
+		printf("RPC program %d v%d not registered on server!\n", prog, vers);
+		return -ENOENT;
+	}
+
+	*port = val;
+
+	return 0;
+}
+
+static int mount_mnt(struct nfs_client *clnt, const char *path)
+{
+	int ret;
+	__u32 *p, status;
+	__u32 req[RPC_BUF_WORDS], reply[RPC_BUF_WORDS];
+	struct xdr_stream xdr;
+
+	p = rpc_put_header(req, ++clnt->xid, RPC_PROG_MOUNT, MOUNT_VERSION, MOUNTPROC3_MNT);
+	p = xdr_put_opaque(p, path, strlen(path));
+
+	ret = rpc_call(clnt, clnt->mnt_port, req, (p - req) * 4,
+			reply, sizeof(reply), &xdr);
+	if (ret < 0)
+		return ret;
+
+	if (xdr_get_u32(&xdr, &status) < 0)
+		return -EPROTO;
+
+	if (status != 0)
+		return nfs_status_to_errno(status);
+
+	return xdr_get_fh(&xdr, &clnt->root);
+}
+
+static __u16 nfs_port_alloc(void)
+{
+	static __u16 port = NFS_RESV_PORT_MAX;
+
+	if (port < NFS_RESV_PORT_MIN)
+		port = NFS_RESV_PORT_MAX;
+
+	return port--;
+}
+
+int nfs_client_open(struct nfs_client *clnt, const char *export)
+{
+	int ret;
+	const char *path;
+	char ip[IPV4_STR_LEN];
+	struct sockaddr_in local_addr;
+
+	path = strchr(export, ':');
+	if (!path || path == export || path - export >= IPV4_STR_LEN || path[1] != '/')
+		return -EINVAL;
+
+	strncpy(ip, export, path - export);
+	ip[path - export] = '\0';
+	path++;
+
+	if (str_to_ip((__u8 *)&clnt->server_ip, ip) < 0)
+		return -EINVAL;
+
+	if (!clnt->rsize)
+		clnt->rsize = NFS_DEF_RSIZE;
+	if (!clnt->window)
+		clnt->window = NFS_DEF_WINDOW;
+	if (!clnt->timeout)
+		clnt->timeout = NFS_DEF_TIMEOUT;
+	if (!clnt->retries)
+		clnt->retries = NFS_DEF_RETRIES;
+
+	if (clnt->rsize > NFS_MAX_RSIZE)
+		clnt->rsize = NFS_MAX_RSIZE;
+	if (clnt->window > NFS_MAX_WINDOW)
+		clnt->window = NFS_MAX_WINDOW;
+
+	clnt->xid = get_tick();
+
+	clnt->sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (clnt->sockfd <= 0)
+		return -EIO;
+
+	memset(&local_addr, 0, sizeof(local_addr));
+	local_addr.sin_family = AF_INET;
+	local_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	local_addr.sin_port = htons(nfs_port_alloc());
+	ret = bind(clnt->sockfd, (struct sockaddr *)&local_addr, sizeof(local_addr));
+	if (ret < 0)
+		goto L1;
+
+	socket_ioctl(clnt->sockfd, SKIOCS_FLAGS, 1);
+	socket_ioctl(clnt->sockfd, SKIOCS_TIMEOUT, clnt->timeout);
+
+	ret = pmap_getport(clnt, RPC_PROG_MOUNT, MOUNT_VERSION, &clnt->mnt_port);
+	if (ret < 0)
+		goto L1;
+
+	ret = pmap_getport(clnt, RPC_PROG_NFS, NFS_VERSION, &clnt->nfs_port);
+	if (ret < 0)
+		goto L1;
+
+	ret = mount_mnt(clnt, path);
+	if (ret < 0) {
+		printf("%s: mount refused (ret = %d)\n", export, ret);
+		goto L1;
+	}
+
+	return 0;
+
+L1:
+	sk_close(clnt->sockfd);
+	return ret;
+}
+
+void nfs_client_close(struct nfs_client *clnt)
+{
+	sk_close(clnt->sockfd);
+}
+
+int nfs_getattr(struct nfs_client *clnt, const struct nfs_fh *fh,
+	struct nfs_fattr *attr)
+{
+	int ret;
+	__u32 *p, status;
+	__u32 req[RPC_BUF_WORDS], reply[RPC_BUF_WORDS];
+	struct xdr_stream xdr;
+
+	p = rpc_put_header(req, ++clnt->xid, RPC_PROG_NFS, NFS_VERSION, NFSPROC3_GETATTR);
+	p = xdr_put_fh(p, fh);
+
+	ret = rpc_call(clnt, clnt->nfs_port, req, (p - req) * 4,
+			reply, sizeof(reply), &xdr);
+	if (ret < 0)
+		return ret;
+
+	if (xdr_get_u32(&xdr, &status) < 0)
+		return -EPROTO;
+
+	if (status != NFS3_OK)
+		return nfs_status_to_errno(status);
+
+	return xdr_get_fattr(&xdr, attr);
+}
+
+int nfs_lookup(struct nfs_client *clnt, const struct nfs_fh *dir,
+	const char *name, int len, struct nfs_fh *fh, struct nfs_fattr *attr)
+{
+	int ret;
+	bool follows;
+	__u32 *p, status;
+	__u32 req[RPC_BUF_WORDS], reply[RPC_BUF_WORDS];
+	struct xdr_stream xdr;
+
+	if (len > 255)
+		return -ENAMETOOLONG;
+
+	p = rpc_put_header(req, ++clnt->xid, RPC_PROG_NFS, NFS_VERSION, NFSPROC3_LOOKUP);
+	p = xdr_put_fh(p, dir);
+	p = xdr_put_opaque(p, name, len);
+
+	ret = rpc_call(clnt, clnt->nfs_port, req, (p - req) * 4,
+			reply, sizeof(reply), &xdr);
+	if (ret < 0)
+		return ret;
+
+	if (xdr_get_u32(&xdr, &status) < 0)
+		return -EPROTO;
+
+	if (status != NFS3_OK)
+		return nfs_status_to_errno(status);
+
+	ret = xdr_get_fh(&xdr, fh);
+	if (ret < 0)
+		return ret;
+
+	ret = xdr_get_post_op_attr(&xdr, attr, &follows);
+	if (ret < 0)
+		return ret;
+
+	// attributes are optional in the reply
+	if (!follows)
+		return nfs_getattr(clnt, fh, attr);
+
+	return 0;
+}
+
+static int nfs_send_read(struct nfs_client *clnt, const struct nfs_fh *fh,
+	struct nfs_read_slot *slot)
+{
+	__u32 *p;
+	__u32 req[64];
+
+	p = rpc_put_header(req, slot->xid, RPC_PROG_NFS, NFS_VERSION, NFSPROC3_READ);
+	p = xdr_put_fh(p, fh);
+	p = xdr_put_u64(p, slot->offset);
+	p = xdr_put_u32(p, slot->count);
+
+	return rpc_send(clnt, clnt->nfs_port, req, (p - req) * 4);
+}
+
+static struct nfs_read_slot *nfs_find_slot(struct nfs_read_slot slots[],
+	int num, const __u32 *reply)
+{
+	int i;
+	__u32 xid = ntohl(reply[0]);
+
+	for (i = 0; i < num; i++) {
+		if (slots[i].busy && slots[i].xid == xid)
+			return &slots[i];
+	}
+
+	return NULL;
+}
+
+ssize_t nfs_read(struct nfs_client *clnt, const struct nfs_fh *fh,
+	u64 offset, void *buff, size_t size)
+{
+	int i, ret, busy = 0, tries = 0;
+	__u32 status, count, eof, len;
+	const void *data;
+	u64 next = offset, end = offset + size;
+	__u32 reply[RPC_BUF_WORDS];
+	struct nfs_read_slot slots[NFS_MAX_WINDOW], *slot;
+	struct xdr_stream xdr;
+
+	memset(slots, 0, sizeof(slots));
+
+	while (1) {
+		// keep the window full
+		for (i = 0; i < clnt->window && next < end; i++) {
+			slot = &slots[i];
+			if (slot->busy)
+				continue;
+
+			slot->offset = next;
+			slot->count = end - next > clnt->rsize ? clnt->rsize : end - next;
+			slot->xid = ++clnt->xid;
+			slot->busy = true;
+			next += slot->count;
+			busy++;
+
+			ret = nfs_send_read(clnt, fh, slot);
+			if (ret < 0)
+				return ret;
+		}
+
+		if (!busy)
+			break;
+
+		ret = rpc_recv(clnt, reply, sizeof(reply));
+		if (ret == -EAGAIN)
+			continue;
+
+		if (ret <= 0) {
+			if (++tries > clnt->retries)
+				return -ETIMEDOUT;
+
+			// same xids, so the server's duplicate request cache absorbs them
+			for (i = 0; i < clnt->window; i++) {
+				if (slots[i].busy)
+					nfs_send_read(clnt, fh, &slots[i]);
+			}
+
+			continue;
+		}
+
+		slot = nfs_find_slot(slots, clnt->window, reply);
+		if (!slot)
+			continue; // late duplicate
+
+		xdr_init(&xdr, reply, ret);
+		ret = rpc_check_reply(&xdr, slot->xid);
+		if (ret < 0)
+			return ret;
+
+		if (xdr_get_u32(&xdr, &status) < 0)
+			return -EPROTO;
+
+		if (status != NFS3_OK)
+			return nfs_status_to_errno(status);
+
+		if (xdr_get_post_op_attr(&xdr, NULL, NULL) < 0 ||
+			xdr_get_u32(&xdr, &count) < 0 || xdr_get_u32(&xdr, &eof) < 0)
+			return -EPROTO;
+
+		data = xdr_get_opaque(&xdr, &len);
+		if (!data || len > slot->count)
+			return -EPROTO;
+
+		memcpy(buff + (slot->offset - offset), data, len);
+
+		tries = 0;
+		slot->busy = false;
+		busy--;
+
+		if (len == slot->count)
+			continue;
+
+		if (eof || !len) {
+			// nothing past here: stop issuing, let the rest drain
+			if (slot->offset + len < end)
+				end = slot->offset + len;
+			if (next > end)
+				next = end;
+		} else if (slot->offset + len < end) {
+			// short read, fetch the remainder with the same slot
+			slot->offset += len;
+			slot->count  -= len;
+			slot->xid = ++clnt->xid;
+			slot->busy = true;
+			busy++;
+
+			ret = nfs_send_read(clnt, fh, slot);
+			if (ret < 0)
+				return ret;
+		}
+	}
+
+	return end - offset;
+}
@@ -10,6 +10,7 @@
 #include <uart/uart.h> // fixme: to be removed
 
 #define MAX_SOCK_NUM  32
+#define SOCK_DEF_TIMEOUT 10000 // ms
 
 static struct socket *g_sock_fds[MAX_SOCK_NUM];
 
@@ -66,6 +67,13 @@ int socket_ioctl(int fd, int cmd, int flags)
 		sock->obstruct_flags = flags;
 		break;
 
+	case SKIOCS_TIMEOUT:
+		if (flags <= 0)
+			return -EINVAL;
+
+		sock->rx_timeout = flags;
+		break;
+
 	default:
 		return -EINVAL;
 	}
@@ -77,7 +85,7 @@ static struct sock_buff *sock_recv_packet(struct socket *sock)
 	__UNUSED__ __u32 psr;
 	struct sock_buff *skb;
 	struct list_head *first;
-	int to = 10000; // timeout
+	int to = sock->rx_timeout;
 	int ret;
 	char key;
 
@@ -160,6 +168,8 @@ alloc_sock:
 	}
 
 	sock->type = type;
+	sock->obstruct_flags = 0;
+	sock->rx_timeout = SOCK_DEF_TIMEOUT;
 	if (SOCK_STREAM == type) { // fixme
 		sock->state = TCPS_CLOSED;
 		sock->seq_num = 1; // fixme
@@ -0,0 +1,506 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <malloc.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <net/net.h>
+#include <net/tftp.h>
+#include <net/socket.h>
+#include <fs.h>
+
+#define TFTPD_DEF_TIMEOUT  1000 // ms
+#define TFTPD_DEF_RETRIES  5
+#define TFTPD_REQ_LEN      (TFTP_MAX_BLKSIZE + TFTP_HDR_LEN)
+
+struct tftp_packet {
+	__u16 op_code;
+	union {
+		__u16 block;
+		__u16 error;
+	};
+	__u8 data[0];
+} __PACKED__;
+
+// data source: an opened file/device or a raw memory range
+struct tftpd_src {
+	int   fd;
+	__u8 *mem;
+	size_t size; // 0 if unknown
+	size_t pos;
+};
+
+struct tftpd_session {
+	int sockfd;
+	struct sockaddr_in peer;
+	struct tftpd_src src;
+
+	int blksize;
+	int winsize;
+	bool opt_blksize, opt_winsize, opt_tsize;
+
+	// window of prepared DATA packets, one slot per block
+	__u8 *win_buff;
+	size_t slot_size;
+	int slot_len[TFTP_MAX_WINSIZE];
+};
+
+static int tftpd_send_error(int sockfd, struct sockaddr_in *peer,
+			__u16 code, const char *msg)
+{
+	__u8 buff[TFTP_HDR_LEN + 64];
+	struct tftp_packet *pkt = (struct tftp_packet *)buff;
+	int len;
+
+	pkt->op_code = TFTP_ERR;
+	pkt->error = htons(code);
+	strncpy((char *)pkt->data, msg, sizeof(buff) - TFTP_HDR_LEN - 1);
+	pkt->data[sizeof(buff) - TFTP_HDR_LEN - 1] = '\0';
+	len = TFTP_HDR_LEN + strlen((char *)pkt->data) + 1;
+
+	return sendto(sockfd, pkt, len, 0, (struct sockaddr *)peer, sizeof(*peer));
+}
+
+/*
+ * "mem:<addr>+<len>" or a path (relative to root if given)
+ */
+static int tftpd_src_open(struct tftpd_src *src, const char *root, const char *name)
+{
+	int ret;
+	char path[PATH_MAX];
+	struct stat st;
+
+	memset(src, 0, sizeof(*src));
+	src->fd = -1;
+
+	if (!strncmp(name, TFTPD_MEM_PREFIX, sizeof(TFTPD_MEM_PREFIX) - 1)) {
+		char *plus;
+		unsigned long addr, size;
+
+		strncpy(path, name + sizeof(TFTPD_MEM_PREFIX) - 1, sizeof(path) - 1);
+		path[sizeof(path) - 1] = '\0';
+
+		plus = strchr(path, '+');
+		if (!plus)
+			return -EINVAL;
+		*plus++ = '\0';
+
+		if (str_to_val(path, &addr) < 0 || str_to_val(plus, &size) < 0 || !size)
+			return -EINVAL;
+
+		src->mem  = (__u8 *)addr;
+		src->size = size;
+
+		return 0;
+	}
+
+	if (root && root[0] && name[0] != '/')
+		snprintf(path, sizeof(path), "%s/%s", root, name);
+	else
+		snprintf(path, sizeof(path), "%s", name);
+
+	ret = open(path, O_RDONLY);
+	if (ret < 0)
+		return ret;
+
+	src->fd = ret;
+
+	if (fstat(src->fd, &st) == 0)
+		src->size = st.st_size;
+
+	return 0;
+}
+
+static ssize_t tftpd_src_read(struct tftpd_src *src, __u8 *buff, size_t len)
+{
+	ssize_t ret;
+	size_t count = 0;
+
+	if (src->mem) {
+		count = min(len, src->size - src->pos);
+		memcpy(buff, src->mem + src->pos, count);
+		src->pos += count;
+
+		return count;
+	}
+
+	// file systems and flash may return short reads, so fill the whole block
+	while (count < len) {
+		ret = read(src->fd, buff + count, len - count);
+		if (ret < 0)
+			return ret;
+		if (ret == 0)
+			break;
+
+		count += ret;
+	}
+
+	src->pos += count;
+
+	return count;
+}
+
+static void tftpd_src_close(struct tftpd_src *src)
+{
+	if (src->fd >= 0)
+		close(src->fd);
+}
+
+static inline __u8 *tftpd_slot(struct tftpd_session *ses, int i)
+{
+	return ses->win_buff + i * ses->slot_size;
+}
+
+static int tftpd_parse_options(struct tftpd_session *ses, struct tftpd_opt *opt,
+			const char *str, const char *end)
+{
+	const char *name, *val;
+	unsigned long num;
+
+	while (str < end) {
+		name = str;
+		str += strnlen(str, end - str) + 1;
+		if (str >= end)
+			break;
+
+		val = str;
+		str += strnlen(str, end - str) + 1;
+
+		if (str_to_val(val, &num) < 0)
+			continue;
+
+		if (!strcasecmp(name, TFTP_OPT_BLKSIZE)) {
+			if (num < TFTP_MIN_BLKSIZE)
+				return -EINVAL;
+
+			ses->blksize = min(num, opt->max_blksize);
+			ses->opt_blksize = true;
+		} else if (!strcasecmp(name, TFTP_OPT_WINSIZE)) {
+			if (num < 1)
+				return -EINVAL;
+
+			ses->winsize = min(num, opt->max_winsize);
+			ses->opt_winsize = true;
+		} else if (!strcasecmp(name, TFTP_OPT_TSIZE)) {
+			ses->opt_tsize = true;
+		}
+	}
+
+	return 0;
+}
+
+static int tftpd_append_opt(__u8 *buff, const char *name, unsigned long val)
+{
+	int len;
+
+	strcpy((char *)buff, name);
+	len = strlen(name) + 1;
+	len += val_to_dec_str((char *)buff + len, val) + 1;
+
+	return len;
+}
+
+static int tftpd_wait_ack(struct tftpd_session *ses, __u16 *blk)
+{
+	int ret;
+	socklen_t addrlen;
+	__u8 buff[TFTP_BUF_LEN];
+	struct tftp_packet *pkt = (struct tftp_packet *)buff;
+	struct sockaddr_in from;
+
+	while (1) {
+		ret = recvfrom(ses->sockfd, buff, sizeof(buff), 0,
+				(struct sockaddr *)&from, &addrlen);
+		if (ret <= 0)
+			return -ETIMEDOUT;
+
+		// packet from a stale/foreign TID
+		if (from.sin_port != ses->peer.sin_port ||
+			from.sin_addr.s_addr != ses->peer.sin_addr.s_addr)
+			continue;
+
+		switch (pkt->op_code) {
+		case TFTP_ACK:
+			*blk = ntohs(pkt->block);
+			return 0;
+
+		case TFTP_ERR:
+			printf("\n%s(): peer aborted: %s (Error num = %d)\n",
+				__func__, pkt->data, ntohs(pkt->error));
+			return -ECONNRESET;
+
+		default:
+			tftpd_send_error(ses->sockfd, &ses->peer, TFTP_EBADOP, "unexpected opcode");
+			return -EIO;
+		}
+	}
+}
+
+static int tftpd_send_oack(struct tftpd_session *ses, struct tftpd_opt *opt)
+{
+	int ret, len, retry;
+	__u16 blk;
+	__u8 buff[TFTP_BUF_LEN];
+
+	*(__u16 *)buff = TFTP_OACK;
+	len = 2;
+
+	if (ses->opt_blksize)
+		len += tftpd_append_opt(buff + len, TFTP_OPT_BLKSIZE, ses->blksize);
+	if (ses->opt_winsize)
+		len += tftpd_append_opt(buff + len, TFTP_OPT_WINSIZE, ses->winsize);
+	if (ses->opt_tsize && ses->src.size)
+		len += tftpd_append_opt(buff + len, TFTP_OPT_TSIZE, ses->src.size);
+
+	for (retry = 0; retry < opt->retries; retry++) {
+		sendto(ses->sockfd, buff, len, 0,
+			(struct sockaddr *)&ses->peer, sizeof(ses->peer));
+
+		ret = tftpd_wait_ack(ses, &blk);
+		if (ret == -ETIMEDOUT)
+			continue;
+		if (ret < 0)
+			return ret;
+
+		if (blk == 0)
+			return 0;
+	}
+
+	return -ETIMEDOUT;
+}
+
+/*
+ * Send the file with RFC 7440 windowing: up to winsize DATA packets are
+ * in flight, and an ACK for block k releases every slot up to k. Slots
+ * are filled straight from the source, so each block is read only once
+ * and retransmissions are sent from the window buffer.
+ */
+static int tftpd_send_data(struct tftpd_session *ses, struct tftpd_opt *opt)
+{
+	int ret, i, nfill = 0, acked, retry = 0;
+	__u16 base = 1, blk;
+	bool eof = false;
+	size_t xmit_len = 0;
+	struct tftp_packet *pkt;
+
+	while (1) {
+		// refill the free slots of the window
+		while (!eof && nfill < ses->winsize) {
+			pkt = (struct tftp_packet *)tftpd_slot(ses, nfill);
+
+			ret = tftpd_src_read(&ses->src, pkt->data, ses->blksize);
+			if (ret < 0) {
+				tftpd_send_error(ses->sockfd, &ses->peer, TFTP_EACCESS, "read error");
+				return ret;
+			}
+
+			pkt->op_code = TFTP_DAT;
+			pkt->block = htons((__u16)(base + nfill));
+			ses->slot_len[nfill] = ret;
+			nfill++;
+
+			if (ret < ses->blksize)
+				eof = true;
+		}
+
+		for (i = 0; i < nfill; i++)
+			sendto(ses->sockfd, tftpd_slot(ses, i), ses->slot_len[i] + TFTP_HDR_LEN, 0,
+				(struct sockaddr *)&ses->peer, sizeof(ses->peer));
+
+		ret = tftpd_wait_ack(ses, &blk);
+		if (ret < 0 && ret != -ETIMEDOUT)
+			return ret;
+
+		// a duplicated or stale ACK is a retry too, or a stuck peer keeps us here
+		acked = ret < 0 ? 0 : (__u16)(blk - base) + 1;
+		if (!acked || acked > nfill) {
+			if (++retry >= opt->retries)
+				return ret < 0 ? ret : -ETIMEDOUT;
+
+			continue;
+		}
+
+		retry = 0;
+
+		for (i = 0; i < acked; i++)
+			xmit_len += ses->slot_len[i];
+
+		if (acked < nfill)
+			memmove(ses->win_buff, tftpd_slot(ses, acked),
+				(nfill - acked) * ses->slot_size);
+		for (i = acked; i < nfill; i++)
+			ses->slot_len[i - acked] = ses->slot_len[i];
+
+		nfill -= acked;
+		base += acked;
+
+		if (opt->verbose && ((xmit_len & 0xfffff) < ses->blksize * acked || (eof && !nfill))) {
+			char tmp[32];
+
+			val_to_hr_str(xmit_len, tmp);
+			printf("\r %d(%s) sent  ", xmit_len, tmp);
+		}
+
+		if (eof && !nfill)
+			break;
+	}
+
+	if (opt->verbose)
+		printf("\n");
+
+	return 0;
+}
+
+static int tftpd_handle_rrq(struct tftpd_opt *opt, struct sockaddr_in *peer,
+			const __u8 *req, int req_len)
+{
+	int ret;
+	const char *fn, *mode, *end = (const char *)req + req_len;
+	struct tftpd_session ses;
+	struct sockaddr_in local_addr;
+
+	memset(&ses, 0, sizeof(ses));
+	ses.peer = *peer;
+	ses.blksize = TFTP_PKT_LEN;
+	ses.winsize = 1;
+
+	// a new TID (port) per transfer, as RFC 1350 demands
+	ses.sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (ses.sockfd <= 0)
+		return -EIO;
+
+	memset(&local_addr, 0, sizeof(local_addr));
+	local_addr.sin_family = AF_INET;
+	local_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	ret = bind(ses.sockfd, (struct sockaddr *)&local_addr, sizeof(local_addr));
+	if (ret < 0)
+		goto L1;
+
+	socket_ioctl(ses.sockfd, SKIOCS_FLAGS, 1);
+	socket_ioctl(ses.sockfd, SKIOCS_TIMEOUT, opt->timeout);
+
+	fn = (const char *)req;
+	mode = fn + strnlen(fn, end - fn) + 1;
+	if (mode >= end) {
+		tftpd_send_error(ses.sockfd, peer, TFTP_EBADOP, "malformed request");
+		ret = -EINVAL;
+		goto L1;
+	}
+
+	ret = tftpd_parse_options(&ses, opt, mode + strnlen(mode, end - mode) + 1, end);
+	if (ret < 0) {
+		tftpd_send_error(ses.sockfd, peer, TFTP_EOPTNEG, "bad option");
+		goto L1;
+	}
+
+	ret = tftpd_src_open(&ses.src, opt->root, fn);
+	if (ret < 0) {
+		tftpd_send_error(ses.sockfd, peer, TFTP_ENOTFOUND, "file not found");
+		goto L1;
+	}
+
+	ses.slot_size = TFTP_HDR_LEN + ses.blksize;
+	ses.win_buff = malloc(ses.slot_size * ses.winsize);
+	if (!ses.win_buff) {
+		tftpd_send_error(ses.sockfd, peer, TFTP_EUNDEF, "out of memory");
+		ret = -ENOMEM;
+		goto L2;
+	}
+
+	if (opt->verbose) {
+		char ip[IPV4_STR_LEN];
+
+		ip_to_str(ip, peer->sin_addr.s_addr);
+		printf("sending \"%s\" to %s:%d (blksize = %d, windowsize = %d)\n",
+			fn, ip, ntohs(peer->sin_port), ses.blksize, ses.winsize);
+	}
+
+	if (ses.opt_blksize || ses.opt_winsize || ses.opt_tsize) {
+		ret = tftpd_send_oack(&ses, opt);
+		if (ret < 0)
+			goto L3;
+	}
+
+	ret = tftpd_send_data(&ses, opt);
+
+L3:
+	free(ses.win_buff);
+L2:
+	tftpd_src_close(&ses.src);
+L1:
+	sk_close(ses.sockfd);
+	return ret;
+}
+
+int tftpd_serve(struct tftpd_opt *opt)
+{
+	int ret, sockfd;
+	socklen_t addrlen;
+	__u8 *buff;
+	struct tftp_packet *pkt;
+	struct sockaddr_in local_addr, remote_addr;
+
+	if (opt->timeout <= 0)
+		opt->timeout = TFTPD_DEF_TIMEOUT;
+	if (opt->retries <= 0)
+		opt->retries = TFTPD_DEF_RETRIES;
+	if (opt->max_blksize <= 0 || opt->max_blksize > TFTP_MAX_BLKSIZE)
+		opt->max_blksize = TFTP_MAX_BLKSIZE;
+	if (opt->max_winsize <= 0 || opt->max_winsize > TFTP_MAX_WINSIZE)
+		opt->max_winsize = TFTP_MAX_WINSIZE;
+
+	buff = malloc(TFTPD_REQ_LEN + 1);
+	if (!buff)
+		return -ENOMEM;
+	pkt = (struct tftp_packet *)buff;
+
+	sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sockfd <= 0) {
+		ret = -EIO;
+		goto L1;
+	}
+
+	memset(&local_addr, 0, sizeof(local_addr));
+	local_addr.sin_family = AF_INET;
+	local_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	local_addr.sin_port = htons(STD_PORT_TFTP);
+	ret = bind(sockfd, (struct sockaddr *)&local_addr, sizeof(local_addr));
+	if (ret < 0)
+		goto L2;
+
+	printf("TFTP server listening on port %d (Ctrl+C to quit)\n", STD_PORT_TFTP);
+
+	while (1) {
+		ret = recvfrom(sockfd, buff, TFTPD_REQ_LEN, 0,
+				(struct sockaddr *)&remote_addr, &addrlen);
+		if (ret <= 0)
+			break; // interrupted
+
+		buff[ret] = '\0';
+
+		switch (pkt->op_code) {
+		case TFTP_RRQ:
+			ret = tftpd_handle_rrq(opt, &remote_addr, buff + 2, ret - 2);
+			if (ret < 0)
+				printf("%s(): transfer failed! (ret = %d)\n", __func__, ret);
+			break;
+
+		case TFTP_WRQ:
+			tftpd_send_error(sockfd, &remote_addr, TFTP_EACCESS, "read-only server");
+			break;
+
+		default:
+			tftpd_send_error(sockfd, &remote_addr, TFTP_EBADOP, "illegal operation");
+			break;
+		}
+
+		if (opt->once)
+			break;
+	}
+
+L2:
+	sk_close(sockfd);
+L1:
+	free(buff);
+	return ret < 0 ? ret : 0;
+}
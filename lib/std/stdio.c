@@ -1,9 +1,17 @@
 #include <stdio.h>
 #include <string.h>
 #include <uart/uart.h>
+#ifdef CONFIG_NET
+#include <net/netconsole.h>
+#endif
 
 int putchar(int ch)
 {
+#ifdef CONFIG_NET
+	if (!netcon_putchar(ch))
+		return ch;
+#endif
+
 	uart_send_byte((char)ch);
 
 	if (ch == '\n')
@@ -38,6 +46,20 @@ int puts(const char * str)
 	return (putchar('\n'));
 }
 
+static char console_getchar(void)
+{
+#ifdef CONFIG_NET
+	char ch;
+
+	while (netcon_active() && !uart_rxbuf_count()) {
+		if (netcon_getchar(&ch) > 0)
+			return ch;
+	}
+#endif
+
+	return uart_recv_byte();
+}
+
 char *gets(char *s)
 {
 	char *str;
@@ -45,7 +67,7 @@ char *gets(char *s)
 	str = s;
 
 	while (1) {
-		*str = uart_recv_byte();
+		*str = console_getchar();
 
 		if (*str == '\r' || *str == '\n') {
 			putchar('\r');
@@ -61,28 +61,32 @@ DIR * GAPI opendir(const char *name)
 	return dir;
 }
 
+// the returned entry is overwritten by the next readdir() on the same dir
 struct dirent * GAPI readdir(DIR *dir)
 {
 	int ret;
-	struct dirent *de;
-	struct linux_dirent lde;
+	struct dirent *de = &dir->ent;
+	struct linux_dirent *lde;
 
 	assert(dir);
 
-	ret = sys_getdents(dir->fd, &lde, 1); // fixme
-	if (ret <= 0) {
-		return NULL;
+	if (dir->pos == dir->len) {
+		ret = sys_getdents(dir->fd, (struct linux_dirent *)dir->buf, sizeof(dir->buf));
+		if (ret <= 0)
+			return NULL;
+
+		dir->pos = 0;
+		dir->len = ret;
 	}
 
-	de = malloc(lde.d_reclen);
-	if (!de)
-		return NULL;
+	lde = (struct linux_dirent *)((char *)dir->buf + dir->pos);
+	dir->pos += lde->d_reclen;
 
-	de->d_ino    = lde.d_ino;
-	de->d_off    = lde.d_off;
-	de->d_reclen = lde.d_reclen;
-	de->d_type   = lde.d_type; // fixme
-	strcpy(de->d_name, lde.d_name);
+	de->d_ino    = lde->d_ino;
+	de->d_off    = lde->d_off;
+	de->d_reclen = sizeof(*de);
+	de->d_type   = lde->d_type; // fixme
+	strcpy(de->d_name, lde->d_name);
 
 	return de;
 }
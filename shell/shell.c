@@ -9,6 +9,7 @@
 #include <dirent.h>
 // fixme: to be removed
 #include <net/net.h>
+#include <net/netconsole.h>
 #include <uart/uart.h>
 #include <fs/devfs.h>
 
@@ -51,8 +52,13 @@ static char shell_getchar(void)
 		if (ret > 0)
 			break;
 
+		ret = netcon_getchar(&ch);
+		if (ret > 0)
+			break;
+
 		// TODO: replace with tasklet
 		ndev_poll();
+		netcon_poll();
 		// device_monitor();
 	}
 